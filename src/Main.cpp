@@ -1,28 +1,165 @@
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <string_view>
 #include <fstream>
+#include <map>
+#include <numeric>
+#include <thread>
 #include <charconv>
+#include <limits>
 #include "lib/nlohmann/json.hpp"
 #include "lib/bencode/decode.hpp"
 #include "lib/bencode/encode.hpp"
 #include "lib/bencode/utils.hpp"
 #include "lib/hash/sha1.hpp"
-#include "lib/http/HTTPRequest.hpp"
-#include "lib/http/utils.hpp"
+#include "lib/http/benchmark.hpp"
+#include "lib/net/block_pool.hpp"
+#include "lib/net/ring_buffer.hpp"
+#include "lib/peer/bitfield.hpp"
+#include "lib/peer/download.hpp"
+#include "lib/peer/picker.hpp"
+#include "lib/peer/probe.hpp"
+#include "lib/peer/seed.hpp"
+#include "lib/peer/wire.hpp"
+#include "lib/torrent/create.hpp"
+#include "lib/torrent/metainfo.hpp"
+#include "lib/torrent/storage.hpp"
+#include "lib/tracker/announce.hpp"
+#include "lib/tracker/peers.hpp"
+#include "lib/tracker/scheduler.hpp"
+#include "lib/tracker/scrape.hpp"
+#include "lib/tracker/server.hpp"
 #include "sys/socket.h"
 #include <arpa/inet.h>
 
+namespace
+{
+        // a whole decimal number within [min, max], what names the argument in the error; the upper bound of wide
+        // types goes unmentioned
+        template <typename T>
+        T parse_number(const std::string_view text, const std::string_view what, const T min = std::numeric_limits<T>::min(),
+                       const T max = std::numeric_limits<T>::max())
+        {
+                T number;
+                const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+                if (error != std::errc() || end != text.data() + text.size() || number < min || number > max)
+                {
+                        std::string range = max == std::numeric_limits<T>::max() && sizeof(T) >= 4 ? "of at least " + std::to_string(min)
+                                                                                    : "from " + std::to_string(min) + " to " + std::to_string(max);
+                        throw std::invalid_argument(std::string(what) + " takes a number " + range + ", not '" + std::string(text) + "'");
+                }
+                return number;
+        }
+
+        // walks a command's --option value pairs from argv[first] on, anything malformed throws std::invalid_argument
+        class OptionParser
+        {
+        public:
+                OptionParser(const int argc, const char *argv[], const int first) : argc(argc), argv(argv), position(first - 2)
+                {
+                }
+
+                bool next()
+                {
+                        position += 2;
+                        if (position >= argc)
+                        {
+                                return false;
+                        }
+                        if (position + 1 >= argc)
+                        {
+                                throw std::invalid_argument("Missing value for " + std::string(argv[position]));
+                        }
+                        return true;
+                }
+
+                std::string_view option() const
+                {
+                        return argv[position];
+                }
+
+                std::string_view value() const
+                {
+                        return argv[position + 1];
+                }
+
+                template <typename T>
+                T number(const T min = std::numeric_limits<T>::min(), const T max = std::numeric_limits<T>::max()) const
+                {
+                        return parse_number<T>(value(), option(), min, max);
+                }
+
+                bool flag() const // 0 or 1
+                {
+                        return number<int>(0, 1) == 1;
+                }
+
+                [[noreturn]] void unknown(const std::string_view command) const
+                {
+                        throw std::invalid_argument("Unknown " + std::string(command) + " option: " + std::string(option()));
+                }
+
+        private:
+                const int argc;
+                const char **argv;
+                int position;
+        };
+
+        // the peers given with --peer, otherwise whatever the torrent's trackers return
+        std::vector<PeerEndpoint> find_peers(const json &metainfo, const std::string &info_hash, const std::vector<PeerEndpoint> &given)
+        {
+                if (!given.empty())
+                {
+                        return given;
+                }
+
+                AnnounceParams params;
+                params.info_hash = info_hash;
+                params.peer_id = "00112233445566778899";
+                params.left = total_length(metainfo.at("info"));
+
+                Announcer announcer{parse_announce_list(metainfo)};
+                const AnnounceSummary summary = announcer.announce(params);
+                for (const auto &response : summary.responses)
+                {
+                        if (!response.success)
+                        {
+                                std::cerr << "Tracker " << response.tracker << " failed: " << response.error << "\n";
+                        }
+                }
+                return summary.peers;
+        }
+
+        void print_peer(std::ostream &output, const Download::PeerStatistics &peer)
+        {
+                output << "  " << peer.endpoint.to_string() << " " << peer.received_bytes << " bytes, " << peer.rate / 1e6 << " MB/s, rtt "
+                       << peer.min_rtt.count() / 1000.0 << " ms, queue depth " << peer.depth << " (" << peer.in_flight << " in flight)" << "\n";
+        }
+
+        Handshake local_handshake(const std::string &info_hash)
+        {
+                Handshake handshake;
+                std::copy(info_hash.begin(), info_hash.end(), handshake.info_hash.begin());
+                const std::string_view self_id = "00112233445566778899";
+                std::copy(self_id.begin(), self_id.end(), handshake.peer_id.begin());
+                handshake.reserved[5] |= 0x10; // BEP 10
+                return handshake;
+        }
+}
+
 int main(const int argc, const char *argv[])
 {
-        if (argc < 3)
+        // the tracker and the benchmarks take nothing but options, which all have defaults
+        const std::string_view command(argc > 1 ? argv[1] : "");
+        const bool options_only = command == "tracker" || command.starts_with("benchmark_");
+        if (argc < 3 && !(argc == 2 && options_only))
         {
                 std::cerr << "Usage: " << argv[0] << " <command> <encoded_value>" << "\n";
                 return 1;
         }
 
-        const std::string_view command(argv[1]);
-        const std::string_view encoded_value(argv[2]);
+        const std::string_view encoded_value(argc > 2 ? argv[2] : "");
 
         if (command == "decode")
         {
@@ -82,23 +219,45 @@ int main(const int argc, const char *argv[])
                 const std::string_view file_data_view(file_data.data(), file_data.size());
                 try
                 {
-                        SHA1 sha1;
                         auto [decoded_info, _] = decode_bencoded_dictionary(file_data_view);
-                        const std::string bencoded_string = encode_to_bencoded_string(decoded_info.at("info"));
-                        const std::string pieces = decoded_info.at("info").at("pieces").get<std::string>();
+                        const json &info = decoded_info.at("info");
+                        const InfoHashes info_hashes = compute_info_hashes(info);
 
-                        std::cout << "Tracker URL: " << decoded_info.at("announce").get<std::string>() << "\n";
-                        std::cout << "Length: " << decoded_info.at("info").at("length").get<int64_t>() << "\n";
-                        std::cout << "Info Hash: " << sha1(bencoded_string) << "\n";
-                        std::cout << "Piece Length: " << decoded_info.at("info").at("piece length").get<int64_t>() << "\n";
-                        std::cout << "Piece Hashes: " << "\n";
-                        for (size_t i = 0; i < pieces.length(); i += 20)
+                        if (decoded_info.contains("announce"))
+                        {
+                                std::cout << "Tracker URL: " << decoded_info.at("announce").get<std::string>() << "\n";
+                        }
+                        if (has_v1_metadata(info))
                         {
-                                const std::string piece_hash = pieces.substr(i, 20);
-                                std::cout << hash_to_hex_string(piece_hash) << "\n";
+                                const std::string pieces = info.at("pieces").get<std::string>();
+
+                                std::cout << "Length: " << total_length(info) << "\n";
+                                std::cout << "Info Hash: " << hash_to_hex_string(info_hashes.v1) << "\n";
+                                std::cout << "Piece Length: " << info.at("piece length").get<int64_t>() << "\n";
+                                std::cout << "Piece Hashes: " << "\n";
+                                for (size_t i = 0; i < pieces.length(); i += 20)
+                                {
+                                        const std::string piece_hash = pieces.substr(i, 20);
+                                        std::cout << hash_to_hex_string(piece_hash) << "\n";
+                                }
+                        }
+                        if (has_v2_metadata(info))
+                        {
+                                std::cout << "Info Hash v2: " << hash_to_hex_string(info_hashes.v2) << "\n";
+                                if (!has_v1_metadata(info))
+                                {
+                                        // hybrids share one piece length, printed with the v1 fields
+                                        std::cout << "Piece Length: " << info.at("piece length").get<int64_t>() << "\n";
+                                }
+                                std::cout << "Files: " << "\n";
+                                for (const auto &file : parse_file_tree(info.at("file tree")))
+                                {
+                                        std::cout << file.path << " " << file.length << " " << hash_to_hex_string(file.pieces_root) << "\n";
+                                }
+                                std::cout << "Piece Layers: " << (verify_piece_layers(decoded_info) ? "valid" : "invalid") << "\n";
                         }
                 }
-                catch (const std::invalid_argument &e)
+                catch (const std::exception &e)
                 {
                         std::cerr << "Error decoding bencoded info dictionary: " << e.what() << "\n";
                         return 1;
@@ -118,28 +277,32 @@ int main(const int argc, const char *argv[])
                 try
                 {
                         SHA1 sha1;
-                        auto [decoded_info, _1] = decode_bencoded_dictionary(file_data_view);
+                        auto [decoded_info, _] = decode_bencoded_dictionary(file_data_view);
                         const std::string bencoded_string = encode_to_bencoded_string(decoded_info.at("info"));
-                        const std::string url = decoded_info.at("announce").get<std::string>();
-                        const std::string encoded_info_hash = url_encode(sha1(bencoded_string));
-                        const std::string left = std::to_string(file_data.size()); // Convert size_t to string
-                        http::Request request{url + "?info_hash=" + encoded_info_hash + "&peer_id=00112233445566778899&port=6881&uploaded=0&downloaded=0&left=" + left + "&compact=1"};
-                        const auto response = request.send("GET");
-                        const std::string response_body{response.body.begin(), response.body.end()};
-                        const std::string_view response_body_view(response_body.data(), response_body.size());
-                        auto [decoded_response, _2] = decode_bencoded_dictionary(response_body_view);
-                        const std::string peers = decoded_response.at("peers").get<std::string>();
-                        for (size_t i = 0; i < peers.length(); i += 6)
-                        {
-                                const std::string ip = std::to_string(static_cast<unsigned char>(peers[i])) + "." +
-                                                       std::to_string(static_cast<unsigned char>(peers[i + 1])) + "." +
-                                                       std::to_string(static_cast<unsigned char>(peers[i + 2])) + "." +
-                                                       std::to_string(static_cast<unsigned char>(peers[i + 3]));
-                                const uint16_t port = (static_cast<uint16_t>(static_cast<unsigned char>(peers[i + 4]) << 8)) | static_cast<uint16_t>(static_cast<unsigned char>(peers[i + 5]));
-                                std::cout << ip << ":" << port << "\n";
+                        sha1.add(bencoded_string.data(), bencoded_string.size());
+                        unsigned char info_hash[SHA1::HashBytes];
+                        sha1.getHash(info_hash);
+
+                        AnnounceParams params;
+                        params.info_hash.assign(reinterpret_cast<const char *>(info_hash), SHA1::HashBytes);
+                        params.peer_id = "00112233445566778899";
+                        params.left = total_length(decoded_info.at("info"));
+
+                        Announcer announcer{parse_announce_list(decoded_info)};
+                        const AnnounceSummary summary = announcer.announce(params);
+                        for (const auto &response : summary.responses)
+                        {
+                                if (!response.success)
+                                {
+                                        std::cerr << "Tracker " << response.tracker << " failed: " << response.error << "\n";
+                                }
+                        }
+                        for (const auto &peer : summary.peers)
+                        {
+                                std::cout << peer.to_string() << "\n";
                         }
                 }
-                catch (const std::invalid_argument &e)
+                catch (const std::exception &e)
                 {
                         std::cerr << "Error decoding bencoded info dictionary: " << e.what() << "\n";
                         return 1;
@@ -220,19 +383,21 @@ int main(const int argc, const char *argv[])
                                 return 1;
                         }
 
-                        unsigned char response[68];
-                        int bytes_received = recv(socket_fd, response, sizeof(response), 0);
-                        if (bytes_received == -1)
+                        // the handshake may arrive in pieces, or together with the first messages
+                        RingBuffer received{handshake_size};
+                        Handshake response;
+                        while (parse_handshake(received.readable(), response) == 0)
                         {
-                                std::cerr << "Error receiving handshake response" << "\n";
-                                close(socket_fd);
-                                return 1;
+                                if (received.fill(socket_fd) <= 0)
+                                {
+                                        std::cerr << "Error receiving handshake response" << "\n";
+                                        close(socket_fd);
+                                        return 1;
+                                }
                         }
 
-                        // extract 20 last bytes from the response, peer id
-                        std::vector<unsigned char> peer_id(response + 48, response + 68);
                         std::stringstream ss;
-                        for (unsigned char c : peer_id)
+                        for (const uint8_t c : response.peer_id)
                         {
                                 ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c);
                         }
@@ -247,6 +412,898 @@ int main(const int argc, const char *argv[])
                         return 1;
                 }
         }
+        else if (command == "create")
+        {
+                // create <path> [--piece-length N] [--announce URL] [--threads N] [-o out.torrent]
+                CreateOptions options;
+                options.path = argv[2];
+                std::string output_path;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 3}; parser.next();)
+                        {
+                                if (parser.option() == "--piece-length")
+                                {
+                                        options.piece_length = parser.number<int64_t>(1);
+                                }
+                                else if (parser.option() == "--announce")
+                                {
+                                        options.announce = parser.value();
+                                }
+                                else if (parser.option() == "--threads")
+                                {
+                                        options.threads = parser.number<unsigned>(1);
+                                }
+                                else if (parser.option() == "-o")
+                                {
+                                        output_path = parser.value();
+                                }
+                                else
+                                {
+                                        parser.unknown("create");
+                                }
+                        }
+
+                        const CreatedTorrent torrent = create_torrent(options);
+                        if (output_path.empty())
+                        {
+                                output_path = torrent.metainfo.at("info").at("name").get<std::string>() + ".torrent";
+                        }
+
+                        std::ofstream output_file{output_path, std::ios::binary};
+                        if (!output_file)
+                        {
+                                std::cerr << "Error opening output file: " << output_path << "\n";
+                                return 1;
+                        }
+                        output_file << encode_to_bencoded_string(torrent.metainfo);
+
+                        const double gigabytes = static_cast<double>(torrent.total_length) / 1e9;
+                        std::cout << "Created " << output_path << "\n";
+                        std::cout << "Info Hash: " << hash_to_hex_string(compute_info_hashes(torrent.metainfo.at("info")).v1) << "\n";
+                        std::cout << "Piece Length: " << torrent.metainfo.at("info").at("piece length").get<int64_t>() << "\n";
+                        std::cout << "Pieces: " << torrent.piece_count << "\n";
+                        std::cout << "Hashed " << torrent.total_length << " bytes in " << torrent.hash_seconds << " s ("
+                                  << (torrent.hash_seconds > 0 ? gigabytes / torrent.hash_seconds : 0.0) << " GB/s)" << "\n";
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error creating torrent: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "announce")
+        {
+                // announce <torrent>... [--duration S], keeps re-announcing on the trackers' intervals for S seconds
+                int64_t duration = 60;
+                std::vector<std::string> paths;
+                AnnounceScheduler scheduler{[&paths](const AnnounceScheduler::TorrentId torrent, const TrackerResponse &response)
+                                            {
+                                                    std::cout << paths[torrent] << ": " << response.tracker;
+                                                    if (response.success)
+                                                    {
+                                                            std::cout << " " << response.peers.size() << " peers, interval " << response.interval << " s" << "\n";
+                                                    }
+                                                    else
+                                                    {
+                                                            std::cout << " failed: " << response.error << "\n";
+                                                    }
+                                            }};
+                try
+                {
+                        int first_option = 2;
+                        while (first_option < argc && !std::string_view(argv[first_option]).starts_with("--"))
+                        {
+                                paths.emplace_back(argv[first_option++]);
+                        }
+                        for (OptionParser parser{argc, argv, first_option}; parser.next();)
+                        {
+                                if (parser.option() == "--duration")
+                                {
+                                        duration = parser.number<int64_t>(1);
+                                }
+                                else
+                                {
+                                        parser.unknown("announce");
+                                }
+                        }
+
+                        std::vector<std::pair<AnnounceParams, std::vector<std::vector<std::string>>>> torrents;
+                        for (const auto &path : paths)
+                        {
+                                std::ifstream input_file{path, std::ios::binary};
+                                if (!input_file)
+                                {
+                                        std::cerr << "Error opening torrent file: " << path << "\n";
+                                        return 1;
+                                }
+
+                                const std::vector<char> file_data((std::istreambuf_iterator<char>(input_file)), std::istreambuf_iterator<char>());
+                                const auto [metainfo, _] = decode_bencoded_dictionary(std::string_view(file_data.data(), file_data.size()));
+                                AnnounceParams params;
+                                params.info_hash = compute_info_hashes(metainfo.at("info")).v1;
+                                params.peer_id = "00112233445566778899";
+                                params.left = total_length(metainfo.at("info"));
+                                params.event = AnnounceEvent::started;
+                                auto tiers = parse_announce_list(metainfo);
+                                if (tiers.empty())
+                                {
+                                        throw std::invalid_argument("No tracker in " + path);
+                                }
+                                torrents.emplace_back(params, std::move(tiers));
+                        }
+
+                        for (const auto &[params, tiers] : torrents)
+                        {
+                                scheduler.add(params, tiers);
+                        }
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+                std::this_thread::sleep_for(std::chrono::seconds{duration});
+
+                const auto statistics = scheduler.statistics();
+                std::cout << "Announces: " << statistics.announces << " (" << statistics.successes << " ok, " << statistics.failures << " failed)" << "\n";
+        }
+        else if (command == "scrape")
+        {
+                // scrape <torrent>..., torrents sharing a tracker are scraped together
+                std::map<std::string, std::vector<std::string>> hashes_by_tracker;
+                std::vector<std::pair<std::string, std::string>> torrents; // path, info hash
+                try
+                {
+                        for (int i = 2; i < argc; ++i)
+                        {
+                                std::ifstream input_file{argv[i], std::ios::binary};
+                                if (!input_file)
+                                {
+                                        std::cerr << "Error opening torrent file: " << argv[i] << "\n";
+                                        return 1;
+                                }
+
+                                const std::vector<char> file_data((std::istreambuf_iterator<char>(input_file)), std::istreambuf_iterator<char>());
+                                const auto [metainfo, _] = decode_bencoded_dictionary(std::string_view(file_data.data(), file_data.size()));
+                                const std::string info_hash = compute_info_hashes(metainfo.at("info")).v1;
+                                const auto tiers = parse_announce_list(metainfo);
+                                if (tiers.empty())
+                                {
+                                        std::cerr << "No tracker in " << argv[i] << "\n";
+                                        return 1;
+                                }
+                                hashes_by_tracker[tiers.front().front()].push_back(info_hash);
+                                torrents.emplace_back(argv[i], info_hash);
+                        }
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error decoding bencoded info dictionary: " << e.what() << "\n";
+                        return 1;
+                }
+
+                Scraper scraper;
+                std::map<std::string, ScrapeStats> files;
+                for (const auto &[tracker, info_hashes] : hashes_by_tracker)
+                {
+                        ScrapeSummary summary = scraper.scrape(tracker, info_hashes);
+                        for (const auto &error : summary.errors)
+                        {
+                                std::cerr << "Tracker " << tracker << " failed: " << error << "\n";
+                        }
+                        files.merge(summary.files);
+                }
+
+                for (const auto &[path, info_hash] : torrents)
+                {
+                        const auto found = files.find(info_hash);
+                        std::cout << path << " " << hash_to_hex_string(info_hash) << ": ";
+                        if (found == files.end())
+                        {
+                                std::cout << "not tracked" << "\n";
+                        }
+                        else
+                        {
+                                std::cout << "seeders " << found->second.complete << " leechers " << found->second.incomplete
+                                          << " downloaded " << found->second.downloaded << "\n";
+                        }
+                }
+        }
+        else if (command == "probe")
+        {
+                // probe <torrent> [--half-open N] [--deadline S] [--peer IP:PORT]..., handshakes with all peers at once
+                try
+                {
+                        ProbeOptions options;
+                        std::vector<PeerEndpoint> given;
+                        for (OptionParser parser{argc, argv, 3}; parser.next();)
+                        {
+                                if (parser.option() == "--half-open")
+                                {
+                                        options.half_open = parser.number<size_t>(1);
+                                }
+                                else if (parser.option() == "--deadline")
+                                {
+                                        options.deadline = std::chrono::seconds{parser.number<int64_t>(1, std::numeric_limits<int32_t>::max())};
+                                }
+                                else if (parser.option() == "--peer")
+                                {
+                                        given.push_back(PeerEndpoint::from_string(parser.value()));
+                                }
+                                else
+                                {
+                                        parser.unknown("probe");
+                                }
+                        }
+
+                        std::ifstream input_file{argv[2], std::ios::binary};
+                        if (!input_file)
+                        {
+                                std::cerr << "Error opening torrent file: " << argv[2] << "\n";
+                                return 1;
+                        }
+                        const std::vector<char> file_data((std::istreambuf_iterator<char>(input_file)), std::istreambuf_iterator<char>());
+                        const json metainfo = decode_bencoded_dictionary(std::string_view(file_data.data(), file_data.size())).first;
+                        const std::string info_hash = compute_info_hashes(metainfo.at("info")).v1;
+
+                        // the trackers' answers can be malformed too, so this stays inside the try
+                        const std::vector<PeerEndpoint> peers = find_peers(metainfo, info_hash, given);
+                        const auto start = std::chrono::steady_clock::now();
+                        std::vector<ProbeResult> results = probe_peers(local_handshake(info_hash), peers, options);
+                        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+                        // fastest first, failures last
+                        std::stable_sort(results.begin(), results.end(), [](const ProbeResult &a, const ProbeResult &b)
+                                         {
+                                                 if (a.handshaken != b.handshaken)
+                                                 {
+                                                         return a.handshaken;
+                                                 }
+                                                 return a.connect_latency + a.handshake_latency < b.connect_latency + b.handshake_latency; });
+
+                        const auto handshaken = std::count_if(results.begin(), results.end(), [](const ProbeResult &result)
+                                                              { return result.handshaken; });
+                        std::cout << "Probed " << results.size() << " peers in " << elapsed.count() << " s, " << handshaken << " handshakes" << "\n";
+                        for (const ProbeResult &result : results)
+                        {
+                                std::cout << result.endpoint.to_string();
+                                if (!result.handshaken)
+                                {
+                                        std::cout << " failed: " << result.error << "\n";
+                                        continue;
+                                }
+                                std::cout << " connect " << result.connect_latency.count() / 1000.0 << " ms handshake " << result.handshake_latency.count() / 1000.0
+                                          << " ms peer id " << hash_to_hex_string(std::string(result.peer_id.begin(), result.peer_id.end()))
+                                          << " " << describe_extensions(result.reserved) << "\n";
+                        }
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "download_piece")
+        {
+                // download_piece -o <out> <torrent> <index> [--pipeline N] [--peer IP:PORT]...
+                if (argc < 6 || std::string_view(argv[2]) != "-o")
+                {
+                        std::cerr << "Usage: " << argv[0] << " download_piece -o <output> <torrent> <index>" << "\n";
+                        return 1;
+                }
+
+                Download::Options options;
+                std::vector<PeerEndpoint> given;
+                json metainfo;
+                std::string info_hash;
+                PieceLayout layout;
+                uint32_t index;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 6}; parser.next();)
+                        {
+                                if (parser.option() == "--pipeline")
+                                {
+                                        options.pipeline = parser.number<size_t>(0, options.max_pipeline);
+                                }
+                                else if (parser.option() == "--peer")
+                                {
+                                        given.push_back(PeerEndpoint::from_string(parser.value()));
+                                }
+                                else
+                                {
+                                        parser.unknown("download_piece");
+                                }
+                        }
+
+                        std::ifstream input_file{argv[4], std::ios::binary};
+                        if (!input_file)
+                        {
+                                std::cerr << "Error opening torrent file: " << argv[4] << "\n";
+                                return 1;
+                        }
+                        const std::vector<char> file_data((std::istreambuf_iterator<char>(input_file)), std::istreambuf_iterator<char>());
+                        metainfo = decode_bencoded_dictionary(std::string_view(file_data.data(), file_data.size())).first;
+                        info_hash = compute_info_hashes(metainfo.at("info")).v1;
+                        layout = PieceLayout::from_info(metainfo.at("info"));
+                        index = parse_number<uint32_t>(argv[5], "Piece index");
+                        if (index >= layout.piece_count())
+                        {
+                                throw std::out_of_range("Piece " + std::string(argv[5]) + " is out of range");
+                        }
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+
+                try
+                {
+                        OutputFile output{argv[3], layout.piece_size(index)};
+                        const std::vector<PeerEndpoint> peers = find_peers(metainfo, info_hash, given);
+                        Download download{local_handshake(info_hash), layout, [&output](const uint32_t, const std::span<const BlockBuffer> blocks)
+                                          { output.write(0, blocks); },
+                                          options};
+                        const auto start = std::chrono::steady_clock::now();
+                        download.run(peers, {index});
+                        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+                        const auto &statistics = download.statistics();
+                        std::cout << "Piece " << index << " downloaded to " << argv[3] << "\n";
+                        std::cout << "Downloaded " << statistics.verified_bytes << " bytes in " << elapsed.count() << " s ("
+                                  << statistics.verified_bytes / elapsed.count() / 1e6 << " MB/s), " << statistics.requests << " requests" << "\n";
+                        for (const auto &peer : statistics.contributions)
+                        {
+                                print_peer(std::cout, peer);
+                        }
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Download failed: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "download")
+        {
+                // download -o <out> <torrent> [--pipeline N] [--max-peers N] [--progress S] [--endgame 0|1] [--huge-pages 0|1]
+                // [--peer IP:PORT]..., the files of a multi-file torrent end up concatenated in <out>; without --pipeline queue
+                // depths adapt per peer
+                if (argc < 5 || std::string_view(argv[2]) != "-o")
+                {
+                        std::cerr << "Usage: " << argv[0] << " download -o <output> <torrent>" << "\n";
+                        return 1;
+                }
+
+                Download::Options options;
+                BlockPool::Options pool_options;
+                std::vector<PeerEndpoint> given;
+                json metainfo;
+                std::string info_hash;
+                PieceLayout layout;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 5}; parser.next();)
+                        {
+                                if (parser.option() == "--pipeline")
+                                {
+                                        options.pipeline = parser.number<size_t>(0, options.max_pipeline);
+                                }
+                                else if (parser.option() == "--max-peers")
+                                {
+                                        options.max_peers = parser.number<size_t>(1, 100000);
+                                }
+                                else if (parser.option() == "--endgame")
+                                {
+                                        options.endgame = parser.flag();
+                                }
+                                else if (parser.option() == "--huge-pages")
+                                {
+                                        pool_options.huge_pages = parser.flag();
+                                }
+                                else if (parser.option() == "--progress")
+                                {
+                                        options.progress_interval = std::chrono::seconds{parser.number<int64_t>(1, 3600)};
+                                        options.progress = [](const Download &download)
+                                        {
+                                                std::cerr << download.statistics().pieces << " pieces done" << "\n";
+                                                for (const auto &peer : download.peer_statistics())
+                                                {
+                                                        print_peer(std::cerr, peer);
+                                                }
+                                        };
+                                }
+                                else if (parser.option() == "--peer")
+                                {
+                                        given.push_back(PeerEndpoint::from_string(parser.value()));
+                                }
+                                else
+                                {
+                                        parser.unknown("download");
+                                }
+                        }
+
+                        std::ifstream input_file{argv[4], std::ios::binary};
+                        if (!input_file)
+                        {
+                                std::cerr << "Error opening torrent file: " << argv[4] << "\n";
+                                return 1;
+                        }
+                        const std::vector<char> file_data((std::istreambuf_iterator<char>(input_file)), std::istreambuf_iterator<char>());
+                        metainfo = decode_bencoded_dictionary(std::string_view(file_data.data(), file_data.size())).first;
+                        info_hash = compute_info_hashes(metainfo.at("info")).v1;
+                        layout = PieceLayout::from_info(metainfo.at("info"));
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+
+                try
+                {
+                        OutputFile output{argv[3], layout.total_length};
+                        BlockPool pool{pool_options};
+                        options.block_pool = &pool;
+                        const std::vector<PeerEndpoint> peers = find_peers(metainfo, info_hash, given);
+                        const uint64_t piece_length = layout.piece_length;
+                        Download download{local_handshake(info_hash), layout, [&output, piece_length](const uint32_t index, const std::span<const BlockBuffer> blocks)
+                                          { output.write(index * piece_length, blocks); },
+                                          options};
+
+                        std::vector<uint32_t> wanted(layout.piece_count());
+                        std::iota(wanted.begin(), wanted.end(), 0);
+                        const auto start = std::chrono::steady_clock::now();
+                        download.run(peers, wanted);
+                        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+                        const auto &statistics = download.statistics();
+                        std::cout << "Downloaded " << argv[4] << " to " << argv[3] << "\n";
+                        std::cout << statistics.verified_bytes << " bytes, " << statistics.pieces << " pieces in " << elapsed.count() << " s ("
+                                  << statistics.verified_bytes / elapsed.count() / 1e6 << " MB/s) from " << statistics.contributions.size()
+                                  << " peers, " << statistics.hash_failures << " hash failures" << "\n";
+                        if (statistics.endgame_pieces > 0)
+                        {
+                                std::cout << "Endgame from " << statistics.endgame_pieces << " pieces: " << statistics.duplicate_requests
+                                          << " duplicate requests, " << statistics.cancels << " cancels" << "\n";
+                        }
+                        std::cout << statistics.wasted_bytes << " bytes wasted" << "\n";
+                        const BlockPool::Statistics blocks = pool.statistics();
+                        std::cout << "Block pool: " << blocks.hits << " hits, " << blocks.misses << " misses, high water " << blocks.high_water
+                                  << " of " << blocks.capacity << " blocks" << (blocks.huge_pages ? " in huge pages" : "") << "\n";
+                        for (const auto &peer : statistics.contributions)
+                        {
+                                print_peer(std::cout, peer);
+                        }
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Download failed: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "tracker")
+        {
+                // tracker [--port N] [--interval S] [--benchmark REQUESTS [--connections C] [--torrents T]]
+                TrackerServerOptions options;
+                uint64_t benchmark_requests = 0;
+                unsigned connections = 8;
+                size_t torrents = 1000;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 2}; parser.next();)
+                        {
+                                if (parser.option() == "--port")
+                                {
+                                        options.port = parser.number<uint16_t>(1);
+                                }
+                                else if (parser.option() == "--interval")
+                                {
+                                        options.interval = std::chrono::seconds{parser.number<int64_t>(1, std::numeric_limits<int32_t>::max())};
+                                }
+                                else if (parser.option() == "--benchmark")
+                                {
+                                        benchmark_requests = parser.number<uint64_t>();
+                                }
+                                else if (parser.option() == "--connections")
+                                {
+                                        connections = parser.number<unsigned>(1, 4096);
+                                }
+                                else if (parser.option() == "--torrents")
+                                {
+                                        torrents = parser.number<size_t>(1);
+                                }
+                                else
+                                {
+                                        parser.unknown("tracker");
+                                }
+                        }
+                        options.min_interval = std::min(options.min_interval, options.interval); // a short --interval has to be usable
+
+                        TrackerServer server{options};
+                        if (benchmark_requests == 0)
+                        {
+                                std::cout << "Tracker listening on port " << server.port() << "\n";
+                                server.run(std::stop_token{});
+                                return 0;
+                        }
+
+                        std::jthread loop{[&server](const std::stop_token stop)
+                                          { server.run(stop); }};
+                        const TrackerBenchmark result = benchmark_tracker(server.port(), connections, benchmark_requests, torrents);
+                        loop.request_stop();
+                        loop.join();
+
+                        const auto statistics = server.statistics();
+                        std::cout << "Announces: " << result.requests << " in " << result.seconds << " s ("
+                                  << static_cast<uint64_t>(result.requests / result.seconds) << "/s), " << result.failures << " failed" << "\n";
+                        std::cout << "Torrents: " << statistics.torrents << ", peers: " << statistics.peers
+                                  << ", connections: " << statistics.connections << "\n";
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Tracker failed: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "benchmark_peers")
+        {
+                // benchmark_peers [--peers N], a compact peer list with repeats decoded and deduplicated
+                uint64_t peer_count = 200000;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 2}; parser.next();)
+                        {
+                                if (parser.option() == "--peers")
+                                {
+                                        peer_count = parser.number<uint64_t>(1, 100000000);
+                                }
+                                else
+                                {
+                                        parser.unknown("benchmark_peers");
+                                }
+                        }
+
+                        const PeersBenchmark result = benchmark_peers(peer_count);
+                        std::cout << result.peers << " peers, " << result.unique << " unique" << "\n";
+                        std::cout << "Strings: " << result.strings_seconds * 1e3 << " ms" << "\n";
+                        std::cout << "Packed: " << result.packed_seconds * 1e3 << " ms" << "\n";
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "benchmark_announce_url")
+        {
+                // benchmark_announce_url [--urls N], announce URLs built from scratch, one-shot and from a cached query
+                uint64_t url_count = 1000000;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 2}; parser.next();)
+                        {
+                                if (parser.option() == "--urls")
+                                {
+                                        url_count = parser.number<uint64_t>(1);
+                                }
+                                else
+                                {
+                                        parser.unknown("benchmark_announce_url");
+                                }
+                        }
+
+                        const AnnounceUrlBenchmark result = benchmark_announce_url(url_count);
+                        const auto per_url = [&result](const double seconds)
+                        { return seconds / static_cast<double>(result.urls) * 1e9; };
+                        std::cout << result.urls << " announce URLs" << "\n";
+                        std::cout << "Strings: " << per_url(result.strings_seconds) << " ns per URL" << "\n";
+                        std::cout << "One-shot query: " << per_url(result.one_shot_seconds) << " ns per URL" << "\n";
+                        std::cout << "Cached query: " << per_url(result.cached_seconds) << " ns per URL" << "\n";
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "benchmark_download")
+        {
+                // benchmark_download [--size MiB] [--piece-length N] [--seed DELAY_MS[:MB/S[:STOP_MS]]]... [--bad-seed DELAY_MS]...
+                // [--pipeline N] [--endgame 0|1] [--progress S], a torrent of random data from local seeds that delay every
+                // block, and optionally cap their rate (0 for none) or go away after a while; bad seeds corrupt every block.
+                // One 20 ms seed unless a seed is given
+                uint64_t size = 64;
+                uint32_t piece_length = 256 * 1024;
+                std::vector<LocalSeedOptions> seeds;
+                Download::Options options;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 2}; parser.next();)
+                        {
+                                if (parser.option() == "--size")
+                                {
+                                        size = parser.number<uint64_t>(1, 64 * 1024);
+                                }
+                                else if (parser.option() == "--piece-length")
+                                {
+                                        piece_length = parser.number<uint32_t>(block_size, 64 * 1024 * 1024);
+                                }
+                                else if (parser.option() == "--seed")
+                                {
+                                        std::string_view spec = parser.value();
+                                        const auto field = [&spec]
+                                        {
+                                                const size_t colon = spec.find(':');
+                                                const std::string_view text = spec.substr(0, colon);
+                                                spec = colon == std::string_view::npos ? std::string_view{} : spec.substr(colon + 1);
+                                                return text;
+                                        };
+                                        LocalSeedOptions seed;
+                                        seed.delay = std::chrono::milliseconds{parse_number<int64_t>(field(), "--seed delay", 0, 60000)};
+                                        if (!spec.empty())
+                                        {
+                                                seed.rate = parse_number<uint32_t>(field(), "--seed rate", 0, 100000) * 1e6;
+                                        }
+                                        if (!spec.empty())
+                                        {
+                                                seed.stop_after = std::chrono::milliseconds{parse_number<int64_t>(field(), "--seed stop", 1, 3600000)};
+                                        }
+                                        seeds.push_back(seed);
+                                }
+                                else if (parser.option() == "--bad-seed")
+                                {
+                                        seeds.push_back({std::chrono::milliseconds{parser.number<int64_t>(0, 60000)}, 0, {}, true});
+                                }
+                                else if (parser.option() == "--pipeline")
+                                {
+                                        options.pipeline = parser.number<size_t>(1, options.max_pipeline);
+                                }
+                                else if (parser.option() == "--endgame")
+                                {
+                                        options.endgame = parser.flag();
+                                }
+                                else if (parser.option() == "--progress")
+                                {
+                                        options.progress_interval = std::chrono::seconds{parser.number<int64_t>(1, 3600)};
+                                        options.progress = [](const Download &download)
+                                        {
+                                                std::cerr << download.statistics().pieces << " pieces done" << "\n";
+                                                for (const auto &peer : download.peer_statistics())
+                                                {
+                                                        print_peer(std::cerr, peer);
+                                                }
+                                        };
+                                }
+                                else
+                                {
+                                        parser.unknown("benchmark_download");
+                                }
+                        }
+                        if (seeds.empty())
+                        {
+                                seeds.push_back({std::chrono::milliseconds{20}, 0, {}, false});
+                        }
+
+                        const DownloadBenchmark result = benchmark_download(size << 20, piece_length, seeds, options);
+                        const auto &statistics = result.statistics;
+                        std::cout << statistics.verified_bytes << " bytes, " << statistics.pieces << " pieces in " << result.seconds << " s ("
+                                  << statistics.verified_bytes / result.seconds / 1e6 << " MB/s) from " << seeds.size() << " seeds, all matching, "
+                                  << statistics.hash_failures << " hash failures" << "\n";
+                        if (statistics.endgame_pieces > 0)
+                        {
+                                std::cout << "Endgame from " << statistics.endgame_pieces << " pieces: " << statistics.duplicate_requests
+                                          << " duplicate requests, " << statistics.cancels << " cancels" << "\n";
+                        }
+                        std::cout << statistics.wasted_bytes << " bytes wasted" << "\n";
+                        for (const auto &peer : statistics.contributions)
+                        {
+                                print_peer(std::cout, peer);
+                        }
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "benchmark_wire")
+        {
+                // benchmark_wire [--messages N] [--pieces PERCENT], a peer message stream parsed through the ring and by copying
+                uint64_t message_count = 200000;
+                unsigned piece_percent = 10;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 2}; parser.next();)
+                        {
+                                if (parser.option() == "--messages")
+                                {
+                                        message_count = parser.number<uint64_t>(1);
+                                }
+                                else if (parser.option() == "--pieces")
+                                {
+                                        piece_percent = parser.number<unsigned>(0, 100);
+                                }
+                                else
+                                {
+                                        parser.unknown("benchmark_wire");
+                                }
+                        }
+
+                        const WireBenchmark result = benchmark_wire(message_count, piece_percent);
+                        const auto rate = [&result](const double seconds)
+                        { return static_cast<double>(result.messages) / seconds / 1e6; };
+                        std::cout << result.messages << " messages, " << result.bytes << " bytes, " << piece_percent << "% pieces" << "\n";
+                        std::cout << "Ring, 64 KiB reads: " << rate(result.ring_seconds) << "M msgs/s, "
+                                  << static_cast<double>(result.bytes) / result.ring_seconds / 1e9 << " GB/s" << "\n";
+                        std::cout << "Ring, 1-1500 B reads: " << rate(result.small_reads_seconds) << "M msgs/s" << "\n";
+                        std::cout << "Copying: " << rate(result.copying_seconds) << "M msgs/s" << "\n";
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "benchmark_picker")
+        {
+                // benchmark_picker --pieces N [--peers P], a swarm of P peers over an N piece torrent
+                uint32_t piece_count = 1000000;
+                size_t peer_count = 500;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 2}; parser.next();)
+                        {
+                                if (parser.option() == "--pieces")
+                                {
+                                        piece_count = parser.number<uint32_t>(1);
+                                }
+                                else if (parser.option() == "--peers")
+                                {
+                                        peer_count = parser.number<size_t>(1, 1000000);
+                                }
+                                else
+                                {
+                                        parser.unknown("benchmark_picker");
+                                }
+                        }
+
+                        const PickerBenchmark result = benchmark_picker(piece_count, peer_count);
+                        std::cout << piece_count << " pieces, " << peer_count << " peers" << "\n";
+                        std::cout << "Bitfields: " << result.bitfield_seconds << " s" << "\n";
+                        std::cout << "Haves: " << result.haves << " in " << result.have_seconds << " s ("
+                                  << static_cast<uint64_t>(result.haves / result.have_seconds) << "/s)" << "\n";
+                        std::cout << "Picks: " << result.picks << " in " << result.pick_seconds << " s ("
+                                  << static_cast<uint64_t>(result.picks / result.pick_seconds) << "/s)" << "\n";
+                        std::cout << "Disconnects: " << result.disconnect_seconds << " s" << "\n";
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "benchmark_bitfield")
+        {
+                // benchmark_bitfield --pieces N [--peers P], one interest check per peer against our bitfield
+                size_t piece_count = 1000000;
+                size_t peer_count = 500;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 2}; parser.next();)
+                        {
+                                if (parser.option() == "--pieces")
+                                {
+                                        piece_count = parser.number<size_t>(10, std::numeric_limits<uint32_t>::max());
+                                }
+                                else if (parser.option() == "--peers")
+                                {
+                                        peer_count = parser.number<size_t>(1, 1000000);
+                                }
+                                else
+                                {
+                                        parser.unknown("benchmark_bitfield");
+                                }
+                        }
+
+                        const BitfieldBenchmark result = benchmark_bitfield(piece_count, peer_count);
+                        const auto per_check = [&result](const double seconds)
+                        { return seconds / static_cast<double>(result.operations) * 1e6; };
+                        std::cout << piece_count << " pieces, " << result.operations << " interest checks" << "\n";
+                        std::cout << "Bytewise: " << per_check(result.bytewise_seconds) << " us per check" << "\n";
+                        std::cout << "Words: " << per_check(result.scalar_seconds) << " us per check" << "\n";
+                        std::cout << result.implementation << ": " << per_check(result.simd_seconds) << " us per check" << "\n";
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "benchmark_block_pool")
+        {
+                // benchmark_block_pool --blocks N [--threads T], 16 KiB blocks filled and freed in piece-sized batches
+                uint64_t block_count = 1000000;
+                unsigned thread_count = 1;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 2}; parser.next();)
+                        {
+                                if (parser.option() == "--blocks")
+                                {
+                                        block_count = parser.number<uint64_t>(1);
+                                }
+                                else if (parser.option() == "--threads")
+                                {
+                                        thread_count = parser.number<unsigned>(1, 1024);
+                                }
+                                else
+                                {
+                                        parser.unknown("benchmark_block_pool");
+                                }
+                        }
+                        if (block_count < thread_count)
+                        {
+                                throw std::invalid_argument("benchmark_block_pool needs a block per thread");
+                        }
+
+                        const BlockPoolBenchmark result = benchmark_block_pool(thread_count, block_count);
+                        const auto per_block = [&result](const double seconds)
+                        { return seconds / static_cast<double>(result.blocks) * 1e9; };
+                        std::cout << result.blocks << " blocks on " << thread_count << " threads" << "\n";
+                        std::cout << "Vector: " << per_block(result.malloc_seconds) << " ns per block" << "\n";
+                        std::cout << "Pool: " << per_block(result.pool_seconds) << " ns per block" << "\n";
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+        }
+        else if (command == "benchmark_chunked")
+        {
+                // benchmark_chunked [--bytes N] [--chunk N] [--feed N], a chunked HTTP response through the response parser
+                size_t body_bytes = 32000000;
+                size_t chunk_size = 1001;
+                size_t feed_size = 16384;
+                try
+                {
+                        for (OptionParser parser{argc, argv, 2}; parser.next();)
+                        {
+                                if (parser.option() == "--bytes")
+                                {
+                                        body_bytes = parser.number<size_t>(1);
+                                }
+                                else if (parser.option() == "--chunk")
+                                {
+                                        chunk_size = parser.number<size_t>(1);
+                                }
+                                else if (parser.option() == "--feed")
+                                {
+                                        feed_size = parser.number<size_t>(1);
+                                }
+                                else
+                                {
+                                        parser.unknown("benchmark_chunked");
+                                }
+                        }
+
+                        const ChunkedBodyBenchmark result = benchmark_chunked_body(body_bytes, chunk_size, feed_size);
+                        const auto rate = [&result](const double seconds)
+                        { return static_cast<double>(result.body_bytes) / seconds / 1e6; };
+                        std::cout << result.body_bytes << " bytes in " << result.chunks << " chunks" << "\n";
+                        std::cout << "Reads of " << feed_size << " bytes: " << result.streamed_seconds * 1e3 << " ms, "
+                                  << rate(result.streamed_seconds) << " MB/s" << "\n";
+                        std::cout << "One read: " << result.single_seconds * 1e3 << " ms, " << rate(result.single_seconds) << " MB/s" << "\n";
+                        std::cout << "Body sink: " << result.sink_seconds * 1e3 << " ms, " << rate(result.sink_seconds) << " MB/s" << "\n";
+                }
+                catch (const std::exception &e)
+                {
+                        std::cerr << "Error: " << e.what() << "\n";
+                        return 1;
+                }
+        }
         else
         {
                 std::cerr << "Unknown command: " << command << "\n";
@@ -69,6 +69,13 @@ std::pair<json, size_t> decode_bencoded_list(const std::string_view encoded_valu
                         current_index += nested_list_length;
                         break;
                 }
+                case 'd':
+                {
+                        auto [decoded_dictionary, dictionary_length] = decode_bencoded_dictionary(encoded_value.substr(current_index));
+                        decoded_list.push_back(decoded_dictionary);
+                        current_index += dictionary_length;
+                        break;
+                }
                 case 'e': // end of encoded value
                 {
                         return {decoded_list, current_index + 1};
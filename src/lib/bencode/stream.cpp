@@ -0,0 +1,157 @@
+#include "stream.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+// consumes the next piece of input, returns true once the top level value is complete
+bool BencodeStreamDecoder::feed(const std::string_view chunk)
+{
+        size_t i = 0;
+        while (i < chunk.size())
+        {
+                if (done)
+                {
+                        throw std::invalid_argument("Trailing data after bencoded value");
+                }
+
+                switch (state)
+                {
+                case State::value:
+                {
+                        const char c = chunk[i++];
+                        if (c == 'i')
+                        {
+                                token.clear();
+                                state = State::integer;
+                        }
+                        else if (c == 'l' || c == 'd')
+                        {
+                                if (!stack.empty() && stack.back().container.is_object() && stack.back().expecting_key)
+                                {
+                                        throw std::invalid_argument("Dictionary key must be a string");
+                                }
+                                stack.push_back({c == 'l' ? json::array() : json::object(), "", c == 'd'});
+                        }
+                        else if (c == 'e')
+                        {
+                                if (stack.empty() || (stack.back().container.is_object() && !stack.back().expecting_key))
+                                {
+                                        throw std::invalid_argument("Unexpected end of bencoded value");
+                                }
+                                json container = std::move(stack.back().container);
+                                stack.pop_back();
+                                emit(std::move(container));
+                        }
+                        else if (std::isdigit(static_cast<unsigned char>(c)))
+                        {
+                                token.assign(1, c);
+                                state = State::string_length;
+                        }
+                        else
+                        {
+                                throw std::invalid_argument("Invalid bencode type");
+                        }
+                        break;
+                }
+                case State::integer:
+                {
+                        const size_t end = chunk.find('e', i);
+                        token.append(chunk.substr(i, end == std::string_view::npos ? std::string_view::npos : end - i));
+                        if (end == std::string_view::npos)
+                        {
+                                i = chunk.size();
+                                break;
+                        }
+
+                        i = end + 1;
+                        state = State::value;
+                        emit(string_to_int64(token));
+                        break;
+                }
+                case State::string_length:
+                {
+                        const size_t end = chunk.find(':', i);
+                        token.append(chunk.substr(i, end == std::string_view::npos ? std::string_view::npos : end - i));
+                        if (end == std::string_view::npos)
+                        {
+                                i = chunk.size();
+                                break;
+                        }
+
+                        i = end + 1;
+                        string_remaining = string_to_uint64(token);
+                        text.clear();
+                        text.reserve(std::min<uint64_t>(string_remaining, 1 << 20));
+                        state = State::string;
+                        if (string_remaining == 0)
+                        {
+                                state = State::value;
+                                emit(std::string{});
+                        }
+                        break;
+                }
+                case State::string:
+                {
+                        // string payloads are copied in bulk, not byte by byte
+                        const size_t take = static_cast<size_t>(std::min<uint64_t>(string_remaining, chunk.size() - i));
+                        text.append(chunk.substr(i, take));
+                        i += take;
+                        string_remaining -= take;
+                        if (string_remaining == 0)
+                        {
+                                state = State::value;
+                                emit(std::move(text));
+                                text = std::string{};
+                        }
+                        break;
+                }
+                }
+        }
+
+        return done;
+}
+
+bool BencodeStreamDecoder::complete() const
+{
+        return done;
+}
+
+json &BencodeStreamDecoder::value()
+{
+        if (!done)
+        {
+                throw std::invalid_argument("Incomplete bencoded value");
+        }
+        return result;
+}
+
+// hands a finished value to the enclosing list or dictionary, or makes it the result
+void BencodeStreamDecoder::emit(json decoded)
+{
+        if (stack.empty())
+        {
+                result = std::move(decoded);
+                done = true;
+                return;
+        }
+
+        Frame &frame = stack.back();
+        if (frame.container.is_array())
+        {
+                frame.container.push_back(std::move(decoded));
+        }
+        else if (frame.expecting_key)
+        {
+                if (!decoded.is_string())
+                {
+                        throw std::invalid_argument("Dictionary key must be a string");
+                }
+                frame.key = decoded.get<std::string>();
+                frame.expecting_key = false;
+        }
+        else
+        {
+                frame.container[frame.key] = std::move(decoded);
+                frame.expecting_key = true;
+        }
+}
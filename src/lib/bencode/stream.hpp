@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// decodes a bencoded value that arrives in pieces (e.g. straight from an HTTP body sink) without buffering the input
+class BencodeStreamDecoder
+{
+public:
+        bool feed(std::string_view chunk);
+        bool complete() const;
+        json &value();
+
+private:
+        enum class State
+        {
+                value,
+                integer,
+                string_length,
+                string
+        };
+
+        struct Frame
+        {
+                json container;
+                std::string key;
+                bool expecting_key;
+        };
+
+        void emit(json decoded);
+
+        State state = State::value;
+        std::vector<Frame> stack;
+        std::string token; // digits of an integer or of a string length
+        std::string text;
+        uint64_t string_remaining = 0;
+        json result;
+        bool done = false;
+};
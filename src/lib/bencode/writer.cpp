@@ -0,0 +1,89 @@
+#include "writer.hpp"
+#include <charconv>
+#include <cstring>
+
+BencodeWriter::BencodeWriter(char *buffer, const size_t capacity)
+    : begin(buffer), position(buffer), limit(buffer + capacity)
+{
+}
+
+BencodeWriter &BencodeWriter::integer(const int64_t value)
+{
+        char digits[24];
+        digits[0] = 'i';
+        char *end = std::to_chars(digits + 1, digits + sizeof(digits) - 1, value).ptr;
+        *end++ = 'e';
+        put({digits, static_cast<size_t>(end - digits)});
+        return *this;
+}
+
+BencodeWriter &BencodeWriter::string(const std::string_view value)
+{
+        if (char *space = string_space(value.size()))
+        {
+                std::memcpy(space, value.data(), value.size());
+        }
+        return *this;
+}
+
+BencodeWriter &BencodeWriter::begin_dictionary()
+{
+        put("d");
+        return *this;
+}
+
+BencodeWriter &BencodeWriter::begin_list()
+{
+        put("l");
+        return *this;
+}
+
+BencodeWriter &BencodeWriter::end()
+{
+        put("e");
+        return *this;
+}
+
+// writes the length prefix, the caller copies the bytes to the returned position
+char *BencodeWriter::string_space(const size_t length)
+{
+        char digits[24];
+        char *end = std::to_chars(digits, digits + sizeof(digits) - 1, length).ptr;
+        *end++ = ':';
+        put({digits, static_cast<size_t>(end - digits)});
+
+        if (overflow || static_cast<size_t>(limit - position) < length)
+        {
+                overflow = true;
+                return nullptr;
+        }
+        char *space = position;
+        position += length;
+        return space;
+}
+
+bool BencodeWriter::ok() const
+{
+        return !overflow;
+}
+
+size_t BencodeWriter::size() const
+{
+        return static_cast<size_t>(position - begin);
+}
+
+std::string_view BencodeWriter::view() const
+{
+        return {begin, size()};
+}
+
+void BencodeWriter::put(const std::string_view bytes)
+{
+        if (overflow || static_cast<size_t>(limit - position) < bytes.size())
+        {
+                overflow = true;
+                return;
+        }
+        std::memcpy(position, bytes.data(), bytes.size());
+        position += bytes.size();
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// writes bencode straight into a caller-owned buffer without allocating; dictionary keys have to be written
+// in sorted order by the caller. Once the buffer is full ok() turns false and further output is dropped.
+class BencodeWriter
+{
+public:
+        BencodeWriter(char *buffer, size_t capacity);
+
+        BencodeWriter &integer(int64_t value);
+        BencodeWriter &string(std::string_view value);
+        BencodeWriter &begin_dictionary();
+        BencodeWriter &begin_list();
+        BencodeWriter &end();
+        char *string_space(size_t length); // room for a string of length bytes the caller fills in, nullptr when full
+
+        bool ok() const;
+        size_t size() const;
+        std::string_view view() const;
+
+private:
+        void put(std::string_view bytes);
+
+        char *const begin;
+        char *position;
+        char *const limit;
+        bool overflow = false;
+};
@@ -0,0 +1,230 @@
+#include "merkle.hpp"
+#include "sha256.hpp"
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+        // splits [0, count) into contiguous ranges, one per thread, small inputs stay on the calling thread
+        template <typename Function>
+        void parallel_for(const size_t count, unsigned threads, const size_t min_per_thread, Function function)
+        {
+                if (count == 0)
+                {
+                        return;
+                }
+                if (threads == 0)
+                {
+                        threads = std::max(1u, std::thread::hardware_concurrency());
+                }
+                threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(1, count / min_per_thread)));
+                if (threads <= 1)
+                {
+                        function(size_t{0}, count);
+                        return;
+                }
+
+                const size_t chunk = (count + threads - 1) / threads;
+                std::vector<std::jthread> workers;
+                workers.reserve(threads);
+                for (size_t begin = 0; begin < count; begin += chunk)
+                {
+                        workers.emplace_back(function, begin, std::min(count, begin + chunk));
+                }
+        }
+
+        // the next layer up, each node is SHA-256 of its two children which sit next to each other in memory
+        std::vector<Sha256Digest> parent_layer(const std::vector<Sha256Digest> &layer, const unsigned threads)
+        {
+                std::vector<Sha256Digest> parents(layer.size() / 2);
+                parallel_for(parents.size(), threads, 4096, [&](const size_t begin, const size_t end)
+                             {
+                                     std::vector<const void *> pairs(end - begin);
+                                     for (size_t i = begin; i < end; ++i)
+                                     {
+                                             pairs[i - begin] = layer[2 * i].data();
+                                     }
+                                     SHA256::hashMany(pairs.data(), pairs.size(), 2 * SHA256::HashBytes,
+                                                      reinterpret_cast<unsigned char(*)[SHA256::HashBytes]>(parents[begin].data())); });
+                return parents;
+        }
+
+        Sha256Digest hash_pair(const Sha256Digest &left, const Sha256Digest &right)
+        {
+                SHA256 sha256;
+                sha256.add(left.data(), left.size());
+                sha256.add(right.data(), right.size());
+                Sha256Digest digest;
+                sha256.getHash(digest.data());
+                return digest;
+        }
+
+        // pads the layer to a power of two and hashes it down to a single node
+        Sha256Digest reduce_to_root(std::vector<Sha256Digest> layer, const Sha256Digest &pad, const unsigned threads)
+        {
+                if (layer.empty())
+                {
+                        return Sha256Digest{};
+                }
+
+                layer.resize(std::bit_ceil(layer.size()), pad);
+                while (layer.size() > 1)
+                {
+                        layer = parent_layer(layer, threads);
+                }
+                return layer.front();
+        }
+}
+
+// SHA-256 of every 16 KiB block of data (the leaf layer), spread across threads
+std::vector<Sha256Digest> hash_merkle_leaves(const std::string_view data, const unsigned threads)
+{
+        const size_t full_blocks = data.size() / merkle_block_size;
+        const size_t tail = data.size() % merkle_block_size;
+        std::vector<Sha256Digest> leaves(full_blocks + (tail > 0 ? 1 : 0));
+
+        // full blocks share one length, so they can go through the multi-buffer path
+        parallel_for(full_blocks, threads, 64, [&](const size_t begin, const size_t end)
+                     {
+                             std::vector<const void *> blocks(end - begin);
+                             for (size_t i = begin; i < end; ++i)
+                             {
+                                     blocks[i - begin] = data.data() + i * merkle_block_size;
+                             }
+                             SHA256::hashMany(blocks.data(), blocks.size(), merkle_block_size,
+                                              reinterpret_cast<unsigned char(*)[SHA256::HashBytes]>(leaves[begin].data())); });
+
+        if (tail > 0)
+        {
+                SHA256 sha256;
+                sha256.add(data.data() + full_blocks * merkle_block_size, tail);
+                sha256.getHash(leaves.back().data());
+        }
+
+        return leaves;
+}
+
+// hash of a subtree of the given height whose leaves are all zero
+Sha256Digest merkle_pad_hash(const unsigned height)
+{
+        Sha256Digest node{};
+        for (unsigned i = 0; i < height; ++i)
+        {
+                node = hash_pair(node, node);
+        }
+        return node;
+}
+
+// walks from a node up to the root using its uncle hashes, lowest first
+Sha256Digest merkle_root_from_proof(Sha256Digest node, size_t index, const std::vector<Sha256Digest> &proof)
+{
+        for (const auto &uncle : proof)
+        {
+                node = (index % 2 == 0) ? hash_pair(node, uncle) : hash_pair(uncle, node);
+                index /= 2;
+        }
+        return node;
+}
+
+// pieces root of a file from its `piece layers` entry, padding pieces are roots of all-zero subtrees
+Sha256Digest merkle_root_from_piece_layer(const std::vector<Sha256Digest> &piece_layer, const size_t blocks_per_piece, const unsigned threads)
+{
+        if (!std::has_single_bit(blocks_per_piece))
+        {
+                throw std::invalid_argument("Piece length must be a power of two multiple of 16 KiB");
+        }
+
+        return reduce_to_root(piece_layer, merkle_pad_hash(std::countr_zero(blocks_per_piece)), threads);
+}
+
+// checks a single block as soon as it arrives, given the uncle hashes up to its piece layer node
+bool verify_merkle_block(const std::string_view block, const size_t index_in_piece, const std::vector<Sha256Digest> &proof, const Sha256Digest &piece_hash)
+{
+        SHA256 sha256;
+        sha256.add(block.data(), block.size());
+        Sha256Digest leaf;
+        sha256.getHash(leaf.data());
+        return merkle_root_from_proof(leaf, index_in_piece, proof) == piece_hash;
+}
+
+// checks a whole piece from its block hashes, the last piece of a file is padded with zero leaves
+bool verify_merkle_piece(const std::vector<Sha256Digest> &block_hashes, const size_t blocks_per_piece, const Sha256Digest &piece_hash)
+{
+        if (block_hashes.empty() || block_hashes.size() > blocks_per_piece || !std::has_single_bit(blocks_per_piece))
+        {
+                return false;
+        }
+
+        std::vector<Sha256Digest> layer = block_hashes;
+        layer.resize(blocks_per_piece, Sha256Digest{});
+        return reduce_to_root(std::move(layer), Sha256Digest{}, 1) == piece_hash;
+}
+
+MerkleTree::MerkleTree(std::vector<Sha256Digest> leaves, const unsigned threads)
+    : leaf_count(leaves.size())
+{
+        if (leaves.empty())
+        {
+                throw std::invalid_argument("Merkle tree needs at least one leaf");
+        }
+
+        leaves.resize(std::bit_ceil(leaves.size()), Sha256Digest{});
+        layers.push_back(std::move(leaves));
+        while (layers.back().size() > 1)
+        {
+                layers.push_back(parent_layer(layers.back(), threads));
+        }
+}
+
+const Sha256Digest &MerkleTree::root() const
+{
+        return layers.back().front();
+}
+
+unsigned MerkleTree::height() const
+{
+        return static_cast<unsigned>(layers.size() - 1);
+}
+
+// 0 is the (padded) leaf layer, height() is the root
+const std::vector<Sha256Digest> &MerkleTree::layer(const unsigned height) const
+{
+        return layers.at(height);
+}
+
+// uncle hashes of a leaf, from the leaf layer up to (excluding) the given height
+std::vector<Sha256Digest> MerkleTree::proof(size_t leaf_index, const unsigned up_to_height) const
+{
+        if (leaf_index >= layers.front().size() || up_to_height > height())
+        {
+                throw std::out_of_range("Merkle proof out of range");
+        }
+
+        std::vector<Sha256Digest> uncles;
+        uncles.reserve(up_to_height);
+        for (unsigned height = 0; height < up_to_height; ++height)
+        {
+                uncles.push_back(layers[height][leaf_index ^ 1]);
+                leaf_index /= 2;
+        }
+        return uncles;
+}
+
+// the `piece layers` value of the file, empty for files not larger than one piece
+std::vector<Sha256Digest> MerkleTree::piece_layer(const size_t blocks_per_piece) const
+{
+        if (!std::has_single_bit(blocks_per_piece))
+        {
+                throw std::invalid_argument("Piece length must be a power of two multiple of 16 KiB");
+        }
+        if (leaf_count <= blocks_per_piece)
+        {
+                return {};
+        }
+
+        const auto &pieces = layers.at(std::countr_zero(blocks_per_piece));
+        const size_t piece_count = (leaf_count + blocks_per_piece - 1) / blocks_per_piece;
+        return {pieces.begin(), pieces.begin() + static_cast<std::ptrdiff_t>(piece_count)};
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+using Sha256Digest = std::array<uint8_t, 32>;
+
+// BEP 52 leaves always cover 16 KiB, the last block of a file may be shorter
+constexpr size_t merkle_block_size = 16 * 1024;
+
+std::vector<Sha256Digest> hash_merkle_leaves(std::string_view data, unsigned threads = 0);
+Sha256Digest merkle_pad_hash(unsigned height);
+Sha256Digest merkle_root_from_proof(Sha256Digest node, size_t index, const std::vector<Sha256Digest> &proof);
+Sha256Digest merkle_root_from_piece_layer(const std::vector<Sha256Digest> &piece_layer, size_t blocks_per_piece, unsigned threads = 0);
+bool verify_merkle_block(std::string_view block, size_t index_in_piece, const std::vector<Sha256Digest> &proof, const Sha256Digest &piece_hash);
+bool verify_merkle_piece(const std::vector<Sha256Digest> &block_hashes, size_t blocks_per_piece, const Sha256Digest &piece_hash);
+
+// full tree over the leaves of one file, padded to a power of two with zero hashes
+class MerkleTree
+{
+public:
+        explicit MerkleTree(std::vector<Sha256Digest> leaves, unsigned threads = 0);
+
+        const Sha256Digest &root() const;
+        unsigned height() const;
+        const std::vector<Sha256Digest> &layer(unsigned height) const;
+        std::vector<Sha256Digest> proof(size_t leaf_index, unsigned up_to_height) const;
+        std::vector<Sha256Digest> piece_layer(size_t blocks_per_piece) const;
+
+private:
+        size_t leaf_count;
+        std::vector<std::vector<Sha256Digest>> layers;
+};
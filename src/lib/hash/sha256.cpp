@@ -0,0 +1,489 @@
+// //////////////////////////////////////////////////////////
+// sha256.cpp
+// SHA-256 (FIPS 180-4), structured like sha1.cpp
+//
+
+#include "sha256.hpp"
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/// same as reset()
+SHA256::SHA256()
+{
+  reset();
+}
+
+/// restart
+void SHA256::reset()
+{
+  m_numBytes = 0;
+  m_bufferSize = 0;
+
+  // according to FIPS 180-4, 5.3.3
+  m_hash[0] = 0x6a09e667;
+  m_hash[1] = 0xbb67ae85;
+  m_hash[2] = 0x3c6ef372;
+  m_hash[3] = 0xa54ff53a;
+  m_hash[4] = 0x510e527f;
+  m_hash[5] = 0x9b05688c;
+  m_hash[6] = 0x1f83d9ab;
+  m_hash[7] = 0x5be0cd19;
+}
+
+namespace
+{
+  // FIPS 180-4, 4.2.2
+  alignas(16) const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+  inline uint32_t rotate(uint32_t a, uint32_t c)
+  {
+    return (a >> c) | (a << (32 - c));
+  }
+
+  inline uint32_t loadBigEndian(const uint8_t* data)
+  {
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+  }
+
+  inline void storeBigEndian(uint8_t* data, uint32_t x)
+  {
+    data[0] = (uint8_t)(x >> 24);
+    data[1] = (uint8_t)(x >> 16);
+    data[2] = (uint8_t)(x >> 8);
+    data[3] = (uint8_t)x;
+  }
+
+  /// portable compression function
+  void processBlocksGeneric(uint32_t hash[8], const uint8_t* data, size_t numBlocks)
+  {
+    for (; numBlocks > 0; numBlocks--, data += SHA256::BlockSize)
+    {
+      uint32_t words[64];
+      for (int i = 0; i < 16; i++)
+        words[i] = loadBigEndian(data + 4 * i);
+
+      for (int i = 16; i < 64; i++)
+      {
+        const uint32_t s0 = rotate(words[i - 15], 7) ^ rotate(words[i - 15], 18) ^ (words[i - 15] >> 3);
+        const uint32_t s1 = rotate(words[i - 2], 17) ^ rotate(words[i - 2], 19) ^ (words[i - 2] >> 10);
+        words[i] = words[i - 16] + s0 + words[i - 7] + s1;
+      }
+
+      uint32_t a = hash[0], b = hash[1], c = hash[2], d = hash[3];
+      uint32_t e = hash[4], f = hash[5], g = hash[6], h = hash[7];
+
+      for (int i = 0; i < 64; i++)
+      {
+        const uint32_t s1 = rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25);
+        const uint32_t ch = g ^ (e & (f ^ g));
+        const uint32_t t1 = h + s1 + ch + k[i] + words[i];
+        const uint32_t s0 = rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22);
+        const uint32_t maj = (a & b) | (c & (a | b));
+        const uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+      }
+
+      hash[0] += a;
+      hash[1] += b;
+      hash[2] += c;
+      hash[3] += d;
+      hash[4] += e;
+      hash[5] += f;
+      hash[6] += g;
+      hash[7] += h;
+    }
+  }
+
+#ifdef SHA256_X86
+  struct CpuFeatures
+  {
+    bool shaNi = false;
+    bool avx2 = false;
+  };
+
+  CpuFeatures detectCpuFeatures()
+  {
+    CpuFeatures features;
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+      return features;
+
+    const bool sse41 = (ecx & (1u << 19)) != 0;
+    const bool osxsave = (ecx & (1u << 27)) != 0;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+      return features;
+
+    features.shaNi = sse41 && (ebx & (1u << 29)) != 0;
+
+    // AVX2 needs the OS to save the upper halves of the ymm registers
+    if (osxsave && (ebx & (1u << 5)) != 0)
+    {
+      uint32_t xcr0Low, xcr0High;
+      __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+      features.avx2 = (xcr0Low & 6) == 6;
+    }
+
+    return features;
+  }
+
+  const CpuFeatures& cpuFeatures()
+  {
+    static const CpuFeatures features = detectCpuFeatures();
+    return features;
+  }
+
+  /// Intel SHA extensions, 4 rounds per pair of sha256rnds2
+  __attribute__((target("sha,sse4.1")))
+  void processBlocksShaNi(uint32_t hash[8], const uint8_t* data, size_t numBlocks)
+  {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // the instructions want the state as ABEF / CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&hash[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&hash[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; numBlocks > 0; numBlocks--, data += SHA256::BlockSize)
+    {
+      const __m128i abefSave = state0;
+      const __m128i cdghSave = state1;
+      __m128i messages[4];
+
+#pragma GCC unroll 16
+      for (int i = 0; i < 16; i++)
+      {
+        if (i < 4)
+          messages[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), byteSwap);
+
+        __m128i message = _mm_add_epi32(messages[i & 3], _mm_load_si128((const __m128i*)&k[4 * i]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+
+        // schedule the words needed four rounds from now
+        if (i >= 3 && i < 15)
+        {
+          tmp = _mm_alignr_epi8(messages[i & 3], messages[(i - 1) & 3], 4);
+          messages[(i + 1) & 3] = _mm_add_epi32(messages[(i + 1) & 3], tmp);
+          messages[(i + 1) & 3] = _mm_sha256msg2_epu32(messages[(i + 1) & 3], messages[i & 3]);
+        }
+
+        message = _mm_shuffle_epi32(message, 0x0E);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, message);
+
+        if (i >= 1 && i < 13)
+          messages[(i - 1) & 3] = _mm_sha256msg1_epu32(messages[(i - 1) & 3], messages[i & 3]);
+      }
+
+      state0 = _mm_add_epi32(state0, abefSave);
+      state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128((__m128i*)&hash[0], state0);
+    _mm_storeu_si128((__m128i*)&hash[4], state1);
+  }
+
+  __attribute__((target("avx2"))) inline __m256i rotate8(__m256i x, int c)
+  {
+    return _mm256_or_si256(_mm256_srli_epi32(x, c), _mm256_slli_epi32(x, 32 - c));
+  }
+
+  /// one 64 byte block of eight independent messages, one message per 32 bit lane
+  __attribute__((target("avx2")))
+  void processBlockX8(__m256i hash[8], const uint8_t* const blocks[8])
+  {
+    __m256i words[64];
+    for (int i = 0; i < 16; i++)
+      words[i] = _mm256_setr_epi32((int)loadBigEndian(blocks[0] + 4 * i), (int)loadBigEndian(blocks[1] + 4 * i),
+                                   (int)loadBigEndian(blocks[2] + 4 * i), (int)loadBigEndian(blocks[3] + 4 * i),
+                                   (int)loadBigEndian(blocks[4] + 4 * i), (int)loadBigEndian(blocks[5] + 4 * i),
+                                   (int)loadBigEndian(blocks[6] + 4 * i), (int)loadBigEndian(blocks[7] + 4 * i));
+
+    for (int i = 16; i < 64; i++)
+    {
+      const __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotate8(words[i - 15], 7), rotate8(words[i - 15], 18)),
+                                          _mm256_srli_epi32(words[i - 15], 3));
+      const __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotate8(words[i - 2], 17), rotate8(words[i - 2], 19)),
+                                          _mm256_srli_epi32(words[i - 2], 10));
+      words[i] = _mm256_add_epi32(_mm256_add_epi32(words[i - 16], s0), _mm256_add_epi32(words[i - 7], s1));
+    }
+
+    __m256i a = hash[0], b = hash[1], c = hash[2], d = hash[3];
+    __m256i e = hash[4], f = hash[5], g = hash[6], h = hash[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+      const __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotate8(e, 6), rotate8(e, 11)), rotate8(e, 25));
+      const __m256i ch = _mm256_xor_si256(g, _mm256_and_si256(e, _mm256_xor_si256(f, g)));
+      const __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, s1),
+                                          _mm256_add_epi32(_mm256_add_epi32(ch, _mm256_set1_epi32((int)k[i])), words[i]));
+      const __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotate8(a, 2), rotate8(a, 13)), rotate8(a, 22));
+      const __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+      const __m256i t2 = _mm256_add_epi32(s0, maj);
+
+      h = g;
+      g = f;
+      f = e;
+      e = _mm256_add_epi32(d, t1);
+      d = c;
+      c = b;
+      b = a;
+      a = _mm256_add_epi32(t1, t2);
+    }
+
+    hash[0] = _mm256_add_epi32(hash[0], a);
+    hash[1] = _mm256_add_epi32(hash[1], b);
+    hash[2] = _mm256_add_epi32(hash[2], c);
+    hash[3] = _mm256_add_epi32(hash[3], d);
+    hash[4] = _mm256_add_epi32(hash[4], e);
+    hash[5] = _mm256_add_epi32(hash[5], f);
+    hash[6] = _mm256_add_epi32(hash[6], g);
+    hash[7] = _mm256_add_epi32(hash[7], h);
+  }
+
+  /// hash eight messages of identical length in parallel
+  __attribute__((target("avx2")))
+  void hashX8(const uint8_t* const data[8], size_t numBytes, unsigned char (*hashes)[SHA256::HashBytes])
+  {
+    static const uint32_t initialHash[8] = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    __m256i hash[8];
+    for (int i = 0; i < 8; i++)
+      hash[i] = _mm256_set1_epi32((int)initialHash[i]);
+
+    const size_t fullBlocks = numBytes / SHA256::BlockSize;
+    const uint8_t* blocks[8];
+    for (size_t block = 0; block < fullBlocks; block++)
+    {
+      for (int lane = 0; lane < 8; lane++)
+        blocks[lane] = data[lane] + block * SHA256::BlockSize;
+      processBlockX8(hash, blocks);
+    }
+
+    // all lanes share the same length, hence the same padding layout
+    const size_t remaining = numBytes % SHA256::BlockSize;
+    const size_t tailBlocks = (remaining + 9 <= SHA256::BlockSize) ? 1 : 2;
+    uint8_t tails[8][2 * SHA256::BlockSize];
+    const uint64_t numBits = 8 * (uint64_t)numBytes;
+    for (int lane = 0; lane < 8; lane++)
+    {
+      uint8_t* tail = tails[lane];
+      memcpy(tail, data[lane] + fullBlocks * SHA256::BlockSize, remaining);
+      tail[remaining] = 0x80;
+      memset(tail + remaining + 1, 0, tailBlocks * SHA256::BlockSize - remaining - 1);
+      storeBigEndian(tail + tailBlocks * SHA256::BlockSize - 8, (uint32_t)(numBits >> 32));
+      storeBigEndian(tail + tailBlocks * SHA256::BlockSize - 4, (uint32_t)numBits);
+    }
+
+    for (size_t block = 0; block < tailBlocks; block++)
+    {
+      for (int lane = 0; lane < 8; lane++)
+        blocks[lane] = tails[lane] + block * SHA256::BlockSize;
+      processBlockX8(hash, blocks);
+    }
+
+    alignas(32) uint32_t lanes[8];
+    for (int i = 0; i < 8; i++)
+    {
+      _mm256_store_si256((__m256i*)lanes, hash[i]);
+      for (int lane = 0; lane < 8; lane++)
+        storeBigEndian(hashes[lane] + 4 * i, lanes[lane]);
+    }
+  }
+#endif // SHA256_X86
+}
+
+/// process one or more 64 byte blocks
+void SHA256::processBlocks(const void* data, size_t numBlocks)
+{
+#ifdef SHA256_X86
+  if (cpuFeatures().shaNi)
+  {
+    processBlocksShaNi(m_hash, (const uint8_t*)data, numBlocks);
+    return;
+  }
+#endif
+  processBlocksGeneric(m_hash, (const uint8_t*)data, numBlocks);
+}
+
+/// add arbitrary number of bytes
+void SHA256::add(const void* data, size_t numBytes)
+{
+  const uint8_t* current = (const uint8_t*)data;
+
+  if (m_bufferSize > 0)
+  {
+    while (numBytes > 0 && m_bufferSize < BlockSize)
+    {
+      m_buffer[m_bufferSize++] = *current++;
+      numBytes--;
+    }
+  }
+
+  // full buffer
+  if (m_bufferSize == BlockSize)
+  {
+    processBlocks(m_buffer, 1);
+    m_numBytes += BlockSize;
+    m_bufferSize = 0;
+  }
+
+  // no more data ?
+  if (numBytes == 0)
+    return;
+
+  // process full blocks in one go, lets the SHA-NI path keep its state in registers
+  const size_t numBlocks = numBytes / BlockSize;
+  if (numBlocks > 0)
+  {
+    processBlocks(current, numBlocks);
+    current += numBlocks * BlockSize;
+    m_numBytes += numBlocks * BlockSize;
+    numBytes -= numBlocks * BlockSize;
+  }
+
+  // keep remaining bytes in buffer
+  while (numBytes > 0)
+  {
+    m_buffer[m_bufferSize++] = *current++;
+    numBytes--;
+  }
+}
+
+/// process final block, less than 64 bytes
+void SHA256::processBuffer()
+{
+  // same padding as SHA1: "1" bit, zeros up to 448 mod 512 bits, 64 bit big endian length
+  uint8_t tail[2 * BlockSize];
+  memcpy(tail, m_buffer, m_bufferSize);
+  tail[m_bufferSize] = 0x80;
+
+  const size_t tailBlocks = (m_bufferSize + 9 <= BlockSize) ? 1 : 2;
+  memset(tail + m_bufferSize + 1, 0, tailBlocks * BlockSize - m_bufferSize - 1);
+
+  const uint64_t msgBits = 8 * (m_numBytes + m_bufferSize);
+  storeBigEndian(tail + tailBlocks * BlockSize - 8, (uint32_t)(msgBits >> 32));
+  storeBigEndian(tail + tailBlocks * BlockSize - 4, (uint32_t)msgBits);
+
+  processBlocks(tail, tailBlocks);
+}
+
+/// return latest hash as 64 hex characters
+std::string SHA256::getHash()
+{
+  // compute hash (as raw bytes)
+  unsigned char rawHash[HashBytes];
+  getHash(rawHash);
+
+  // convert to hex string
+  std::string result;
+  result.reserve(2 * HashBytes);
+  for (int i = 0; i < HashBytes; i++)
+  {
+    static const char dec2hex[16 + 1] = "0123456789abcdef";
+    result += dec2hex[(rawHash[i] >> 4) & 15];
+    result += dec2hex[rawHash[i] & 15];
+  }
+
+  return result;
+}
+
+/// return latest hash as bytes
+void SHA256::getHash(unsigned char buffer[SHA256::HashBytes])
+{
+  // save old hash if buffer is partially filled
+  uint32_t oldHash[HashValues];
+  for (int i = 0; i < HashValues; i++)
+    oldHash[i] = m_hash[i];
+
+  // process remaining bytes
+  processBuffer();
+
+  for (int i = 0; i < HashValues; i++)
+  {
+    storeBigEndian(buffer + 4 * i, m_hash[i]);
+
+    // restore old hash
+    m_hash[i] = oldHash[i];
+  }
+}
+
+/// compute SHA256 of a memory block
+std::string SHA256::operator()(const void* data, size_t numBytes)
+{
+  reset();
+  add(data, numBytes);
+  return getHash();
+}
+
+/// compute SHA256 of a string, excluding final zero
+std::string SHA256::operator()(const std::string& text)
+{
+  reset();
+  add(text.c_str(), text.size());
+  return getHash();
+}
+
+/// hash count messages of numBytes each, uses the widest available code path
+void SHA256::hashMany(const void* const* data, size_t count, size_t numBytes,
+                      unsigned char (*hashes)[HashBytes])
+{
+  size_t i = 0;
+
+#ifdef SHA256_X86
+  // SHA-NI beats eight AVX2 lanes, only go wide without it
+  if (!cpuFeatures().shaNi && cpuFeatures().avx2)
+    for (; i + 8 <= count; i += 8)
+      hashX8((const uint8_t* const*)data + i, numBytes, hashes + i);
+#endif
+
+  SHA256 sha256;
+  for (; i < count; i++)
+  {
+    sha256.reset();
+    sha256.add(data[i], numBytes);
+    sha256.getHash(hashes[i]);
+  }
+}
+
+/// name of the code path picked for this CPU ("sha-ni", "avx2" or "generic")
+const char* SHA256::implementation()
+{
+#ifdef SHA256_X86
+  if (cpuFeatures().shaNi)
+    return "sha-ni";
+  if (cpuFeatures().avx2)
+    return "avx2";
+#endif
+  return "generic";
+}
@@ -0,0 +1,79 @@
+// //////////////////////////////////////////////////////////
+// sha256.hpp
+// SHA-256 with the same interface as sha1.hpp, plus SHA-NI and
+// AVX2 (8 messages at once) code paths selected at runtime
+//
+
+#pragma once
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// compute SHA256 hash
+/** Usage:
+    SHA256 sha256;
+    std::string myHash  = sha256("Hello World");     // std::string
+    std::string myHash2 = sha256("How are you", 11); // arbitrary data, 11 bytes
+
+    // or in a streaming fashion:
+
+    SHA256 sha256;
+    while (more data available)
+      sha256.add(pointer to fresh data, number of new bytes);
+    std::string myHash3 = sha256.getHash();
+
+    // or many equally sized messages at once (merkle tree layers):
+
+    SHA256::hashMany(pointers, count, numBytes, hashes);
+  */
+class SHA256
+{
+public:
+  /// split into 64 byte blocks (=> 512 bits), hash is 32 bytes long
+  enum { BlockSize = 512 / 8, HashBytes = 32 };
+
+  /// same as reset()
+  SHA256();
+
+  /// compute SHA256 of a memory block
+  std::string operator()(const void* data, size_t numBytes);
+  /// compute SHA256 of a string, excluding final zero
+  std::string operator()(const std::string& text);
+
+  /// add arbitrary number of bytes
+  void add(const void* data, size_t numBytes);
+
+  /// return latest hash as 64 hex characters
+  std::string getHash();
+  /// return latest hash as bytes
+  void        getHash(unsigned char buffer[HashBytes]);
+
+  /// restart
+  void reset();
+
+  /// hash count messages of numBytes each, uses the widest available code path
+  static void hashMany(const void* const* data, size_t count, size_t numBytes,
+                       unsigned char (*hashes)[HashBytes]);
+
+  /// name of the code path picked for this CPU ("sha-ni", "avx2" or "generic")
+  static const char* implementation();
+
+private:
+  /// process one or more 64 byte blocks
+  void processBlocks(const void* data, size_t numBlocks);
+  /// process everything left in the internal buffer
+  void processBuffer();
+
+  /// size of processed data in bytes
+  uint64_t m_numBytes;
+  /// valid bytes in m_buffer
+  size_t   m_bufferSize;
+  /// bytes not processed yet
+  uint8_t  m_buffer[BlockSize];
+
+  enum { HashValues = HashBytes / 4 };
+  /// hash, stored as integers
+  uint32_t m_hash[HashValues];
+};
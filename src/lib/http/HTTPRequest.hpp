@@ -12,12 +12,19 @@
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <future>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <system_error>
+#include <thread>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -45,7 +52,7 @@ extern "C" char *_strdup(const char *strSource);
 #  include <fcntl.h>
 #  include <netinet/in.h>
 #  include <netdb.h>
-#  include <sys/select.h>
+#  include <poll.h>
 #  include <sys/socket.h>
 #  include <sys/types.h>
 #  include <unistd.h>
@@ -70,7 +77,8 @@ namespace http
     enum class InternetProtocol: std::uint8_t
     {
         v4,
-        v6
+        v6,
+        any // both families, connections race across all addresses
     };
 
     struct Uri final
@@ -178,6 +186,18 @@ namespace http
         std::vector<std::uint8_t> body;
     };
 
+    // one resolved socket address, copyable unlike addrinfo lists
+    struct Address final
+    {
+        sockaddr_storage storage;
+        socklen_t length;
+
+        int family() const noexcept { return storage.ss_family; }
+    };
+
+    // receives body bytes as they arrive, chunked framing already removed; Response::body stays empty
+    using BodySink = std::function<void(const std::uint8_t* data, std::size_t size)>;
+
     inline namespace detail
     {
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -344,6 +364,7 @@ namespace http
         {
             return (internetProtocol == InternetProtocol::v4) ? AF_INET :
                 (internetProtocol == InternetProtocol::v6) ? AF_INET6 :
+                (internetProtocol == InternetProtocol::any) ? AF_UNSPEC :
                 throw RequestError{"Unsupported protocol"};
         }
 
@@ -359,7 +380,12 @@ namespace http
 #endif // defined(_WIN32) || defined(__CYGWIN__)
 
             explicit Socket(const InternetProtocol internetProtocol):
-                endpoint{socket(getAddressFamily(internetProtocol), SOCK_STREAM, IPPROTO_TCP)}
+                Socket{getAddressFamily(internetProtocol)}
+            {
+            }
+
+            explicit Socket(const int addressFamily):
+                endpoint{socket(addressFamily, SOCK_STREAM, IPPROTO_TCP)}
             {
                 if (endpoint == invalid)
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -420,6 +446,16 @@ namespace http
 
             void connect(const struct sockaddr* address, const socklen_t addressSize, const std::int64_t timeout)
             {
+                if (!startConnect(address, addressSize))
+                {
+                    poll(PollType::write, timeout);
+                    finishConnect();
+                }
+            }
+
+            // returns false while the connection is still being established, wait for writability and call finishConnect
+            bool startConnect(const struct sockaddr* address, const socklen_t addressSize)
+            {
 #if defined(_WIN32) || defined(__CYGWIN__)
                 auto result = ::connect(endpoint, address, addressSize);
                 while (result == -1 && WSAGetLastError() == WSAEINTR)
@@ -428,22 +464,9 @@ namespace http
                 if (result == -1)
                 {
                     if (WSAGetLastError() == WSAEWOULDBLOCK)
-                    {
-                        select(SelectType::write, timeout);
+                        return false;
 
-                        char socketErrorPointer[sizeof(int)];
-                        socklen_t optionLength = sizeof(socketErrorPointer);
-                        if (getsockopt(endpoint, SOL_SOCKET, SO_ERROR, socketErrorPointer, &optionLength) == SOCKET_ERROR)
-                            throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to get socket option"};
-
-                        int socketError;
-                        std::memcpy(&socketError, socketErrorPointer, sizeof(socketErrorPointer));
-
-                        if (socketError != 0)
-                            throw std::system_error{socketError, winsock::errorCategory, "Failed to connect"};
-                    }
-                    else
-                        throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to connect"};
+                    throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to connect"};
                 }
 #else
                 auto result = ::connect(endpoint, address, addressSize);
@@ -453,132 +476,156 @@ namespace http
                 if (result == -1)
                 {
                     if (errno == EINPROGRESS)
-                    {
-                        select(SelectType::write, timeout);
-
-                        int socketError;
-                        socklen_t optionLength = sizeof(socketError);
-                        if (getsockopt(endpoint, SOL_SOCKET, SO_ERROR, &socketError, &optionLength) == -1)
-                            throw std::system_error{errno, std::system_category(), "Failed to get socket option"};
+                        return false;
 
-                        if (socketError != 0)
-                            throw std::system_error{socketError, std::system_category(), "Failed to connect"};
-                    }
-                    else
-                        throw std::system_error{errno, std::system_category(), "Failed to connect"};
+                    throw std::system_error{errno, std::system_category(), "Failed to connect"};
                 }
 #endif // defined(_WIN32) || defined(__CYGWIN__)
+
+                return true;
             }
 
-            std::size_t send(const void* buffer, const std::size_t length, const std::int64_t timeout)
+            void finishConnect()
             {
-                select(SelectType::write, timeout);
 #if defined(_WIN32) || defined(__CYGWIN__)
-                auto result = ::send(endpoint, reinterpret_cast<const char*>(buffer),
-                                     static_cast<int>(length), 0);
+                char socketErrorPointer[sizeof(int)];
+                socklen_t optionLength = sizeof(socketErrorPointer);
+                if (getsockopt(endpoint, SOL_SOCKET, SO_ERROR, socketErrorPointer, &optionLength) == SOCKET_ERROR)
+                    throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to get socket option"};
 
-                while (result == SOCKET_ERROR && WSAGetLastError() == WSAEINTR)
-                    result = ::send(endpoint, reinterpret_cast<const char*>(buffer),
-                                    static_cast<int>(length), 0);
+                int socketError;
+                std::memcpy(&socketError, socketErrorPointer, sizeof(socketErrorPointer));
 
-                if (result == SOCKET_ERROR)
-                    throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to send data"};
+                if (socketError != 0)
+                    throw std::system_error{socketError, winsock::errorCategory, "Failed to connect"};
 #else
-                auto result = ::send(endpoint, reinterpret_cast<const char*>(buffer),
-                                     length, noSignal);
+                int socketError;
+                socklen_t optionLength = sizeof(socketError);
+                if (getsockopt(endpoint, SOL_SOCKET, SO_ERROR, &socketError, &optionLength) == -1)
+                    throw std::system_error{errno, std::system_category(), "Failed to get socket option"};
 
-                while (result == -1 && errno == EINTR)
-                    result = ::send(endpoint, reinterpret_cast<const char*>(buffer),
-                                    length, noSignal);
+                if (socketError != 0)
+                    throw std::system_error{socketError, std::system_category(), "Failed to connect"};
+#endif // defined(_WIN32) || defined(__CYGWIN__)
+            }
 
-                if (result == -1)
-                    throw std::system_error{errno, std::system_category(), "Failed to send data"};
+            // the socket is non-blocking, so poll only when the kernel buffer is full
+            std::size_t send(const void* buffer, const std::size_t length, const std::int64_t timeout)
+            {
+#if defined(_WIN32) || defined(__CYGWIN__)
+                for (;;)
+                {
+                    const auto result = ::send(endpoint, reinterpret_cast<const char*>(buffer),
+                                               static_cast<int>(length), 0);
+                    if (result != SOCKET_ERROR)
+                        return static_cast<std::size_t>(result);
+
+                    if (WSAGetLastError() == WSAEWOULDBLOCK)
+                        poll(PollType::write, timeout);
+                    else if (WSAGetLastError() != WSAEINTR)
+                        throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to send data"};
+                }
+#else
+                for (;;)
+                {
+                    const auto result = ::send(endpoint, reinterpret_cast<const char*>(buffer),
+                                               length, noSignal);
+                    if (result != -1)
+                        return static_cast<std::size_t>(result);
+
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        poll(PollType::write, timeout);
+                    else if (errno != EINTR)
+                        throw std::system_error{errno, std::system_category(), "Failed to send data"};
+                }
 #endif // defined(_WIN32) || defined(__CYGWIN__)
-                return static_cast<std::size_t>(result);
             }
 
+            // same as send, data that is already buffered costs a single syscall
             std::size_t recv(void* buffer, const std::size_t length, const std::int64_t timeout)
             {
-                select(SelectType::read, timeout);
 #if defined(_WIN32) || defined(__CYGWIN__)
-                auto result = ::recv(endpoint, reinterpret_cast<char*>(buffer),
-                                     static_cast<int>(length), 0);
-
-                while (result == SOCKET_ERROR && WSAGetLastError() == WSAEINTR)
-                    result = ::recv(endpoint, reinterpret_cast<char*>(buffer),
-                                    static_cast<int>(length), 0);
+                for (;;)
+                {
+                    const auto result = ::recv(endpoint, reinterpret_cast<char*>(buffer),
+                                               static_cast<int>(length), 0);
+                    if (result != SOCKET_ERROR)
+                        return static_cast<std::size_t>(result);
 
-                if (result == SOCKET_ERROR)
-                    throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to read data"};
+                    if (WSAGetLastError() == WSAEWOULDBLOCK)
+                        poll(PollType::read, timeout);
+                    else if (WSAGetLastError() != WSAEINTR)
+                        throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to read data"};
+                }
 #else
-                auto result = ::recv(endpoint, reinterpret_cast<char*>(buffer),
-                                     length, noSignal);
-
-                while (result == -1 && errno == EINTR)
-                    result = ::recv(endpoint, reinterpret_cast<char*>(buffer),
-                                    length, noSignal);
+                for (;;)
+                {
+                    const auto result = ::recv(endpoint, reinterpret_cast<char*>(buffer),
+                                               length, noSignal);
+                    if (result != -1)
+                        return static_cast<std::size_t>(result);
+
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        poll(PollType::read, timeout);
+                    else if (errno != EINTR)
+                        throw std::system_error{errno, std::system_category(), "Failed to read data"};
+                }
+#endif // defined(_WIN32) || defined(__CYGWIN__)
+            }
 
-                if (result == -1)
-                    throw std::system_error{errno, std::system_category(), "Failed to read data"};
+            // an idle keep-alive connection is only reusable if the peer neither closed it nor sent anything
+            bool isIdle() noexcept
+            {
+                char byte;
+#if defined(_WIN32) || defined(__CYGWIN__)
+                const auto result = ::recv(endpoint, &byte, 1, MSG_PEEK);
+                return result == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+                const auto result = ::recv(endpoint, &byte, 1, MSG_PEEK | noSignal);
+                return result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
 #endif // defined(_WIN32) || defined(__CYGWIN__)
-                return static_cast<std::size_t>(result);
+            }
+
+            // the raw descriptor, for registering the socket with an event loop
+            Type native() const noexcept
+            {
+                return endpoint;
             }
 
         private:
-            enum class SelectType
+            enum class PollType
             {
                 read,
                 write
             };
 
-            void select(const SelectType type, const std::int64_t timeout)
+            // unlike select, poll has no FD_SETSIZE limit on the descriptor value
+            void poll(const PollType type, const std::int64_t timeout)
             {
-                fd_set descriptorSet;
-                FD_ZERO(&descriptorSet);
-                FD_SET(endpoint, &descriptorSet);
-
 #if defined(_WIN32) || defined(__CYGWIN__)
-                TIMEVAL selectTimeout{
-                    static_cast<LONG>(timeout / 1000),
-                    static_cast<LONG>((timeout % 1000) * 1000)
-                };
-                auto count = ::select(0,
-                                      (type == SelectType::read) ? &descriptorSet : nullptr,
-                                      (type == SelectType::write) ? &descriptorSet : nullptr,
-                                      nullptr,
-                                      (timeout >= 0) ? &selectTimeout : nullptr);
+                WSAPOLLFD descriptor{};
+                descriptor.fd = endpoint;
+                descriptor.events = (type == PollType::read) ? POLLRDNORM : POLLWRNORM;
 
+                auto count = WSAPoll(&descriptor, 1, (timeout >= 0) ? static_cast<INT>(timeout) : -1);
                 while (count == SOCKET_ERROR && WSAGetLastError() == WSAEINTR)
-                    count = ::select(0,
-                                     (type == SelectType::read) ? &descriptorSet : nullptr,
-                                     (type == SelectType::write) ? &descriptorSet : nullptr,
-                                     nullptr,
-                                     (timeout >= 0) ? &selectTimeout : nullptr);
+                    count = WSAPoll(&descriptor, 1, (timeout >= 0) ? static_cast<INT>(timeout) : -1);
 
                 if (count == SOCKET_ERROR)
-                    throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to select socket"};
+                    throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to poll socket"};
                 else if (count == 0)
                     throw ResponseError{"Request timed out"};
 #else
-                timeval selectTimeout{
-                    static_cast<time_t>(timeout / 1000),
-                    static_cast<suseconds_t>((timeout % 1000) * 1000)
-                };
-                auto count = ::select(endpoint + 1,
-                                      (type == SelectType::read) ? &descriptorSet : nullptr,
-                                      (type == SelectType::write) ? &descriptorSet : nullptr,
-                                      nullptr,
-                                      (timeout >= 0) ? &selectTimeout : nullptr);
+                pollfd descriptor{};
+                descriptor.fd = endpoint;
+                descriptor.events = (type == PollType::read) ? POLLIN : POLLOUT;
 
+                auto count = ::poll(&descriptor, 1, (timeout >= 0) ? static_cast<int>(timeout) : -1);
                 while (count == -1 && errno == EINTR)
-                    count = ::select(endpoint + 1,
-                                     (type == SelectType::read) ? &descriptorSet : nullptr,
-                                     (type == SelectType::write) ? &descriptorSet : nullptr,
-                                     nullptr,
-                                     (timeout >= 0) ? &selectTimeout : nullptr);
+                    count = ::poll(&descriptor, 1, (timeout >= 0) ? static_cast<int>(timeout) : -1);
 
                 if (count == -1)
-                    throw std::system_error{errno, std::system_category(), "Failed to select socket"};
+                    throw std::system_error{errno, std::system_category(), "Failed to poll socket"};
                 else if (count == 0)
                     throw ResponseError{"Request timed out"};
 #endif // defined(_WIN32) || defined(__CYGWIN__)
@@ -602,6 +649,154 @@ namespace http
             Type endpoint = invalid;
         };
 
+        // blocking getaddrinfo, copied out of the addrinfo list
+        inline std::vector<Address> lookupAddresses(const std::string& host, const std::string& port, const int family)
+        {
+            addrinfo hints = {};
+            hints.ai_family = family;
+            hints.ai_socktype = SOCK_STREAM;
+
+            addrinfo* info;
+            if (getaddrinfo(host.c_str(), port.c_str(), &hints, &info) != 0)
+#if defined(_WIN32) || defined(__CYGWIN__)
+                throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to get address info of " + host};
+#else
+                throw std::system_error{errno, std::system_category(), "Failed to get address info of " + host};
+#endif // defined(_WIN32) || defined(__CYGWIN__)
+
+            const std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> addressInfo{info, freeaddrinfo};
+
+            std::vector<Address> result;
+            for (auto i = addressInfo.get(); i; i = i->ai_next)
+            {
+                Address address{};
+                std::memcpy(&address.storage, i->ai_addr, i->ai_addrlen);
+                address.length = static_cast<socklen_t>(i->ai_addrlen);
+                result.push_back(address);
+            }
+
+            return result;
+        }
+
+        // RFC 8305 Happy Eyeballs: families alternate, a new attempt starts every attemptDelay or as soon as
+        // the previous one fails, and the first established connection wins
+        inline Socket connectAddresses(const std::vector<Address>& addresses,
+                                       const std::int64_t timeout,
+                                       const std::chrono::milliseconds attemptDelay = std::chrono::milliseconds{250})
+        {
+            if (addresses.empty())
+                throw RequestError{"No addresses to connect to"};
+
+            // interleave the families, starting with the one getaddrinfo sorted first
+            std::vector<const Address*> preferred;
+            std::vector<const Address*> other;
+            for (const auto& address : addresses)
+                (address.family() == addresses.front().family() ? preferred : other).push_back(&address);
+
+            std::vector<const Address*> order;
+            for (std::size_t i = 0; i < preferred.size() || i < other.size(); ++i)
+            {
+                if (i < preferred.size()) order.push_back(preferred[i]);
+                if (i < other.size()) order.push_back(other[i]);
+            }
+
+            const auto stopTime = std::chrono::steady_clock::now() + std::chrono::milliseconds{timeout};
+            auto nextAttemptTime = std::chrono::steady_clock::now();
+            std::size_t next = 0;
+            std::vector<Socket> attempts;
+            std::exception_ptr lastError;
+
+            for (;;)
+            {
+                const auto now = std::chrono::steady_clock::now();
+
+                if (next < order.size() && (attempts.empty() || now >= nextAttemptTime))
+                {
+                    const auto& address = *order[next++];
+                    nextAttemptTime = now + attemptDelay;
+                    try
+                    {
+                        Socket socket{address.family()};
+                        if (socket.startConnect(reinterpret_cast<const sockaddr*>(&address.storage), address.length))
+                            return socket;
+                        attempts.push_back(std::move(socket));
+                    }
+                    catch (...)
+                    {
+                        lastError = std::current_exception();
+                    }
+                    continue;
+                }
+
+                if (attempts.empty())
+                    std::rethrow_exception(lastError);
+
+                if (timeout >= 0 && now >= stopTime)
+                    throw ResponseError{"Request timed out"};
+
+                auto wait = (timeout >= 0) ?
+                    std::chrono::duration_cast<std::chrono::milliseconds>(stopTime - now).count() : std::int64_t{-1};
+                if (next < order.size())
+                {
+                    const auto untilNextAttempt = std::chrono::duration_cast<std::chrono::milliseconds>(nextAttemptTime - now).count();
+                    wait = (wait < 0) ? untilNextAttempt : (std::min)(wait, untilNextAttempt);
+                }
+
+#if defined(_WIN32) || defined(__CYGWIN__)
+                std::vector<WSAPOLLFD> descriptors(attempts.size());
+                for (std::size_t i = 0; i < attempts.size(); ++i)
+                {
+                    descriptors[i].fd = attempts[i].native();
+                    descriptors[i].events = POLLWRNORM;
+                }
+
+                auto count = WSAPoll(descriptors.data(), static_cast<ULONG>(descriptors.size()), static_cast<INT>(wait));
+                while (count == SOCKET_ERROR && WSAGetLastError() == WSAEINTR)
+                    count = WSAPoll(descriptors.data(), static_cast<ULONG>(descriptors.size()), static_cast<INT>(wait));
+
+                if (count == SOCKET_ERROR)
+                    throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to poll socket"};
+#else
+                std::vector<pollfd> descriptors(attempts.size());
+                for (std::size_t i = 0; i < attempts.size(); ++i)
+                {
+                    descriptors[i].fd = attempts[i].native();
+                    descriptors[i].events = POLLOUT;
+                }
+
+                auto count = ::poll(descriptors.data(), descriptors.size(), static_cast<int>(wait));
+                while (count == -1 && errno == EINTR)
+                    count = ::poll(descriptors.data(), descriptors.size(), static_cast<int>(wait));
+
+                if (count == -1)
+                    throw std::system_error{errno, std::system_category(), "Failed to poll socket"};
+#endif // defined(_WIN32) || defined(__CYGWIN__)
+
+                std::size_t pending = 0;
+                for (std::size_t i = 0; i < attempts.size(); ++i)
+                {
+                    if (descriptors[i].revents == 0)
+                    {
+                        attempts[pending++] = std::move(attempts[i]);
+                        continue;
+                    }
+
+                    try
+                    {
+                        attempts[i].finishConnect();
+                        return std::move(attempts[i]);
+                    }
+                    catch (...)
+                    {
+                        // a failed attempt makes room for the next address right away
+                        lastError = std::current_exception();
+                        nextAttemptTime = now;
+                    }
+                }
+                attempts.erase(attempts.begin() + static_cast<std::ptrdiff_t>(pending), attempts.end());
+            }
+        }
+
         inline char toLower(const char c) noexcept
         {
             return (c >= 'A' && c <= 'Z') ? c - ('A' - 'a') : c;
@@ -986,7 +1181,12 @@ namespace http
         {
             T result = 0;
             for (auto i = begin; i != end; ++i)
-                result = T(10U) * result + digitToUint<T>(*i);
+            {
+                const T digit = digitToUint<T>(*i);
+                if (result > (std::numeric_limits<T>::max() - digit) / T(10U))
+                    throw ResponseError{"Number out of range"};
+                result = T(10U) * result + digit;
+            }
 
             return result;
         }
@@ -996,7 +1196,12 @@ namespace http
         {
             T result = 0;
             for (auto i = begin; i != end; ++i)
-                result = T(16U) * result + hexDigitToUint<T>(*i);
+            {
+                const T digit = hexDigitToUint<T>(*i);
+                if (result > (std::numeric_limits<T>::max() - digit) / T(16U))
+                    throw ResponseError{"Number out of range"};
+                result = T(16U) * result + digit;
+            }
 
             return result;
         }
@@ -1112,16 +1317,607 @@ namespace http
         }
     }
 
+    // Incremental HTTP/1.1 response parser: every byte is looked at once, body bytes go straight into the body
+    class ResponseParser final
+    {
+    public:
+        explicit ResponseParser(const std::string& method = "GET", BodySink sink = {}):
+            headRequest{method == "HEAD"},
+            bodySink{std::move(sink)}
+        {
+        }
+
+        // consumes the next bytes read from the connection, returns true once the response is complete
+        bool feed(const std::uint8_t* data, const std::size_t size)
+        {
+            if (size > 0) started = true;
+
+            auto i = data;
+            const auto end = data + size;
+
+            while (i != end && state != State::complete)
+            {
+                switch (state)
+                {
+                    case State::head:
+                        i = parseHead(i, end);
+                        break;
+
+                    case State::body:
+                    case State::chunkData:
+                    {
+                        const auto toWrite = (std::min)(remaining, static_cast<std::size_t>(end - i));
+                        deliver(i, toWrite);
+                        i += toWrite;
+                        remaining -= toWrite;
+
+                        if (remaining == 0)
+                            state = (state == State::body) ? State::complete : State::chunkDataEnd;
+                        break;
+                    }
+
+                    case State::bodyUntilClose:
+                        deliver(i, static_cast<std::size_t>(end - i));
+                        i = end;
+                        break;
+
+                    // RFC 7230, 4.1. Chunked Transfer Coding
+                    case State::chunkSize:
+                    {
+                        i = readLine(i, end);
+                        if (!lineComplete) break;
+
+                        // RFC 7230, 4.1.1. Chunk Extensions are ignored
+                        const auto sizeEnd = std::find(line.begin(), line.end(), ';');
+                        remaining = hexStringToUint<std::size_t>(line.begin(), sizeEnd);
+                        state = (remaining == 0) ? State::trailer : State::chunkData;
+                        break;
+                    }
+
+                    case State::chunkDataEnd:
+                        i = readLine(i, end);
+                        if (!lineComplete) break;
+
+                        if (!line.empty())
+                            throw ResponseError{"Invalid chunk"};
+
+                        state = State::chunkSize;
+                        break;
+
+                    // RFC 7230, 4.1.2. Chunked Trailer Part, ends with an empty line
+                    case State::trailer:
+                        i = readLine(i, end);
+                        if (lineComplete && line.empty())
+                            state = State::complete;
+                        break;
+
+                    case State::complete:
+                        break;
+                }
+            }
+
+            // anything after the response means the connection is out of sync
+            if (state == State::complete && i != end)
+                persistent = false;
+
+            return state == State::complete;
+        }
+
+        // the server closed the connection, only a body without length or chunks may end like this
+        bool finish() noexcept
+        {
+            if (state == State::bodyUntilClose)
+                state = State::complete;
+
+            persistent = false;
+            return state == State::complete;
+        }
+
+        bool complete() const noexcept { return state == State::complete; }
+
+        // true once any byte of the response arrived
+        bool hasStarted() const noexcept { return started; }
+
+        // only framed responses of a persistent connection (RFC 7230, 6.3) leave it reusable
+        bool keepAlive() const noexcept { return state == State::complete && persistent; }
+
+        Response& response() noexcept { return result; }
+
+    private:
+        enum class State
+        {
+            head,
+            body,
+            bodyUntilClose,
+            chunkSize,
+            chunkData,
+            chunkDataEnd,
+            trailer,
+            complete
+        };
+
+        static constexpr std::size_t maxLineLength = 64 * 1024;
+        static constexpr std::size_t maxBodyReserve = 1024 * 1024; // beyond it the body grows as data arrives
+
+        void deliver(const std::uint8_t* data, const std::size_t size)
+        {
+            if (size == 0) return;
+
+            if (bodySink)
+                bodySink(data, size);
+            else
+                result.body.insert(result.body.end(), data, data + size);
+        }
+
+        // collects one CRLF terminated line into `line` without the CRLF, across reads if needed
+        const std::uint8_t* readLine(const std::uint8_t* begin, const std::uint8_t* end)
+        {
+            if (lineComplete)
+            {
+                line.clear();
+                lineComplete = false;
+            }
+
+            const auto newLine = static_cast<const std::uint8_t*>(std::memchr(begin, '\n', static_cast<std::size_t>(end - begin)));
+            const auto lineEnd = newLine ? newLine : end;
+            line.append(begin, lineEnd);
+
+            if (line.size() > maxLineLength)
+                throw ResponseError{"Line too long"};
+
+            if (!newLine) return end;
+
+            if (line.empty() || line.back() != '\r')
+                throw ResponseError{"Invalid line ending"};
+
+            line.pop_back();
+            lineComplete = true;
+            return newLine + 1;
+        }
+
+        // buffers only the header section, the search resumes where the previous read left off
+        const std::uint8_t* parseHead(const std::uint8_t* begin, const std::uint8_t* end)
+        {
+            constexpr std::array<std::uint8_t, 4> headerEnd = {'\r', '\n', '\r', '\n'};
+
+            const auto previousSize = header.size();
+            header.insert(header.end(), begin, end);
+
+            // RFC 7230, 3. Message Format
+            // Empty line indicates the end of the header section (RFC 7230, 2.1. Client/Server Messaging)
+            const auto searchBegin = header.cbegin() + static_cast<std::ptrdiff_t>(headerSearchOffset);
+            const auto endIterator = std::search(searchBegin, header.cend(), headerEnd.cbegin(), headerEnd.cend());
+            if (endIterator == header.cend())
+            {
+                headerSearchOffset = (header.size() >= headerEnd.size() - 1) ? header.size() - (headerEnd.size() - 1) : 0;
+                return end;
+            }
+
+            const auto headerEndIterator = endIterator + 2;
+            auto statusLineResult = parseStatusLine(header.cbegin(), headerEndIterator);
+            auto i = statusLineResult.first;
+            result.status = std::move(statusLineResult.second);
+
+            bool chunked = false;
+            bool contentLengthReceived = false;
+            std::size_t contentLength = 0U;
+            bool connectionClose = false;
+            bool connectionKeepAlive = false;
+
+            while (i != headerEndIterator)
+            {
+                auto headerFieldResult = parseHeaderField(i, headerEndIterator);
+                i = headerFieldResult.first;
+
+                auto fieldName = std::move(headerFieldResult.second.first);
+                auto fieldValue = std::move(headerFieldResult.second.second);
+
+                if (fieldName == "transfer-encoding")
+                {
+                    // RFC 7230, 3.3.1. Transfer-Encoding
+                    if (fieldValue == "chunked")
+                        chunked = true;
+                    else
+                        throw ResponseError{"Unsupported transfer encoding: " + fieldValue};
+                }
+                else if (fieldName == "content-length")
+                {
+                    // RFC 7230, 3.3.2. Content-Length
+                    contentLength = stringToUint<std::size_t>(fieldValue.cbegin(), fieldValue.cend());
+                    contentLengthReceived = true;
+                }
+                else if (fieldName == "connection")
+                {
+                    // RFC 7230, 6.1. Connection
+                    const auto value = toLower(fieldValue);
+                    if (value == "close") connectionClose = true;
+                    else if (value == "keep-alive") connectionKeepAlive = true;
+                }
+
+                result.headerFields.push_back({std::move(fieldName), std::move(fieldValue)});
+            }
+
+            const auto bodyOffset = static_cast<std::size_t>(std::distance(header.cbegin(), endIterator)) + headerEnd.size();
+            header.clear();
+            header.shrink_to_fit();
+
+            // RFC 7230, 6.3. Persistence
+            const bool http11 = result.status.version.major > 1 ||
+                (result.status.version.major == 1 && result.status.version.minor >= 1);
+            persistent = !connectionClose && (http11 || connectionKeepAlive);
+
+            // RFC 7230, 3.3.3. Message Body Length
+            if (headRequest ||
+                (result.status.code >= 100 && result.status.code < 200) ||
+                result.status.code == Status::NoContent ||
+                result.status.code == Status::NotModified)
+                state = State::complete;
+            // Content-Length must be ignored if Transfer-Encoding is received (RFC 7230, 3.2. Content-Length)
+            else if (chunked)
+                state = State::chunkSize;
+            else if (contentLengthReceived)
+            {
+                // the announced length is only a hint, a hostile server could name any size
+                if (!bodySink) result.body.reserve(std::min(contentLength, maxBodyReserve));
+                remaining = contentLength;
+                state = (contentLength == 0) ? State::complete : State::body;
+            }
+            else
+            {
+                persistent = false;
+                state = State::bodyUntilClose;
+            }
+
+            return begin + (bodyOffset - previousSize);
+        }
+
+        const bool headRequest;
+        const BodySink bodySink;
+        State state = State::head;
+        Response result;
+        std::vector<std::uint8_t> header;
+        std::size_t headerSearchOffset = 0;
+        std::string line;
+        bool lineComplete = false;
+        std::size_t remaining = 0;
+        bool started = false;
+        bool persistent = false;
+    };
+
+    // Keeps idle keep-alive connections per (host, port) so repeated requests skip the TCP handshake
+    class ConnectionPool final
+    {
+    public:
+        explicit ConnectionPool(const std::chrono::milliseconds idleTimeout = std::chrono::seconds{30},
+                                const std::size_t maxIdlePerHost = 4):
+            idleTimeout{idleTimeout},
+            maxIdlePerHost{maxIdlePerHost}
+        {
+        }
+
+        ConnectionPool(const ConnectionPool&) = delete;
+        ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+        // most recently used connection first, stale ones are dropped on the way
+        std::optional<Socket> acquire(const std::string& host, const std::string& port)
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            evictExpired(std::chrono::steady_clock::now());
+
+            const auto i = connections.find({host, port});
+            if (i == connections.end()) return std::nullopt;
+
+            auto& idle = i->second;
+            while (!idle.empty())
+            {
+                auto socket = std::move(idle.back().socket);
+                idle.pop_back();
+                if (socket.isIdle())
+                {
+                    ++reused;
+                    return socket;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        void release(const std::string& host, const std::string& port, Socket socket)
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            auto& idle = connections[{host, port}];
+            if (idle.size() >= maxIdlePerHost)
+                idle.erase(idle.begin()); // the oldest one is the most likely to be closed by the server
+
+            idle.push_back({std::move(socket), std::chrono::steady_clock::now()});
+        }
+
+        // closes connections idle for longer than the idle timeout
+        void evictIdle()
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            evictExpired(std::chrono::steady_clock::now());
+        }
+
+        std::size_t idleCount() const
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            std::size_t result = 0;
+            for (const auto& connection : connections)
+                result += connection.second.size();
+            return result;
+        }
+
+        std::size_t reuseCount() const
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            return reused;
+        }
+
+    private:
+        struct IdleConnection final
+        {
+            Socket socket;
+            std::chrono::steady_clock::time_point lastUsed;
+        };
+
+        void evictExpired(const std::chrono::steady_clock::time_point now)
+        {
+            for (auto i = connections.begin(); i != connections.end();)
+            {
+                auto& idle = i->second;
+                idle.erase(std::remove_if(idle.begin(), idle.end(), [this, now](const IdleConnection& connection) {
+                    return now - connection.lastUsed >= idleTimeout;
+                }), idle.end());
+
+                if (idle.empty())
+                    i = connections.erase(i);
+                else
+                    ++i;
+            }
+        }
+
+#if defined(_WIN32) || defined(__CYGWIN__)
+        winsock::Api winSock;
+#endif // defined(_WIN32) || defined(__CYGWIN__)
+        const std::chrono::milliseconds idleTimeout;
+        const std::size_t maxIdlePerHost;
+        mutable std::mutex mutex;
+        std::map<std::pair<std::string, std::string>, std::vector<IdleConnection>> connections;
+        std::size_t reused = 0;
+    };
+
+    // Caches host lookups with a TTL (including failures, for a shorter time) and resolves on worker threads
+    class Resolver final
+    {
+    public:
+        using Lookup = std::function<std::vector<Address>(const std::string& host, const std::string& port, int family)>;
+
+        struct Statistics final
+        {
+            std::size_t hits = 0;
+            std::size_t negativeHits = 0;
+            std::size_t misses = 0;
+            std::size_t coalesced = 0; // lookups that joined one already in flight
+
+            double hitRate() const noexcept
+            {
+                const auto total = hits + negativeHits + misses + coalesced;
+                return total ? static_cast<double>(hits + negativeHits + coalesced) / static_cast<double>(total) : 0.0;
+            }
+        };
+
+        // getaddrinfo reports no TTL, so cached entries live for a fixed time; lookup can be replaced by a stub
+        explicit Resolver(const std::chrono::milliseconds ttl = std::chrono::minutes{5},
+                          const std::chrono::milliseconds negativeTtl = std::chrono::seconds{30},
+                          const std::size_t workerCount = 4,
+                          Lookup lookup = lookupAddresses):
+            ttl{ttl},
+            negativeTtl{negativeTtl},
+            lookup{std::move(lookup)}
+        {
+            for (std::size_t i = 0; i < workerCount; ++i)
+                workers.emplace_back([this]() { work(); });
+        }
+
+        ~Resolver()
+        {
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                stopping = true;
+            }
+            jobsChanged.notify_all();
+            for (auto& worker : workers) worker.join();
+        }
+
+        Resolver(const Resolver&) = delete;
+        Resolver& operator=(const Resolver&) = delete;
+
+        std::vector<Address> resolve(const std::string& host, const std::string& port,
+                                     const InternetProtocol protocol = InternetProtocol::any)
+        {
+            return resolveAsync(host, port, protocol).get();
+        }
+
+        // cached answers come back as ready futures, concurrent lookups of the same name share one query
+        std::shared_future<std::vector<Address>> resolveAsync(const std::string& host, const std::string& port,
+                                                              const InternetProtocol protocol = InternetProtocol::any)
+        {
+            const Key key{host, port, getAddressFamily(protocol)};
+            std::unique_lock<std::mutex> lock{mutex};
+
+            const auto now = std::chrono::steady_clock::now();
+            const auto cached = cache.find(key);
+            if (cached != cache.end())
+            {
+                if (now < cached->second.expiry)
+                {
+                    ++(cached->second.error ? statistics.negativeHits : statistics.hits);
+                    return cached->second.result;
+                }
+                cache.erase(cached);
+            }
+
+            const auto pending = inFlight.find(key);
+            if (pending != inFlight.end())
+            {
+                ++statistics.coalesced;
+                return pending->second;
+            }
+
+            ++statistics.misses;
+            auto promise = std::make_shared<std::promise<std::vector<Address>>>();
+            std::shared_future<std::vector<Address>> result = promise->get_future().share();
+            inFlight.emplace(key, result);
+            jobs.push_back({key, std::move(promise)});
+
+            // without workers the lookup runs on the calling thread
+            if (workers.empty())
+                runJob(lock);
+            else
+                jobsChanged.notify_one();
+
+            return result;
+        }
+
+        Statistics getStatistics() const
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            return statistics;
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            cache.clear();
+        }
+
+    private:
+        using Key = std::tuple<std::string, std::string, int>;
+
+        struct Entry final
+        {
+            std::shared_future<std::vector<Address>> result;
+            std::chrono::steady_clock::time_point expiry;
+            bool error;
+        };
+
+        struct Job final
+        {
+            Key key;
+            std::shared_ptr<std::promise<std::vector<Address>>> promise;
+        };
+
+        void work()
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            for (;;)
+            {
+                jobsChanged.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping) return;
+                runJob(lock);
+            }
+        }
+
+        // takes the oldest job, resolves it without holding the lock and publishes the outcome
+        void runJob(std::unique_lock<std::mutex>& lock)
+        {
+            auto job = std::move(jobs.front());
+            jobs.erase(jobs.begin());
+
+            lock.unlock();
+            std::vector<Address> addresses;
+            std::exception_ptr error;
+            try
+            {
+                addresses = lookup(std::get<0>(job.key), std::get<1>(job.key), std::get<2>(job.key));
+                if (addresses.empty())
+                    throw ResponseError{"No addresses for " + std::get<0>(job.key)};
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            lock.lock();
+
+            const auto result = inFlight.at(job.key);
+            inFlight.erase(job.key);
+            const auto now = std::chrono::steady_clock::now();
+            if (now >= nextSweep || cache.size() >= maxEntries)
+                evict(now);
+            cache[job.key] = Entry{result, now + (error ? negativeTtl : ttl), error != nullptr};
+
+            if (error)
+                job.promise->set_exception(error);
+            else
+                job.promise->set_value(std::move(addresses));
+        }
+
+        // drops what has expired, at most once per ttl unless the cache is full; a cache still full after that
+        // loses the entry closest to expiry
+        void evict(const std::chrono::steady_clock::time_point now)
+        {
+            for (auto i = cache.begin(); i != cache.end();)
+                i = now < i->second.expiry ? std::next(i) : cache.erase(i);
+            nextSweep = now + std::min(ttl, negativeTtl);
+
+            if (cache.size() >= maxEntries)
+                cache.erase(std::min_element(cache.begin(), cache.end(), [](const auto& a, const auto& b) {
+                    return a.second.expiry < b.second.expiry;
+                }));
+        }
+
+        static constexpr std::size_t maxEntries = 4096;
+
+#if defined(_WIN32) || defined(__CYGWIN__)
+        winsock::Api winSock;
+#endif // defined(_WIN32) || defined(__CYGWIN__)
+        const std::chrono::milliseconds ttl;
+        const std::chrono::milliseconds negativeTtl;
+        const Lookup lookup;
+        mutable std::mutex mutex;
+        std::condition_variable jobsChanged;
+        std::vector<Job> jobs;
+        std::map<Key, Entry> cache;
+        std::chrono::steady_clock::time_point nextSweep;
+        std::map<Key, std::shared_future<std::vector<Address>>> inFlight;
+        Statistics statistics;
+        bool stopping = false;
+        std::vector<std::thread> workers;
+    };
+
     class Request final
     {
     public:
         explicit Request(const std::string& uriString,
-                         const InternetProtocol protocol = InternetProtocol::v4):
+                         const InternetProtocol protocol = InternetProtocol::any):
             internetProtocol{protocol},
             uri{parseUri(uriString.begin(), uriString.end())}
         {
         }
 
+        // connections are taken from and returned to the pool, which must outlive the request
+        Request(const std::string& uriString,
+                ConnectionPool& pool,
+                const InternetProtocol protocol = InternetProtocol::any):
+            internetProtocol{protocol},
+            uri{parseUri(uriString.begin(), uriString.end())},
+            connectionPool{&pool}
+        {
+        }
+
+        // host names are looked up through the (shared, caching) resolver instead of getaddrinfo on every send
+        Request(const std::string& uriString,
+                ConnectionPool& pool,
+                Resolver& hostResolver,
+                const InternetProtocol protocol = InternetProtocol::any):
+            internetProtocol{protocol},
+            uri{parseUri(uriString.begin(), uriString.end())},
+            connectionPool{&pool},
+            resolver{&hostResolver}
+        {
+        }
+
         Response send(const std::string& method = "GET",
                       const std::string& body = "",
                       const HeaderFields& headerFields = {},
@@ -1137,193 +1933,163 @@ namespace http
                       const std::vector<uint8_t>& body,
                       const HeaderFields& headerFields = {},
                       const std::chrono::milliseconds timeout = std::chrono::milliseconds{-1})
+        {
+            return send(method, body, headerFields, BodySink{}, timeout);
+        }
+
+        // streams the response body into sink instead of collecting it in Response::body
+        Response send(const std::string& method,
+                      const std::string& body,
+                      const HeaderFields& headerFields,
+                      const BodySink& sink,
+                      const std::chrono::milliseconds timeout = std::chrono::milliseconds{-1})
+        {
+            return send(method,
+                        std::vector<uint8_t>(body.begin(), body.end()),
+                        headerFields,
+                        sink,
+                        timeout);
+        }
+
+        Response send(const std::string& method,
+                      const std::vector<uint8_t>& body,
+                      const HeaderFields& headerFields,
+                      const BodySink& sink,
+                      const std::chrono::milliseconds timeout = std::chrono::milliseconds{-1})
         {
             const auto stopTime = std::chrono::steady_clock::now() + timeout;
 
             if (uri.scheme != "http")
                 throw RequestError{"Only HTTP scheme is supported"};
 
-            addrinfo hints = {};
-            hints.ai_family = getAddressFamily(internetProtocol);
-            hints.ai_socktype = SOCK_STREAM;
+            const std::string port = uri.port.empty() ? "80" : uri.port;
+            const auto requestData = encodeHtml(uri, method, body, headerFields);
 
-            const char* port = uri.port.empty() ? "80" : uri.port.c_str();
+            const bool idempotent = method == "GET" || method == "HEAD";
+            if (connectionPool)
+            {
+                if (auto pooledSocket = connectionPool->acquire(uri.host, port))
+                {
+                    Exchange exchange;
+                    try
+                    {
+                        auto response = exchangeMessages(*pooledSocket, requestData, method, sink, timeout, stopTime, exchange);
+                        if (exchange.responseStarted)
+                        {
+                            if (exchange.keepAlive)
+                                connectionPool->release(uri.host, port, std::move(*pooledSocket));
+                            return response;
+                        }
+                    }
+                    catch (const std::system_error&)
+                    {
+                        if (exchange.responseStarted || !idempotent) throw;
+                    }
+                    catch (const ResponseError&)
+                    {
+                        if (exchange.responseStarted || !idempotent) throw;
+                    }
+                    // the server closed the idle connection before our request reached it, retry on a new one;
+                    // only safe when the request may run twice, as the server might have acted on it anyway
+                }
+            }
 
-            addrinfo* info;
-            if (getaddrinfo(uri.host.c_str(), port, &hints, &info) != 0)
-#if defined(_WIN32) || defined(__CYGWIN__)
-                throw std::system_error{WSAGetLastError(), winsock::errorCategory, "Failed to get address info of " + uri.host};
-#else
-                throw std::system_error{errno, std::system_category(), "Failed to get address info of " + uri.host};
-#endif // defined(_WIN32) || defined(__CYGWIN__)
+            Socket socket = connect(port, timeout, stopTime);
 
-            const std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> addressInfo{info, freeaddrinfo};
+            Exchange exchange;
+            auto response = exchangeMessages(socket, requestData, method, sink, timeout, stopTime, exchange);
+            if (connectionPool && exchange.keepAlive)
+                connectionPool->release(uri.host, port, std::move(socket));
 
-            const auto requestData = encodeHtml(uri, method, body, headerFields);
+            return response;
+        }
 
-            Socket socket{internetProtocol};
+    private:
+        struct Exchange final
+        {
+            bool responseStarted = false;
+            bool keepAlive = false;
+        };
 
-            const auto getRemainingMilliseconds = [](const std::chrono::steady_clock::time_point time) noexcept -> std::int64_t {
-                const auto now = std::chrono::steady_clock::now();
-                const auto remainingTime = std::chrono::duration_cast<std::chrono::milliseconds>(time - now);
-                return (remainingTime.count() > 0) ? remainingTime.count() : 0;
-            };
+        static std::int64_t getRemainingMilliseconds(const std::chrono::milliseconds timeout,
+                                                     const std::chrono::steady_clock::time_point stopTime) noexcept
+        {
+            if (timeout.count() < 0) return -1;
 
-            // take the first address from the list
-            socket.connect(addressInfo->ai_addr, static_cast<socklen_t>(addressInfo->ai_addrlen),
-                           (timeout.count() >= 0) ? getRemainingMilliseconds(stopTime) : -1);
+            const auto now = std::chrono::steady_clock::now();
+            const auto remainingTime = std::chrono::duration_cast<std::chrono::milliseconds>(stopTime - now);
+            return (remainingTime.count() > 0) ? remainingTime.count() : 0;
+        }
 
+        Socket connect(const std::string& port,
+                       const std::chrono::milliseconds timeout,
+                       const std::chrono::steady_clock::time_point stopTime)
+        {
+            std::vector<Address> addresses;
+            if (resolver)
+            {
+                // a slow name server must not hold the request past its deadline
+                const auto lookup = resolver->resolveAsync(uri.host, port, internetProtocol);
+                if (timeout.count() >= 0 && lookup.wait_until(stopTime) != std::future_status::ready)
+                    throw ResponseError{"Request timed out"};
+                addresses = lookup.get();
+            }
+            else
+                addresses = lookupAddresses(uri.host, port, getAddressFamily(internetProtocol));
+
+            return connectAddresses(addresses, getRemainingMilliseconds(timeout, stopTime));
+        }
+
+        // writes the request and reads exactly one response, leaving the socket at the start of the next one
+        Response exchangeMessages(Socket& socket,
+                                  const std::vector<std::uint8_t>& requestData,
+                                  const std::string& method,
+                                  const BodySink& sink,
+                                  const std::chrono::milliseconds timeout,
+                                  const std::chrono::steady_clock::time_point stopTime,
+                                  Exchange& exchange)
+        {
             auto remaining = requestData.size();
             auto sendData = requestData.data();
 
             // send the request
             while (remaining > 0)
             {
-                const auto size = socket.send(sendData, remaining,
-                                              (timeout.count() >= 0) ? getRemainingMilliseconds(stopTime) : -1);
+                const auto size = socket.send(sendData, remaining, getRemainingMilliseconds(timeout, stopTime));
                 remaining -= size;
                 sendData += size;
             }
 
-            std::array<std::uint8_t, 4096> tempBuffer;
-            constexpr std::array<std::uint8_t, 2> crlf = {'\r', '\n'};
-            constexpr std::array<std::uint8_t, 4> headerEnd = {'\r', '\n', '\r', '\n'};
-            Response response;
-            std::vector<std::uint8_t> responseData;
-            bool parsingBody = false;
-            bool contentLengthReceived = false;
-            std::size_t contentLength = 0U;
-            bool chunkedResponse = false;
-            std::size_t expectedChunkSize = 0U;
-            bool removeCrlfAfterChunk = false;
+            std::array<std::uint8_t, 16384> tempBuffer;
+            ResponseParser parser{method, sink};
 
             // read the response
             for (;;)
             {
-                const auto size = socket.recv(tempBuffer.data(), tempBuffer.size(),
-                                              (timeout.count() >= 0) ? getRemainingMilliseconds(stopTime) : -1);
+                const auto size = socket.recv(tempBuffer.data(), tempBuffer.size(), getRemainingMilliseconds(timeout, stopTime));
                 if (size == 0) // disconnected
-                    return response;
-
-                responseData.insert(responseData.end(), tempBuffer.begin(), tempBuffer.begin() + size);
-
-                if (!parsingBody)
                 {
-                    // RFC 7230, 3. Message Format
-                    // Empty line indicates the end of the header section (RFC 7230, 2.1. Client/Server Messaging)
-                    const auto endIterator = std::search(responseData.cbegin(), responseData.cend(),
-                                                         headerEnd.cbegin(), headerEnd.cend());
-                    if (endIterator == responseData.cend()) break; // two consecutive CRLFs not found
-
-                    const auto headerBeginIterator = responseData.cbegin();
-                    const auto headerEndIterator = endIterator + 2;
-
-                    auto statusLineResult = parseStatusLine(headerBeginIterator, headerEndIterator);
-                    auto i = statusLineResult.first;
-
-                    response.status = std::move(statusLineResult.second);
-
-                    for (;;)
-                    {
-                        auto headerFieldResult = parseHeaderField(i, headerEndIterator);
-                        i = headerFieldResult.first;
-
-                        auto fieldName = std::move(headerFieldResult.second.first);
-                        auto fieldValue = std::move(headerFieldResult.second.second);
-
-                        if (fieldName == "transfer-encoding")
-                        {
-                            // RFC 7230, 3.3.1. Transfer-Encoding
-                            if (fieldValue == "chunked")
-                                chunkedResponse = true;
-                            else
-                                throw ResponseError{"Unsupported transfer encoding: " + fieldValue};
-                        }
-                        else if (fieldName == "content-length")
-                        {
-                            // RFC 7230, 3.3.2. Content-Length
-                            contentLength = stringToUint<std::size_t>(fieldValue.cbegin(), fieldValue.cend());
-                            contentLengthReceived = true;
-                            response.body.reserve(contentLength);
-                        }
-
-                        response.headerFields.push_back({std::move(fieldName), std::move(fieldValue)});
-
-                        if (i == headerEndIterator)
-                            break;
-                    }
-
-                    responseData.erase(responseData.cbegin(), headerEndIterator + 2);
-                    parsingBody = true;
+                    if (!parser.finish())
+                        throw ResponseError{"Connection closed before the response was complete"};
+                    return std::move(parser.response());
                 }
 
-                if (parsingBody)
+                exchange.responseStarted = true;
+                if (parser.feed(tempBuffer.data(), size))
                 {
-                    // Content-Length must be ignored if Transfer-Encoding is received (RFC 7230, 3.2. Content-Length)
-                    if (chunkedResponse)
-                    {
-                        // RFC 7230, 4.1. Chunked Transfer Coding
-                        for (;;)
-                        {
-                            if (expectedChunkSize > 0)
-                            {
-                                const auto toWrite = (std::min)(expectedChunkSize, responseData.size());
-                                response.body.insert(response.body.end(), responseData.begin(),
-                                                     responseData.begin() + static_cast<std::ptrdiff_t>(toWrite));
-                                responseData.erase(responseData.begin(),
-                                                   responseData.begin() + static_cast<std::ptrdiff_t>(toWrite));
-                                expectedChunkSize -= toWrite;
-
-                                if (expectedChunkSize == 0) removeCrlfAfterChunk = true;
-                                if (responseData.empty()) break;
-                            }
-                            else
-                            {
-                                if (removeCrlfAfterChunk)
-                                {
-                                    if (responseData.size() < 2) break;
-                                    
-                                    if (!std::equal(crlf.begin(), crlf.end(), responseData.begin()))
-                                        throw ResponseError{"Invalid chunk"};
-
-                                    removeCrlfAfterChunk = false;
-                                    responseData.erase(responseData.begin(), responseData.begin() + 2);
-                                }
-
-                                const auto i = std::search(responseData.begin(), responseData.end(),
-                                                           crlf.begin(), crlf.end());
-
-                                if (i == responseData.end()) break;
-
-                                expectedChunkSize = detail::hexStringToUint<std::size_t>(responseData.begin(), i);
-                                responseData.erase(responseData.begin(), i + 2);
-
-                                if (expectedChunkSize == 0)
-                                    return response;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        response.body.insert(response.body.end(), responseData.begin(), responseData.end());
-                        responseData.clear();
-
-                        // got the whole content
-                        if (contentLengthReceived && response.body.size() >= contentLength)
-                            return response;
-                    }
+                    exchange.keepAlive = parser.keepAlive();
+                    return std::move(parser.response());
                 }
             }
-
-            return response;
         }
 
-    private:
 #if defined(_WIN32) || defined(__CYGWIN__)
         winsock::Api winSock;
 #endif // defined(_WIN32) || defined(__CYGWIN__)
         InternetProtocol internetProtocol;
         Uri uri;
+        ConnectionPool* connectionPool = nullptr;
+        Resolver* resolver = nullptr;
     };
 }
 
@@ -0,0 +1,88 @@
+#include "benchmark.hpp"
+#include "HTTPRequest.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+        std::vector<uint8_t> chunked_response(const size_t body_bytes, const size_t chunk_size, uint64_t &chunks)
+        {
+                const std::string head = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\n\r\n";
+                std::vector<uint8_t> response(head.begin(), head.end());
+                response.reserve(head.size() + body_bytes + body_bytes / chunk_size * 12 + 32);
+                chunks = 0;
+                for (size_t offset = 0; offset < body_bytes; offset += chunk_size)
+                {
+                        const size_t size = std::min(chunk_size, body_bytes - offset);
+                        char line[24];
+                        const int length = std::snprintf(line, sizeof line, "%zx;ext=1\r\n", size);
+                        response.insert(response.end(), line, line + length);
+                        for (size_t byte = 0; byte < size; ++byte)
+                        {
+                                response.push_back(static_cast<uint8_t>((offset + byte) * 131));
+                        }
+                        response.push_back('\r');
+                        response.push_back('\n');
+                        ++chunks;
+                }
+                const std::string trailer = "0\r\nX-Trailer: done\r\n\r\n";
+                response.insert(response.end(), trailer.begin(), trailer.end());
+                return response;
+        }
+
+        // returns the bytes delivered, throws if the parser did not see the whole response
+        uint64_t parse(std::span<const uint8_t> response, const size_t feed_size, const http::BodySink &sink)
+        {
+                http::ResponseParser parser{"GET", sink};
+                bool complete = false;
+                while (!response.empty() && !complete)
+                {
+                        const size_t size = std::min(feed_size, response.size());
+                        complete = parser.feed(response.data(), size);
+                        response = response.subspan(size);
+                }
+                if (!complete || !response.empty())
+                {
+                        throw std::runtime_error("Chunked body benchmark response was not parsed whole");
+                }
+                return parser.response().body.size();
+        }
+}
+
+ChunkedBodyBenchmark benchmark_chunked_body(const size_t body_bytes, const size_t chunk_size, const size_t feed_size)
+{
+        using Clock = std::chrono::steady_clock;
+        const auto seconds_since = [](const Clock::time_point start)
+        { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+        ChunkedBodyBenchmark result{};
+        result.body_bytes = body_bytes;
+        const std::vector<uint8_t> response = chunked_response(body_bytes, chunk_size, result.chunks);
+        const auto check = [body_bytes](const uint64_t delivered)
+        {
+                if (delivered != body_bytes)
+                {
+                        throw std::runtime_error("Chunked body benchmark delivered " + std::to_string(delivered) + " bytes");
+                }
+        };
+
+        auto start = Clock::now();
+        check(parse(response, feed_size, {}));
+        result.streamed_seconds = seconds_since(start);
+
+        start = Clock::now();
+        check(parse(response, response.size(), {}));
+        result.single_seconds = seconds_since(start);
+
+        uint64_t delivered = 0;
+        start = Clock::now();
+        parse(response, feed_size, [&delivered](const uint8_t *, const size_t size) { delivered += size; });
+        result.sink_seconds = seconds_since(start);
+        check(delivered);
+        return result;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+struct ChunkedBodyBenchmark
+{
+        double streamed_seconds; // fed in reads of feed_size bytes, body collected in the response
+        double single_seconds;   // the whole response in one feed
+        double sink_seconds;     // fed like streamed, body handed to a BodySink instead
+        uint64_t body_bytes;
+        uint64_t chunks;
+};
+
+// a chunked response of body_bytes in chunks of chunk_size through http::ResponseParser, each run checked
+ChunkedBodyBenchmark benchmark_chunked_body(size_t body_bytes, size_t chunk_size, size_t feed_size);
@@ -1,37 +1,73 @@
 #include "utils.hpp"
 #include <string>
-#include <cctype>
 #include <array>
+#include <stdexcept>
 
-std::string url_encode(const std::string &hex_string)
+namespace
 {
-        std::string result;
-        result.reserve(hex_string.length() + hex_string.length() / 2);
+        // RFC 3986 unreserved characters pass through, everything else becomes %XX
+        constexpr std::array<bool, 256> unreserved_characters()
+        {
+                std::array<bool, 256> unreserved{};
+                for (size_t i = '0'; i <= '9'; ++i)
+                        unreserved[i] = true;
+                for (size_t i = 'A'; i <= 'Z'; ++i)
+                        unreserved[i] = true;
+                for (size_t i = 'a'; i <= 'z'; ++i)
+                        unreserved[i] = true;
+                unreserved['-'] = true;
+                unreserved['_'] = true;
+                unreserved['.'] = true;
+                unreserved['~'] = true;
+                return unreserved;
+        }
 
-        std::array<bool, 256> unreserved{};
-        for (size_t i = '0'; i <= '9'; ++i)
-                unreserved[i] = true;
-        for (size_t i = 'A'; i <= 'Z'; ++i)
-                unreserved[i] = true;
-        for (size_t i = 'a'; i <= 'z'; ++i)
-                unreserved[i] = true;
-        unreserved['-'] = true;
-        unreserved['_'] = true;
-        unreserved['.'] = true;
-        unreserved['~'] = true;
+        constexpr std::array<bool, 256> unreserved = unreserved_characters();
+        constexpr char hex_digits[] = "0123456789ABCDEF";
 
-        for (size_t i = 0; i < hex_string.length(); i += 2)
+        int hex_value(const char c)
+        {
+                if (c >= '0' && c <= '9')
+                        return c - '0';
+                if (c >= 'a' && c <= 'f')
+                        return c - 'a' + 10;
+                if (c >= 'A' && c <= 'F')
+                        return c - 'A' + 10;
+                throw std::invalid_argument("Invalid hex digit");
+        }
+}
+
+// appends the raw bytes percent-encoded to out
+void percent_encode(const std::string_view bytes, std::string &out)
+{
+        out.reserve(out.size() + bytes.size() * 3);
+        for (const char c : bytes)
         {
-                std::string byte_str = hex_string.substr(i, 2);
-                size_t byte_val = std::stoul(byte_str, nullptr, 16);
-                if (unreserved[byte_val])
+                const auto byte = static_cast<unsigned char>(c);
+                if (unreserved[byte])
                 {
-                        result += static_cast<char>(byte_val);
+                        out += c;
                 }
                 else
                 {
-                        result += "%" + byte_str;
+                        out += '%';
+                        out += hex_digits[byte >> 4];
+                        out += hex_digits[byte & 0x0f];
                 }
         }
+}
+
+// same as percent_encode for bytes given as a hex string
+std::string url_encode(const std::string &hex_string)
+{
+        std::string bytes;
+        bytes.reserve(hex_string.length() / 2);
+        for (size_t i = 0; i + 1 < hex_string.length(); i += 2)
+        {
+                bytes += static_cast<char>((hex_value(hex_string[i]) << 4) | hex_value(hex_string[i + 1]));
+        }
+
+        std::string result;
+        percent_encode(bytes, result);
         return result;
-}
\ No newline at end of file
+}
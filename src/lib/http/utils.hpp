@@ -1,4 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 
-std::string url_encode(const std::string &hex_string);
\ No newline at end of file
+std::string url_encode(const std::string &hex_string);
+void percent_encode(std::string_view bytes, std::string &out);
@@ -0,0 +1,416 @@
+#include "block_pool.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+
+namespace
+{
+        constexpr size_t huge_page = 2 * 1024 * 1024;
+
+        // ids of the pools alive; a thread that exits hands its cached blocks back only to these
+        struct Registry
+        {
+                std::mutex lock;
+                std::unordered_set<uint64_t> live;
+                uint64_t next = 1;
+        };
+
+        Registry &registry()
+        {
+                static Registry instance;
+                return instance;
+        }
+
+        uint64_t register_pool()
+        {
+                Registry &pools = registry();
+                const std::lock_guard guard{pools.lock};
+                pools.live.insert(pools.next);
+                return pools.next++;
+        }
+
+        // MAP_HUGETLB needs reserved huge pages, without them an aligned mapping may still get transparent ones
+        uint8_t *map_chunk(const size_t bytes, const bool huge_pages, bool &huge)
+        {
+                huge = false;
+                if (huge_pages)
+                {
+                        void *base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                        if (base != MAP_FAILED)
+                        {
+                                huge = true;
+                                return static_cast<uint8_t *>(base);
+                        }
+                }
+
+                const size_t slack = huge_pages ? huge_page : 0;
+                void *base = mmap(nullptr, bytes + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (base == MAP_FAILED)
+                {
+                        throw std::runtime_error(std::string("Failed to map block pool: ") + std::strerror(errno));
+                }
+                auto *bytes_start = static_cast<uint8_t *>(base);
+                if (huge_pages)
+                {
+                        const auto address = reinterpret_cast<uintptr_t>(base);
+                        auto *aligned = bytes_start + ((huge_page - address % huge_page) % huge_page);
+                        if (aligned != bytes_start)
+                        {
+                                munmap(bytes_start, static_cast<size_t>(aligned - bytes_start));
+                        }
+                        munmap(aligned + bytes, slack - static_cast<size_t>(aligned - bytes_start));
+                        madvise(aligned, bytes, MADV_HUGEPAGE);
+                        return aligned;
+                }
+                return bytes_start;
+        }
+}
+
+// every thread keeps its free blocks per pool, the pool's id tells a live pool from a dead one at the same address
+struct BlockPool::ThreadCaches
+{
+        struct Cache
+        {
+                BlockPool *pool;
+                uint64_t id;
+                std::vector<uint32_t> blocks;
+        };
+
+        std::vector<Cache> caches;
+
+        ~ThreadCaches()
+        {
+                Registry &pools = registry();
+                const std::lock_guard guard{pools.lock};
+                for (Cache &cache : caches)
+                {
+                        if (pools.live.contains(cache.id))
+                        {
+                                for (const uint32_t index : cache.blocks)
+                                {
+                                        cache.pool->push(index);
+                                }
+                        }
+                }
+        }
+
+        std::vector<uint32_t> &of(BlockPool &pool)
+        {
+                for (Cache &cache : caches)
+                {
+                        if (cache.id == pool.id)
+                        {
+                                return cache.blocks;
+                        }
+                }
+
+                // a new pool for this thread, a good time to forget the ones that are gone
+                {
+                        Registry &pools = registry();
+                        const std::lock_guard guard{pools.lock};
+                        std::erase_if(caches, [&pools](const Cache &cache) { return !pools.live.contains(cache.id); });
+                }
+                caches.push_back(Cache{&pool, pool.id, {}});
+                caches.back().blocks.reserve(pool.options.thread_cache + 1);
+                return caches.back().blocks;
+        }
+
+        static ThreadCaches &local()
+        {
+                thread_local ThreadCaches instance;
+                return instance;
+        }
+};
+
+BlockBuffer::BlockBuffer(BlockPool *pool, const uint32_t index, uint8_t *memory, const uint32_t size)
+    : pool(pool), index(index), length(size), memory(memory)
+{
+}
+
+BlockBuffer::~BlockBuffer()
+{
+        if (pool)
+        {
+                pool->release(index);
+        }
+}
+
+BlockBuffer::BlockBuffer(BlockBuffer &&other) noexcept
+    : pool(std::exchange(other.pool, nullptr)), index(other.index), length(std::exchange(other.length, 0)),
+      memory(std::exchange(other.memory, nullptr))
+{
+}
+
+BlockBuffer &BlockBuffer::operator=(BlockBuffer &&other) noexcept
+{
+        if (this != &other)
+        {
+                if (pool)
+                {
+                        pool->release(index);
+                }
+                pool = std::exchange(other.pool, nullptr);
+                index = other.index;
+                length = std::exchange(other.length, 0);
+                memory = std::exchange(other.memory, nullptr);
+        }
+        return *this;
+}
+
+uint8_t *BlockBuffer::data()
+{
+        return memory;
+}
+
+const uint8_t *BlockBuffer::data() const
+{
+        return memory;
+}
+
+size_t BlockBuffer::size() const
+{
+        return length;
+}
+
+void BlockBuffer::resize(const size_t size)
+{
+        if (size > BlockPool::block_bytes || (!memory && size > 0))
+        {
+                throw std::invalid_argument("Block buffer size " + std::to_string(size) + " out of range");
+        }
+        length = static_cast<uint32_t>(size);
+}
+
+std::span<const uint8_t> BlockBuffer::bytes() const
+{
+        return {memory, length};
+}
+
+BlockBuffer::operator bool() const
+{
+        return memory != nullptr;
+}
+
+BlockPool::BlockPool(Options options) : options(options), id(register_pool())
+{
+        if (options.chunk_blocks == 0 || options.chunk_blocks > UINT32_MAX / max_chunks)
+        {
+                throw std::invalid_argument("Block pool chunk of " + std::to_string(options.chunk_blocks) + " blocks");
+        }
+}
+
+BlockPool::BlockPool() : BlockPool(Options{})
+{
+}
+
+BlockPool::~BlockPool()
+{
+        {
+                Registry &pools = registry();
+                const std::lock_guard guard{pools.lock};
+                pools.live.erase(id);
+        }
+        const size_t count = chunk_count.load();
+        for (size_t chunk = 0; chunk < count; ++chunk)
+        {
+                munmap(chunks[chunk].load(), options.chunk_blocks * block_bytes);
+                delete[] links[chunk].load();
+        }
+}
+
+BlockPool &BlockPool::shared()
+{
+        static BlockPool pool;
+        return pool;
+}
+
+BlockBuffer BlockPool::acquire(const size_t size)
+{
+        if (size > block_bytes)
+        {
+                throw std::invalid_argument("Block of " + std::to_string(size) + " bytes is larger than the pool's");
+        }
+
+        std::vector<uint32_t> &cache = ThreadCaches::local().of(*this);
+        uint32_t top = empty;
+        if (!cache.empty())
+        {
+                top = cache.back() + 1;
+                cache.pop_back();
+        }
+        else
+        {
+                top = pop();
+        }
+        if (top != empty)
+        {
+                hits.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+                top = grow();
+        }
+
+        const size_t used = in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+        size_t highest = high_water.load(std::memory_order_relaxed);
+        while (used > highest && !high_water.compare_exchange_weak(highest, used, std::memory_order_relaxed))
+        {
+        }
+        return BlockBuffer{this, top - 1, address(top - 1), static_cast<uint32_t>(size)};
+}
+
+BlockPool::Statistics BlockPool::statistics() const
+{
+        Statistics result;
+        result.hits = hits.load(std::memory_order_relaxed);
+        result.misses = misses.load(std::memory_order_relaxed);
+        result.in_use = in_use.load(std::memory_order_relaxed);
+        result.high_water = high_water.load(std::memory_order_relaxed);
+        result.capacity = chunk_count.load(std::memory_order_acquire) * options.chunk_blocks;
+        result.huge_pages = mapped_huge.load(std::memory_order_relaxed);
+        return result;
+}
+
+void BlockPool::release(const uint32_t index)
+{
+        in_use.fetch_sub(1, std::memory_order_relaxed);
+        std::vector<uint32_t> &cache = ThreadCaches::local().of(*this);
+        cache.push_back(index);
+        if (cache.size() > options.thread_cache)
+        {
+                // keep the cache half full, so a thread that frees and allocates in turn stays off the shared stack
+                const size_t keep = options.thread_cache / 2;
+                for (size_t block = keep; block < cache.size(); ++block)
+                {
+                        push(cache[block]);
+                }
+                cache.resize(keep);
+        }
+}
+
+uint8_t *BlockPool::address(const uint32_t index) const
+{
+        const uint8_t *chunk = chunks[index / options.chunk_blocks].load(std::memory_order_acquire);
+        return const_cast<uint8_t *>(chunk) + (index % options.chunk_blocks) * block_bytes;
+}
+
+// the tag in the top half of head changes on every update, so a pop that read a top which was popped and pushed
+// again in between fails its exchange instead of installing a stale next link (ABA)
+void BlockPool::push(const uint32_t index)
+{
+        std::atomic<uint32_t> &next = links[index / options.chunk_blocks].load(std::memory_order_acquire)[index % options.chunk_blocks];
+        uint64_t old = head.load(std::memory_order_relaxed);
+        uint64_t update;
+        do
+        {
+                next.store(static_cast<uint32_t>(old), std::memory_order_relaxed);
+                update = ((old >> 32) + 1) << 32 | (index + 1);
+        } while (!head.compare_exchange_weak(old, update, std::memory_order_release, std::memory_order_relaxed));
+}
+
+uint32_t BlockPool::pop()
+{
+        uint64_t old = head.load(std::memory_order_acquire);
+        uint64_t update;
+        do
+        {
+                const auto top = static_cast<uint32_t>(old);
+                if (top == empty)
+                {
+                        return empty;
+                }
+                const uint32_t index = top - 1;
+                const uint32_t next =
+                    links[index / options.chunk_blocks].load(std::memory_order_acquire)[index % options.chunk_blocks].load(std::memory_order_relaxed);
+                update = ((old >> 32) + 1) << 32 | next;
+        } while (!head.compare_exchange_weak(old, update, std::memory_order_acquire, std::memory_order_acquire));
+        return static_cast<uint32_t>(old);
+}
+
+// maps one more chunk, hands out its first block and puts the rest on the shared stack
+uint32_t BlockPool::grow()
+{
+        const std::lock_guard guard{growing};
+        // another thread may have grown the pool while this one waited
+        if (const uint32_t top = pop(); top != empty)
+        {
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return top;
+        }
+
+        const size_t chunk = chunk_count.load(std::memory_order_relaxed);
+        if (chunk == max_chunks)
+        {
+                throw std::runtime_error("Block pool is out of chunks at " + std::to_string(chunk * options.chunk_blocks) + " blocks");
+        }
+        bool huge = false;
+        uint8_t *memory = map_chunk(options.chunk_blocks * block_bytes, options.huge_pages, huge);
+        links[chunk].store(new std::atomic<uint32_t>[options.chunk_blocks](), std::memory_order_release);
+        chunks[chunk].store(memory, std::memory_order_release);
+        chunk_count.store(chunk + 1, std::memory_order_release);
+        if (huge)
+        {
+                mapped_huge.store(true, std::memory_order_relaxed);
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+
+        const auto first = static_cast<uint32_t>(chunk * options.chunk_blocks);
+        for (uint32_t block = 1; block < options.chunk_blocks; ++block)
+        {
+                push(first + block);
+        }
+        return first + 1;
+}
+
+BlockPoolBenchmark benchmark_block_pool(const unsigned threads, const uint64_t blocks)
+{
+        using Clock = std::chrono::steady_clock;
+        constexpr size_t window = 16; // blocks a thread holds at once, a 256 KiB piece
+
+        // every thread fills a window of blocks, drops them all and starts over, like assembling pieces
+        const auto run = [threads, blocks](auto &&allocate)
+        {
+                const auto start = Clock::now();
+                std::vector<std::thread> workers;
+                for (unsigned thread = 0; thread < threads; ++thread)
+                {
+                        workers.emplace_back(
+                            [&allocate, thread, share = blocks / threads]
+                            {
+                                    using Block = decltype(allocate());
+                                    std::vector<Block> held;
+                                    held.reserve(window);
+                                    for (uint64_t block = 0; block < share; ++block)
+                                    {
+                                            held.push_back(allocate());
+                                            std::memset(held.back().data(), static_cast<int>(block + thread), BlockPool::block_bytes);
+                                            if (held.size() == window)
+                                            {
+                                                    held.clear();
+                                            }
+                                    }
+                            });
+                }
+                for (std::thread &worker : workers)
+                {
+                        worker.join();
+                }
+                return std::chrono::duration<double>(Clock::now() - start).count();
+        };
+
+        BlockPool pool;
+        BlockPoolBenchmark result{};
+        result.blocks = blocks / threads * threads;
+        result.malloc_seconds = run([] { return std::vector<uint8_t>(BlockPool::block_bytes); });
+        result.pool_seconds = run([&pool] { return pool.acquire(); });
+        return result;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+
+class BlockPool;
+
+// one 16 KiB block out of a BlockPool, handed back when the handle goes away
+class BlockBuffer
+{
+public:
+        BlockBuffer() = default;
+        ~BlockBuffer();
+        BlockBuffer(BlockBuffer &&other) noexcept;
+        BlockBuffer &operator=(BlockBuffer &&other) noexcept;
+        BlockBuffer(const BlockBuffer &) = delete;
+        BlockBuffer &operator=(const BlockBuffer &) = delete;
+
+        uint8_t *data();
+        const uint8_t *data() const;
+        size_t size() const; // bytes in use, up to BlockPool::block_bytes
+        void resize(size_t size);
+        std::span<const uint8_t> bytes() const;
+        explicit operator bool() const;
+
+private:
+        friend class BlockPool;
+        BlockBuffer(BlockPool *pool, uint32_t index, uint8_t *memory, uint32_t size);
+
+        BlockPool *pool = nullptr;
+        uint32_t index = 0;
+        uint32_t length = 0;
+        uint8_t *memory = nullptr;
+};
+
+// Fixed-size blocks carved out of large mappings that are never given back while the pool lives. Each thread keeps
+// a small cache of free blocks; behind the caches sits a lock-free stack (Treiber, the head tagged against ABA)
+// shared by all threads. Only growing the pool takes a lock. Safe to use from any thread; the pool must outlive
+// its buffers and no other thread may use it while it is destroyed.
+class BlockPool
+{
+public:
+        static constexpr size_t block_bytes = 16 * 1024;
+
+        struct Options
+        {
+                size_t chunk_blocks = 128; // blocks per mapping, 2 MiB
+                size_t thread_cache = 64;  // free blocks a thread keeps before it hands half of them back
+                bool huge_pages = false;   // MAP_HUGETLB, else transparent huge pages on 2 MiB aligned chunks
+        };
+
+        struct Statistics
+        {
+                uint64_t hits = 0;   // served from a thread cache or the shared stack
+                uint64_t misses = 0; // had to map a new chunk
+                size_t in_use = 0;
+                size_t high_water = 0; // most blocks in use at once
+                size_t capacity = 0;   // blocks mapped
+                bool huge_pages = false; // the chunks came from MAP_HUGETLB
+        };
+
+        explicit BlockPool(Options options);
+        BlockPool();
+        ~BlockPool();
+        BlockPool(const BlockPool &) = delete;
+        BlockPool &operator=(const BlockPool &) = delete;
+
+        BlockBuffer acquire(size_t size = block_bytes);
+        Statistics statistics() const;
+
+        static BlockPool &shared(); // default options, lives until exit
+
+private:
+        friend class BlockBuffer;
+        struct ThreadCaches;
+
+        static constexpr size_t max_chunks = 4096;
+        static constexpr uint32_t empty = 0;
+
+        void release(uint32_t index);
+        uint8_t *address(uint32_t index) const;
+        void push(uint32_t index);
+        uint32_t pop(); // empty, or the index plus one
+        uint32_t grow();
+
+        const Options options;
+        const uint64_t id; // tells the thread caches of pools apart, never reused
+        std::atomic<uint64_t> head{0}; // tag << 32 | (index + 1) of the top free block
+        std::array<std::atomic<uint8_t *>, max_chunks> chunks{};
+        // the free stack's next links, one per block and apart from the blocks so a stale read in pop() never
+        // races with what a buffer's owner writes
+        std::array<std::atomic<std::atomic<uint32_t> *>, max_chunks> links{};
+        std::atomic<size_t> chunk_count{0};
+        std::mutex growing;
+        std::atomic<bool> mapped_huge{false};
+
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<size_t> in_use{0};
+        std::atomic<size_t> high_water{0};
+};
+
+struct BlockPoolBenchmark
+{
+        double malloc_seconds; // a fresh zeroed std::vector per block
+        double pool_seconds;
+        uint64_t blocks; // allocated, filled and freed per run, across all threads
+};
+
+BlockPoolBenchmark benchmark_block_pool(unsigned threads, uint64_t blocks);
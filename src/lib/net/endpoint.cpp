@@ -0,0 +1,171 @@
+#include "endpoint.hpp"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+socklen_t PeerEndpoint::to_sockaddr(sockaddr_storage &storage) const
+{
+        storage = {};
+        if (family == AF_INET6)
+        {
+                auto &ipv6 = reinterpret_cast<sockaddr_in6 &>(storage);
+                ipv6.sin6_family = AF_INET6;
+                ipv6.sin6_port = htons(port);
+                std::memcpy(&ipv6.sin6_addr, address.data(), 16);
+                return sizeof(sockaddr_in6);
+        }
+
+        auto &ipv4 = reinterpret_cast<sockaddr_in &>(storage);
+        ipv4.sin_family = AF_INET;
+        ipv4.sin_port = htons(port);
+        std::memcpy(&ipv4.sin_addr, address.data(), 4);
+        return sizeof(sockaddr_in);
+}
+
+// 1.2.3.4:6881 or [::1]:6881, only for output
+std::string PeerEndpoint::to_string() const
+{
+        char text[INET6_ADDRSTRLEN];
+        inet_ntop(family, address.data(), text, sizeof(text));
+        return family == AF_INET6 ? "[" + std::string(text) + "]:" + std::to_string(port) : std::string(text) + ":" + std::to_string(port);
+}
+
+uint64_t PeerEndpoint::hash() const
+{
+        uint64_t high;
+        uint64_t low;
+        std::memcpy(&high, address.data(), 8);
+        std::memcpy(&low, address.data() + 8, 8);
+
+        // multiply-xorshift mixing, good enough to spread addresses that differ in a single byte
+        uint64_t h = high * 0x9e3779b97f4a7c15ull ^ std::rotl(low * 0xc2b2ae3d27d4eb4full, 31) ^ (uint64_t{port} << 8 | family);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+}
+
+PeerEndpoint PeerEndpoint::from_sockaddr(const sockaddr *address)
+{
+        PeerEndpoint endpoint;
+        if (address->sa_family == AF_INET6)
+        {
+                const auto ipv6 = reinterpret_cast<const sockaddr_in6 *>(address);
+                endpoint.family = AF_INET6;
+                endpoint.port = ntohs(ipv6->sin6_port);
+                std::memcpy(endpoint.address.data(), &ipv6->sin6_addr, 16);
+        }
+        else
+        {
+                const auto ipv4 = reinterpret_cast<const sockaddr_in *>(address);
+                endpoint.port = ntohs(ipv4->sin_port);
+                std::memcpy(endpoint.address.data(), &ipv4->sin_addr, 4);
+        }
+        return endpoint;
+}
+
+// parses 1.2.3.4:6881 or [::1]:6881 as typed on the command line
+PeerEndpoint PeerEndpoint::from_string(const std::string_view text)
+{
+        const size_t colon = text.rfind(':');
+        if (colon == std::string_view::npos)
+        {
+                throw std::invalid_argument("Invalid peer format. Expected IP:PORT");
+        }
+
+        std::string host(text.substr(0, colon));
+        const std::string_view port_text = text.substr(colon + 1);
+        PeerEndpoint endpoint;
+        const auto [end, error] = std::from_chars(port_text.data(), port_text.data() + port_text.size(), endpoint.port);
+        if (error != std::errc{} || end != port_text.data() + port_text.size() || endpoint.port == 0)
+        {
+                throw std::invalid_argument("Invalid peer port: " + std::string(port_text));
+        }
+
+        if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+        {
+                host = host.substr(1, host.size() - 2);
+                endpoint.family = AF_INET6;
+        }
+        if (inet_pton(endpoint.family, host.c_str(), endpoint.address.data()) != 1)
+        {
+                throw std::invalid_argument("Invalid or unsupported IP address: " + host);
+        }
+        return endpoint;
+}
+
+PeerSet::PeerSet(const size_t expected)
+{
+        const size_t capacity = std::bit_ceil(std::max<size_t>(16, expected * 2));
+        slots.resize(capacity);
+        used.resize(capacity);
+}
+
+bool PeerSet::insert(const PeerEndpoint &endpoint)
+{
+        if ((count + 1) * 2 > slots.size())
+        {
+                grow();
+        }
+
+        const size_t mask = slots.size() - 1;
+        for (size_t i = endpoint.hash() & mask;; i = (i + 1) & mask)
+        {
+                if (!used[i])
+                {
+                        used[i] = 1;
+                        slots[i] = endpoint;
+                        ++count;
+                        return true;
+                }
+                if (slots[i] == endpoint)
+                {
+                        return false;
+                }
+        }
+}
+
+bool PeerSet::contains(const PeerEndpoint &endpoint) const
+{
+        const size_t mask = slots.size() - 1;
+        for (size_t i = endpoint.hash() & mask; used[i]; i = (i + 1) & mask)
+        {
+                if (slots[i] == endpoint)
+                {
+                        return true;
+                }
+        }
+        return false;
+}
+
+size_t PeerSet::size() const
+{
+        return count;
+}
+
+void PeerSet::clear()
+{
+        std::fill(used.begin(), used.end(), 0);
+        count = 0;
+}
+
+// keeps the load factor at or below one half
+void PeerSet::grow()
+{
+        std::vector<PeerEndpoint> old_slots(slots.size() * 2);
+        std::vector<uint8_t> old_used(used.size() * 2);
+        old_slots.swap(slots);
+        old_used.swap(used);
+        count = 0;
+        for (size_t i = 0; i < old_slots.size(); ++i)
+        {
+                if (old_used[i])
+                {
+                        insert(old_slots[i]);
+                }
+        }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/socket.h>
+
+// IPv4 or IPv6 peer address without any strings, 20 bytes; bytes are kept in network order so compact
+// tracker entries copy straight in, IPv4 addresses use the first 4 bytes of address
+struct PeerEndpoint
+{
+        std::array<uint8_t, 16> address{};
+        uint16_t port = 0; // host byte order
+        uint8_t family = AF_INET;
+
+        socklen_t to_sockaddr(sockaddr_storage &storage) const;
+        std::string to_string() const;
+        uint64_t hash() const;
+        static PeerEndpoint from_sockaddr(const sockaddr *address);
+        static PeerEndpoint from_string(std::string_view text);
+        bool operator==(const PeerEndpoint &other) const = default;
+};
+
+// open addressing (linear probing) set used to drop peers that several trackers or sources report
+class PeerSet
+{
+public:
+        explicit PeerSet(size_t expected = 0);
+
+        bool insert(const PeerEndpoint &endpoint); // false if it was there already
+        bool contains(const PeerEndpoint &endpoint) const;
+        size_t size() const;
+        void clear();
+
+private:
+        void grow();
+
+        std::vector<PeerEndpoint> slots;
+        std::vector<uint8_t> used;
+        size_t count = 0;
+};
@@ -0,0 +1,158 @@
+#include "poller.hpp"
+#include <cerrno>
+#include <system_error>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace
+{
+        // never handed out to callers, marks the wakeup eventfd
+        constexpr uint64_t wake_token = UINT64_MAX;
+
+        uint32_t to_epoll_events(const uint32_t flags)
+        {
+                uint32_t events = 0;
+                if (flags & poll_readable)
+                {
+                        events |= EPOLLIN | EPOLLRDHUP;
+                }
+                if (flags & poll_writable)
+                {
+                        events |= EPOLLOUT;
+                }
+                if (flags & poll_edge_triggered)
+                {
+                        events |= EPOLLET;
+                }
+                return events;
+        }
+
+        uint32_t from_epoll_events(const uint32_t events)
+        {
+                uint32_t flags = 0;
+                if (events & EPOLLIN)
+                {
+                        flags |= poll_readable;
+                }
+                if (events & EPOLLOUT)
+                {
+                        flags |= poll_writable;
+                }
+                if (events & EPOLLERR)
+                {
+                        flags |= poll_error;
+                }
+                if (events & (EPOLLHUP | EPOLLRDHUP))
+                {
+                        flags |= poll_hangup;
+                }
+                return flags;
+        }
+
+        void control(const int epoll_fd, const int operation, const int fd, const uint32_t flags, const uint64_t token)
+        {
+                epoll_event event{};
+                event.events = to_epoll_events(flags);
+                event.data.u64 = token;
+                if (epoll_ctl(epoll_fd, operation, fd, &event) == -1)
+                {
+                        throw std::system_error{errno, std::system_category(), "Failed to update epoll interest"};
+                }
+        }
+}
+
+Poller::Poller()
+    : epoll_fd(epoll_create1(EPOLL_CLOEXEC)), wake_fd(-1)
+{
+        if (epoll_fd == -1)
+        {
+                throw std::system_error{errno, std::system_category(), "Failed to create epoll instance"};
+        }
+
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd == -1)
+        {
+                const int error = errno;
+                close(epoll_fd);
+                throw std::system_error{error, std::system_category(), "Failed to create eventfd"};
+        }
+
+        try
+        {
+                control(epoll_fd, EPOLL_CTL_ADD, wake_fd, poll_readable, wake_token);
+        }
+        catch (...)
+        {
+                close(wake_fd);
+                close(epoll_fd);
+                throw;
+        }
+}
+
+Poller::~Poller()
+{
+        close(wake_fd);
+        close(epoll_fd);
+}
+
+void Poller::add(const int fd, const uint32_t flags, const uint64_t token)
+{
+        control(epoll_fd, EPOLL_CTL_ADD, fd, flags, token);
+}
+
+void Poller::modify(const int fd, const uint32_t flags, const uint64_t token)
+{
+        control(epoll_fd, EPOLL_CTL_MOD, fd, flags, token);
+}
+
+void Poller::remove(const int fd)
+{
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr) == -1 && errno != ENOENT && errno != EBADF)
+        {
+                throw std::system_error{errno, std::system_category(), "Failed to remove descriptor from epoll"};
+        }
+}
+
+// fills events with what became ready (a wake() alone yields zero events), -1 waits forever
+size_t Poller::wait(std::vector<PollEvent> &events, const int timeout_ms)
+{
+        constexpr size_t max_events = 256;
+        buffer.resize(max_events * sizeof(epoll_event));
+        auto *ready = reinterpret_cast<epoll_event *>(buffer.data());
+
+        int count = epoll_wait(epoll_fd, ready, static_cast<int>(max_events), timeout_ms);
+        if (count == -1)
+        {
+                if (errno == EINTR)
+                {
+                        count = 0;
+                }
+                else
+                {
+                        throw std::system_error{errno, std::system_category(), "Failed to wait on epoll"};
+                }
+        }
+
+        events.clear();
+        for (int i = 0; i < count; ++i)
+        {
+                if (ready[i].data.u64 == wake_token)
+                {
+                        uint64_t value;
+                        while (read(wake_fd, &value, sizeof(value)) > 0)
+                        {
+                        }
+                        continue;
+                }
+                events.push_back({ready[i].data.u64, from_epoll_events(ready[i].events)});
+        }
+        return events.size();
+}
+
+// interrupts a wait() in progress on another thread
+void Poller::wake()
+{
+        const uint64_t value = 1;
+        [[maybe_unused]] const auto written = write(wake_fd, &value, sizeof(value));
+}
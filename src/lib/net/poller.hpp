@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// readiness flags, the first two are used both for interest and for reported events
+enum PollFlags : uint32_t
+{
+        poll_readable = 1u << 0,
+        poll_writable = 1u << 1,
+        poll_error = 1u << 2,  // reported only
+        poll_hangup = 1u << 3, // reported only
+        poll_edge_triggered = 1u << 4,
+};
+
+struct PollEvent
+{
+        uint64_t token; // whatever was passed to add()/modify() for the descriptor
+        uint32_t flags;
+};
+
+// epoll readiness interface shared by tracker and peer connections, with an eventfd for cross-thread wakeups
+class Poller
+{
+public:
+        Poller();
+        ~Poller();
+        Poller(const Poller &) = delete;
+        Poller &operator=(const Poller &) = delete;
+
+        void add(int fd, uint32_t flags, uint64_t token);
+        void modify(int fd, uint32_t flags, uint64_t token);
+        void remove(int fd);
+        size_t wait(std::vector<PollEvent> &events, int timeout_ms);
+        void wake();
+
+private:
+        int epoll_fd;
+        int wake_fd;
+        std::vector<uint8_t> buffer; // raw epoll_event storage reused across waits
+};
@@ -0,0 +1,157 @@
+#include "ring_buffer.hpp"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+        // reserves 2 * capacity of address space and maps the same memfd pages into both halves
+        uint8_t *map_mirrored(const size_t capacity)
+        {
+                const int fd = memfd_create("ring_buffer", MFD_CLOEXEC);
+                if (fd == -1)
+                {
+                        throw std::runtime_error(std::string("Failed to create ring buffer: ") + std::strerror(errno));
+                }
+                if (ftruncate(fd, static_cast<off_t>(capacity)) == -1)
+                {
+                        const int error = errno;
+                        close(fd);
+                        throw std::runtime_error(std::string("Failed to size ring buffer: ") + std::strerror(error));
+                }
+
+                void *base = mmap(nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (base == MAP_FAILED)
+                {
+                        const int error = errno;
+                        close(fd);
+                        throw std::runtime_error(std::string("Failed to map ring buffer: ") + std::strerror(error));
+                }
+
+                auto *bytes = static_cast<uint8_t *>(base);
+                const bool mapped = mmap(bytes, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+                                    mmap(bytes + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+                const int error = errno;
+                close(fd);
+                if (!mapped)
+                {
+                        munmap(base, 2 * capacity);
+                        throw std::runtime_error(std::string("Failed to map ring buffer: ") + std::strerror(error));
+                }
+                return bytes;
+        }
+
+        size_t round_capacity(const size_t capacity)
+        {
+                const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                return std::bit_ceil(std::max(capacity, page));
+        }
+}
+
+RingBuffer::RingBuffer(const size_t capacity)
+{
+        const size_t rounded = round_capacity(capacity);
+        data = map_mirrored(rounded);
+        mask = rounded - 1;
+}
+
+RingBuffer::~RingBuffer()
+{
+        release();
+}
+
+RingBuffer::RingBuffer(RingBuffer &&other) noexcept
+    : data(std::exchange(other.data, nullptr)), mask(std::exchange(other.mask, 0)),
+      head(std::exchange(other.head, 0)), tail(std::exchange(other.tail, 0))
+{
+}
+
+RingBuffer &RingBuffer::operator=(RingBuffer &&other) noexcept
+{
+        if (this != &other)
+        {
+                release();
+                data = std::exchange(other.data, nullptr);
+                mask = std::exchange(other.mask, 0);
+                head = std::exchange(other.head, 0);
+                tail = std::exchange(other.tail, 0);
+        }
+        return *this;
+}
+
+std::span<const uint8_t> RingBuffer::readable() const
+{
+        return {data + (tail & mask), static_cast<size_t>(head - tail)};
+}
+
+void RingBuffer::consume(const size_t count)
+{
+        tail += count;
+}
+
+std::span<uint8_t> RingBuffer::writable()
+{
+        return {data + (head & mask), capacity() - size()};
+}
+
+void RingBuffer::commit(const size_t count)
+{
+        head += count;
+}
+
+ssize_t RingBuffer::fill(const int fd)
+{
+        const auto space = writable();
+        const ssize_t received = recv(fd, space.data(), space.size(), 0);
+        if (received > 0)
+        {
+                commit(static_cast<size_t>(received));
+        }
+        return received;
+}
+
+// only needed when a single message is larger than the buffer, e.g. the bitfield of a huge torrent
+void RingBuffer::grow(const size_t new_capacity)
+{
+        const size_t rounded = round_capacity(new_capacity);
+        if (rounded <= capacity())
+        {
+                return;
+        }
+
+        uint8_t *bigger = map_mirrored(rounded);
+        const auto pending = readable();
+        std::memcpy(bigger, pending.data(), pending.size());
+        const size_t count = pending.size();
+        release();
+        data = bigger;
+        mask = rounded - 1;
+        tail = 0;
+        head = count;
+}
+
+size_t RingBuffer::size() const
+{
+        return static_cast<size_t>(head - tail);
+}
+
+size_t RingBuffer::capacity() const
+{
+        return mask + 1;
+}
+
+void RingBuffer::release()
+{
+        if (data)
+        {
+                munmap(data, 2 * capacity());
+                data = nullptr;
+        }
+}
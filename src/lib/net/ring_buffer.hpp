@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <sys/types.h>
+
+// receive buffer mapped twice back to back, so the readable bytes and the free space are each one
+// contiguous span even when they wrap around; messages are parsed in place without being copied out
+class RingBuffer
+{
+public:
+        explicit RingBuffer(size_t capacity = 64 * 1024); // rounded up to a power of two number of pages
+        ~RingBuffer();
+        RingBuffer(RingBuffer &&other) noexcept;
+        RingBuffer &operator=(RingBuffer &&other) noexcept;
+        RingBuffer(const RingBuffer &) = delete;
+        RingBuffer &operator=(const RingBuffer &) = delete;
+
+        std::span<const uint8_t> readable() const;
+        void consume(size_t count);
+        std::span<uint8_t> writable();
+        void commit(size_t count);
+        ssize_t fill(int fd); // one recv() into the free space, its result as is
+
+        void grow(size_t capacity); // keeps the unread bytes
+        size_t size() const;
+        size_t capacity() const;
+
+private:
+        void release();
+
+        uint8_t *data = nullptr;
+        size_t mask = 0;
+        uint64_t head = 0; // total bytes written
+        uint64_t tail = 0; // total bytes consumed
+};
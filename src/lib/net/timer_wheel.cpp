@@ -0,0 +1,169 @@
+#include "timer_wheel.hpp"
+#include <algorithm>
+
+TimerWheel::TimerWheel(const std::chrono::milliseconds tick, const Clock::time_point start)
+    : tick_length(std::max(tick, std::chrono::milliseconds{1})), start(start)
+{
+        heads.fill(none);
+}
+
+// the id carries a generation, so cancelling a timer that already fired never hits its successor
+TimerWheel::TimerId TimerWheel::schedule(const Clock::time_point deadline, const uint64_t token)
+{
+        uint32_t index;
+        if (free_nodes.empty())
+        {
+                index = static_cast<uint32_t>(nodes.size());
+                nodes.push_back({});
+        }
+        else
+        {
+                index = free_nodes.back();
+                free_nodes.pop_back();
+        }
+
+        Node &node = nodes[index];
+        node.token = token;
+        node.expiry = std::max(to_tick(deadline), current + 1);
+        ++node.generation;
+        link(index);
+        ++active;
+        return (TimerId{node.generation} << 32) | (TimerId{index} + 1);
+}
+
+bool TimerWheel::cancel(const TimerId timer)
+{
+        const uint64_t slot_index = (timer & 0xffffffff);
+        if (slot_index == 0 || slot_index > nodes.size())
+        {
+                return false;
+        }
+
+        const auto index = static_cast<uint32_t>(slot_index - 1);
+        Node &node = nodes[index];
+        if (node.slot == none || node.generation != static_cast<uint32_t>(timer >> 32))
+        {
+                return false;
+        }
+
+        unlink(index);
+        free_nodes.push_back(index);
+        --active;
+        return true;
+}
+
+// appends the tokens of every timer due by now, in expiry order across ticks
+void TimerWheel::advance(const Clock::time_point now, std::vector<uint64_t> &expired)
+{
+        const uint64_t target = now < start ? 0 : static_cast<uint64_t>((now - start) / tick_length);
+        while (current < target)
+        {
+                // nothing pending, so there is nothing to cascade either
+                if (active == 0)
+                {
+                        current = target;
+                        return;
+                }
+
+                ++current;
+                // when a level wraps around, the next slot of the level above moves down
+                for (unsigned level = 1; level < levels; ++level)
+                {
+                        if (((current >> ((level - 1) * slot_bits)) & (slots - 1)) != 0)
+                        {
+                                break;
+                        }
+                        cascade(level);
+                }
+
+                auto &head = heads[current & (slots - 1)];
+                while (head != none)
+                {
+                        const uint32_t index = head;
+                        unlink(index);
+                        expired.push_back(nodes[index].token);
+                        free_nodes.push_back(index);
+                        --active;
+                }
+        }
+}
+
+size_t TimerWheel::size() const
+{
+        return active;
+}
+
+std::chrono::milliseconds TimerWheel::tick() const
+{
+        return tick_length;
+}
+
+// the level is picked by how far ahead the timer is, the slot by the matching bits of its expiry
+void TimerWheel::link(const uint32_t index)
+{
+        Node &node = nodes[index];
+        uint64_t expiry = node.expiry;
+        const uint64_t max_delta = (uint64_t{1} << (levels * slot_bits)) - 1;
+        if (expiry - current > max_delta)
+        {
+                expiry = current + max_delta;
+        }
+
+        unsigned level = 0;
+        while (level + 1 < levels && (expiry - current) >= (uint64_t{1} << ((level + 1) * slot_bits)))
+        {
+                ++level;
+        }
+
+        const uint32_t slot = level * slots + static_cast<uint32_t>((expiry >> (level * slot_bits)) & (slots - 1));
+        node.slot = slot;
+        node.previous = none;
+        node.next = heads[slot];
+        if (node.next != none)
+        {
+                nodes[node.next].previous = index;
+        }
+        heads[slot] = index;
+}
+
+void TimerWheel::unlink(const uint32_t index)
+{
+        Node &node = nodes[index];
+        if (node.previous != none)
+        {
+                nodes[node.previous].next = node.next;
+        }
+        else
+        {
+                heads[node.slot] = node.next;
+        }
+        if (node.next != none)
+        {
+                nodes[node.next].previous = node.previous;
+        }
+        node.slot = none;
+}
+
+// re-links the timers of the level's current slot, they now land on lower levels
+void TimerWheel::cascade(const unsigned level)
+{
+        const uint32_t slot = level * slots + static_cast<uint32_t>((current >> (level * slot_bits)) & (slots - 1));
+        uint32_t index = heads[slot];
+        heads[slot] = none;
+        while (index != none)
+        {
+                const uint32_t next = nodes[index].next;
+                link(index);
+                index = next;
+        }
+}
+
+uint64_t TimerWheel::to_tick(const Clock::time_point time) const
+{
+        if (time <= start)
+        {
+                return 0;
+        }
+        // rounded up, a timer never fires early
+        return static_cast<uint64_t>((time - start + tick_length - Clock::duration{1}) / tick_length);
+}
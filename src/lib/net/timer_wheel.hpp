@@ -0,0 +1,54 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// hierarchical timer wheel (4 levels of 256 slots): schedule, cancel and expiry are O(1) per timer,
+// deadlines are rounded up to the tick and the farthest one is 2^32 ticks ahead
+class TimerWheel
+{
+public:
+        using Clock = std::chrono::steady_clock;
+        using TimerId = uint64_t;
+
+        static constexpr TimerId invalid_timer = 0;
+
+        explicit TimerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds{100}, Clock::time_point start = Clock::now());
+
+        TimerId schedule(Clock::time_point deadline, uint64_t token);
+        bool cancel(TimerId timer);
+        void advance(Clock::time_point now, std::vector<uint64_t> &expired);
+        size_t size() const;
+        std::chrono::milliseconds tick() const;
+
+private:
+        static constexpr unsigned levels = 4;
+        static constexpr unsigned slot_bits = 8;
+        static constexpr unsigned slots = 1u << slot_bits;
+        static constexpr uint32_t none = UINT32_MAX;
+
+        struct Node
+        {
+                uint64_t token;
+                uint64_t expiry; // in ticks since start
+                uint32_t previous;
+                uint32_t next;
+                uint32_t slot; // level * slots + index, none while the node is free
+                uint32_t generation;
+        };
+
+        void link(uint32_t index);
+        void unlink(uint32_t index);
+        void cascade(unsigned level);
+        uint64_t to_tick(Clock::time_point time) const;
+
+        const std::chrono::milliseconds tick_length;
+        const Clock::time_point start;
+        uint64_t current = 0; // every tick up to and including this one has expired
+        size_t active = 0;
+        std::vector<Node> nodes;
+        std::vector<uint32_t> free_nodes;
+        std::array<uint32_t, levels * slots> heads;
+};
@@ -0,0 +1,420 @@
+#include "bitfield.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BITFIELD_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+        // n is a whole number of padded words in every kernel, from need not be
+        struct Kernels
+        {
+                const char *name;
+                size_t (*count)(const uint64_t *words, size_t n);
+                size_t (*count_and_not)(const uint64_t *words, const uint64_t *mask, size_t n);
+                size_t (*find_and_not)(const uint64_t *words, const uint64_t *mask, size_t from, size_t n); // word index or n
+        };
+
+        size_t count_generic(const uint64_t *words, const size_t n)
+        {
+                size_t total = 0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                        total += static_cast<size_t>(std::popcount(words[i]));
+                }
+                return total;
+        }
+
+        size_t count_and_not_generic(const uint64_t *words, const uint64_t *mask, const size_t n)
+        {
+                size_t total = 0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                        total += static_cast<size_t>(std::popcount(words[i] & ~mask[i]));
+                }
+                return total;
+        }
+
+        size_t find_and_not_generic(const uint64_t *words, const uint64_t *mask, size_t from, const size_t n)
+        {
+                while (from < n && (words[from] & ~mask[from]) == 0)
+                {
+                        ++from;
+                }
+                return from;
+        }
+
+        constexpr Kernels generic{"generic", count_generic, count_and_not_generic, find_and_not_generic};
+
+#ifdef BITFIELD_X86
+        __attribute__((target("popcnt"))) size_t count_popcnt(const uint64_t *words, const size_t n)
+        {
+                size_t total = 0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                        total += static_cast<size_t>(__builtin_popcountll(words[i]));
+                }
+                return total;
+        }
+
+        __attribute__((target("popcnt"))) size_t count_and_not_popcnt(const uint64_t *words, const uint64_t *mask, const size_t n)
+        {
+                size_t total = 0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                        total += static_cast<size_t>(__builtin_popcountll(words[i] & ~mask[i]));
+                }
+                return total;
+        }
+
+        // a nibble lookup per byte with vpshufb, summed per 64-bit lane with vpsadbw (Mula et al.)
+        __attribute__((target("avx2"))) inline __m256i popcount_lanes(const __m256i v)
+        {
+                const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+                const __m256i low = _mm256_set1_epi8(0x0f);
+                const __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low)),
+                                                       _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+                return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+        }
+
+        __attribute__((target("avx2"))) size_t sum_lanes(const __m256i total)
+        {
+                return static_cast<size_t>(_mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+                                           _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3));
+        }
+
+        __attribute__((target("avx2"))) size_t count_avx2(const uint64_t *words, const size_t n)
+        {
+                __m256i total = _mm256_setzero_si256();
+                for (size_t i = 0; i < n; i += 4)
+                {
+                        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i));
+                        total = _mm256_add_epi64(total, popcount_lanes(v));
+                }
+                return sum_lanes(total);
+        }
+
+        __attribute__((target("avx2"))) size_t count_and_not_avx2(const uint64_t *words, const uint64_t *mask, const size_t n)
+        {
+                __m256i total = _mm256_setzero_si256();
+                for (size_t i = 0; i < n; i += 4)
+                {
+                        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i));
+                        const __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask + i));
+                        total = _mm256_add_epi64(total, popcount_lanes(_mm256_andnot_si256(m, v)));
+                }
+                return sum_lanes(total);
+        }
+
+        __attribute__((target("avx2"))) size_t find_and_not_avx2(const uint64_t *words, const uint64_t *mask, size_t from, const size_t n)
+        {
+                while (from < n && from % 4 != 0)
+                {
+                        if ((words[from] & ~mask[from]) != 0)
+                        {
+                                return from;
+                        }
+                        ++from;
+                }
+                for (; from < n; from += 4)
+                {
+                        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + from));
+                        const __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask + from));
+                        if (!_mm256_testc_si256(m, v)) // some bit of v is clear in m
+                        {
+                                return find_and_not_generic(words, mask, from, from + 4);
+                        }
+                }
+                return n;
+        }
+
+        constexpr Kernels popcnt{"popcnt", count_popcnt, count_and_not_popcnt, find_and_not_generic};
+        constexpr Kernels avx2{"avx2", count_avx2, count_and_not_avx2, find_and_not_avx2};
+#endif
+
+        const Kernels &kernels()
+        {
+#ifdef BITFIELD_X86
+                static const Kernels &selected = __builtin_cpu_supports("avx2") ? avx2 : __builtin_cpu_supports("popcnt") ? popcnt : generic;
+                return selected;
+#else
+                return generic;
+#endif
+        }
+
+        uint64_t big_endian(const uint64_t word)
+        {
+                if constexpr (std::endian::native == std::endian::little)
+                {
+                        return std::byteswap(word);
+                }
+                return word;
+        }
+
+        size_t padded_words(const size_t size)
+        {
+                return (size + 255) / 256 * 4;
+        }
+}
+
+Bitfield::Bitfield(const size_t size) : words(padded_words(size)), length(size)
+{
+}
+
+Bitfield Bitfield::from_wire(const std::span<const uint8_t> payload, const size_t size)
+{
+        Bitfield result{size};
+        if (payload.size() != result.wire_size())
+        {
+                throw std::invalid_argument("Bitfield of " + std::to_string(payload.size()) + " bytes for " + std::to_string(size) + " pieces");
+        }
+
+        size_t byte = 0;
+        for (; byte + 8 <= payload.size(); byte += 8)
+        {
+                uint64_t word;
+                std::memcpy(&word, payload.data() + byte, sizeof(word));
+                result.words[byte / 8] = big_endian(word);
+        }
+        for (; byte < payload.size(); ++byte)
+        {
+                result.words[byte / 8] |= uint64_t{payload[byte]} << (56 - 8 * (byte % 8));
+        }
+
+        if (size % 64 != 0 && (result.words[size / 64] & (~uint64_t{0} >> (size % 64))) != 0)
+        {
+                throw std::invalid_argument("Bitfield has spare bits set");
+        }
+        return result;
+}
+
+size_t Bitfield::wire_size() const
+{
+        return (length + 7) / 8;
+}
+
+void Bitfield::to_wire(const std::span<uint8_t> out) const
+{
+        const size_t bytes = std::min(out.size(), wire_size());
+        size_t byte = 0;
+        for (; byte + 8 <= bytes; byte += 8)
+        {
+                const uint64_t word = big_endian(words[byte / 8]);
+                std::memcpy(out.data() + byte, &word, sizeof(word));
+        }
+        for (; byte < bytes; ++byte)
+        {
+                out[byte] = static_cast<uint8_t>(words[byte / 8] >> (56 - 8 * (byte % 8)));
+        }
+}
+
+std::vector<uint8_t> Bitfield::to_wire() const
+{
+        std::vector<uint8_t> out(wire_size());
+        to_wire(out);
+        return out;
+}
+
+size_t Bitfield::size() const
+{
+        return length;
+}
+
+bool Bitfield::test(const size_t index) const
+{
+        return index < length && (words[index / 64] & (top >> (index % 64))) != 0;
+}
+
+void Bitfield::set(const size_t index)
+{
+        if (index >= length)
+        {
+                throw std::out_of_range("Bit " + std::to_string(index) + " of " + std::to_string(length));
+        }
+        words[index / 64] |= top >> (index % 64);
+}
+
+void Bitfield::reset(const size_t index)
+{
+        if (index < length)
+        {
+                words[index / 64] &= ~(top >> (index % 64));
+        }
+}
+
+void Bitfield::set_all()
+{
+        std::fill(words.begin(), words.end(), 0);
+        std::fill(words.begin(), words.begin() + static_cast<std::ptrdiff_t>(length / 64), ~uint64_t{0});
+        if (length % 64 != 0)
+        {
+                words[length / 64] = ~(~uint64_t{0} >> (length % 64));
+        }
+}
+
+size_t Bitfield::count() const
+{
+        return kernels().count(words.data(), words.size());
+}
+
+bool Bitfield::all() const
+{
+        return count() == length;
+}
+
+bool Bitfield::none() const
+{
+        return find_first() == npos;
+}
+
+size_t Bitfield::find_first() const
+{
+        return find_next(0);
+}
+
+size_t Bitfield::find_next(const size_t index) const
+{
+        if (index >= length)
+        {
+                return npos;
+        }
+        size_t word = index / 64;
+        uint64_t bits = words[word] & (~uint64_t{0} >> (index % 64));
+        while (bits == 0)
+        {
+                if (++word == words.size())
+                {
+                        return npos;
+                }
+                bits = words[word];
+        }
+        return word * 64 + static_cast<size_t>(std::countl_zero(bits));
+}
+
+// a shorter mask counts as clear past its end
+size_t Bitfield::count_and_not(const Bitfield &mask) const
+{
+        const size_t common = std::min(words.size(), mask.words.size());
+        return kernels().count_and_not(words.data(), mask.words.data(), common) +
+               kernels().count(words.data() + common, words.size() - common);
+}
+
+size_t Bitfield::find_first_and_not(const Bitfield &mask, const size_t from) const
+{
+        if (from >= length)
+        {
+                return npos;
+        }
+        const size_t common = std::min(words.size(), mask.words.size());
+        const auto masked = [this, &mask, common](const size_t word)
+        { return words[word] & ~(word < common ? mask.words[word] : 0); };
+
+        size_t word = from / 64;
+        uint64_t bits = masked(word) & (~uint64_t{0} >> (from % 64));
+        if (bits == 0)
+        {
+                word = word + 1 < common ? kernels().find_and_not(words.data(), mask.words.data(), word + 1, common) : word + 1;
+                while (word < words.size() && (bits = masked(word)) == 0)
+                {
+                        ++word;
+                }
+                if (word == words.size())
+                {
+                        return npos;
+                }
+        }
+        return word * 64 + static_cast<size_t>(std::countl_zero(bits));
+}
+
+std::span<const uint64_t> Bitfield::data() const
+{
+        return words;
+}
+
+const char *Bitfield::implementation()
+{
+        return kernels().name;
+}
+
+BitfieldBenchmark benchmark_bitfield(const size_t pieces, const size_t peers)
+{
+        using Clock = std::chrono::steady_clock;
+
+        // we have the first 90% of the torrent and every other piece of the rest, so the finds run a long way
+        std::mt19937_64 random{1};
+        Bitfield ours{pieces};
+        for (size_t index = 0; index < pieces; ++index)
+        {
+                if (index < pieces / 10 * 9 || random() % 2 == 0)
+                {
+                        ours.set(index);
+                }
+        }
+        std::vector<Bitfield> theirs;
+        for (size_t peer = 0; peer < peers; ++peer)
+        {
+                theirs.emplace_back(pieces);
+                for (size_t index = 0; index < pieces; ++index)
+                {
+                        if (random() % 2 == 0)
+                        {
+                                theirs.back().set(index);
+                        }
+                }
+        }
+        const std::vector<uint8_t> our_wire = ours.to_wire();
+        std::vector<std::vector<uint8_t>> their_wire;
+        for (const Bitfield &peer : theirs)
+        {
+                their_wire.push_back(peer.to_wire());
+        }
+
+        BitfieldBenchmark result{Bitfield::implementation(), 0, 0, 0, peers};
+        std::vector<size_t> expected;
+
+        auto start = Clock::now();
+        for (const auto &peer : their_wire)
+        {
+                size_t interesting = 0;
+                size_t first = pieces;
+                for (size_t index = 0; index < pieces; ++index)
+                {
+                        const auto bit = static_cast<uint8_t>(0x80 >> (index % 8));
+                        if ((peer[index / 8] & bit) != 0 && (our_wire[index / 8] & bit) == 0)
+                        {
+                                first = interesting++ == 0 ? index : first;
+                        }
+                }
+                expected.push_back(interesting << 32 | first);
+        }
+        result.bytewise_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        // the kernels straight, the way Bitfield calls them
+        const auto run = [&](const Kernels &code)
+        {
+                const auto begin = Clock::now();
+                for (size_t peer = 0; peer < peers; ++peer)
+                {
+                        const auto words = theirs[peer].data();
+                        const auto mask = ours.data();
+                        const size_t interesting = code.count_and_not(words.data(), mask.data(), words.size());
+                        const size_t word = code.find_and_not(words.data(), mask.data(), 0, words.size());
+                        const size_t first = word == words.size() ? pieces : word * 64 + static_cast<size_t>(std::countl_zero(words[word] & ~mask[word]));
+                        if ((interesting << 32 | first) != expected[peer])
+                        {
+                                throw std::logic_error(std::string{"Bitfield code path "} + code.name + " disagrees with the bytewise loop");
+                        }
+                }
+                return std::chrono::duration<double>(Clock::now() - begin).count();
+        };
+        result.scalar_seconds = run(generic);
+        result.simd_seconds = run(kernels());
+        return result;
+}
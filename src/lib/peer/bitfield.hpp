@@ -0,0 +1,77 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// One bit per piece in 64-bit words, the first piece in the top bit of the first word, so a word is the big-endian
+// reading of 8 bytes of the wire bitfield. Words are padded to 32 bytes with zeroes, which lets the bulk operations
+// run in whole AVX2 registers; the code path is picked for the CPU at runtime.
+class Bitfield
+{
+public:
+        static constexpr size_t npos = SIZE_MAX;
+
+        Bitfield() = default;
+        explicit Bitfield(size_t size); // all clear
+
+        // the payload of a bitfield message, throws std::invalid_argument on a wrong length or spare bits set
+        static Bitfield from_wire(std::span<const uint8_t> payload, size_t size);
+        size_t wire_size() const;
+        void to_wire(std::span<uint8_t> out) const; // out holds wire_size() bytes
+        std::vector<uint8_t> to_wire() const;
+
+        size_t size() const;
+        bool test(size_t index) const; // false past the end
+        void set(size_t index);
+        void reset(size_t index);
+        void set_all();
+
+        size_t count() const;
+        bool all() const;
+        bool none() const;
+        size_t find_first() const;
+        size_t find_next(size_t index) const; // the first set bit at or after index
+
+        // bits set here and clear in mask, which is what a peer has that we still need
+        size_t count_and_not(const Bitfield &mask) const;
+        size_t find_first_and_not(const Bitfield &mask, size_t from = 0) const;
+
+        template <typename Visit>
+        void for_each(Visit visit) const // every set bit in order
+        {
+                for (size_t word = 0; word < words.size(); ++word)
+                {
+                        for (uint64_t bits = words[word]; bits != 0;)
+                        {
+                                const auto bit = static_cast<size_t>(std::countl_zero(bits));
+                                visit(word * 64 + bit);
+                                bits &= ~(top >> bit);
+                        }
+                }
+        }
+
+        std::span<const uint64_t> data() const; // whole words, padding included
+
+        // name of the code path picked for this CPU ("avx2", "popcnt" or "generic")
+        static const char *implementation();
+
+private:
+        static constexpr uint64_t top = uint64_t{1} << 63;
+        static constexpr size_t padding = 4; // words per AVX2 register
+
+        std::vector<uint64_t> words;
+        size_t length = 0;
+};
+
+struct BitfieldBenchmark
+{
+        const char *implementation;
+        double bytewise_seconds; // the same work on wire bytes, one bit at a time
+        double scalar_seconds;   // 64-bit words without SIMD or POPCNT
+        double simd_seconds;     // the code path picked for this CPU
+        uint64_t operations;     // interest checks, each an AND-NOT count and find over the whole bitfield
+};
+
+BitfieldBenchmark benchmark_bitfield(size_t pieces, size_t peers);
@@ -0,0 +1,720 @@
+#include "download.hpp"
+#include "../hash/sha1.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+static_assert(block_size == BlockPool::block_bytes, "a block must fit one pool buffer");
+
+PieceLayout PieceLayout::from_info(const json &info)
+{
+        PieceLayout layout;
+        if (info.contains("length"))
+        {
+                layout.total_length = info.at("length").get<uint64_t>();
+        }
+        else
+        {
+                for (const auto &file : info.at("files"))
+                {
+                        layout.total_length += file.at("length").get<uint64_t>();
+                }
+        }
+        layout.piece_length = info.at("piece length").get<uint32_t>();
+        layout.piece_hashes = info.at("pieces").get<std::string>();
+
+        if (layout.piece_length == 0 || layout.piece_hashes.size() % 20 != 0 ||
+            layout.piece_count() != (layout.total_length + layout.piece_length - 1) / layout.piece_length)
+        {
+                throw std::invalid_argument("Piece hashes do not match the torrent's length");
+        }
+        return layout;
+}
+
+uint32_t PieceLayout::piece_count() const
+{
+        return static_cast<uint32_t>(piece_hashes.size() / 20);
+}
+
+uint32_t PieceLayout::piece_size(const uint32_t index) const
+{
+        const uint64_t begin = uint64_t{index} * piece_length;
+        return static_cast<uint32_t>(std::min<uint64_t>(piece_length, total_length - begin));
+}
+
+uint32_t PieceLayout::block_count(const uint32_t index) const
+{
+        return static_cast<uint32_t>((piece_size(index) + block_size - 1) / block_size);
+}
+
+Download::Download(const Handshake &local, PieceLayout layout, PieceCallback callback, const Options options)
+    : layout(std::move(layout)), callback(std::move(callback)), options(options),
+      block_pool(options.block_pool ? *options.block_pool : BlockPool::shared()),
+      reactor(local,
+              {
+                  .on_connected = [this](const ConnectionId connection)
+                  {
+                          peers.at(connection).connected = true;
+                          --connecting;
+                  },
+                  .on_handshake = {},
+                  .on_message = [this](const ConnectionId connection, const PeerMessage &message)
+                  { on_message(connection, message); },
+                  .on_close = [this](const ConnectionId connection, const std::string &reason)
+                  { on_close(connection, reason); },
+              },
+              [&options]
+              {
+                      PeerReactor::Options reactor_options;
+                      reactor_options.connect_timeout = options.connect_timeout;
+                      return reactor_options;
+              }()),
+      pieces(this->layout.piece_count()), picker(this->layout.piece_count())
+{
+}
+
+Download::Download(const Handshake &local, PieceLayout layout, PieceCallback callback)
+    : Download(local, std::move(layout), std::move(callback), Options{})
+{
+}
+
+// returns once every wanted piece passed its hash check
+void Download::run(const std::vector<PeerEndpoint> &endpoints, const std::vector<uint32_t> &wanted)
+{
+        for (const uint32_t index : wanted)
+        {
+                if (index >= pieces.size())
+                {
+                        throw std::out_of_range("Piece " + std::to_string(index) + " is out of range");
+                }
+                if (!pieces[index].wanted && !pieces[index].done)
+                {
+                        pieces[index].wanted = true;
+                        picker.add(index, false);
+                        ++remaining;
+                }
+        }
+        unneeded = Bitfield{pieces.size()};
+        unneeded.set_all();
+        for (uint32_t index = 0; index < pieces.size(); ++index)
+        {
+                if (pieces[index].wanted && !pieces[index].done)
+                {
+                        unneeded.reset(index);
+                }
+        }
+        for (auto &[connection, peer] : peers)
+        {
+                peer.interesting = peer.have.count_and_not(unneeded);
+                update_interest(connection, peer);
+        }
+        candidates.insert(candidates.end(), endpoints.begin(), endpoints.end());
+
+        auto next_progress = PeerReactor::Clock::now() + options.progress_interval;
+        while (remaining > 0)
+        {
+                connect_more();
+                if (peers.empty())
+                {
+                        throw std::runtime_error("Ran out of peers with " + std::to_string(remaining) + " pieces missing");
+                }
+                reactor.poll(std::chrono::milliseconds{100});
+                if (released)
+                {
+                        released = false;
+                        refill();
+                }
+
+                if (options.progress && PeerReactor::Clock::now() >= next_progress)
+                {
+                        options.progress(*this);
+                        next_progress += options.progress_interval;
+                }
+        }
+
+        std::vector<ConnectionId> open;
+        for (const auto &[connection, peer] : peers)
+        {
+                open.push_back(connection);
+        }
+        for (const ConnectionId connection : open)
+        {
+                reactor.close(connection, "Download complete");
+        }
+}
+
+const Download::Statistics &Download::statistics() const
+{
+        return counters;
+}
+
+std::vector<Download::PeerStatistics> Download::peer_statistics() const
+{
+        std::vector<PeerStatistics> result;
+        for (const auto &[connection, peer] : peers)
+        {
+                if (peer.connected)
+                {
+                        result.push_back(describe(connection, peer));
+                }
+        }
+        return result;
+}
+
+void Download::connect_more()
+{
+        while (peers.size() < options.max_peers && connecting < options.half_open && next_candidate < candidates.size())
+        {
+                const ConnectionId connection = reactor.connect(candidates[next_candidate++]);
+                peers.emplace(connection, Peer{}).first->second.depth = options.pipeline ? options.pipeline : options.initial_pipeline;
+                ++connecting;
+                ++counters.peers_tried;
+        }
+}
+
+void Download::on_message(const ConnectionId connection, const PeerMessage &message)
+{
+        Peer &peer = peers.at(connection);
+        switch (message.type)
+        {
+        case MessageType::bitfield:
+                try
+                {
+                        if (peer.have.size() != 0)
+                        {
+                                throw std::invalid_argument("Bitfield after the first message");
+                        }
+                        peer.have = Bitfield::from_wire(message.payload, pieces.size());
+                }
+                catch (const std::invalid_argument &e)
+                {
+                        reactor.close(connection, std::string{"Peer sent a bitfield that does not fit the torrent: "} + e.what());
+                        return;
+                }
+                peer.seed = peer.have.all();
+                peer.seed ? picker.add_seed() : picker.add_bitfield(peer.have);
+                peer.interesting = peer.have.count_and_not(unneeded);
+                update_interest(connection, peer);
+                break;
+        case MessageType::have:
+                if (message.index >= pieces.size())
+                {
+                        reactor.close(connection, "Peer has a piece the torrent does not");
+                        return;
+                }
+                if (peer.have.size() == 0)
+                {
+                        peer.have = Bitfield{pieces.size()};
+                }
+                if (!peer.have.test(message.index))
+                {
+                        peer.have.set(message.index);
+                        if (!peer.seed)
+                        {
+                                picker.increment(message.index);
+                        }
+                        peer.interesting += unneeded.test(message.index) ? 0 : 1;
+                        update_interest(connection, peer);
+                }
+                break;
+        case MessageType::unchoke:
+                if (peer.choked)
+                {
+                        peer.choked = false;
+                        ++counters.peers_unchoked;
+                }
+                break;
+        case MessageType::choke:
+                // the peer drops whatever we asked for, other peers may pick the pieces up
+                peer.choked = true;
+                release(connection, peer);
+                return;
+        case MessageType::piece:
+                on_block(connection, peer, message);
+                if (!peers.contains(connection))
+                {
+                        return;
+                }
+                break;
+        default:
+                return;
+        }
+        fill(connection, peer);
+}
+
+void Download::on_block(const ConnectionId connection, Peer &peer, const PeerMessage &message)
+{
+        counters.received_bytes += message.length;
+        peer.received_bytes += message.length;
+
+        // normally the oldest request; a block that crossed our cancel on the wire is wasted, anything else was
+        // never asked for and goes nowhere near the pool
+        std::optional<PeerReactor::Clock::time_point> sent;
+        const auto request = std::find_if(peer.outstanding.begin(), peer.outstanding.end(), [&message](const Request &candidate)
+                                          { return candidate.index == message.index && candidate.begin == message.begin; });
+        if (request != peer.outstanding.end())
+        {
+                if (request->timed)
+                {
+                        sent = request->sent;
+                }
+                peer.outstanding.erase(request);
+        }
+        else if (const auto cancelled = std::ranges::find(peer.cancelled, std::pair{message.index, message.begin}); cancelled != peer.cancelled.end())
+        {
+                peer.cancelled.erase(cancelled);
+        }
+        else
+        {
+                reactor.close(connection, "Peer sent a block that was never requested");
+                return;
+        }
+        update_depth(peer, PeerReactor::Clock::now(), message.length, sent);
+
+        // every request asks for a whole block, or for the rest of the last piece
+        if (message.length != std::min<uint32_t>(block_size, layout.piece_size(message.index) - message.begin))
+        {
+                reactor.close(connection, "Peer sent a block of the wrong length");
+                return;
+        }
+
+        // blocks of pieces that changed hands in the meantime are still good, the hash check has the last word
+        Piece &piece = pieces[message.index];
+        const uint32_t block = message.begin / block_size;
+        if (!piece.wanted || piece.done || piece.blocks.empty() || piece.blocks[block] == block_received)
+        {
+                counters.wasted_bytes += message.length;
+                return;
+        }
+        piece.data[block] = block_pool.acquire(message.length);
+        std::memcpy(piece.data[block].data(), message.payload.data(), message.length);
+        piece.blocks[block] = block_received;
+        piece.senders[block] = connection;
+
+        if (const auto found = requesters.find(block_key(message.index, block)); found != requesters.end())
+        {
+                const std::vector<ConnectionId> others = std::move(found->second);
+                requesters.erase(found);
+                for (const ConnectionId other : others)
+                {
+                        if (other != connection)
+                        {
+                                cancel(other, message.index, message.begin, message.length);
+                        }
+                }
+        }
+        if (++piece.received == piece.blocks.size())
+        {
+                finish_piece(message.index);
+        }
+}
+
+void Download::on_close(const ConnectionId connection, const std::string &)
+{
+        const auto found = peers.find(connection);
+        if (found == peers.end())
+        {
+                return;
+        }
+        if (!found->second.connected)
+        {
+                --connecting;
+        }
+        if (found->second.received_bytes > 0)
+        {
+                counters.contributions.push_back(describe(connection, found->second));
+        }
+        if (found->second.seed)
+        {
+                picker.remove_seed();
+        }
+        else
+        {
+                picker.remove_bitfield(found->second.have);
+        }
+        release(connection, found->second);
+        peers.erase(found);
+}
+
+// tops the peer's request pipeline up, claiming new pieces as the current ones run out of blocks
+void Download::fill(const ConnectionId connection, Peer &peer)
+{
+        if (peer.choked)
+        {
+                return;
+        }
+
+        requests.clear();
+        size_t owned = 0;
+        const auto now = PeerReactor::Clock::now();
+        while (peer.outstanding.size() < peer.depth)
+        {
+                if (owned == peer.pieces.size() && !claim(connection, peer))
+                {
+                        if (options.endgame && picker.size() == 0)
+                        {
+                                duplicate(connection, peer, now);
+                        }
+                        break;
+                }
+
+                const uint32_t index = peer.pieces[owned];
+                Piece &piece = pieces[index];
+                while (piece.cursor < piece.blocks.size() && piece.blocks[piece.cursor] != block_missing)
+                {
+                        ++piece.cursor;
+                }
+                if (piece.cursor == piece.blocks.size())
+                {
+                        ++owned;
+                        continue;
+                }
+
+                piece.blocks[piece.cursor] = block_requested;
+                request(peer, index, piece.cursor, now);
+        }
+
+        if (!requests.empty())
+        {
+                reactor.send(connection, requests);
+        }
+}
+
+// the rarest wanted piece nobody works on that the peer has
+bool Download::claim(const ConnectionId connection, Peer &peer)
+{
+        const std::optional<uint32_t> picked = picker.pick(peer.have, peer.seed);
+        if (!picked)
+        {
+                return false;
+        }
+
+        const uint32_t index = *picked;
+        Piece &piece = pieces[index];
+        picker.remove(index);
+        piece.claimed = true;
+        piece.owner = connection;
+        if (piece.blocks.empty())
+        {
+                piece.blocks.assign(layout.block_count(index), block_missing);
+                piece.data.resize(piece.blocks.size());
+                piece.senders.resize(piece.blocks.size());
+        }
+        peer.pieces.push_back(index);
+        return true;
+}
+
+// Endgame: every wanted piece is claimed, so rather than idle the peer asks for blocks of other peers' pieces,
+// unrequested ones first as their owners are busy elsewhere, then ones already asked for, up to
+// endgame_requesters peers per block. The first copy to arrive cancels the others in on_block().
+void Download::duplicate(const ConnectionId connection, Peer &peer, const PeerReactor::Clock::time_point now)
+{
+        if (counters.endgame_pieces == 0)
+        {
+                counters.endgame_pieces = remaining;
+        }
+
+        for (const uint8_t wanted_state : {block_missing, block_requested})
+        {
+                for (const auto &[other, other_peer] : peers)
+                {
+                        if (other == connection)
+                        {
+                                continue;
+                        }
+                        for (const uint32_t index : other_peer.pieces)
+                        {
+                                Piece &piece = pieces[index];
+                                if (!has_piece(peer, index))
+                                {
+                                        continue;
+                                }
+                                for (uint32_t block = 0; block < piece.blocks.size(); ++block)
+                                {
+                                        if (peer.outstanding.size() >= peer.depth)
+                                        {
+                                                return;
+                                        }
+                                        if (piece.blocks[block] != wanted_state)
+                                        {
+                                                continue;
+                                        }
+
+                                        // a requested block without an entry is the owner's own request
+                                        auto &asked = requesters[block_key(index, block)];
+                                        if (asked.empty() && wanted_state == block_requested)
+                                        {
+                                                asked.push_back(other);
+                                        }
+                                        if (asked.size() >= options.endgame_requesters || std::ranges::find(asked, connection) != asked.end())
+                                        {
+                                                continue;
+                                        }
+                                        counters.duplicate_requests += asked.empty() ? 0 : 1;
+                                        asked.push_back(connection);
+                                        piece.blocks[block] = block_requested;
+                                        request(peer, index, block, now);
+                                }
+                        }
+                }
+        }
+}
+
+void Download::request(Peer &peer, const uint32_t index, const uint32_t block, const PeerReactor::Clock::time_point now)
+{
+        const uint32_t begin = block * static_cast<uint32_t>(block_size);
+        const uint32_t length = std::min<uint32_t>(block_size, layout.piece_size(index) - begin);
+        const size_t offset = requests.size();
+        requests.resize(offset + request_message_size);
+        write_request(requests.data() + offset, MessageType::request, index, begin, length);
+        peer.outstanding.push_back({index, begin, now, peer.outstanding.size() < options.min_pipeline});
+        ++counters.requests;
+}
+
+void Download::cancel(const ConnectionId connection, const uint32_t index, const uint32_t begin, const uint32_t length)
+{
+        const auto found = peers.find(connection);
+        if (found == peers.end())
+        {
+                return;
+        }
+        auto &outstanding = found->second.outstanding;
+        const auto request = std::find_if(outstanding.begin(), outstanding.end(), [index, begin](const Request &candidate)
+                                          { return candidate.index == index && candidate.begin == begin; });
+        if (request == outstanding.end())
+        {
+                return;
+        }
+        outstanding.erase(request);
+        auto &cancelled = found->second.cancelled;
+        cancelled.emplace_back(index, begin);
+        if (cancelled.size() > options.max_pipeline)
+        {
+                cancelled.pop_front();
+        }
+        uint8_t message[request_message_size];
+        write_request(message, MessageType::cancel, index, begin, length);
+        reactor.send(connection, message);
+        ++counters.cancels;
+}
+
+// gives the peer's pieces back and its requests up, blocks other peers were also asked for stay theirs
+void Download::release(const ConnectionId connection, Peer &peer)
+{
+        for (const Request &request : peer.outstanding)
+        {
+                Piece &piece = pieces[request.index];
+                const uint32_t block = request.begin / block_size;
+                if (piece.done || piece.blocks.empty() || piece.blocks[block] != block_requested)
+                {
+                        continue;
+                }
+                if (const auto found = requesters.find(block_key(request.index, block)); found != requesters.end())
+                {
+                        std::erase(found->second, connection);
+                        if (!found->second.empty())
+                        {
+                                continue;
+                        }
+                        requesters.erase(found);
+                }
+                piece.blocks[block] = block_missing;
+                piece.cursor = std::min(piece.cursor, block);
+        }
+
+        for (const uint32_t index : peer.pieces)
+        {
+                Piece &piece = pieces[index];
+                if (piece.claimed && piece.owner == connection)
+                {
+                        piece.claimed = false;
+                        picker.add(index, piece.received > 0);
+                }
+        }
+        released = released || !peer.pieces.empty() || !peer.outstanding.empty();
+        peer.pieces.clear();
+        peer.outstanding.clear();
+        peer.cancelled.clear(); // a choking peer drops every request it has not answered
+}
+
+// fill() only runs on a peer's own messages, so unchoked peers with nothing outstanding would never see work
+// that a choke, a closed connection or a failed hash check gave back
+void Download::refill()
+{
+        std::vector<ConnectionId> unchoked;
+        for (const auto &[connection, peer] : peers)
+        {
+                if (peer.connected && !peer.choked)
+                {
+                        unchoked.push_back(connection);
+                }
+        }
+        for (const ConnectionId connection : unchoked)
+        {
+                // a failed send closes the connection and takes the peer away
+                if (const auto found = peers.find(connection); found != peers.end())
+                {
+                        fill(connection, found->second);
+                }
+        }
+}
+
+void Download::finish_piece(const uint32_t index)
+{
+        Piece &piece = pieces[index];
+        SHA1 sha1;
+        for (const BlockBuffer &block : piece.data)
+        {
+                sha1.add(block.data(), block.size());
+        }
+        unsigned char digest[SHA1::HashBytes];
+        sha1.getHash(digest);
+
+        if (piece.claimed)
+        {
+                auto &owned = peers.at(piece.owner).pieces;
+                owned.erase(std::find(owned.begin(), owned.end(), index));
+                piece.claimed = false;
+        }
+
+        if (std::memcmp(digest, layout.piece_hashes.data() + size_t{index} * 20, SHA1::HashBytes) != 0)
+        {
+                ++counters.hash_failures;
+                for (uint32_t block = 0; block < piece.blocks.size(); ++block)
+                {
+                        requesters.erase(block_key(index, block));
+                }
+                std::fill(piece.blocks.begin(), piece.blocks.end(), block_missing);
+                for (BlockBuffer &buffer : piece.data)
+                {
+                        buffer = BlockBuffer{};
+                }
+                piece.received = 0;
+                piece.cursor = 0;
+                picker.remove(index);
+                picker.add(index, false);
+                released = true;
+
+                // in the endgame or after a release the owner need not have sent any of it, so whoever did goes
+                std::vector<ConnectionId> senders = std::move(piece.senders);
+                piece.senders.assign(piece.blocks.size(), ConnectionId{});
+                std::ranges::sort(senders);
+                senders.erase(std::unique(senders.begin(), senders.end()), senders.end());
+                for (const ConnectionId sender : senders)
+                {
+                        if (peers.contains(sender))
+                        {
+                                reactor.close(sender, "Piece " + std::to_string(index) + " failed its hash check");
+                        }
+                }
+                return;
+        }
+
+        // a piece only counts as done once the callback has it, a write that throws leaves it missing
+        callback(index, piece.data);
+        piece.done = true;
+        picker.remove(index);
+        unneeded.set(index);
+        for (auto &[connection, peer] : peers)
+        {
+                if (peer.have.test(index))
+                {
+                        --peer.interesting;
+                        update_interest(connection, peer);
+                }
+        }
+        --remaining;
+        ++counters.pieces;
+        counters.verified_bytes += layout.piece_size(index);
+        std::vector<BlockBuffer>().swap(piece.data);
+        std::vector<uint8_t>().swap(piece.blocks);
+        std::vector<ConnectionId>().swap(piece.senders);
+}
+
+// sent is when the block was requested, for requests that went out into a short queue. Those RTTs are mostly path
+// delay, while deeper in a full queue they grow with the queue itself and would feed back into ever deeper queues
+// on a bandwidth limited peer. The lowest of them stands for the path delay; a 10 s window whose lowest sample is
+// higher moves it an eighth of the way up, so a path that got slower is followed slowly. Twice rate x that RTT keeps
+// the pipe full, lets the depth double per window while the peer keeps up, and settles once it stops doing so.
+void Download::update_depth(Peer &peer, const PeerReactor::Clock::time_point now, const uint32_t bytes,
+                            const std::optional<PeerReactor::Clock::time_point> sent)
+{
+        using std::chrono::microseconds;
+        constexpr auto rate_window = std::chrono::milliseconds{200};
+        constexpr auto rtt_window = std::chrono::seconds{10};
+
+        if (sent)
+        {
+                const auto rtt = std::max(microseconds{1}, std::chrono::duration_cast<microseconds>(now - *sent));
+                if (peer.window_min_rtt == microseconds{0} || rtt < peer.window_min_rtt)
+                {
+                        peer.window_min_rtt = rtt;
+                }
+                if (peer.min_rtt == microseconds{0} || rtt < peer.min_rtt)
+                {
+                        peer.min_rtt = rtt;
+                }
+        }
+        if (now - peer.rtt_window_start >= rtt_window && peer.rtt_window_start != PeerReactor::Clock::time_point{})
+        {
+                if (peer.window_min_rtt > peer.min_rtt)
+                {
+                        peer.min_rtt += (peer.window_min_rtt - peer.min_rtt) / 8;
+                }
+                peer.window_min_rtt = microseconds{0};
+                peer.rtt_window_start = now;
+        }
+
+        if (peer.window_bytes == 0 && peer.window_start == PeerReactor::Clock::time_point{})
+        {
+                peer.window_start = now;
+                peer.rtt_window_start = now;
+        }
+        peer.window_bytes += bytes;
+        const auto elapsed = now - peer.window_start;
+        if (elapsed < rate_window)
+        {
+                return;
+        }
+
+        const double sample = static_cast<double>(peer.window_bytes) / std::chrono::duration<double>(elapsed).count();
+        peer.rate = sample > peer.rate ? sample : 0.75 * peer.rate + 0.25 * sample; // rises at once, decays slowly
+        peer.window_bytes = 0;
+        peer.window_start = now;
+
+        if (options.pipeline == 0 && peer.min_rtt > microseconds{0})
+        {
+                const double bandwidth_delay = peer.rate * std::chrono::duration<double>(peer.min_rtt).count();
+                const auto depth = static_cast<size_t>(std::ceil(2 * bandwidth_delay / block_size));
+                peer.depth = std::clamp(depth, options.min_pipeline, options.max_pipeline);
+        }
+}
+
+// tells the peer whenever it turns interesting or stops being so
+void Download::update_interest(const ConnectionId connection, Peer &peer)
+{
+        if ((peer.interesting > 0) == peer.interested)
+        {
+                return;
+        }
+        peer.interested = !peer.interested;
+        uint8_t message[5];
+        reactor.send(connection, {message, write_message(message, peer.interested ? MessageType::interested : MessageType::not_interested)});
+}
+
+Download::PeerStatistics Download::describe(const ConnectionId connection, const Peer &peer) const
+{
+        return {reactor.endpoint(connection), peer.received_bytes, peer.rate, peer.min_rtt, peer.depth, peer.outstanding.size()};
+}
+
+bool Download::has_piece(const Peer &peer, const uint32_t index)
+{
+        return peer.have.test(index);
+}
+
+uint64_t Download::block_key(const uint32_t index, const uint32_t block)
+{
+        return uint64_t{index} << 32 | block;
+}
+
@@ -0,0 +1,183 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "bitfield.hpp"
+#include "picker.hpp"
+#include "reactor.hpp"
+#include "../net/block_pool.hpp"
+#include "../nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// v1 piece geometry of a torrent, every piece but the last is piece_length long
+struct PieceLayout
+{
+        uint64_t total_length = 0;
+        uint32_t piece_length = 0;
+        std::string piece_hashes; // 20 bytes of SHA-1 per piece
+
+        static PieceLayout from_info(const json &info);
+        uint32_t piece_count() const;
+        uint32_t piece_size(uint32_t index) const;
+        uint32_t block_count(uint32_t index) const;
+};
+
+// Fetches a set of pieces from many peers over one PeerReactor: every unchoked peer keeps its queue depth of block
+// requests in flight and claims another piece whenever its current ones are fully requested, so faster peers
+// end up with more pieces. Claims go rarest first through a PiecePicker. Once nothing is left to claim, peers
+// with room in their queue ask for blocks other peers are still fetching (endgame), and whichever copy arrives
+// first cancels the rest. Blocks land in pooled 16 KiB buffers as they arrive, and pieces are SHA-1 checked before
+// their blocks are handed to the callback.
+class Download
+{
+public:
+        using PieceCallback = std::function<void(uint32_t index, std::span<const BlockBuffer> blocks)>;
+
+        struct Options
+        {
+                size_t pipeline = 0; // fixed outstanding 16 KiB requests per peer, 0 sizes each queue from its bandwidth-delay product
+                size_t initial_pipeline = 16;
+                size_t min_pipeline = 2;
+                size_t max_pipeline = 1024;
+                size_t max_peers = 64;
+                size_t half_open = 32;
+                std::chrono::milliseconds connect_timeout{5000};
+                bool endgame = true;
+                size_t endgame_requesters = 2; // peers asked for the same block at most, the first one included
+                BlockPool *block_pool = nullptr; // where block buffers come from, BlockPool::shared() if null
+                std::function<void(const Download &)> progress; // called from run() every progress_interval
+                std::chrono::milliseconds progress_interval{1000};
+        };
+
+        struct PeerStatistics
+        {
+                PeerEndpoint endpoint;
+                uint64_t received_bytes = 0;
+                double rate = 0; // bytes per second, smoothed
+                std::chrono::microseconds min_rtt{0}; // request to block for requests sent into a short queue, see update_depth()
+                size_t depth = 0;
+                size_t in_flight = 0;
+        };
+
+        struct Statistics
+        {
+                uint64_t verified_bytes = 0;
+                uint64_t received_bytes = 0; // piece payload, including blocks that were not needed
+                uint64_t wasted_bytes = 0;   // blocks that arrived after another copy or for a finished piece
+                uint64_t requests = 0;
+                uint64_t duplicate_requests = 0; // endgame requests for blocks another peer was asked for
+                uint64_t cancels = 0;
+                uint32_t endgame_pieces = 0; // pieces missing when the endgame began, 0 if it never did
+                uint32_t pieces = 0;
+                uint32_t hash_failures = 0;
+                size_t peers_tried = 0;
+                size_t peers_unchoked = 0;
+                std::vector<PeerStatistics> contributions; // peers that sent blocks, as they were when they closed
+        };
+
+        Download(const Handshake &local, PieceLayout layout, PieceCallback callback, Options options);
+        Download(const Handshake &local, PieceLayout layout, PieceCallback callback);
+
+        void run(const std::vector<PeerEndpoint> &peers, const std::vector<uint32_t> &wanted); // throws when peers run out
+        const Statistics &statistics() const;
+        std::vector<PeerStatistics> peer_statistics() const; // connected peers
+
+private:
+        using ConnectionId = PeerReactor::ConnectionId;
+
+        enum BlockState : uint8_t
+        {
+                block_missing,
+                block_requested,
+                block_received,
+        };
+
+        struct Piece
+        {
+                bool wanted = false;
+                bool done = false;
+                ConnectionId owner = 0; // meaningful while claimed
+                bool claimed = false;
+                uint32_t received = 0;
+                uint32_t cursor = 0; // blocks before it are requested or received
+                std::vector<uint8_t> blocks; // BlockState per block
+                std::vector<BlockBuffer> data; // one per block, acquired as it arrives
+                std::vector<ConnectionId> senders; // per received block, who sent it
+        };
+
+        struct Request
+        {
+                uint32_t index;
+                uint32_t begin;
+                PeerReactor::Clock::time_point sent;
+                bool timed; // sent with fewer than min_pipeline requests ahead, so its RTT is hardly queueing
+        };
+
+        struct Peer
+        {
+                bool connected = false;
+                bool choked = true;
+                bool seed = false; // counted in the picker as a seed
+                bool interested = false; // as last told to the peer
+                Bitfield have; // empty until the bitfield or the first have message
+                size_t interesting = 0; // pieces it has that we still need
+                std::vector<uint32_t> pieces; // claimed, in claim order
+                std::deque<Request> outstanding; // oldest first, peers answer in order
+                std::deque<std::pair<uint32_t, uint32_t>> cancelled; // index and begin, the block may have crossed the cancel
+                uint64_t received_bytes = 0;
+
+                // queue depth from rate x RTT, see update_depth()
+                size_t depth = 0;
+                PeerReactor::Clock::time_point window_start;
+                uint64_t window_bytes = 0;
+                double rate = 0;
+                std::chrono::microseconds min_rtt{0}; // lowest timed RTT, creeps up towards higher windows
+                std::chrono::microseconds window_min_rtt{0};
+                PeerReactor::Clock::time_point rtt_window_start;
+        };
+
+        void connect_more();
+        void on_message(ConnectionId connection, const PeerMessage &message);
+        void on_block(ConnectionId connection, Peer &peer, const PeerMessage &message);
+        void on_close(ConnectionId connection, const std::string &reason);
+        void fill(ConnectionId connection, Peer &peer);
+        bool claim(ConnectionId connection, Peer &peer);
+        void duplicate(ConnectionId connection, Peer &peer, PeerReactor::Clock::time_point now);
+        void request(Peer &peer, uint32_t index, uint32_t block, PeerReactor::Clock::time_point now);
+        void cancel(ConnectionId connection, uint32_t index, uint32_t begin, uint32_t length);
+        void release(ConnectionId connection, Peer &peer);
+        void refill();
+        void finish_piece(uint32_t index);
+        void update_interest(ConnectionId connection, Peer &peer);
+        void update_depth(Peer &peer, PeerReactor::Clock::time_point now, uint32_t bytes, std::optional<PeerReactor::Clock::time_point> sent);
+        PeerStatistics describe(ConnectionId connection, const Peer &peer) const;
+        static bool has_piece(const Peer &peer, uint32_t index);
+        static uint64_t block_key(uint32_t index, uint32_t block);
+
+        const PieceLayout layout;
+        const PieceCallback callback;
+        const Options options;
+        BlockPool &block_pool;
+        PeerReactor reactor;
+
+        std::vector<Piece> pieces;
+        Bitfield unneeded; // done or not wanted, a peer is interesting for what it has outside of it
+        PiecePicker picker;
+        std::unordered_map<ConnectionId, Peer> peers;
+        std::vector<PeerEndpoint> candidates;
+        size_t next_candidate = 0;
+        size_t connecting = 0;
+        uint32_t remaining = 0;
+        std::vector<uint8_t> requests; // outgoing request messages batched per fill()
+        std::unordered_map<uint64_t, std::vector<ConnectionId>> requesters; // endgame blocks, by block_key()
+        bool released = false; // pieces or blocks went back since the last refill()
+        Statistics counters;
+};
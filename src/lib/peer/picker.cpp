@@ -0,0 +1,313 @@
+#include "picker.hpp"
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+PiecePicker::PiecePicker(const uint32_t piece_count, const uint32_t seed)
+    : counts(piece_count), states(piece_count, not_pickable), positions(piece_count), buckets(2), random(seed)
+{
+}
+
+PiecePicker::PiecePicker(const uint32_t piece_count) : PiecePicker(piece_count, std::random_device{}())
+{
+}
+
+void PiecePicker::add(const uint32_t index, const bool partial_piece)
+{
+        if (states.at(index) != not_pickable)
+        {
+                return;
+        }
+        states[index] = partial_piece ? partial : whole;
+        ++pickable;
+        if (partial_piece)
+        {
+                insert(partials, index);
+        }
+        else if (!dirty)
+        {
+                insert(buckets[counts[index]], index);
+        }
+}
+
+void PiecePicker::remove(const uint32_t index)
+{
+        const State state = static_cast<State>(states.at(index));
+        if (state == not_pickable)
+        {
+                return;
+        }
+        if (state == partial)
+        {
+                erase(partials, index);
+        }
+        else if (!dirty)
+        {
+                erase(buckets[counts[index]], index);
+        }
+        states[index] = not_pickable;
+        --pickable;
+}
+
+bool PiecePicker::contains(const uint32_t index) const
+{
+        return states.at(index) != not_pickable;
+}
+
+size_t PiecePicker::size() const
+{
+        return pickable;
+}
+
+void PiecePicker::increment(const uint32_t index)
+{
+        move(index, counts.at(index) + 1);
+}
+
+void PiecePicker::decrement(const uint32_t index)
+{
+        if (counts.at(index) > 0)
+        {
+                move(index, counts[index] - 1);
+        }
+}
+
+void PiecePicker::add_bitfield(const Bitfield &have)
+{
+        count_bitfield(have, true);
+}
+
+void PiecePicker::remove_bitfield(const Bitfield &have)
+{
+        count_bitfield(have, false);
+}
+
+void PiecePicker::add_seed()
+{
+        ++seeds;
+}
+
+void PiecePicker::remove_seed()
+{
+        seeds -= seeds > 0 ? 1 : 0;
+}
+
+uint32_t PiecePicker::availability(const uint32_t index) const
+{
+        return counts.at(index) + seeds;
+}
+
+// A peer that is not a seed counts towards every piece it has, so the bucket of unannounced pieces only matters
+// to seeds. Partial pieces are few, the rarest of them wins.
+std::optional<uint32_t> PiecePicker::pick(const Bitfield &have, const bool seed)
+{
+        if (dirty)
+        {
+                rebuild();
+        }
+
+        uint32_t best = UINT32_MAX;
+        for (const uint32_t index : partials)
+        {
+                if ((seed || have.test(index)) && (best == UINT32_MAX || counts[index] < counts[best]))
+                {
+                        best = index;
+                }
+        }
+        if (best != UINT32_MAX)
+        {
+                return best;
+        }
+
+        for (size_t count = seed ? 0 : 1; count < buckets.size(); ++count)
+        {
+                const std::vector<uint32_t> &bucket = buckets[count];
+                const size_t start = bucket.empty() ? 0 : random() % bucket.size();
+                for (size_t offset = 0; offset < bucket.size(); ++offset)
+                {
+                        const uint32_t index = bucket[(start + offset) % bucket.size()];
+                        if (seed || have.test(index))
+                        {
+                                return index;
+                        }
+                }
+        }
+        return std::nullopt;
+}
+
+void PiecePicker::insert(std::vector<uint32_t> &bucket, const uint32_t index)
+{
+        positions[index] = static_cast<uint32_t>(bucket.size());
+        bucket.push_back(index);
+}
+
+void PiecePicker::erase(std::vector<uint32_t> &bucket, const uint32_t index)
+{
+        const uint32_t position = positions[index];
+        bucket[position] = bucket.back();
+        positions[bucket[position]] = position;
+        bucket.pop_back();
+}
+
+void PiecePicker::move(const uint32_t index, const uint32_t count)
+{
+        const bool bucketed = states[index] == whole && !dirty;
+        if (bucketed)
+        {
+                erase(buckets[counts[index]], index);
+        }
+        counts[index] = count;
+        if (count >= buckets.size())
+        {
+                buckets.resize(count + 1);
+        }
+        if (bucketed)
+        {
+                insert(buckets[count], index);
+        }
+}
+
+// a sparse bitfield is cheaper to apply piece by piece than to pay for a rebuild
+void PiecePicker::count_bitfield(const Bitfield &have, const bool add)
+{
+        const size_t announced = have.count();
+        if (!dirty && announced * 32 < counts.size())
+        {
+                have.for_each([this, add](const size_t index)
+                              { add ? increment(static_cast<uint32_t>(index)) : decrement(static_cast<uint32_t>(index)); });
+                return;
+        }
+
+        // dense: every bit is added, set or not, which the compiler turns into straight-line code
+        const std::span<const uint64_t> words = have.data();
+        const size_t limit = std::min(counts.size(), have.size());
+        uint32_t *count = counts.data();
+        for (size_t word = 0; word * 64 < limit; ++word, count += 64)
+        {
+                const uint64_t bits = words[word];
+                const size_t width = std::min<size_t>(64, limit - word * 64);
+                for (size_t bit = 0; bit < width; ++bit)
+                {
+                        const auto set = static_cast<uint32_t>(bits >> (63 - bit)) & 1;
+                        count[bit] = add ? count[bit] + set : count[bit] - std::min(set, count[bit]);
+                }
+        }
+        dirty = dirty || announced > 0;
+}
+
+// a counting sort of the whole pickable pieces
+void PiecePicker::rebuild()
+{
+        // every count needs its bucket, pieces that become pickable later go straight in
+        uint32_t highest = 0;
+        for (const uint32_t count : counts)
+        {
+                highest = std::max(highest, count);
+        }
+        std::vector<uint32_t> sizes(std::max<size_t>(buckets.size(), size_t{highest} + 1));
+        for (uint32_t index = 0; index < counts.size(); ++index)
+        {
+                sizes[counts[index]] += states[index] == whole ? 1 : 0;
+        }
+        buckets.resize(std::max(buckets.size(), sizes.size()));
+        for (size_t count = 0; count < sizes.size(); ++count)
+        {
+                buckets[count].resize(sizes[count]);
+                sizes[count] = 0;
+        }
+        for (uint32_t index = 0; index < counts.size(); ++index)
+        {
+                if (states[index] == whole)
+                {
+                        const uint32_t position = sizes[counts[index]]++;
+                        buckets[counts[index]][position] = index;
+                        positions[index] = position;
+                }
+        }
+        dirty = false;
+}
+
+PickerBenchmark benchmark_picker(const uint32_t pieces, const size_t peers)
+{
+        using Clock = std::chrono::steady_clock;
+        const auto seconds_since = [](const Clock::time_point start)
+        { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+        // one peer in ten is a seed, the others have between an eighth and seven eighths of the pieces
+        std::mt19937_64 random{1};
+        std::vector<uint8_t> wire((size_t{pieces} + 7) / 8);
+        std::vector<Bitfield> bitfields(peers, Bitfield{pieces});
+        std::vector<bool> seeds(peers);
+        for (size_t peer = 0; peer < peers; ++peer)
+        {
+                seeds[peer] = peer % 10 == 0;
+                if (seeds[peer])
+                {
+                        continue;
+                }
+                const unsigned eighths = 1 + peer % 7;
+                for (uint8_t &byte : wire)
+                {
+                        const uint64_t a = random(), b = random(), c = random();
+                        const uint64_t mixed[] = {a & b & c, a & b, a & (b | c), a, a | (b & c), a | b, a | b | c};
+                        byte = static_cast<uint8_t>(mixed[eighths - 1]);
+                }
+                wire.back() &= static_cast<uint8_t>(0xff00 >> (pieces % 8 == 0 ? 8 : pieces % 8));
+                bitfields[peer] = Bitfield::from_wire(wire, pieces);
+        }
+
+        PiecePicker picker{pieces, 1};
+        for (uint32_t index = 0; index < pieces; ++index)
+        {
+                picker.add(index, false);
+        }
+
+        PickerBenchmark result{};
+        auto start = Clock::now();
+        for (size_t peer = 0; peer < peers; ++peer)
+        {
+                seeds[peer] ? picker.add_seed() : picker.add_bitfield(bitfields[peer]);
+                picker.pick(bitfields[peer], seeds[peer]);
+        }
+        result.bitfield_seconds = seconds_since(start);
+
+        start = Clock::now();
+        for (uint64_t message = 0; message < pieces; ++message)
+        {
+                const size_t peer = random() % peers;
+                const auto index = static_cast<uint32_t>(random() % pieces);
+                if (seeds[peer])
+                {
+                        continue;
+                }
+                if (bitfields[peer].test(index))
+                {
+                        continue;
+                }
+                bitfields[peer].set(index);
+                picker.increment(index);
+                ++result.haves;
+        }
+        result.have_seconds = seconds_since(start);
+
+        start = Clock::now();
+        for (uint32_t attempt = 0; attempt < pieces / 10; ++attempt)
+        {
+                const size_t peer = random() % peers;
+                if (const auto index = picker.pick(bitfields[peer], seeds[peer]))
+                {
+                        picker.remove(*index);
+                        ++result.picks;
+                }
+        }
+        result.pick_seconds = seconds_since(start);
+
+        start = Clock::now();
+        for (size_t peer = 0; peer < peers; ++peer)
+        {
+                seeds[peer] ? picker.remove_seed() : picker.remove_bitfield(bitfields[peer]);
+                picker.pick(bitfields[(peer + 1) % peers], seeds[(peer + 1) % peers]);
+        }
+        result.disconnect_seconds = seconds_since(start);
+        return result;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <vector>
+#include "bitfield.hpp"
+
+// Rarest-first piece selection. Pickable pieces sit in one bucket per availability, so a have message moves a
+// piece one bucket up in O(1) and a pick walks the buckets from the rarest end, starting each bucket at a random
+// place, which spreads peers with the same pieces over different ones. Whole bitfields only touch the
+// counts and leave the buckets to be rebuilt by the next pick, one pass over the pieces instead of a random move
+// per bit. Partially downloaded pieces are kept apart and picked before any other. Seeds only bump a counter, as
+// they have every piece alike.
+class PiecePicker
+{
+public:
+        PiecePicker(uint32_t piece_count, uint32_t seed);
+        explicit PiecePicker(uint32_t piece_count);
+
+        // pickable pieces are wanted, not done and nobody works on them
+        void add(uint32_t index, bool partial);
+        void remove(uint32_t index);
+        bool contains(uint32_t index) const;
+        size_t size() const;
+
+        // availability
+        void increment(uint32_t index);
+        void decrement(uint32_t index);
+        void add_bitfield(const Bitfield &have);
+        void remove_bitfield(const Bitfield &have);
+        void add_seed();
+        void remove_seed();
+        uint32_t availability(uint32_t index) const;
+
+        // the rarest pickable piece the peer has, ties broken at random and partial pieces first; leaves it pickable
+        std::optional<uint32_t> pick(const Bitfield &have, bool seed);
+
+private:
+        enum State : uint8_t
+        {
+                not_pickable,
+                whole,
+                partial,
+        };
+
+        void insert(std::vector<uint32_t> &bucket, uint32_t index);
+        void erase(std::vector<uint32_t> &bucket, uint32_t index);
+        void move(uint32_t index, uint32_t count);
+        void count_bitfield(const Bitfield &have, bool add);
+        void rebuild();
+
+        std::vector<uint32_t> counts; // peers that announced the piece, seeds aside
+        std::vector<uint8_t> states;
+        std::vector<uint32_t> positions; // in the piece's bucket or in partials, while pickable and not dirty
+        std::vector<std::vector<uint32_t>> buckets; // whole pickable pieces by count
+        std::vector<uint32_t> partials;
+        bool dirty = false; // buckets are out of date, counts are not
+        uint32_t seeds = 0;
+        size_t pickable = 0;
+        std::minstd_rand random;
+};
+
+struct PickerBenchmark
+{
+        double bitfield_seconds;   // every peer connects and sends its bitfield, a pick follows each
+        double have_seconds;       // have messages
+        double pick_seconds;       // picks, each claiming its piece
+        double disconnect_seconds; // every peer goes away again, a pick follows each
+        uint64_t haves;
+        uint64_t picks;
+};
+
+PickerBenchmark benchmark_picker(uint32_t pieces, size_t peers);
@@ -0,0 +1,119 @@
+#include "probe.hpp"
+#include "reactor.hpp"
+#include <stdexcept>
+#include <unordered_map>
+
+// handshakes with every peer concurrently on one reactor, at most half_open of them still connecting at a time
+std::vector<ProbeResult> probe_peers(const Handshake &local, const std::vector<PeerEndpoint> &peers, const ProbeOptions &options)
+{
+        using Clock = PeerReactor::Clock;
+        if (options.half_open == 0)
+        {
+                throw std::invalid_argument("Probing needs at least one half-open connection");
+        }
+
+        std::vector<ProbeResult> results(peers.size());
+        std::vector<Clock::time_point> started(peers.size());
+        std::unordered_map<PeerReactor::ConnectionId, size_t> probing; // connection to peer index
+        size_t next = 0;
+        size_t connecting = 0;
+        size_t finished = 0;
+
+        PeerReactor::Options reactor_options;
+        reactor_options.connect_timeout = options.connect_timeout;
+        reactor_options.handshake_timeout = options.handshake_timeout;
+        reactor_options.tick = std::chrono::milliseconds{10};
+        reactor_options.receive_buffer = 4096; // only the handshake is read
+
+        PeerReactor *reactor_pointer = nullptr;
+        PeerReactor reactor{local, {
+                                       .on_connected = [&](const PeerReactor::ConnectionId connection)
+                                       {
+                                               ProbeResult &result = results[probing.at(connection)];
+                                               result.connected = true;
+                                               result.connect_latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started[probing.at(connection)]);
+                                               --connecting;
+                                       },
+                                       .on_handshake = [&](const PeerReactor::ConnectionId connection, const Handshake &handshake)
+                                       {
+                                               const size_t index = probing.at(connection);
+                                               ProbeResult &result = results[index];
+                                               result.handshaken = true;
+                                               result.handshake_latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started[index]) - result.connect_latency;
+                                               result.peer_id = handshake.peer_id;
+                                               result.reserved = handshake.reserved;
+                                               reactor_pointer->close(connection, {});
+                                       },
+                                       .on_message = {},
+                                       .on_close = [&](const PeerReactor::ConnectionId connection, const std::string &reason)
+                                       {
+                                               ProbeResult &result = results[probing.at(connection)];
+                                               if (!result.connected)
+                                               {
+                                                       --connecting;
+                                               }
+                                               if (!result.handshaken)
+                                               {
+                                                       result.error = reason;
+                                               }
+                                               probing.erase(connection);
+                                               ++finished;
+                                       },
+                                   },
+                            reactor_options};
+        reactor_pointer = &reactor;
+
+        const auto deadline = Clock::now() + options.deadline;
+        while (finished < peers.size() && Clock::now() < deadline)
+        {
+                while (next < peers.size() && connecting < options.half_open)
+                {
+                        results[next].endpoint = peers[next];
+                        started[next] = Clock::now();
+                        probing.emplace(reactor.connect(peers[next]), next);
+                        ++connecting;
+                        ++next;
+                }
+                reactor.poll(std::chrono::milliseconds{10});
+        }
+
+        for (size_t index = 0; index < peers.size(); ++index)
+        {
+                results[index].endpoint = peers[index];
+                if (index >= next)
+                {
+                        results[index].error = "Not tried before the deadline";
+                }
+                else if (!results[index].handshaken && results[index].error.empty())
+                {
+                        results[index].error = "Probe deadline passed";
+                }
+        }
+        return results;
+}
+
+// BEP 10 extension protocol, BEP 5 DHT and BEP 6 fast extension bits, plus the raw reserved bytes
+std::string describe_extensions(const std::array<uint8_t, 8> &reserved)
+{
+        std::string description;
+        const auto add = [&](const bool present, const char *name)
+        {
+                if (present)
+                {
+                        description += description.empty() ? "" : ",";
+                        description += name;
+                }
+        };
+        add(reserved[5] & 0x10, "extension-protocol");
+        add(reserved[7] & 0x01, "dht");
+        add(reserved[7] & 0x04, "fast");
+
+        static constexpr char digits[] = "0123456789abcdef";
+        description += description.empty() ? "reserved " : " reserved ";
+        for (const uint8_t byte : reserved)
+        {
+                description += digits[byte >> 4];
+                description += digits[byte & 0x0f];
+        }
+        return description;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "wire.hpp"
+#include "../net/endpoint.hpp"
+
+struct ProbeOptions
+{
+        size_t half_open = 64; // connects in flight at once
+        std::chrono::milliseconds deadline{10000};
+        std::chrono::milliseconds connect_timeout{3000};
+        std::chrono::milliseconds handshake_timeout{5000};
+};
+
+struct ProbeResult
+{
+        PeerEndpoint endpoint;
+        bool connected = false;
+        bool handshaken = false;
+        std::chrono::microseconds connect_latency{0};   // connect() until the TCP connection is up
+        std::chrono::microseconds handshake_latency{0}; // from there until the peer's handshake arrived
+        std::array<uint8_t, 20> peer_id{};
+        std::array<uint8_t, 8> reserved{};
+        std::string error;
+};
+
+std::vector<ProbeResult> probe_peers(const Handshake &local, const std::vector<PeerEndpoint> &peers, const ProbeOptions &options);
+std::string describe_extensions(const std::array<uint8_t, 8> &reserved);
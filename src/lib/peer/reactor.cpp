@@ -0,0 +1,461 @@
+#include "reactor.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+PeerReactor::PeerReactor(const Handshake &local, Callbacks callbacks, const Options options)
+    : local(local), callbacks(std::move(callbacks)), options(options), wheel(options.tick)
+{
+}
+
+PeerReactor::PeerReactor(const Handshake &local, Callbacks callbacks)
+    : PeerReactor(local, std::move(callbacks), Options{})
+{
+}
+
+PeerReactor::~PeerReactor()
+{
+        for (const auto &connection : slots)
+        {
+                if (connection->state != State::closed)
+                {
+                        ::close(connection->fd);
+                }
+        }
+}
+
+// starts a non-blocking connect, the handshake goes out as soon as it completes
+PeerReactor::ConnectionId PeerReactor::connect(const PeerEndpoint &endpoint)
+{
+        const int fd = socket(endpoint.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+        {
+                throw std::runtime_error(std::string("Failed to create peer socket: ") + std::strerror(errno));
+        }
+        const int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        uint32_t slot;
+        if (free_slots.empty())
+        {
+                slot = static_cast<uint32_t>(slots.size());
+                slots.push_back(std::make_unique<Connection>());
+                slots.back()->input = RingBuffer{options.receive_buffer};
+        }
+        else
+        {
+                slot = free_slots.back();
+                free_slots.pop_back();
+        }
+
+        Connection &connection = *slots[slot];
+        const auto now = Clock::now();
+        connection.fd = fd;
+        connection.state = State::connecting;
+        connection.connected = false;
+        connection.endpoint = endpoint;
+        connection.output.resize(handshake_size);
+        write_handshake(connection.output.data(), local);
+        connection.deadline = now + options.connect_timeout;
+        connection.last_sent = now;
+        connection.connect_error = 0;
+        ++counters.connects;
+        ++counters.open;
+
+        sockaddr_storage storage;
+        const socklen_t length = endpoint.to_sockaddr(storage);
+        if (::connect(fd, reinterpret_cast<sockaddr *>(&storage), length) == -1 && errno != EINPROGRESS)
+        {
+                // reported through on_close like every other failure, but only once the caller has the id
+                connection.connect_error = errno;
+                connection.deadline = now;
+        }
+        poller.add(fd, poll_readable | poll_writable | poll_edge_triggered, id_of(slot));
+        arm(slot, connection.deadline);
+        return id_of(slot);
+}
+
+void PeerReactor::send(const ConnectionId id, const std::span<const uint8_t> bytes)
+{
+        Connection *connection = find(id);
+        if (!connection || connection->state == State::closed)
+        {
+                return;
+        }
+        connection->output.insert(connection->output.end(), bytes.begin(), bytes.end());
+        if (connection->connected)
+        {
+                flush(static_cast<uint32_t>(id));
+        }
+}
+
+void PeerReactor::close(const ConnectionId id, const std::string &reason)
+{
+        if (find(id))
+        {
+                close_slot(static_cast<uint32_t>(id), reason, false);
+        }
+}
+
+PeerReactor::State PeerReactor::state(const ConnectionId id) const
+{
+        const Connection *connection = find(id);
+        return connection ? connection->state : State::closed;
+}
+
+const PeerEndpoint &PeerReactor::endpoint(const ConnectionId id) const
+{
+        const Connection *connection = find(id);
+        if (!connection)
+        {
+                throw std::out_of_range("Unknown peer connection");
+        }
+        return connection->endpoint;
+}
+
+size_t PeerReactor::open_connections() const
+{
+        return counters.open;
+}
+
+const PeerReactor::Statistics &PeerReactor::statistics() const
+{
+        return counters;
+}
+
+size_t PeerReactor::poll(const std::chrono::milliseconds max_wait)
+{
+        const auto wait = std::min(max_wait, wheel.tick());
+        const size_t count = poller.wait(events, static_cast<int>(wait.count()));
+        for (const PollEvent &event : events)
+        {
+                const auto slot = static_cast<uint32_t>(event.token);
+                if (find(event.token))
+                {
+                        on_event(slot, event.flags);
+                }
+        }
+
+        const auto now = Clock::now();
+        expired.clear();
+        wheel.advance(now, expired);
+        for (const uint64_t token : expired)
+        {
+                if (find(token))
+                {
+                        slots[static_cast<uint32_t>(token)]->timer = TimerWheel::invalid_timer;
+                        on_timer(static_cast<uint32_t>(token), now);
+                }
+        }
+
+        // slots closed in callbacks may still have been in use further up the stack until now
+        for (const uint32_t slot : released)
+        {
+                Connection &connection = *slots[slot];
+                ++connection.generation;
+                connection.input.consume(connection.input.size());
+                connection.output.clear();
+                connection.output_sent = 0;
+                free_slots.push_back(slot);
+        }
+        released.clear();
+        return count + expired.size();
+}
+
+void PeerReactor::run(const std::stop_token stop)
+{
+        std::stop_callback wake_on_stop{stop, [this]
+                                        { poller.wake(); }};
+        while (!stop.stop_requested())
+        {
+                poll(std::chrono::milliseconds{1000});
+        }
+}
+
+void PeerReactor::wake()
+{
+        poller.wake();
+}
+
+PeerReactor::Connection *PeerReactor::find(const ConnectionId id)
+{
+        const auto slot = static_cast<uint32_t>(id);
+        if (slot >= slots.size() || slots[slot]->generation != static_cast<uint32_t>(id >> 32))
+        {
+                return nullptr;
+        }
+        return slots[slot].get();
+}
+
+const PeerReactor::Connection *PeerReactor::find(const ConnectionId id) const
+{
+        return const_cast<PeerReactor *>(this)->find(id);
+}
+
+PeerReactor::ConnectionId PeerReactor::id_of(const uint32_t slot) const
+{
+        return uint64_t{slots[slot]->generation} << 32 | slot;
+}
+
+void PeerReactor::on_event(const uint32_t slot, const uint32_t flags)
+{
+        Connection &connection = *slots[slot];
+        if (connection.state == State::closed)
+        {
+                return;
+        }
+        if (!connection.connected)
+        {
+                if (!(flags & (poll_writable | poll_error | poll_hangup)))
+                {
+                        return;
+                }
+                finish_connect(slot);
+                return;
+        }
+
+        // edge triggered: both directions are drained until the kernel says EAGAIN
+        if (flags & (poll_readable | poll_hangup | poll_error))
+        {
+                receive(slot);
+        }
+        if ((flags & poll_writable) && connection.state != State::closed)
+        {
+                flush(slot);
+        }
+}
+
+void PeerReactor::finish_connect(const uint32_t slot)
+{
+        Connection &connection = *slots[slot];
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+        {
+                error = errno;
+        }
+        if (error != 0)
+        {
+                close_slot(slot, std::string("Connect failed: ") + std::strerror(error), false);
+                return;
+        }
+
+        connection.connected = true;
+        connection.state = State::handshaking;
+        connection.deadline = Clock::now() + options.handshake_timeout;
+        if (callbacks.on_connected)
+        {
+                callbacks.on_connected(id_of(slot));
+                if (connection.state == State::closed)
+                {
+                        return;
+                }
+        }
+        flush(slot);
+        if (connection.state != State::closed)
+        {
+                // the handshake reply may be there already, and with edge triggering nobody would say so again
+                receive(slot);
+        }
+}
+
+void PeerReactor::receive(const uint32_t slot)
+{
+        Connection &connection = *slots[slot];
+        const ConnectionId id = id_of(slot);
+        bool received_any = false;
+
+        try
+        {
+                for (;;)
+                {
+                        if (connection.input.writable().empty())
+                        {
+                                connection.input.grow(std::max(2 * connection.input.capacity(), pending_message_size(connection.input.readable())));
+                        }
+
+                        const ssize_t received = connection.input.fill(connection.fd);
+                        if (received == 0)
+                        {
+                                close_slot(slot, "Peer closed the connection", false);
+                                return;
+                        }
+                        if (received == -1)
+                        {
+                                if (errno == EINTR)
+                                {
+                                        continue;
+                                }
+                                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                {
+                                        close_slot(slot, std::string("Receive failed: ") + std::strerror(errno), false);
+                                        return;
+                                }
+                                break;
+                        }
+                        counters.bytes_received += static_cast<uint64_t>(received);
+                        received_any = true;
+
+                        if (connection.state == State::handshaking)
+                        {
+                                Handshake remote;
+                                const size_t used = parse_handshake(connection.input.readable(), remote);
+                                if (used == 0)
+                                {
+                                        continue;
+                                }
+                                connection.input.consume(used);
+                                if (remote.info_hash != local.info_hash)
+                                {
+                                        close_slot(slot, "Peer answered with another info hash", false);
+                                        return;
+                                }
+                                connection.state = State::bitfield;
+                                ++counters.handshakes;
+                                if (callbacks.on_handshake)
+                                {
+                                        callbacks.on_handshake(id, remote);
+                                }
+                                if (connection.state == State::closed)
+                                {
+                                        return;
+                                }
+                        }
+
+                        PeerMessage message;
+                        while (const size_t used = parse_message(connection.input.readable(), message))
+                        {
+                                if (connection.state == State::bitfield)
+                                {
+                                        connection.state = State::active;
+                                }
+                                ++counters.messages;
+                                if (callbacks.on_message)
+                                {
+                                        callbacks.on_message(id, message);
+                                }
+                                if (connection.state == State::closed)
+                                {
+                                        return;
+                                }
+                                connection.input.consume(used);
+                        }
+                }
+        }
+        catch (const PeerProtocolError &e)
+        {
+                // anything else, a failed disk write in a callback for one, goes out of poll() to the owner
+                close_slot(slot, e.what(), false);
+                return;
+        }
+
+        // the idle timeout counts from the last byte received, the timer picks the new deadline up lazily
+        if (received_any && connection.state != State::handshaking)
+        {
+                connection.deadline = Clock::now() + options.idle_timeout;
+        }
+}
+
+void PeerReactor::flush(const uint32_t slot)
+{
+        Connection &connection = *slots[slot];
+        while (connection.output_sent < connection.output.size())
+        {
+                const ssize_t sent = ::send(connection.fd, connection.output.data() + connection.output_sent,
+                                            connection.output.size() - connection.output_sent, MSG_NOSIGNAL);
+                if (sent == -1)
+                {
+                        if (errno == EINTR)
+                        {
+                                continue;
+                        }
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                        {
+                                close_slot(slot, std::string("Send failed: ") + std::strerror(errno), false);
+                        }
+                        return; // the next writable edge continues
+                }
+                connection.output_sent += static_cast<size_t>(sent);
+                counters.bytes_sent += static_cast<uint64_t>(sent);
+                connection.last_sent = Clock::now();
+        }
+        connection.output.clear();
+        connection.output_sent = 0;
+}
+
+// deadlines only ever move later, so a timer that fires early just re-arms for the current one
+void PeerReactor::on_timer(const uint32_t slot, const Clock::time_point now)
+{
+        Connection &connection = *slots[slot];
+        if (connection.state == State::closed)
+        {
+                return;
+        }
+        if (connection.connect_error != 0)
+        {
+                close_slot(slot, std::string("Connect failed: ") + std::strerror(connection.connect_error), false);
+                return;
+        }
+        if (now >= connection.deadline)
+        {
+                static constexpr const char *reasons[] = {"Connect timed out", "Handshake timed out", "Peer went idle", "Peer went idle"};
+                close_slot(slot, reasons[static_cast<size_t>(connection.state)], true);
+                return;
+        }
+
+        Clock::time_point next = connection.deadline;
+        if (connection.state == State::bitfield || connection.state == State::active)
+        {
+                if (now - connection.last_sent >= options.keep_alive_interval)
+                {
+                        uint8_t keep_alive[4];
+                        send(id_of(slot), {keep_alive, write_message(keep_alive, MessageType::keep_alive)});
+                        if (connection.state == State::closed)
+                        {
+                                return;
+                        }
+                }
+                next = std::min(next, connection.last_sent + options.keep_alive_interval);
+        }
+        arm(slot, std::max(next, now + options.tick));
+}
+
+void PeerReactor::arm(const uint32_t slot, const Clock::time_point deadline)
+{
+        Connection &connection = *slots[slot];
+        if (connection.timer == TimerWheel::invalid_timer)
+        {
+                connection.timer = wheel.schedule(deadline, id_of(slot));
+        }
+}
+
+void PeerReactor::close_slot(const uint32_t slot, const std::string &reason, const bool timeout)
+{
+        Connection &connection = *slots[slot];
+        if (connection.state == State::closed)
+        {
+                return;
+        }
+
+        poller.remove(connection.fd);
+        ::close(connection.fd);
+        if (connection.timer != TimerWheel::invalid_timer)
+        {
+                wheel.cancel(connection.timer);
+                connection.timer = TimerWheel::invalid_timer;
+        }
+        connection.state = State::closed;
+        --counters.open;
+        ++(timeout ? counters.timeouts : counters.failures);
+        released.push_back(slot);
+
+        if (callbacks.on_close)
+        {
+                callbacks.on_close(id_of(slot), reason);
+        }
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <vector>
+#include "wire.hpp"
+#include "../net/endpoint.hpp"
+#include "../net/poller.hpp"
+#include "../net/ring_buffer.hpp"
+#include "../net/timer_wheel.hpp"
+
+// Drives many peer connections from the calling thread: non-blocking sockets on an edge-triggered poller, each
+// connection walks connecting -> handshaking -> bitfield -> active, and a timer wheel enforces the per-state
+// timeouts. Not thread safe; callbacks run inside poll() and may call send(), connect() and close().
+class PeerReactor
+{
+public:
+        using ConnectionId = uint64_t; // slot and generation, stale ids are ignored
+        using Clock = TimerWheel::Clock;
+
+        enum class State : uint8_t
+        {
+                connecting,
+                handshaking,
+                bitfield, // handshake accepted, waiting for the first message
+                active,
+                closed,
+        };
+
+        struct Options
+        {
+                std::chrono::milliseconds connect_timeout{5000};
+                std::chrono::milliseconds handshake_timeout{10000};
+                std::chrono::milliseconds idle_timeout{120000};      // nothing received for this long
+                std::chrono::milliseconds keep_alive_interval{90000}; // nothing sent for this long
+                std::chrono::milliseconds tick{100};
+                size_t receive_buffer = 64 * 1024;
+        };
+
+        struct Callbacks
+        {
+                std::function<void(ConnectionId)> on_connected; // TCP is up, the handshake is on its way
+                std::function<void(ConnectionId, const Handshake &)> on_handshake;
+                std::function<void(ConnectionId, const PeerMessage &)> on_message; // payload is valid during the call only
+                std::function<void(ConnectionId, const std::string &reason)> on_close;
+        };
+
+        struct Statistics
+        {
+                uint64_t connects = 0;
+                uint64_t handshakes = 0;
+                uint64_t timeouts = 0;
+                uint64_t failures = 0; // closed for any other reason
+                uint64_t messages = 0;
+                uint64_t bytes_received = 0;
+                uint64_t bytes_sent = 0;
+                size_t open = 0;
+        };
+
+        PeerReactor(const Handshake &local, Callbacks callbacks, Options options);
+        PeerReactor(const Handshake &local, Callbacks callbacks);
+        ~PeerReactor();
+        PeerReactor(const PeerReactor &) = delete;
+        PeerReactor &operator=(const PeerReactor &) = delete;
+
+        ConnectionId connect(const PeerEndpoint &endpoint);
+        void send(ConnectionId connection, std::span<const uint8_t> bytes);
+        void close(ConnectionId connection, const std::string &reason);
+        State state(ConnectionId connection) const;
+        const PeerEndpoint &endpoint(ConnectionId connection) const;
+        size_t open_connections() const;
+        const Statistics &statistics() const;
+
+        size_t poll(std::chrono::milliseconds max_wait); // one round of I/O and timers, returns the events handled
+        void run(std::stop_token stop);                  // polls until stop is requested
+        void wake();                                     // the only member safe to call from other threads
+
+private:
+        struct Connection
+        {
+                int fd = -1;
+                uint32_t generation = 0;
+                State state = State::closed;
+                bool connected = false;
+                int connect_error = 0; // connect() failed right away, reported from the timer
+                PeerEndpoint endpoint;
+                RingBuffer input;
+                std::vector<uint8_t> output;
+                size_t output_sent = 0;
+                Clock::time_point deadline;  // the connection times out at this point unless it moves on
+                Clock::time_point last_sent;
+                TimerWheel::TimerId timer = TimerWheel::invalid_timer;
+        };
+
+        Connection *find(ConnectionId connection);
+        const Connection *find(ConnectionId connection) const;
+        ConnectionId id_of(uint32_t slot) const;
+        void on_event(uint32_t slot, uint32_t flags);
+        void finish_connect(uint32_t slot);
+        void receive(uint32_t slot);
+        void flush(uint32_t slot);
+        void on_timer(uint32_t slot, Clock::time_point now);
+        void arm(uint32_t slot, Clock::time_point deadline);
+        void close_slot(uint32_t slot, const std::string &reason, bool timeout);
+
+        const Handshake local;
+        const Callbacks callbacks;
+        const Options options;
+
+        Poller poller;
+        TimerWheel wheel;
+        std::vector<std::unique_ptr<Connection>> slots;
+        std::vector<uint32_t> free_slots;
+        std::vector<uint32_t> released; // closed during this poll(), reusable after it
+        std::vector<PollEvent> events;
+        std::vector<uint64_t> expired;
+        Statistics counters;
+};
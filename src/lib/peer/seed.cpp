@@ -0,0 +1,475 @@
+#include "seed.hpp"
+#include "../hash/sha1.hpp"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+        // never a descriptor, marks the listening socket
+        constexpr uint64_t listen_token = UINT64_MAX - 1;
+
+        // blocks may take the link this far ahead of time, one poller wakeup, so fast links are not held to one block per wakeup
+        constexpr auto link_slack = std::chrono::milliseconds{1};
+}
+
+struct LocalSeed::Connection
+{
+        int fd;
+        std::array<uint8_t, 16 * 1024> input; // a downloader sends nothing longer than its handshake or a request
+        size_t input_size = 0;
+        std::vector<uint8_t> output;
+        size_t output_sent = 0;
+        bool handshaken = false;
+        bool want_writable = false;
+        std::deque<Request> queued; // asked for, not on the link yet
+        std::deque<std::pair<Clock::time_point, Request>> in_flight; // on the link, sent once the time has come
+        Clock::time_point link_free;
+};
+
+LocalSeed::LocalSeed(const std::span<const uint8_t> data, const uint32_t piece_length, const std::array<uint8_t, 20> &info_hash,
+                     const LocalSeedOptions options)
+    : data(data), piece_length(piece_length),
+      piece_count(piece_length == 0 ? 0 : static_cast<uint32_t>((data.size() + piece_length - 1) / piece_length)), options(options)
+{
+        if (piece_length == 0 || options.rate < 0)
+        {
+                throw std::invalid_argument("Local seed needs a piece length and a rate of at least 0");
+        }
+
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd == -1)
+        {
+                throw std::runtime_error(std::string("Failed to create seed socket: ") + std::strerror(errno));
+        }
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), length) == -1 || listen(listen_fd, SOMAXCONN) == -1 ||
+            getsockname(listen_fd, reinterpret_cast<sockaddr *>(&address), &length) == -1)
+        {
+                const int error = errno;
+                close(listen_fd);
+                throw std::runtime_error(std::string("Failed to listen for seed connections: ") + std::strerror(error));
+        }
+        bound_port = ntohs(address.sin_port);
+        poller.add(listen_fd, poll_readable, listen_token);
+
+        local.info_hash = info_hash;
+        const std::string peer_id = "-LS0001-" + std::to_string(1000000000000ull + bound_port).substr(1);
+        std::copy(peer_id.begin(), peer_id.end(), local.peer_id.begin());
+
+        const size_t bitfield_bytes = (piece_count + 7) / 8;
+        greeting.resize(handshake_size);
+        write_handshake(greeting.data(), local);
+        greeting.resize(handshake_size + 5 + bitfield_bytes, 0xff);
+        write_bitfield_header(greeting.data() + handshake_size, bitfield_bytes);
+        if (piece_count % 8 != 0)
+        {
+                greeting.back() = static_cast<uint8_t>(0xff << (8 - piece_count % 8)); // spare bits stay clear
+        }
+}
+
+LocalSeed::~LocalSeed()
+{
+        for (const auto &connection : connections)
+        {
+                if (connection)
+                {
+                        close(connection->fd);
+                }
+        }
+        close(listen_fd);
+}
+
+uint16_t LocalSeed::port() const
+{
+        return bound_port;
+}
+
+void LocalSeed::run(const std::stop_token stop)
+{
+        std::stop_callback wake_on_stop{stop, [this]
+                                        { poller.wake(); }};
+        std::vector<PollEvent> events;
+        const auto stop_at = options.stop_after > std::chrono::milliseconds{0} ? Clock::now() + options.stop_after : Clock::time_point::max();
+
+        while (!stop.stop_requested())
+        {
+                const auto before = Clock::now();
+                if (before >= stop_at)
+                {
+                        // like a seed that went away, later connects are refused
+                        for (size_t fd = 0; fd < connections.size(); ++fd)
+                        {
+                                if (connections[fd])
+                                {
+                                        close_connection(static_cast<int>(fd));
+                                }
+                        }
+                        poller.remove(listen_fd);
+                        shutdown(listen_fd, SHUT_RDWR);
+                        return;
+                }
+                int timeout = next_timeout(before);
+                if (stop_at != Clock::time_point::max())
+                {
+                        const auto until_stop = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(stop_at - before).count());
+                        timeout = timeout == -1 ? until_stop : std::min(timeout, until_stop);
+                }
+                poller.wait(events, timeout);
+                for (const PollEvent &event : events)
+                {
+                        if (event.token == listen_token)
+                        {
+                                accept_connections();
+                                continue;
+                        }
+
+                        const int fd = static_cast<int>(event.token);
+                        if (static_cast<size_t>(fd) >= connections.size() || !connections[fd])
+                        {
+                                continue;
+                        }
+                        if (event.flags & poll_error)
+                        {
+                                close_connection(fd);
+                                continue;
+                        }
+                        if (event.flags & (poll_readable | poll_hangup))
+                        {
+                                on_readable(*connections[fd]);
+                        }
+                        if ((event.flags & poll_writable) && connections[fd])
+                        {
+                                flush(*connections[fd]);
+                        }
+                }
+
+                const auto now = Clock::now();
+                for (size_t fd = 0; fd < connections.size(); ++fd)
+                {
+                        if (connections[fd])
+                        {
+                                pump(*connections[fd], now);
+                        }
+                }
+        }
+}
+
+void LocalSeed::accept_connections()
+{
+        for (;;)
+        {
+                const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd == -1)
+                {
+                        return;
+                }
+
+                const int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                auto connection = std::make_unique<Connection>();
+                connection->fd = fd;
+                if (static_cast<size_t>(fd) >= connections.size())
+                {
+                        connections.resize(std::bit_ceil(static_cast<size_t>(fd) + 1));
+                }
+                connections[fd] = std::move(connection);
+                poller.add(fd, poll_readable, static_cast<uint64_t>(fd));
+        }
+}
+
+void LocalSeed::on_readable(Connection &connection)
+{
+        const int fd = connection.fd;
+        for (;;)
+        {
+                if (connection.input_size == connection.input.size())
+                {
+                        close_connection(fd);
+                        return;
+                }
+                const ssize_t received = recv(fd, connection.input.data() + connection.input_size, connection.input.size() - connection.input_size, 0);
+                if (received == 0 || (received == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                {
+                        close_connection(fd);
+                        return;
+                }
+                if (received == -1)
+                {
+                        break;
+                }
+                connection.input_size += static_cast<size_t>(received);
+
+                size_t consumed = 0;
+                try
+                {
+                        if (!connection.handshaken)
+                        {
+                                Handshake remote;
+                                consumed = parse_handshake({connection.input.data(), connection.input_size}, remote);
+                                if (consumed != 0 && remote.info_hash != local.info_hash)
+                                {
+                                        close_connection(fd);
+                                        return;
+                                }
+                                if (consumed != 0)
+                                {
+                                        connection.handshaken = true;
+                                        connection.output.insert(connection.output.end(), greeting.begin(), greeting.end());
+                                }
+                        }
+                        PeerMessage message;
+                        while (connection.handshaken)
+                        {
+                                const size_t size = parse_message({connection.input.data() + consumed, connection.input_size - consumed}, message);
+                                if (size == 0)
+                                {
+                                        break;
+                                }
+                                consumed += size;
+                                if (!on_message(connection, message))
+                                {
+                                        close_connection(fd);
+                                        return;
+                                }
+                        }
+                }
+                catch (const PeerProtocolError &)
+                {
+                        close_connection(fd);
+                        return;
+                }
+                std::memmove(connection.input.data(), connection.input.data() + consumed, connection.input_size - consumed);
+                connection.input_size -= consumed;
+        }
+        pump(connection, Clock::now());
+}
+
+// false closes the connection
+bool LocalSeed::on_message(Connection &connection, const PeerMessage &message)
+{
+        switch (message.type)
+        {
+        case MessageType::interested:
+        {
+                uint8_t unchoke[5];
+                connection.output.insert(connection.output.end(), unchoke, unchoke + write_message(unchoke, MessageType::unchoke));
+                return true;
+        }
+        case MessageType::request:
+        {
+                if (message.index >= piece_count || message.length == 0 || message.length > block_size)
+                {
+                        return false;
+                }
+                const uint64_t piece_begin = uint64_t{message.index} * piece_length;
+                const uint64_t piece_end = std::min<uint64_t>(piece_begin + piece_length, data.size());
+                if (uint64_t{message.begin} + message.length > piece_end - piece_begin)
+                {
+                        return false;
+                }
+                connection.queued.push_back({message.index, message.begin, message.length});
+                return true;
+        }
+        case MessageType::cancel:
+                std::erase_if(connection.queued, [&message](const Request &request)
+                              { return request.index == message.index && request.begin == message.begin; });
+                return true;
+        default:
+                return true;
+        }
+}
+
+// requests take the link one after another at options.rate, and their blocks go out options.delay after that
+void LocalSeed::pump(Connection &connection, const Clock::time_point now)
+{
+        while (!connection.queued.empty() && connection.link_free <= now + link_slack)
+        {
+                const Request request = connection.queued.front();
+                connection.queued.pop_front();
+                const auto transmit = options.rate > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(request.length / options.rate))
+                                                       : Clock::duration{0};
+                connection.link_free = std::max(connection.link_free, now) + transmit;
+                connection.in_flight.emplace_back(connection.link_free + options.delay, request);
+        }
+
+        while (!connection.in_flight.empty() && connection.in_flight.front().first <= now)
+        {
+                const Request &request = connection.in_flight.front().second;
+                const size_t offset = connection.output.size();
+                connection.output.resize(offset + piece_header_size + request.length);
+                write_piece_header(connection.output.data() + offset, request.index, request.begin, request.length);
+                std::memcpy(connection.output.data() + offset + piece_header_size, data.data() + uint64_t{request.index} * piece_length + request.begin,
+                            request.length);
+                if (options.corrupt)
+                {
+                        connection.output[offset + piece_header_size] ^= 1;
+                }
+                connection.in_flight.pop_front();
+        }
+
+        if (connection.output_sent < connection.output.size() && !connection.want_writable)
+        {
+                flush(connection);
+        }
+}
+
+void LocalSeed::flush(Connection &connection)
+{
+        while (connection.output_sent < connection.output.size())
+        {
+                const ssize_t sent = send(connection.fd, connection.output.data() + connection.output_sent,
+                                          connection.output.size() - connection.output_sent, MSG_NOSIGNAL);
+                if (sent == -1)
+                {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        {
+                                if (!connection.want_writable)
+                                {
+                                        connection.want_writable = true;
+                                        poller.modify(connection.fd, poll_readable | poll_writable, static_cast<uint64_t>(connection.fd));
+                                }
+                                // keeps the buffer from growing without bound behind a slow reader
+                                connection.output.erase(connection.output.begin(), connection.output.begin() + static_cast<ptrdiff_t>(connection.output_sent));
+                                connection.output_sent = 0;
+                                return;
+                        }
+                        if (errno == EINTR)
+                        {
+                                continue;
+                        }
+                        close_connection(connection.fd);
+                        return;
+                }
+                connection.output_sent += static_cast<size_t>(sent);
+        }
+
+        connection.output.clear();
+        connection.output_sent = 0;
+        if (connection.want_writable)
+        {
+                connection.want_writable = false;
+                poller.modify(connection.fd, poll_readable, static_cast<uint64_t>(connection.fd));
+        }
+}
+
+void LocalSeed::close_connection(const int fd)
+{
+        poller.remove(fd);
+        close(fd);
+        connections[fd].reset();
+}
+
+// until the next block is due to take the link or to go out, -1 when nothing is waiting
+int LocalSeed::next_timeout(const Clock::time_point now) const
+{
+        auto next = Clock::time_point::max();
+        for (const auto &connection : connections)
+        {
+                if (!connection)
+                {
+                        continue;
+                }
+                if (!connection->in_flight.empty())
+                {
+                        next = std::min(next, connection->in_flight.front().first);
+                }
+                if (!connection->queued.empty())
+                {
+                        next = std::min(next, connection->link_free - link_slack);
+                }
+        }
+        if (next == Clock::time_point::max())
+        {
+                return -1;
+        }
+        return next <= now ? 0 : static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(next - now).count());
+}
+
+DownloadBenchmark benchmark_download(const uint64_t length, const uint32_t piece_length, const std::vector<LocalSeedOptions> &seeds,
+                                     const Download::Options options)
+{
+        if (length == 0 || piece_length == 0 || seeds.empty())
+        {
+                throw std::invalid_argument("Download benchmark needs data, a piece length and at least one seed");
+        }
+
+        std::vector<uint8_t> data(length);
+        std::mt19937_64 random{1};
+        for (uint64_t offset = 0; offset < length; offset += 8)
+        {
+                const uint64_t word = random();
+                std::memcpy(data.data() + offset, &word, std::min<uint64_t>(8, length - offset));
+        }
+
+        PieceLayout layout;
+        layout.total_length = length;
+        layout.piece_length = piece_length;
+        for (uint64_t begin = 0; begin < length; begin += piece_length)
+        {
+                SHA1 sha1;
+                sha1.add(data.data() + begin, static_cast<size_t>(std::min<uint64_t>(piece_length, length - begin)));
+                unsigned char digest[SHA1::HashBytes];
+                sha1.getHash(digest);
+                layout.piece_hashes.append(reinterpret_cast<const char *>(digest), sizeof(digest));
+        }
+
+        Handshake local;
+        for (uint8_t &byte : local.info_hash)
+        {
+                byte = static_cast<uint8_t>(random());
+        }
+        const std::string_view self_id = "-BT0001-benchmark000";
+        std::copy(self_id.begin(), self_id.end(), local.peer_id.begin());
+
+        std::vector<std::unique_ptr<LocalSeed>> servers;
+        std::vector<PeerEndpoint> endpoints;
+        for (const LocalSeedOptions &seed : seeds)
+        {
+                servers.push_back(std::make_unique<LocalSeed>(data, piece_length, local.info_hash, seed));
+                endpoints.push_back(PeerEndpoint::from_string("127.0.0.1:" + std::to_string(servers.back()->port())));
+        }
+        std::vector<std::jthread> loops; // declared after the seeds, so they stop before the seeds go away
+        for (const auto &server : servers)
+        {
+                loops.emplace_back([&server](const std::stop_token stop)
+                                   { server->run(stop); });
+        }
+
+        uint32_t mismatches = 0;
+        Download download{local, layout, [&](const uint32_t index, const std::span<const BlockBuffer> blocks)
+                          {
+                                  uint64_t offset = uint64_t{index} * piece_length;
+                                  for (const BlockBuffer &block : blocks)
+                                  {
+                                          mismatches += std::memcmp(block.data(), data.data() + offset, block.size()) != 0;
+                                          offset += block.size();
+                                  }
+                          },
+                          options};
+        std::vector<uint32_t> wanted(layout.piece_count());
+        std::iota(wanted.begin(), wanted.end(), 0);
+
+        const auto start = std::chrono::steady_clock::now();
+        download.run(endpoints, wanted);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (mismatches != 0)
+        {
+                throw std::runtime_error(std::to_string(mismatches) + " downloaded blocks differ from the source");
+        }
+        return {elapsed.count(), download.statistics()};
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <stop_token>
+#include <utility>
+#include <vector>
+#include "download.hpp"
+#include "wire.hpp"
+#include "../net/poller.hpp"
+
+struct LocalSeedOptions
+{
+        std::chrono::milliseconds delay{0}; // added to every block, a stand-in for the path delay
+        double rate = 0; // bytes per second per connection, 0 for no limit; requests queue behind it as at a real uplink
+        std::chrono::milliseconds stop_after{0}; // run() closes every connection and returns this long after it began, 0 never
+        bool corrupt = false; // flips a bit in every block, so its pieces fail their hash checks
+};
+
+// Serves one torrent held in memory on a loopback port to any number of peers, so Download can be measured
+// against peers of known delay and bandwidth. Every peer gets the full bitfield, and an unchoke once interested;
+// cancels drop requests that have not taken the link yet. Runs on a single poller thread like TrackerServer.
+class LocalSeed
+{
+public:
+        using Clock = std::chrono::steady_clock;
+
+        LocalSeed(std::span<const uint8_t> data, uint32_t piece_length, const std::array<uint8_t, 20> &info_hash, LocalSeedOptions options);
+        ~LocalSeed();
+        LocalSeed(const LocalSeed &) = delete;
+        LocalSeed &operator=(const LocalSeed &) = delete;
+
+        uint16_t port() const;
+        void run(std::stop_token stop);
+
+private:
+        struct Request
+        {
+                uint32_t index;
+                uint32_t begin;
+                uint32_t length;
+        };
+        struct Connection;
+
+        void accept_connections();
+        void on_readable(Connection &connection);
+        bool on_message(Connection &connection, const PeerMessage &message);
+        void pump(Connection &connection, Clock::time_point now);
+        void flush(Connection &connection);
+        void close_connection(int fd);
+        int next_timeout(Clock::time_point now) const;
+
+        const std::span<const uint8_t> data;
+        const uint32_t piece_length;
+        const uint32_t piece_count;
+        const LocalSeedOptions options;
+        Handshake local;
+        std::vector<uint8_t> greeting; // handshake and bitfield
+        int listen_fd = -1;
+        uint16_t bound_port = 0;
+        Poller poller;
+        std::vector<std::unique_ptr<Connection>> connections; // by descriptor
+};
+
+struct DownloadBenchmark
+{
+        double seconds;
+        Download::Statistics statistics;
+};
+
+// length random bytes in pieces of piece_length, served by one LocalSeed per entry of seeds and downloaded whole;
+// every piece is compared with the source
+DownloadBenchmark benchmark_download(uint64_t length, uint32_t piece_length, const std::vector<LocalSeedOptions> &seeds, Download::Options options);
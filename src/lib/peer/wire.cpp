@@ -0,0 +1,360 @@
+#include "wire.hpp"
+#include "../net/ring_buffer.hpp"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+        constexpr std::string_view protocol = "\x13"
+                                              "BitTorrent protocol";
+
+        uint32_t read_u32(const uint8_t *in)
+        {
+                uint32_t value;
+                std::memcpy(&value, in, sizeof(value));
+                return std::endian::native == std::endian::little ? std::byteswap(value) : value;
+        }
+
+        void write_u32(uint8_t *out, uint32_t value)
+        {
+                if constexpr (std::endian::native == std::endian::little)
+                {
+                        value = std::byteswap(value);
+                }
+                std::memcpy(out, &value, sizeof(value));
+        }
+
+        // payload sizes the fixed-size messages must have, -1 for variable ones
+        constexpr int fixed_payload(const uint8_t id)
+        {
+                switch (id)
+                {
+                case 0:
+                case 1:
+                case 2:
+                case 3:
+                        return 0;
+                case 4:
+                        return 4;
+                case 6:
+                case 8:
+                        return 12;
+                case 9:
+                        return 2;
+                default:
+                        return -1;
+                }
+        }
+
+        [[noreturn]] void malformed(const uint8_t id, const uint32_t length)
+        {
+                throw PeerProtocolError("Malformed peer message " + std::to_string(id) + " of length " + std::to_string(length));
+        }
+}
+
+// 68 once a whole handshake is there, 0 while bytes are missing
+size_t parse_handshake(const std::span<const uint8_t> data, Handshake &handshake)
+{
+        const size_t checked = std::min(data.size(), protocol.size());
+        if (std::memcmp(data.data(), protocol.data(), checked) != 0)
+        {
+                throw PeerProtocolError("Peer does not speak the BitTorrent protocol");
+        }
+        if (data.size() < handshake_size)
+        {
+                return 0;
+        }
+
+        std::memcpy(handshake.reserved.data(), data.data() + 20, 8);
+        std::memcpy(handshake.info_hash.data(), data.data() + 28, 20);
+        std::memcpy(handshake.peer_id.data(), data.data() + 48, 20);
+        return handshake_size;
+}
+
+// parses the message at the front of data in place; the bytes it took, 0 while it is incomplete
+size_t parse_message(const std::span<const uint8_t> data, PeerMessage &message)
+{
+        if (data.size() < 4)
+        {
+                return 0;
+        }
+        const uint32_t length = read_u32(data.data());
+        if (length > max_message_length)
+        {
+                throw PeerProtocolError("Peer message of " + std::to_string(length) + " bytes is too long");
+        }
+        if (data.size() < 4 + size_t{length})
+        {
+                return 0;
+        }
+        if (length == 0)
+        {
+                message = PeerMessage{};
+                return 4;
+        }
+
+        const uint8_t *body = data.data() + 5;
+        const uint32_t payload_length = length - 1;
+        message = PeerMessage{};
+        message.id = data[4];
+        message.payload = {body, payload_length};
+
+        const int expected = fixed_payload(message.id);
+        if (expected >= 0 && payload_length != static_cast<uint32_t>(expected))
+        {
+                malformed(message.id, length);
+        }
+
+        switch (message.id)
+        {
+        case 4:
+                message.index = read_u32(body);
+                break;
+        case 6:
+        case 8:
+                message.index = read_u32(body);
+                message.begin = read_u32(body + 4);
+                message.length = read_u32(body + 8);
+                break;
+        case 7:
+                if (payload_length < 8)
+                {
+                        malformed(message.id, length);
+                }
+                message.index = read_u32(body);
+                message.begin = read_u32(body + 4);
+                message.length = payload_length - 8;
+                message.payload = {body + 8, message.length};
+                break;
+        }
+        message.type = message.id <= 9 ? static_cast<MessageType>(message.id) : MessageType::other;
+        return 4 + size_t{length};
+}
+
+// bytes the message at the front needs in total, so a too small buffer can be grown before it stalls
+size_t pending_message_size(const std::span<const uint8_t> data)
+{
+        return data.size() < 4 ? 4 : 4 + size_t{read_u32(data.data())};
+}
+
+void write_handshake(uint8_t *out, const Handshake &handshake)
+{
+        std::memcpy(out, protocol.data(), protocol.size());
+        std::memcpy(out + 20, handshake.reserved.data(), 8);
+        std::memcpy(out + 28, handshake.info_hash.data(), 20);
+        std::memcpy(out + 48, handshake.peer_id.data(), 20);
+}
+
+// messages without payload: choke, unchoke, interested, not interested; keep_alive writes just the length
+size_t write_message(uint8_t *out, const MessageType type)
+{
+        if (type == MessageType::keep_alive)
+        {
+                write_u32(out, 0);
+                return 4;
+        }
+        write_u32(out, 1);
+        out[4] = static_cast<uint8_t>(type);
+        return 5;
+}
+
+size_t write_have(uint8_t *out, const uint32_t index)
+{
+        write_u32(out, 5);
+        out[4] = static_cast<uint8_t>(MessageType::have);
+        write_u32(out + 5, index);
+        return 9;
+}
+
+// request or cancel, which share their layout
+size_t write_request(uint8_t *out, const MessageType type, const uint32_t index, const uint32_t begin, const uint32_t length)
+{
+        write_u32(out, 13);
+        out[4] = static_cast<uint8_t>(type);
+        write_u32(out + 5, index);
+        write_u32(out + 9, begin);
+        write_u32(out + 13, length);
+        return request_message_size;
+}
+
+// the block itself is sent from where it lies, after this header
+size_t write_piece_header(uint8_t *out, const uint32_t index, const uint32_t begin, const uint32_t length)
+{
+        write_u32(out, 9 + length);
+        out[4] = static_cast<uint8_t>(MessageType::piece);
+        write_u32(out + 5, index);
+        write_u32(out + 9, begin);
+        return piece_header_size;
+}
+
+size_t write_bitfield_header(uint8_t *out, const size_t bitfield_bytes)
+{
+        write_u32(out, static_cast<uint32_t>(1 + bitfield_bytes));
+        out[4] = static_cast<uint8_t>(MessageType::bitfield);
+        return 5;
+}
+
+namespace
+{
+        // folds what a consumer would look at into one number, so runs can be compared
+        uint64_t digest(const PeerMessage &message)
+        {
+                uint64_t value = static_cast<uint64_t>(message.type) * 31 + message.index;
+                value = value * 31 + message.begin;
+                value = value * 31 + message.length;
+                value = value * 31 + message.payload.size();
+                return value + (message.payload.empty() ? 0 : message.payload.front() + message.payload.back());
+        }
+
+        // feeds the stream through a ring in reads sized by next_read, parsing whatever is complete after each
+        template <typename NextRead>
+        uint64_t parse_through_ring(const std::span<const uint8_t> stream, NextRead next_read, uint64_t &messages)
+        {
+                RingBuffer ring{64 * 1024};
+                uint64_t sum = 0;
+                size_t offset = 0;
+                while (offset < stream.size() || ring.size() > 0)
+                {
+                        const std::span<uint8_t> space = ring.writable();
+                        const size_t count = std::min({next_read(), space.size(), stream.size() - offset});
+                        std::memcpy(space.data(), stream.data() + offset, count);
+                        ring.commit(count);
+                        offset += count;
+
+                        PeerMessage message;
+                        while (const size_t used = parse_message(ring.readable(), message))
+                        {
+                                sum += digest(message);
+                                ++messages;
+                                ring.consume(used);
+                        }
+                        if (count == 0 && ring.size() > 0)
+                        {
+                                throw std::runtime_error("Wire benchmark stream ends in the middle of a message");
+                        }
+                }
+                return sum;
+        }
+
+        // the way a receive loop without the ring goes: append, copy each message out, erase what was used
+        uint64_t parse_copying(const std::span<const uint8_t> stream, const size_t read_size, uint64_t &messages)
+        {
+                std::vector<uint8_t> buffer;
+                uint64_t sum = 0;
+                for (size_t offset = 0; offset < stream.size();)
+                {
+                        const size_t count = std::min(read_size, stream.size() - offset);
+                        buffer.insert(buffer.end(), stream.begin() + static_cast<ptrdiff_t>(offset),
+                                      stream.begin() + static_cast<ptrdiff_t>(offset + count));
+                        offset += count;
+
+                        size_t used = 0;
+                        while (buffer.size() - used >= 4)
+                        {
+                                const size_t length = 4 + size_t{read_u32(buffer.data() + used)};
+                                if (buffer.size() - used < length)
+                                {
+                                        break;
+                                }
+                                const std::vector<uint8_t> copy(buffer.begin() + static_cast<ptrdiff_t>(used),
+                                                                buffer.begin() + static_cast<ptrdiff_t>(used + length));
+                                PeerMessage message;
+                                parse_message(copy, message);
+                                sum += digest(message);
+                                ++messages;
+                                used += length;
+                        }
+                        buffer.erase(buffer.begin(), buffer.begin() + static_cast<ptrdiff_t>(used));
+                }
+                return sum;
+        }
+}
+
+WireBenchmark benchmark_wire(const uint64_t messages, const unsigned piece_percent)
+{
+        using Clock = std::chrono::steady_clock;
+        const auto seconds_since = [](const Clock::time_point start)
+        { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+        std::mt19937_64 random{1};
+        std::vector<uint8_t> stream;
+        std::vector<uint8_t> block(block_size);
+        for (size_t byte = 0; byte < block.size(); ++byte)
+        {
+                block[byte] = static_cast<uint8_t>(byte * 7);
+        }
+        for (uint64_t count = 0; count < messages; ++count)
+        {
+                uint8_t header[std::max(request_message_size, piece_header_size)];
+                const auto index = static_cast<uint32_t>(random() % 100000);
+                const uint64_t kind = random() % 100;
+                if (kind < piece_percent)
+                {
+                        const auto begin = static_cast<uint32_t>(random() % 16) * static_cast<uint32_t>(block_size);
+                        stream.insert(stream.end(), header, header + write_piece_header(header, index, begin, block_size));
+                        stream.insert(stream.end(), block.begin(), block.end());
+                }
+                else if (kind % 3 == 0)
+                {
+                        stream.insert(stream.end(), header, header + write_have(header, index));
+                }
+                else if (kind % 3 == 1)
+                {
+                        stream.insert(stream.end(), header, header + write_request(header, MessageType::request, index, 0, block_size));
+                }
+                else
+                {
+                        stream.insert(stream.end(), header, header + write_message(header, MessageType::unchoke));
+                }
+        }
+
+        uint64_t expected = 0;
+        uint64_t parsed = 0;
+        PeerMessage message;
+        for (std::span<const uint8_t> rest = stream; !rest.empty();)
+        {
+                const size_t used = parse_message(rest, message);
+                expected += digest(message);
+                ++parsed;
+                rest = rest.subspan(used);
+        }
+
+        const auto check = [expected, parsed](const uint64_t sum, const uint64_t count)
+        {
+                if (sum != expected || count != parsed)
+                {
+                        throw std::runtime_error("Wire benchmark parsed a different stream");
+                }
+        };
+
+        WireBenchmark result{};
+        result.messages = parsed;
+        result.bytes = stream.size();
+
+        uint64_t count = 0;
+        auto start = Clock::now();
+        uint64_t sum = parse_through_ring(stream, [] { return size_t{64 * 1024}; }, count);
+        result.ring_seconds = seconds_since(start);
+        check(sum, count);
+
+        std::minstd_rand sizes{2};
+        count = 0;
+        start = Clock::now();
+        sum = parse_through_ring(stream, [&sizes] { return size_t{1} + sizes() % 1500; }, count);
+        result.small_reads_seconds = seconds_since(start);
+        check(sum, count);
+
+        count = 0;
+        start = Clock::now();
+        sum = parse_copying(stream, 64 * 1024, count);
+        result.copying_seconds = seconds_since(start);
+        check(sum, count);
+        return result;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+// a peer broke the wire protocol; the connection is closed, unlike on any other error
+class PeerProtocolError : public std::runtime_error
+{
+public:
+        using std::runtime_error::runtime_error;
+};
+
+// BEP 3 peer wire protocol: 4-byte big-endian length, 1-byte id, payload
+enum class MessageType : uint8_t
+{
+        choke = 0,
+        unchoke = 1,
+        interested = 2,
+        not_interested = 3,
+        have = 4,
+        bitfield = 5,
+        request = 6,
+        piece = 7,
+        cancel = 8,
+        port = 9,
+        keep_alive = 0xfe, // zero length message, has no id on the wire
+        other = 0xff,      // extension messages, passed on with their raw id and payload
+};
+
+// a parsed message; payload points into the receive buffer and is valid until those bytes are consumed
+struct PeerMessage
+{
+        MessageType type = MessageType::keep_alive;
+        uint8_t id = 0;
+        uint32_t index = 0;  // have, request, piece, cancel
+        uint32_t begin = 0;  // request, piece, cancel
+        uint32_t length = 0; // request, cancel; the block size for piece
+        std::span<const uint8_t> payload; // bitfield bits, piece block, or the body of other messages
+};
+
+struct Handshake
+{
+        std::array<uint8_t, 8> reserved{};
+        std::array<uint8_t, 20> info_hash{};
+        std::array<uint8_t, 20> peer_id{};
+};
+
+constexpr size_t handshake_size = 68;
+constexpr size_t block_size = 16 * 1024;
+constexpr size_t request_message_size = 17;
+constexpr size_t piece_header_size = 13;
+constexpr uint32_t max_message_length = 4 * 1024 * 1024; // anything longer is treated as a broken peer
+
+size_t parse_handshake(std::span<const uint8_t> data, Handshake &handshake);
+size_t parse_message(std::span<const uint8_t> data, PeerMessage &message);
+size_t pending_message_size(std::span<const uint8_t> data);
+
+void write_handshake(uint8_t *out, const Handshake &handshake);
+size_t write_message(uint8_t *out, MessageType type);
+size_t write_have(uint8_t *out, uint32_t index);
+size_t write_request(uint8_t *out, MessageType type, uint32_t index, uint32_t begin, uint32_t length);
+size_t write_piece_header(uint8_t *out, uint32_t index, uint32_t begin, uint32_t length);
+size_t write_bitfield_header(uint8_t *out, size_t bitfield_bytes);
+
+struct WireBenchmark
+{
+        double ring_seconds;        // 64 KiB reads into a RingBuffer, parsed in place
+        double small_reads_seconds; // reads of 1 to 1500 bytes into the ring
+        double copying_seconds;     // 64 KiB reads appended to a vector, every message copied out into its own
+        uint64_t messages;
+        uint64_t bytes;
+};
+
+// piece_percent of the messages are 16 KiB pieces, the rest have, request and unchoke; every run is checked
+// against one flat parse of the stream
+WireBenchmark benchmark_wire(uint64_t messages, unsigned piece_percent);
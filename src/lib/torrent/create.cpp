@@ -0,0 +1,233 @@
+#include "create.hpp"
+#include "../hash/sha1.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+        struct InputFile
+        {
+                std::filesystem::path path;
+                std::vector<std::string> relative_path;
+                int64_t offset; // where the file starts in the concatenated payload
+                int64_t length;
+                int fd;
+        };
+
+        // closes every descriptor opened for hashing, also when hashing throws
+        struct InputFiles
+        {
+                std::vector<InputFile> files;
+
+                ~InputFiles()
+                {
+                        for (const auto &file : files)
+                        {
+                                if (file.fd >= 0)
+                                {
+                                        close(file.fd);
+                                }
+                        }
+                }
+        };
+
+        // regular files below root in byte order of their paths, which is also the order they are hashed in
+        void collect_input_files(const std::filesystem::path &root, InputFiles &input)
+        {
+                std::vector<std::filesystem::path> paths;
+                if (std::filesystem::is_regular_file(root))
+                {
+                        paths.push_back(root);
+                }
+                else if (std::filesystem::is_directory(root))
+                {
+                        for (const auto &entry : std::filesystem::recursive_directory_iterator(root))
+                        {
+                                if (entry.is_regular_file())
+                                {
+                                        paths.push_back(entry.path());
+                                }
+                        }
+                        std::sort(paths.begin(), paths.end());
+                }
+                else
+                {
+                        throw std::invalid_argument("Not a file or directory: " + root.string());
+                }
+
+                int64_t offset = 0;
+                for (const auto &path : paths)
+                {
+                        InputFile file{path, {}, offset, static_cast<int64_t>(std::filesystem::file_size(path)), -1};
+                        for (const auto &component : std::filesystem::relative(path, root))
+                        {
+                                if (component != ".")
+                                {
+                                        file.relative_path.push_back(component.string());
+                                }
+                        }
+
+                        file.fd = open(path.c_str(), O_RDONLY);
+                        if (file.fd < 0)
+                        {
+                                throw std::system_error{errno, std::system_category(), "Failed to open " + path.string()};
+                        }
+
+                        offset += file.length;
+                        input.files.push_back(std::move(file));
+                }
+        }
+
+        // fills buffer with the payload bytes at [offset, offset + size), crossing file boundaries as needed
+        void read_payload(const std::vector<InputFile> &files, int64_t offset, char *buffer, size_t size)
+        {
+                auto file = std::upper_bound(files.begin(), files.end(), offset, [](const int64_t value, const InputFile &candidate)
+                                             { return value < candidate.offset; });
+                --file;
+
+                while (size > 0)
+                {
+                        const int64_t file_offset = offset - file->offset;
+                        const size_t available = static_cast<size_t>(std::min<int64_t>(file->length - file_offset, static_cast<int64_t>(size)));
+                        size_t done = 0;
+                        while (done < available)
+                        {
+                                const ssize_t result = pread(file->fd, buffer + done, available - done, file_offset + static_cast<int64_t>(done));
+                                if (result < 0 && errno == EINTR)
+                                {
+                                        continue;
+                                }
+                                if (result <= 0)
+                                {
+                                        throw std::system_error{errno, std::system_category(), "Failed to read " + file->path.string()};
+                                }
+                                done += static_cast<size_t>(result);
+                        }
+
+                        buffer += available;
+                        offset += static_cast<int64_t>(available);
+                        size -= available;
+                        ++file;
+                }
+        }
+}
+
+// aims for roughly 1500 pieces, a power of two between 16 KiB and 16 MiB
+int64_t select_piece_length(const int64_t total_length)
+{
+        constexpr uint64_t min_piece_length = 16 * 1024;
+        constexpr uint64_t max_piece_length = 16 * 1024 * 1024;
+        const uint64_t target = std::bit_ceil(static_cast<uint64_t>(std::max<int64_t>(total_length, 1)) / 1500 + 1);
+        return static_cast<int64_t>(std::clamp(target, min_piece_length, max_piece_length));
+}
+
+// hashes the pieces with a pool of workers that pull piece indices from a shared counter
+CreatedTorrent create_torrent(const CreateOptions &options)
+{
+        // v1 clients expect a power of two, and one piece must hold at least a 16 KiB block
+        if (options.piece_length != 0 && (options.piece_length < 16 * 1024 || !std::has_single_bit(static_cast<uint64_t>(options.piece_length))))
+        {
+                throw std::invalid_argument("Piece length " + std::to_string(options.piece_length) + " is not a power of two of at least 16 KiB");
+        }
+
+        InputFiles input;
+        collect_input_files(options.path, input);
+
+        const int64_t total_length = input.files.empty() ? 0 : input.files.back().offset + input.files.back().length;
+        if (total_length == 0)
+        {
+                throw std::invalid_argument("Nothing to hash in " + options.path);
+        }
+
+        const int64_t piece_length = options.piece_length > 0 ? options.piece_length : select_piece_length(total_length);
+        const size_t piece_count = static_cast<size_t>((total_length + piece_length - 1) / piece_length);
+        std::string pieces(piece_count * SHA1::HashBytes, '\0');
+
+        const unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+        const unsigned threads = static_cast<unsigned>(std::min<size_t>(options.threads > 0 ? options.threads : hardware_threads, piece_count));
+
+        std::atomic<size_t> next_piece{0};
+        std::exception_ptr failure;
+        std::atomic<bool> failed{false};
+
+        const auto start = std::chrono::steady_clock::now();
+        {
+                std::vector<std::jthread> workers;
+                for (unsigned i = 0; i < threads; ++i)
+                {
+                        workers.emplace_back([&]
+                                             {
+                                                     std::vector<char> buffer(static_cast<size_t>(piece_length));
+                                                     SHA1 sha1;
+                                                     try
+                                                     {
+                                                             for (size_t piece = next_piece++; piece < piece_count && !failed; piece = next_piece++)
+                                                             {
+                                                                     const int64_t offset = static_cast<int64_t>(piece) * piece_length;
+                                                                     const size_t size = static_cast<size_t>(std::min(piece_length, total_length - offset));
+                                                                     read_payload(input.files, offset, buffer.data(), size);
+
+                                                                     sha1.reset();
+                                                                     sha1.add(buffer.data(), size);
+                                                                     sha1.getHash(reinterpret_cast<unsigned char *>(pieces.data()) + piece * SHA1::HashBytes);
+                                                             }
+                                                     }
+                                                     catch (...)
+                                                     {
+                                                             // only the first failure is kept, the other workers stop at their next piece
+                                                             if (!failed.exchange(true))
+                                                             {
+                                                                     failure = std::current_exception();
+                                                             }
+                                                     } });
+                }
+        }
+        const double hash_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (failure)
+        {
+                std::rethrow_exception(failure);
+        }
+
+        const std::filesystem::path root{options.path};
+        json info = json::object();
+        info["name"] = std::filesystem::absolute(root).lexically_normal().filename().string();
+        if (info["name"].get<std::string>().empty())
+        {
+                info["name"] = std::filesystem::absolute(root).lexically_normal().parent_path().filename().string();
+        }
+        info["piece length"] = piece_length;
+        info["pieces"] = pieces;
+
+        if (std::filesystem::is_regular_file(root))
+        {
+                info["length"] = total_length;
+        }
+        else
+        {
+                json files = json::array();
+                for (const auto &file : input.files)
+                {
+                        files.push_back({{"length", file.length}, {"path", file.relative_path}});
+                }
+                info["files"] = files;
+        }
+
+        json metainfo = json::object();
+        if (!options.announce.empty())
+        {
+                metainfo["announce"] = options.announce;
+        }
+        metainfo["info"] = info;
+
+        return {metainfo, total_length, piece_count, hash_seconds};
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "../nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+struct CreateOptions
+{
+        std::string path;
+        std::string announce;     // left out of the metainfo when empty
+        int64_t piece_length = 0; // 0 picks one from the total size, else a power of two of at least 16 KiB
+        unsigned threads = 0;     // 0 uses every core
+};
+
+struct CreatedTorrent
+{
+        json metainfo;
+        int64_t total_length;
+        size_t piece_count;
+        double hash_seconds;
+};
+
+int64_t select_piece_length(int64_t total_length);
+CreatedTorrent create_torrent(const CreateOptions &options);
@@ -0,0 +1,137 @@
+#include "metainfo.hpp"
+#include "../bencode/encode.hpp"
+#include "../hash/sha1.hpp"
+#include "../hash/sha256.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+        // depth first walk, json objects keep their keys sorted so files come out in bencode order
+        void collect_files(const json &node, const std::string &path, std::vector<FileTreeEntry> &files)
+        {
+                if (!node.is_object())
+                {
+                        throw std::invalid_argument("Invalid file tree node");
+                }
+
+                for (const auto &[name, child] : node.items())
+                {
+                        // an empty key marks a file, its value holds length and pieces root
+                        if (name.empty())
+                        {
+                                const std::string pieces_root = child.contains("pieces root") ? child.at("pieces root").get<std::string>() : "";
+                                if (!pieces_root.empty() && pieces_root.size() != SHA256::HashBytes)
+                                {
+                                        throw std::invalid_argument("Invalid pieces root in file tree");
+                                }
+                                files.push_back({path, child.at("length").get<int64_t>(), pieces_root});
+                        }
+                        else
+                        {
+                                collect_files(child, path.empty() ? name : path + "/" + name, files);
+                        }
+                }
+        }
+}
+
+// v1 torrents carry concatenated SHA-1 piece hashes, hybrids carry both
+bool has_v1_metadata(const json &info)
+{
+        return info.contains("pieces");
+}
+
+// BEP 52 torrents set `meta version` to 2 and describe files with a `file tree`
+bool has_v2_metadata(const json &info)
+{
+        return info.contains("meta version") && info.at("meta version").get<int64_t>() >= 2 && info.contains("file tree");
+}
+
+// both hashes come from the same canonical encoding, so hybrid torrents end up in one swarm per version
+InfoHashes compute_info_hashes(const json &info)
+{
+        const std::string bencoded_info = encode_to_bencoded_string(info);
+        InfoHashes hashes;
+
+        if (has_v1_metadata(info))
+        {
+                SHA1 sha1;
+                unsigned char buffer[SHA1::HashBytes];
+                sha1.add(bencoded_info.data(), bencoded_info.size());
+                sha1.getHash(buffer);
+                hashes.v1.assign(reinterpret_cast<const char *>(buffer), SHA1::HashBytes);
+        }
+
+        if (has_v2_metadata(info))
+        {
+                SHA256 sha256;
+                unsigned char buffer[SHA256::HashBytes];
+                sha256.add(bencoded_info.data(), bencoded_info.size());
+                sha256.getHash(buffer);
+                hashes.v2.assign(reinterpret_cast<const char *>(buffer), SHA256::HashBytes);
+        }
+
+        return hashes;
+}
+
+// flattens a BEP 52 `file tree` dictionary into files with "/" separated paths
+std::vector<FileTreeEntry> parse_file_tree(const json &file_tree)
+{
+        std::vector<FileTreeEntry> files;
+        collect_files(file_tree, "", files);
+        return files;
+}
+
+// splits one `piece layers` value into its 32 byte piece hashes
+std::vector<Sha256Digest> parse_piece_layer(const std::string_view layer)
+{
+        if (layer.size() % SHA256::HashBytes != 0)
+        {
+                throw std::invalid_argument("Piece layer length is not a multiple of 32");
+        }
+
+        std::vector<Sha256Digest> hashes(layer.size() / SHA256::HashBytes);
+        std::memcpy(hashes.data(), layer.data(), layer.size());
+        return hashes;
+}
+
+// every file larger than a piece must have a piece layer that hashes up to its pieces root
+bool verify_piece_layers(const json &metainfo, const unsigned threads)
+{
+        const json &info = metainfo.at("info");
+        const int64_t piece_length = info.at("piece length").get<int64_t>();
+        if (piece_length < static_cast<int64_t>(merkle_block_size) || piece_length % static_cast<int64_t>(merkle_block_size) != 0)
+        {
+                throw std::invalid_argument("Invalid v2 piece length");
+        }
+
+        const size_t blocks_per_piece = static_cast<size_t>(piece_length) / merkle_block_size;
+        const json piece_layers = metainfo.contains("piece layers") ? metainfo.at("piece layers") : json::object();
+
+        for (const auto &file : parse_file_tree(info.at("file tree")))
+        {
+                if (file.length <= piece_length)
+                {
+                        continue;
+                }
+                if (!piece_layers.contains(file.pieces_root))
+                {
+                        return false;
+                }
+
+                const auto layer = parse_piece_layer(piece_layers.at(file.pieces_root).get<std::string>());
+                const size_t expected_pieces = static_cast<size_t>((file.length + piece_length - 1) / piece_length);
+                if (layer.size() != expected_pieces)
+                {
+                        return false;
+                }
+
+                const Sha256Digest root = merkle_root_from_piece_layer(layer, blocks_per_piece, threads);
+                if (std::memcmp(root.data(), file.pieces_root.data(), root.size()) != 0)
+                {
+                        return false;
+                }
+        }
+
+        return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../hash/merkle.hpp"
+#include "../nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// one file of a BEP 52 `file tree`, pieces_root is empty for zero length files
+struct FileTreeEntry
+{
+        std::string path;
+        int64_t length;
+        std::string pieces_root;
+};
+
+// v1 is the SHA-1 of the info dictionary, v2 the SHA-256, each empty when the torrent lacks that version
+struct InfoHashes
+{
+        std::string v1;
+        std::string v2;
+};
+
+bool has_v1_metadata(const json &info);
+bool has_v2_metadata(const json &info);
+InfoHashes compute_info_hashes(const json &info);
+std::vector<FileTreeEntry> parse_file_tree(const json &file_tree);
+std::vector<Sha256Digest> parse_piece_layer(std::string_view layer);
+bool verify_piece_layers(const json &metainfo, unsigned threads = 0);
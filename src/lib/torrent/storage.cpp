@@ -0,0 +1,93 @@
+#include "storage.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+OutputFile::OutputFile(const std::string &path, const uint64_t length)
+    : path(path), fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+{
+        if (fd < 0)
+        {
+                throw std::system_error{errno, std::system_category(), "Failed to open " + path};
+        }
+
+        // reserving the blocks keeps out-of-order writes from fragmenting the file; not every filesystem can
+        if (posix_fallocate(fd, 0, static_cast<off_t>(length)) != 0 && ftruncate(fd, static_cast<off_t>(length)) != 0)
+        {
+                const int error = errno;
+                close(fd);
+                throw std::system_error{error, std::system_category(), "Failed to size " + path};
+        }
+}
+
+OutputFile::~OutputFile()
+{
+        close(fd);
+}
+
+void OutputFile::write(uint64_t offset, std::span<const uint8_t> data)
+{
+        while (!data.empty())
+        {
+                const ssize_t result = pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset));
+                if (result < 0 && errno == EINTR)
+                {
+                        continue;
+                }
+                if (result <= 0)
+                {
+                        throw std::system_error{errno, std::system_category(), "Failed to write " + path};
+                }
+                data = data.subspan(static_cast<size_t>(result));
+                offset += static_cast<uint64_t>(result);
+        }
+}
+
+void OutputFile::write(uint64_t offset, std::span<const BlockBuffer> blocks)
+{
+        std::vector<iovec> vectors;
+        vectors.reserve(std::min<size_t>(blocks.size(), IOV_MAX));
+        while (!blocks.empty())
+        {
+                vectors.clear();
+                for (const BlockBuffer &block : blocks.first(std::min<size_t>(blocks.size(), IOV_MAX)))
+                {
+                        vectors.push_back({const_cast<uint8_t *>(block.data()), block.size()});
+                }
+
+                // a short write ends in the middle of some block, the rest goes out one block at a time
+                size_t written = 0;
+                while (true)
+                {
+                        const ssize_t result = pwritev(fd, vectors.data(), static_cast<int>(vectors.size()), static_cast<off_t>(offset));
+                        if (result < 0 && errno == EINTR)
+                        {
+                                continue;
+                        }
+                        if (result <= 0)
+                        {
+                                throw std::system_error{errno, std::system_category(), "Failed to write " + path};
+                        }
+                        written = static_cast<size_t>(result);
+                        break;
+                }
+
+                for (const iovec &vector : vectors)
+                {
+                        const size_t done = std::min(written, vector.iov_len);
+                        if (done < vector.iov_len)
+                        {
+                                write(offset + done, std::span<const uint8_t>{static_cast<const uint8_t *>(vector.iov_base) + done,
+                                                                              vector.iov_len - done});
+                        }
+                        written -= done;
+                        offset += vector.iov_len;
+                }
+                blocks = blocks.subspan(vectors.size());
+        }
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include "../net/block_pool.hpp"
+
+// the download target, sized up front so verified pieces are written in place at their offsets in any order
+class OutputFile
+{
+public:
+        OutputFile(const std::string &path, uint64_t length);
+        ~OutputFile();
+        OutputFile(const OutputFile &) = delete;
+        OutputFile &operator=(const OutputFile &) = delete;
+
+        void write(uint64_t offset, std::span<const uint8_t> data);
+        void write(uint64_t offset, std::span<const BlockBuffer> blocks); // back to back from offset, one pwritev per batch
+
+private:
+        std::string path;
+        int fd;
+};
@@ -0,0 +1,381 @@
+#include "announce.hpp"
+#include "peers.hpp"
+#include "udp.hpp"
+#include "../bencode/stream.hpp"
+#include "../bencode/utils.hpp"
+#include "../http/utils.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <future>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+        std::string_view event_parameter(const AnnounceEvent event)
+        {
+                switch (event)
+                {
+                case AnnounceEvent::completed:
+                        return "&event=completed";
+                case AnnounceEvent::started:
+                        return "&event=started";
+                case AnnounceEvent::stopped:
+                        return "&event=stopped";
+                default:
+                        return "";
+                }
+        }
+}
+
+// BEP 12 tiers, a torrent without `announce-list` has a single tier holding `announce`
+std::vector<std::vector<std::string>> parse_announce_list(const json &metainfo)
+{
+        std::vector<std::vector<std::string>> tiers;
+        if (metainfo.contains("announce-list"))
+        {
+                for (const auto &tier : metainfo.at("announce-list"))
+                {
+                        std::vector<std::string> trackers;
+                        for (const auto &tracker : tier)
+                        {
+                                const std::string url = tracker.get<std::string>();
+                                if (!url.empty() && std::find(trackers.begin(), trackers.end(), url) == trackers.end())
+                                {
+                                        trackers.push_back(url);
+                                }
+                        }
+                        if (!trackers.empty())
+                        {
+                                tiers.push_back(std::move(trackers));
+                        }
+                }
+        }
+
+        if (tiers.empty() && metainfo.contains("announce") && !metainfo.at("announce").get<std::string>().empty())
+        {
+                tiers.push_back({metainfo.at("announce").get<std::string>()});
+        }
+        return tiers;
+}
+
+std::string build_announce_url(const std::string &tracker, const AnnounceParams &params)
+{
+        AnnounceQuery query{params};
+        return query.url(tracker, params);
+}
+
+AnnounceQuery::AnnounceQuery(const AnnounceParams &params)
+{
+        fixed = "info_hash=";
+        percent_encode(params.info_hash, fixed);
+        fixed += "&peer_id=";
+        percent_encode(params.peer_id, fixed);
+        fixed += "&port=" + std::to_string(params.port) + "&compact=1";
+}
+
+const std::string &AnnounceQuery::url(const std::string &tracker, const AnnounceParams &params)
+{
+        buffer.clear();
+        buffer += tracker;
+        buffer += tracker.find('?') == std::string::npos ? '?' : '&';
+        buffer += fixed;
+
+        char digits[24];
+        const auto append_counter = [&](const std::string_view name, const int64_t value)
+        {
+                buffer += name;
+                buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+        };
+        append_counter("&uploaded=", params.uploaded);
+        append_counter("&downloaded=", params.downloaded);
+        append_counter("&left=", params.left);
+        buffer += event_parameter(params.event);
+        return buffer;
+}
+
+// fills response from a decoded HTTP tracker reply, a `failure reason` is thrown
+void parse_announce_response(const json &decoded, TrackerResponse &response)
+{
+        if (decoded.contains("failure reason"))
+        {
+                throw std::runtime_error(decoded.at("failure reason").get<std::string>());
+        }
+
+        response.interval = decoded.contains("interval") ? decoded.at("interval").get<int64_t>() : 0;
+        response.min_interval = decoded.contains("min interval") ? decoded.at("min interval").get<int64_t>() : 0;
+        response.complete = decoded.contains("complete") ? decoded.at("complete").get<int64_t>() : 0;
+        response.incomplete = decoded.contains("incomplete") ? decoded.at("incomplete").get<int64_t>() : 0;
+        response.peers = decode_peers(decoded);
+        response.success = true;
+}
+
+// bytes left to download when nothing is there yet
+int64_t total_length(const json &info)
+{
+        if (info.contains("length"))
+        {
+                return info.at("length").get<int64_t>();
+        }
+
+        int64_t length = 0;
+        if (info.contains("files"))
+        {
+                for (const auto &file : info.at("files"))
+                {
+                        length += file.at("length").get<int64_t>();
+                }
+        }
+        return length;
+}
+
+Announcer::Announcer(std::vector<std::vector<std::string>> tiers, const std::chrono::milliseconds deadline)
+    : tier_list(std::move(tiers)), deadline(deadline)
+{
+}
+
+Announcer::~Announcer() = default;
+
+AnnounceSummary Announcer::announce(const AnnounceParams &params)
+{
+        AnnounceSummary summary;
+        PeerSet seen;
+
+        for (const auto &tier : tiers())
+        {
+                std::vector<std::future<TrackerResponse>> pending;
+                pending.reserve(tier.size());
+                for (const auto &tracker : tier)
+                {
+                        pending.push_back(std::async(std::launch::async, [this, &tracker, &params]()
+                                                     { return announce_to(tracker, params); }));
+                }
+
+                std::vector<TrackerResponse> responses;
+                for (auto &response : pending)
+                {
+                        responses.push_back(response.get());
+                }
+
+                // the fastest answers go first, both for the peer order and for the next announce of this tier
+                std::stable_sort(responses.begin(), responses.end(), [](const TrackerResponse &a, const TrackerResponse &b)
+                                 { return a.success != b.success ? a.success : (a.success && a.elapsed < b.elapsed); });
+
+                bool tier_succeeded = false;
+                for (auto &response : responses)
+                {
+                        if (!response.success)
+                        {
+                                continue;
+                        }
+                        tier_succeeded = true;
+                        for (const auto &peer : response.peers)
+                        {
+                                if (seen.insert(peer))
+                                {
+                                        summary.peers.push_back(peer);
+                                }
+                        }
+                }
+
+                {
+                        std::lock_guard<std::mutex> lock{mutex};
+                        for (auto &trackers : tier_list)
+                        {
+                                if (trackers != tier)
+                                {
+                                        continue;
+                                }
+                                for (size_t i = 0; i < responses.size(); ++i)
+                                {
+                                        trackers[i] = responses[i].tracker;
+                                }
+                                break;
+                        }
+                }
+
+                std::move(responses.begin(), responses.end(), std::back_inserter(summary.responses));
+                if (tier_succeeded)
+                {
+                        break;
+                }
+        }
+
+        return summary;
+}
+
+std::vector<std::vector<std::string>> Announcer::tiers() const
+{
+        std::lock_guard<std::mutex> lock{mutex};
+        return tier_list;
+}
+
+// never throws, a failing tracker only shows up as an unsuccessful response
+TrackerResponse Announcer::announce_to(const std::string &tracker, const AnnounceParams &params)
+{
+        if (tracker.starts_with("udp://"))
+        {
+                return announce_udp(tracker, params);
+        }
+
+        TrackerResponse response;
+        response.tracker = tracker;
+        const auto start = std::chrono::steady_clock::now();
+
+        try
+        {
+                http::Request request{build_announce_url(tracker, params), pool, resolver};
+                BencodeStreamDecoder decoder;
+                const auto result = request.send("GET", "", {}, [&decoder](const std::uint8_t *data, const std::size_t size)
+                                                 { decoder.feed({reinterpret_cast<const char *>(data), size}); }, deadline);
+                if (result.status.code != http::Status::Ok)
+                {
+                        throw std::runtime_error("HTTP status " + std::to_string(result.status.code));
+                }
+
+                parse_announce_response(decoder.value(), response);
+        }
+        catch (const std::exception &e)
+        {
+                response.error = e.what();
+        }
+
+        response.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        return response;
+}
+
+TrackerResponse Announcer::announce_udp(const std::string &tracker, const AnnounceParams &params)
+{
+        UdpSlot *slot;
+        {
+                std::lock_guard<std::mutex> lock{mutex};
+                auto &entry = udp_trackers[tracker];
+                if (!entry)
+                {
+                        entry = std::make_unique<UdpSlot>();
+                }
+                slot = entry.get();
+        }
+
+        std::lock_guard<std::mutex> lock{slot->mutex};
+        try
+        {
+                // the name is looked up through the shared resolver, and the time it takes counts against the deadline
+                const auto start = std::chrono::steady_clock::now();
+                if (!slot->tracker)
+                {
+                        // a quarter of the deadline as first timeout leaves room for retransmitting a lost datagram
+                        slot->tracker = std::make_unique<UdpTracker>(tracker, resolver, deadline, deadline / 4);
+                }
+                const auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+                return slot->tracker->announce_all({params}, std::max(deadline - spent, std::chrono::milliseconds{0})).front();
+        }
+        catch (const std::exception &e)
+        {
+                TrackerResponse response;
+                response.tracker = tracker;
+                response.error = e.what();
+                return response;
+        }
+}
+
+AnnounceUrlBenchmark benchmark_announce_url(const uint64_t urls)
+{
+        using Clock = std::chrono::steady_clock;
+        const auto seconds_since = [](const Clock::time_point start)
+        { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+        constexpr size_t torrent_count = 1000;
+        const std::string tracker = "http://tracker.example.org:6969/announce";
+        std::mt19937_64 random{1};
+        std::vector<AnnounceParams> torrents(torrent_count);
+        for (auto &params : torrents)
+        {
+                for (std::string *bytes : {&params.info_hash, &params.peer_id})
+                {
+                        bytes->resize(20);
+                        for (char &c : *bytes)
+                        {
+                                c = static_cast<char>(random());
+                        }
+                }
+                params.left = static_cast<int64_t>(random() % (int64_t{1} << 40));
+        }
+        const auto advance = [](AnnounceParams &params)
+        {
+                params.downloaded += 16384;
+                params.left -= 16384;
+        };
+
+        // how URLs were built before AnnounceQuery: a hex string per hash, turned back byte by byte with stoul
+        const auto old_url_encode = [](const std::string &hex_string)
+        {
+                std::array<bool, 256> unreserved{};
+                for (size_t i = '0'; i <= '9'; ++i)
+                        unreserved[i] = true;
+                for (size_t i = 'A'; i <= 'Z'; ++i)
+                        unreserved[i] = true;
+                for (size_t i = 'a'; i <= 'z'; ++i)
+                        unreserved[i] = true;
+                unreserved['-'] = unreserved['_'] = unreserved['.'] = unreserved['~'] = true;
+
+                std::string result;
+                for (size_t i = 0; i < hex_string.length(); i += 2)
+                {
+                        std::string byte_str = hex_string.substr(i, 2);
+                        size_t byte_val = std::stoul(byte_str, nullptr, 16);
+                        result += unreserved[byte_val] ? std::string(1, static_cast<char>(byte_val)) : "%" + byte_str;
+                }
+                return result;
+        };
+
+        AnnounceUrlBenchmark result{};
+        result.urls = urls;
+        size_t lengths[3] = {}; // every pass starts from the same counters, so its URLs add up to the same length
+
+        std::vector<AnnounceParams> state = torrents;
+        auto start = Clock::now();
+        for (uint64_t i = 0; i < urls; ++i)
+        {
+                AnnounceParams &params = state[i % torrent_count];
+                advance(params);
+                const std::string url = tracker + "?" + "info_hash=" + old_url_encode(hash_to_hex_string(params.info_hash)) +
+                                        "&peer_id=" + old_url_encode(hash_to_hex_string(params.peer_id)) + "&port=" + std::to_string(params.port) +
+                                        "&uploaded=" + std::to_string(params.uploaded) + "&downloaded=" + std::to_string(params.downloaded) +
+                                        "&left=" + std::to_string(params.left) + "&compact=1" + std::string(event_parameter(params.event));
+                lengths[0] += url.size();
+        }
+        result.strings_seconds = seconds_since(start);
+
+        state = torrents;
+        start = Clock::now();
+        for (uint64_t i = 0; i < urls; ++i)
+        {
+                AnnounceParams &params = state[i % torrent_count];
+                advance(params);
+                lengths[1] += build_announce_url(tracker, params).size();
+        }
+        result.one_shot_seconds = seconds_since(start);
+
+        std::vector<AnnounceQuery> queries;
+        for (const auto &params : torrents)
+        {
+                queries.emplace_back(params);
+        }
+        state = torrents;
+        start = Clock::now();
+        for (uint64_t i = 0; i < urls; ++i)
+        {
+                AnnounceParams &params = state[i % torrent_count];
+                advance(params);
+                lengths[2] += queries[i % torrent_count].url(tracker, params).size();
+        }
+        result.cached_seconds = seconds_since(start);
+
+        if (lengths[0] != lengths[1] || lengths[1] != lengths[2])
+        {
+                throw std::runtime_error("Announce URL benchmark built URLs of different lengths");
+        }
+        return result;
+}
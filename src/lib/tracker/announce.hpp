@@ -0,0 +1,124 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../http/HTTPRequest.hpp"
+#include "../net/endpoint.hpp"
+#include "../nlohmann/json.hpp"
+
+class UdpTracker;
+
+using json = nlohmann::json;
+
+// numbered as in BEP 15, HTTP trackers get the names
+enum class AnnounceEvent : uint32_t
+{
+        none = 0,
+        completed = 1,
+        started = 2,
+        stopped = 3,
+};
+
+// info_hash and peer_id are the raw 20 bytes, they are percent-encoded when the URL is built
+struct AnnounceParams
+{
+        std::string info_hash;
+        std::string peer_id;
+        uint16_t port = 6881;
+        int64_t uploaded = 0;
+        int64_t downloaded = 0;
+        int64_t left = 0;
+        AnnounceEvent event = AnnounceEvent::none;
+};
+
+// outcome of one tracker, error is set when it failed or missed its deadline
+struct TrackerResponse
+{
+        std::string tracker;
+        bool success = false;
+        std::string error;
+        int64_t interval = 0;
+        int64_t min_interval = 0;
+        int64_t complete = 0;   // seeders
+        int64_t incomplete = 0; // leechers
+        std::vector<PeerEndpoint> peers;
+        std::chrono::milliseconds elapsed{0};
+};
+
+// BEP 48 counters of one torrent
+struct ScrapeStats
+{
+        int64_t complete = 0;   // seeders
+        int64_t incomplete = 0; // leechers
+        int64_t downloaded = 0;
+};
+
+struct AnnounceSummary
+{
+        std::vector<PeerEndpoint> peers; // merged across trackers, without duplicates
+        std::vector<TrackerResponse> responses;
+};
+
+std::vector<std::vector<std::string>> parse_announce_list(const json &metainfo);
+std::string build_announce_url(const std::string &tracker, const AnnounceParams &params);
+
+// the part of the announce query that never changes for a torrent is encoded once, each announce only appends
+// the tracker and the counters to a buffer that is reused
+class AnnounceQuery
+{
+public:
+        AnnounceQuery() = default;
+        explicit AnnounceQuery(const AnnounceParams &params);
+
+        const std::string &url(const std::string &tracker, const AnnounceParams &params); // valid until the next call
+
+private:
+        std::string fixed; // info_hash, peer_id, port and compact
+        std::string buffer;
+};
+void parse_announce_response(const json &decoded, TrackerResponse &response);
+int64_t total_length(const json &info);
+
+// BEP 12 announcer: every tracker of a tier is asked at once, lower tiers are only tried when a whole tier failed
+class Announcer
+{
+public:
+        explicit Announcer(std::vector<std::vector<std::string>> tiers, std::chrono::milliseconds deadline = std::chrono::seconds{5});
+        ~Announcer();
+
+        AnnounceSummary announce(const AnnounceParams &params);
+        std::vector<std::vector<std::string>> tiers() const;
+
+private:
+        TrackerResponse announce_to(const std::string &tracker, const AnnounceParams &params);
+        TrackerResponse announce_udp(const std::string &tracker, const AnnounceParams &params);
+
+        // UDP trackers are kept between announces so their connection IDs can be reused
+        struct UdpSlot
+        {
+                std::mutex mutex;
+                std::unique_ptr<UdpTracker> tracker;
+        };
+
+        mutable std::mutex mutex;
+        std::vector<std::vector<std::string>> tier_list;
+        const std::chrono::milliseconds deadline;
+        http::ConnectionPool pool;
+        http::Resolver resolver;
+        std::map<std::string, std::unique_ptr<UdpSlot>> udp_trackers;
+};
+
+struct AnnounceUrlBenchmark
+{
+        double strings_seconds; // concatenated per announce, the hashes percent-encoded by way of hex strings
+        double one_shot_seconds; // build_announce_url, a fresh AnnounceQuery each time
+        double cached_seconds;   // one AnnounceQuery per torrent, reused
+        uint64_t urls;
+};
+
+// announces of 1000 torrents in turn, every one with new counters
+AnnounceUrlBenchmark benchmark_announce_url(uint64_t urls);
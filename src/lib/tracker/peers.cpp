@@ -0,0 +1,168 @@
+#include "peers.hpp"
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <arpa/inet.h>
+
+namespace
+{
+        // address bytes stay in network order, only the port is turned around
+        template <size_t AddressBytes>
+        void decode_compact(const std::string_view blob, const uint8_t family, std::vector<PeerEndpoint> &out)
+        {
+                constexpr size_t entry_size = AddressBytes + 2;
+                if (blob.size() % entry_size != 0)
+                {
+                        throw std::invalid_argument("Invalid compact peer list");
+                }
+
+                const auto data = reinterpret_cast<const uint8_t *>(blob.data());
+                const size_t count = blob.size() / entry_size;
+                const size_t first = out.size();
+                out.resize(first + count);
+                for (size_t i = 0; i < count; ++i)
+                {
+                        PeerEndpoint &endpoint = out[first + i];
+                        const uint8_t *entry = data + i * entry_size;
+                        std::memcpy(endpoint.address.data(), entry, AddressBytes);
+                        endpoint.port = static_cast<uint16_t>((entry[AddressBytes] << 8) | entry[AddressBytes + 1]);
+                        endpoint.family = family;
+                }
+        }
+}
+
+// BEP 23: 4 bytes of address and 2 bytes of port per peer
+void decode_compact_peers(const std::string_view peers, std::vector<PeerEndpoint> &out)
+{
+        decode_compact<4>(peers, AF_INET, out);
+}
+
+// BEP 7: 16 bytes of address and 2 bytes of port per peer
+void decode_compact_peers6(const std::string_view peers6, std::vector<PeerEndpoint> &out)
+{
+        decode_compact<16>(peers6, AF_INET6, out);
+}
+
+// BEP 3 list of {ip, port} dictionaries, host names are skipped since they would need a lookup each
+void decode_peer_dictionaries(const json &peers, std::vector<PeerEndpoint> &out)
+{
+        for (const auto &peer : peers)
+        {
+                const std::string ip = peer.at("ip").get<std::string>();
+                PeerEndpoint endpoint;
+                endpoint.port = static_cast<uint16_t>(peer.at("port").get<int64_t>());
+                if (inet_pton(AF_INET, ip.c_str(), endpoint.address.data()) == 1)
+                {
+                        endpoint.family = AF_INET;
+                }
+                else if (inet_pton(AF_INET6, ip.c_str(), endpoint.address.data()) == 1)
+                {
+                        endpoint.family = AF_INET6;
+                }
+                else
+                {
+                        continue;
+                }
+                out.push_back(endpoint);
+        }
+}
+
+// every peer of an HTTP announce reply, whichever model the tracker chose, plus `peers6`
+std::vector<PeerEndpoint> decode_peers(const json &response)
+{
+        std::vector<PeerEndpoint> peers;
+        if (response.contains("peers"))
+        {
+                const json &list = response.at("peers");
+                if (list.is_string())
+                {
+                        decode_compact_peers(list.get_ref<const std::string &>(), peers);
+                }
+                else
+                {
+                        decode_peer_dictionaries(list, peers);
+                }
+        }
+        if (response.contains("peers6"))
+        {
+                decode_compact_peers6(response.at("peers6").get_ref<const std::string &>(), peers);
+        }
+        return peers;
+}
+
+PeersBenchmark benchmark_peers(const uint64_t peers)
+{
+        using Clock = std::chrono::steady_clock;
+        const auto seconds_since = [](const Clock::time_point start)
+        { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+        std::mt19937_64 random{1};
+        std::string compact(peers * 6, '\0');
+        for (uint64_t i = 0; i < peers; ++i)
+        {
+                const uint64_t source = i >= 4 && random() % 4 == 0 ? random() % i : i;
+                if (source != i)
+                {
+                        std::memcpy(compact.data() + i * 6, compact.data() + source * 6, 6);
+                        continue;
+                }
+                const uint64_t bits = random();
+                std::memcpy(compact.data() + i * 6, &bits, 6);
+        }
+
+        PeersBenchmark result{};
+        result.peers = peers;
+
+        // what the announcer did before PeerEndpoint: a string per address, formatted again for the dedup key
+        auto start = Clock::now();
+        {
+                struct StringPeer
+                {
+                        std::string ip;
+                        uint16_t port;
+                };
+                std::vector<StringPeer> decoded;
+                decoded.reserve(peers);
+                for (size_t i = 0; i < compact.size(); i += 6)
+                {
+                        const auto byte = [&](const size_t offset)
+                        { return static_cast<unsigned char>(compact[i + offset]); };
+                        decoded.push_back({std::to_string(byte(0)) + "." + std::to_string(byte(1)) + "." + std::to_string(byte(2)) + "." + std::to_string(byte(3)),
+                                           static_cast<uint16_t>((byte(4) << 8) | byte(5))});
+                }
+                std::unordered_set<std::string> seen;
+                std::vector<StringPeer> unique;
+                for (const auto &peer : decoded)
+                {
+                        if (seen.insert(peer.ip + ":" + std::to_string(peer.port)).second)
+                        {
+                                unique.push_back(peer);
+                        }
+                }
+                result.unique = unique.size();
+        }
+        result.strings_seconds = seconds_since(start);
+
+        start = Clock::now();
+        std::vector<PeerEndpoint> decoded;
+        decode_compact_peers(compact, decoded);
+        PeerSet seen;
+        std::vector<PeerEndpoint> unique;
+        for (const auto &peer : decoded)
+        {
+                if (seen.insert(peer))
+                {
+                        unique.push_back(peer);
+                }
+        }
+        result.packed_seconds = seconds_since(start);
+
+        if (unique.size() != result.unique)
+        {
+                throw std::runtime_error("Peer benchmark found a different number of unique peers");
+        }
+        return result;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <string_view>
+#include <vector>
+#include "../net/endpoint.hpp"
+#include "../nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+void decode_compact_peers(std::string_view peers, std::vector<PeerEndpoint> &out);
+void decode_compact_peers6(std::string_view peers6, std::vector<PeerEndpoint> &out);
+void decode_peer_dictionaries(const json &peers, std::vector<PeerEndpoint> &out);
+std::vector<PeerEndpoint> decode_peers(const json &response);
+
+struct PeersBenchmark
+{
+        double strings_seconds; // 'a.b.c.d' strings and a port per entry, deduplicated by 'ip:port' keys in a hash set
+        double packed_seconds;  // decode_compact_peers into PeerEndpoints, deduplicated with a PeerSet
+        uint64_t peers;
+        uint64_t unique;
+};
+
+// one compact list as several trackers would return it together, a quarter of the entries repeat earlier ones
+PeersBenchmark benchmark_peers(uint64_t peers);
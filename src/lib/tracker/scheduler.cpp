@@ -0,0 +1,725 @@
+#include "scheduler.hpp"
+#include "udp.hpp"
+#include "../bencode/stream.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <optional>
+#include <stdexcept>
+#include <sys/socket.h>
+
+namespace
+{
+        // the kind sits in the top byte of poller and timer tokens, the rest is a torrent or exchange id
+        constexpr uint64_t kind_shift = 56;
+        constexpr uint64_t kind_announce = 1;
+        constexpr uint64_t kind_http = 2;
+        constexpr uint64_t kind_http_timeout = 3;
+        constexpr uint64_t kind_udp = 4;
+
+        uint64_t make_token(const uint64_t kind, const uint64_t id)
+        {
+                return (kind << kind_shift) | id;
+        }
+
+        uint64_t token_kind(const uint64_t token)
+        {
+                return token >> kind_shift;
+        }
+
+        uint64_t token_id(const uint64_t token)
+        {
+                return token & ((uint64_t{1} << kind_shift) - 1);
+        }
+}
+
+struct AnnounceScheduler::HttpExchange
+{
+        enum class State
+        {
+                resolving,
+                connecting,
+                sending,
+                receiving
+        };
+
+        TorrentId torrent;
+        std::string tracker;
+        http::Uri uri;
+        std::string port;
+        State state = State::resolving;
+        std::shared_future<std::vector<http::Address>> addresses;
+        size_t next_address = 0;
+        std::optional<http::Socket> socket;
+        bool reused = false; // came from the pool, may have been closed by the server meanwhile
+        bool response_started = false;
+        std::vector<uint8_t> request;
+        size_t sent = 0;
+        BencodeStreamDecoder decoder;
+        std::unique_ptr<http::ResponseParser> parser;
+        TimerWheel::TimerId timeout = TimerWheel::invalid_timer;
+        TimerWheel::Clock::time_point start;
+        std::string last_error;
+};
+
+struct AnnounceScheduler::UdpEndpoint
+{
+        uint64_t id;
+        std::unique_ptr<UdpTracker> tracker;
+        std::shared_future<std::vector<http::Address>> addresses;
+        std::vector<TorrentId> waiting; // for the address
+};
+
+AnnounceScheduler::AnnounceScheduler(Callback callback)
+    : AnnounceScheduler(std::move(callback), Options{})
+{
+}
+
+AnnounceScheduler::AnnounceScheduler(Callback callback, const Options options)
+    : callback(std::move(callback)), options(options), wheel(options.tick), random(std::random_device{}()),
+      loop([this](std::stop_token stop)
+           { run(stop); })
+{
+}
+
+AnnounceScheduler::~AnnounceScheduler()
+{
+        loop.request_stop();
+        poller.wake();
+        loop.join();
+}
+
+AnnounceScheduler::TorrentId AnnounceScheduler::add(const AnnounceParams &params, std::vector<std::vector<std::string>> tiers)
+{
+        // announcing walks tier by tier, tracker by tracker, an empty tier would leave it nothing to pick
+        std::erase_if(tiers, [](const std::vector<std::string> &tier)
+                      { return tier.empty(); });
+        if (tiers.empty())
+        {
+                throw std::invalid_argument("Torrent without trackers");
+        }
+
+        TorrentId torrent;
+        {
+                std::lock_guard<std::mutex> lock{mutex};
+                torrent = next_torrent++;
+                commands.push_back({torrent, false, params, std::move(tiers)});
+        }
+        poller.wake();
+        return torrent;
+}
+
+void AnnounceScheduler::remove(const TorrentId torrent)
+{
+        {
+                std::lock_guard<std::mutex> lock{mutex};
+                commands.push_back({torrent, true, {}, {}});
+        }
+        poller.wake();
+}
+
+AnnounceScheduler::Statistics AnnounceScheduler::statistics() const
+{
+        std::lock_guard<std::mutex> lock{mutex};
+        return counters;
+}
+
+void AnnounceScheduler::run(const std::stop_token stop)
+{
+        std::vector<PollEvent> events;
+        std::vector<uint64_t> expired;
+
+        while (!stop.stop_requested())
+        {
+                apply_commands(TimerWheel::Clock::now());
+
+                while (in_flight < options.max_in_flight && !ready.empty())
+                {
+                        const TorrentId torrent = ready.front();
+                        ready.pop_front();
+                        start_announce(torrent);
+                }
+
+                {
+                        std::lock_guard<std::mutex> lock{mutex};
+                        counters.in_flight = in_flight;
+                        counters.queued = ready.size();
+                }
+
+                // the wheel only needs a look every tick, UDP retransmissions may be due earlier
+                auto wait = options.tick;
+                const auto now = TimerWheel::Clock::now();
+                for (const auto &[_, endpoint] : udp_endpoints)
+                {
+                        if (endpoint->tracker)
+                        {
+                                const auto deadline = endpoint->tracker->next_deadline();
+                                if (deadline < now + wait)
+                                {
+                                        wait = std::max(std::chrono::milliseconds{0}, std::chrono::ceil<std::chrono::milliseconds>(deadline - now));
+                                }
+                        }
+                }
+
+                poller.wait(events, static_cast<int>(wait.count()));
+                for (const auto &event : events)
+                {
+                        if (token_kind(event.token) == kind_http)
+                        {
+                                on_http_event(token_id(event.token), event.flags);
+                        }
+                        else if (token_kind(event.token) == kind_udp)
+                        {
+                                const auto found = udp_by_id.find(token_id(event.token));
+                                if (found != udp_by_id.end() && found->second->tracker)
+                                {
+                                        found->second->tracker->on_readable();
+                                }
+                        }
+                }
+
+                check_resolutions();
+
+                const auto after = TimerWheel::Clock::now();
+                for (const auto &[_, endpoint] : udp_endpoints)
+                {
+                        if (endpoint->tracker && endpoint->tracker->next_deadline() <= after)
+                        {
+                                endpoint->tracker->on_timer(after);
+                        }
+                }
+
+                expired.clear();
+                wheel.advance(after, expired);
+                for (const auto token : expired)
+                {
+                        if (token_kind(token) == kind_announce)
+                        {
+                                torrents[token_id(token)].timer = TimerWheel::invalid_timer;
+                                queue(token_id(token));
+                        }
+                        else if (token_kind(token) == kind_http_timeout && exchanges.contains(token_id(token)))
+                        {
+                                exchanges.at(token_id(token))->timeout = TimerWheel::invalid_timer;
+                                finish_http(token_id(token), "Request timed out");
+                        }
+                }
+        }
+}
+
+void AnnounceScheduler::apply_commands(const TimerWheel::Clock::time_point now)
+{
+        std::vector<Command> pending;
+        {
+                std::lock_guard<std::mutex> lock{mutex};
+                pending.swap(commands);
+        }
+
+        for (auto &command : pending)
+        {
+                if (!command.remove)
+                {
+                        if (torrents.size() <= command.torrent)
+                        {
+                                torrents.resize(command.torrent + 1);
+                        }
+                        Torrent &torrent = torrents[command.torrent];
+                        torrent.params = std::move(command.params);
+                        torrent.query = AnnounceQuery{torrent.params};
+                        torrent.tiers = std::move(command.tiers);
+
+                        const auto spread = std::chrono::duration_cast<std::chrono::milliseconds>(options.startup_spread).count();
+                        const auto delay = spread > 0 ? std::uniform_int_distribution<int64_t>(0, spread)(random) : 0;
+                        torrent.timer = wheel.schedule(now + std::chrono::milliseconds{delay}, make_token(kind_announce, command.torrent));
+
+                        std::lock_guard<std::mutex> lock{mutex};
+                        ++counters.torrents;
+                        continue;
+                }
+
+                if (command.torrent >= torrents.size() || torrents[command.torrent].removed)
+                {
+                        continue;
+                }
+
+                Torrent &torrent = torrents[command.torrent];
+                torrent.removed = true;
+                wheel.cancel(torrent.timer);
+                torrent.timer = TimerWheel::invalid_timer;
+                {
+                        std::lock_guard<std::mutex> lock{mutex};
+                        --counters.torrents;
+                }
+
+                // a last announce tells the tracker we left, unless one is running right now; one already queued
+                // goes out as `stopped` instead
+                if (torrent.announced && !torrent.in_flight)
+                {
+                        torrent.params.event = AnnounceEvent::stopped;
+                        queue(command.torrent);
+                }
+        }
+}
+
+void AnnounceScheduler::queue(const TorrentId id)
+{
+        if (!torrents[id].queued)
+        {
+                torrents[id].queued = true;
+                ready.push_back(id);
+        }
+}
+
+void AnnounceScheduler::start_announce(const TorrentId id)
+{
+        Torrent &torrent = torrents[id];
+        torrent.queued = false;
+        if (torrent.in_flight || torrent.tiers.empty() || (torrent.removed && torrent.params.event != AnnounceEvent::stopped))
+        {
+                return;
+        }
+
+        torrent.in_flight = true;
+        ++in_flight;
+        {
+                std::lock_guard<std::mutex> lock{mutex};
+                ++counters.announces;
+        }
+
+        const std::string url = torrent.tiers[torrent.tier][torrent.position];
+        try
+        {
+                if (url.starts_with("udp://"))
+                {
+                        start_udp(id, url);
+                }
+                else
+                {
+                        start_http(id, url);
+                }
+        }
+        catch (const std::exception &e)
+        {
+                TrackerResponse response;
+                response.tracker = url;
+                response.error = e.what();
+                finish_announce(id, std::move(response));
+        }
+}
+
+// BEP 12 on the scheduler's terms: a responsive tracker moves to the front of its tier, a failing one hands over
+// to the next tracker right away, and only after all of them failed the torrent backs off
+void AnnounceScheduler::finish_announce(const TorrentId id, TrackerResponse response)
+{
+        Torrent &torrent = torrents[id];
+        torrent.in_flight = false;
+        --in_flight;
+        {
+                std::lock_guard<std::mutex> lock{mutex};
+                ++(response.success ? counters.successes : counters.failures);
+        }
+
+        callback(id, response);
+
+        if (torrent.removed)
+        {
+                // the removal came in while this announce was running, follow up with `stopped`
+                if (torrent.params.event != AnnounceEvent::stopped && (torrent.announced || response.success))
+                {
+                        torrent.params.event = AnnounceEvent::stopped;
+                        queue(id);
+                }
+                return;
+        }
+
+        size_t tracker_count = 0;
+        for (const auto &tier : torrent.tiers)
+        {
+                tracker_count += tier.size();
+        }
+
+        if (response.success)
+        {
+                auto &tier = torrent.tiers[torrent.tier];
+                std::rotate(tier.begin(), tier.begin() + static_cast<std::ptrdiff_t>(torrent.position), tier.begin() + static_cast<std::ptrdiff_t>(torrent.position) + 1);
+                torrent.tier = 0;
+                torrent.position = 0;
+                torrent.failures = 0;
+                torrent.announced = true;
+                torrent.params.event = AnnounceEvent::none;
+
+                const auto interval = response.interval > 0 ? std::chrono::seconds{response.interval} : options.default_interval;
+                const auto delay = std::max<std::chrono::milliseconds>(jittered(interval), std::chrono::seconds{response.min_interval});
+                schedule(id, delay);
+                return;
+        }
+
+        ++torrent.failures;
+        if (++torrent.position == torrent.tiers[torrent.tier].size())
+        {
+                torrent.position = 0;
+                torrent.tier = (torrent.tier + 1) % torrent.tiers.size();
+        }
+
+        if (torrent.failures % tracker_count != 0)
+        {
+                schedule(id, std::chrono::milliseconds{0});
+                return;
+        }
+
+        const unsigned rounds = std::min(torrent.failures / static_cast<unsigned>(tracker_count) - 1, 16u);
+        const auto retry = std::min<std::chrono::milliseconds>(options.retry_interval * (int64_t{1} << rounds), options.max_retry_interval);
+        schedule(id, jittered(retry));
+}
+
+void AnnounceScheduler::schedule(const TorrentId torrent, const std::chrono::milliseconds delay)
+{
+        torrents[torrent].timer = wheel.schedule(TimerWheel::Clock::now() + delay, make_token(kind_announce, torrent));
+}
+
+// takes a random share of up to options.jitter off, so torrents added together drift apart
+std::chrono::milliseconds AnnounceScheduler::jittered(const std::chrono::milliseconds interval)
+{
+        const auto range = static_cast<int64_t>(static_cast<double>(interval.count()) * options.jitter);
+        if (range <= 0)
+        {
+                return interval;
+        }
+        return interval - std::chrono::milliseconds{std::uniform_int_distribution<int64_t>(0, range)(random)};
+}
+
+void AnnounceScheduler::start_http(const TorrentId torrent, const std::string &url)
+{
+        const uint64_t id = next_id++;
+        auto exchange = std::make_unique<HttpExchange>();
+        exchange->torrent = torrent;
+        exchange->tracker = url;
+        exchange->start = TimerWheel::Clock::now();
+        HttpExchange &state = *exchange;
+        exchanges.emplace(id, std::move(exchange));
+        state.timeout = wheel.schedule(state.start + options.request_timeout, make_token(kind_http_timeout, id));
+
+        try
+        {
+                const std::string &full_url = torrents[torrent].query.url(url, torrents[torrent].params);
+                state.uri = http::parseUri(full_url.begin(), full_url.end());
+                state.port = state.uri.port.empty() ? "80" : state.uri.port;
+                state.request = http::encodeHtml(state.uri, "GET", {}, {});
+                state.parser = std::make_unique<http::ResponseParser>("GET", [&state](const std::uint8_t *data, const std::size_t size)
+                                                                      { state.decoder.feed({reinterpret_cast<const char *>(data), size}); });
+
+                if (auto socket = pool.acquire(state.uri.host, state.port))
+                {
+                        state.socket.emplace(std::move(*socket));
+                        state.reused = true;
+                        state.state = HttpExchange::State::sending;
+                        poller.add(state.socket->native(), poll_writable, make_token(kind_http, id));
+                        return;
+                }
+
+                state.addresses = resolver.resolveAsync(state.uri.host, state.port);
+        }
+        catch (const std::exception &e)
+        {
+                finish_http(id, e.what());
+        }
+}
+
+// tries the resolved addresses one after another until a connect gets under way
+void AnnounceScheduler::connect_http(const uint64_t id)
+{
+        HttpExchange &exchange = *exchanges.at(id);
+        const auto &addresses = exchange.addresses.get();
+
+        while (exchange.next_address < addresses.size())
+        {
+                const auto &address = addresses[exchange.next_address++];
+                try
+                {
+                        exchange.socket.emplace(address.family());
+                        exchange.state = exchange.socket->startConnect(reinterpret_cast<const sockaddr *>(&address.storage), address.length)
+                                             ? HttpExchange::State::sending
+                                             : HttpExchange::State::connecting;
+                        poller.add(exchange.socket->native(), poll_writable, make_token(kind_http, id));
+                        return;
+                }
+                catch (const std::exception &e)
+                {
+                        exchange.socket.reset();
+                        exchange.last_error = e.what();
+                }
+        }
+
+        finish_http(id, exchange.last_error.empty() ? "No address to connect to" : exchange.last_error);
+}
+
+void AnnounceScheduler::on_http_event(const uint64_t id, const uint32_t flags)
+{
+        const auto found = exchanges.find(id);
+        if (found == exchanges.end())
+        {
+                return;
+        }
+        HttpExchange &exchange = *found->second;
+
+        try
+        {
+                if (exchange.state == HttpExchange::State::connecting)
+                {
+                        try
+                        {
+                                exchange.socket->finishConnect();
+                        }
+                        catch (const std::exception &e)
+                        {
+                                poller.remove(exchange.socket->native());
+                                exchange.socket.reset();
+                                exchange.last_error = e.what();
+                                connect_http(id);
+                                return;
+                        }
+                        exchange.state = HttpExchange::State::sending;
+                }
+
+                if (exchange.state == HttpExchange::State::sending && (flags & (poll_writable | poll_error | poll_hangup)))
+                {
+                        if (!send_http(exchange))
+                        {
+                                return;
+                        }
+                        exchange.state = HttpExchange::State::receiving;
+                        poller.modify(exchange.socket->native(), poll_readable, make_token(kind_http, id));
+                        return;
+                }
+
+                if (exchange.state == HttpExchange::State::receiving && receive_http(exchange))
+                {
+                        finish_http(id, {});
+                }
+        }
+        catch (const std::exception &e)
+        {
+                // a pooled connection the server closed before it saw the request gets one retry on a new one
+                if (exchange.reused && !exchange.response_started)
+                {
+                        poller.remove(exchange.socket->native());
+                        exchange.socket.reset();
+                        exchange.reused = false;
+                        exchange.sent = 0;
+                        exchange.state = HttpExchange::State::resolving;
+                        exchange.addresses = resolver.resolveAsync(exchange.uri.host, exchange.port);
+                        return;
+                }
+                finish_http(id, e.what());
+        }
+}
+
+// returns true once the whole request is written
+bool AnnounceScheduler::send_http(HttpExchange &exchange)
+{
+        while (exchange.sent < exchange.request.size())
+        {
+                const ssize_t result = ::send(exchange.socket->native(), exchange.request.data() + exchange.sent,
+                                              exchange.request.size() - exchange.sent, MSG_NOSIGNAL);
+                if (result < 0)
+                {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        {
+                                return false;
+                        }
+                        if (errno != EINTR)
+                        {
+                                throw std::system_error(errno, std::system_category(), "Failed to send data");
+                        }
+                        continue;
+                }
+                exchange.sent += static_cast<size_t>(result);
+        }
+        return true;
+}
+
+// returns true once the response is complete
+bool AnnounceScheduler::receive_http(HttpExchange &exchange)
+{
+        std::array<uint8_t, 16384> buffer;
+        for (;;)
+        {
+                const ssize_t result = ::recv(exchange.socket->native(), buffer.data(), buffer.size(), 0);
+                if (result < 0)
+                {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        {
+                                return false;
+                        }
+                        if (errno != EINTR)
+                        {
+                                throw std::system_error(errno, std::system_category(), "Failed to read data");
+                        }
+                        continue;
+                }
+                if (result == 0)
+                {
+                        if (!exchange.parser->finish())
+                        {
+                                throw std::runtime_error("Connection closed before the response was complete");
+                        }
+                        return true;
+                }
+
+                exchange.response_started = true;
+                if (exchange.parser->feed(buffer.data(), static_cast<size_t>(result)))
+                {
+                        return true;
+                }
+        }
+}
+
+// an empty error means the response is complete
+void AnnounceScheduler::finish_http(const uint64_t id, const std::string &error)
+{
+        const auto found = exchanges.find(id);
+        if (found == exchanges.end())
+        {
+                return;
+        }
+        std::unique_ptr<HttpExchange> exchange = std::move(found->second);
+        exchanges.erase(found);
+        wheel.cancel(exchange->timeout);
+
+        TrackerResponse response;
+        response.tracker = exchange->tracker;
+        response.error = error;
+        response.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(TimerWheel::Clock::now() - exchange->start);
+
+        if (exchange->socket)
+        {
+                poller.remove(exchange->socket->native());
+        }
+
+        if (error.empty())
+        {
+                try
+                {
+                        const auto &result = exchange->parser->response();
+                        if (result.status.code != http::Status::Ok)
+                        {
+                                throw std::runtime_error("HTTP status " + std::to_string(result.status.code));
+                        }
+                        parse_announce_response(exchange->decoder.value(), response);
+                }
+                catch (const std::exception &e)
+                {
+                        response.error = e.what();
+                }
+
+                if (exchange->parser->keepAlive())
+                {
+                        pool.release(exchange->uri.host, exchange->port, std::move(*exchange->socket));
+                }
+        }
+
+        finish_announce(exchange->torrent, std::move(response));
+}
+
+void AnnounceScheduler::start_udp(const TorrentId torrent, const std::string &url)
+{
+        auto &endpoint = udp_endpoints[url];
+        if (!endpoint)
+        {
+                endpoint = std::make_unique<UdpEndpoint>();
+                endpoint->id = next_id++;
+                udp_by_id[endpoint->id] = endpoint.get();
+        }
+
+        if (endpoint->tracker)
+        {
+                endpoint->tracker->announce(torrents[torrent].params, [this, torrent](TrackerResponse response)
+                                            { finish_announce(torrent, std::move(response)); });
+                return;
+        }
+
+        endpoint->waiting.push_back(torrent);
+        if (!endpoint->addresses.valid())
+        {
+                try
+                {
+                        const auto uri = http::parseUri(url.begin(), url.end());
+                        endpoint->addresses = resolver.resolveAsync(uri.host, uri.port);
+                }
+                catch (const std::exception &e)
+                {
+                        std::promise<std::vector<http::Address>> failed;
+                        failed.set_exception(std::current_exception());
+                        endpoint->addresses = failed.get_future().share();
+                }
+        }
+}
+
+// the resolver answers on its own threads, finished lookups are picked up here once per loop iteration
+void AnnounceScheduler::check_resolutions()
+{
+        const auto is_ready = [](const auto &future)
+        { return future.valid() && future.wait_for(std::chrono::seconds{0}) == std::future_status::ready; };
+
+        std::vector<uint64_t> resolved;
+        for (const auto &[id, exchange] : exchanges)
+        {
+                if (exchange->state == HttpExchange::State::resolving && is_ready(exchange->addresses))
+                {
+                        resolved.push_back(id);
+                }
+        }
+        for (const auto id : resolved)
+        {
+                try
+                {
+                        exchanges.at(id)->addresses.get();
+                }
+                catch (const std::exception &e)
+                {
+                        finish_http(id, e.what());
+                        continue;
+                }
+                connect_http(id);
+        }
+
+        for (auto &[url, endpoint] : udp_endpoints)
+        {
+                if (endpoint->tracker || !is_ready(endpoint->addresses))
+                {
+                        continue;
+                }
+
+                std::string error;
+                try
+                {
+                        endpoint->tracker = std::make_unique<UdpTracker>(url, UdpTracker::pick_address(endpoint->addresses.get()), options.request_timeout / 4,
+                                                                         options.udp_retransmissions, options.request_timeout);
+                        poller.add(endpoint->tracker->fd(), poll_readable, make_token(kind_udp, endpoint->id));
+                }
+                catch (const std::exception &e)
+                {
+                        endpoint->tracker.reset();
+                        error = e.what();
+                }
+
+                std::vector<TorrentId> waiting;
+                waiting.swap(endpoint->waiting);
+                endpoint->addresses = {}; // a failed lookup is retried with the next announce
+                for (const auto torrent : waiting)
+                {
+                        if (endpoint->tracker)
+                        {
+                                endpoint->tracker->announce(torrents[torrent].params, [this, torrent](TrackerResponse response)
+                                                            { finish_announce(torrent, std::move(response)); });
+                        }
+                        else
+                        {
+                                TrackerResponse response;
+                                response.tracker = url;
+                                response.error = error;
+                                finish_announce(torrent, std::move(response));
+                        }
+                }
+        }
+}
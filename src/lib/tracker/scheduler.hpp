@@ -0,0 +1,131 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "announce.hpp"
+#include "../net/poller.hpp"
+#include "../net/timer_wheel.hpp"
+
+class UdpTracker;
+
+// Re-announces many torrents from one event loop thread: due announces come out of a timer wheel, HTTP exchanges
+// and UDP trackers share one poller, and the next announce honours `interval`/`min interval` minus some jitter.
+class AnnounceScheduler
+{
+public:
+        using TorrentId = size_t;
+        using Callback = std::function<void(TorrentId torrent, const TrackerResponse &response)>; // runs on the loop thread
+
+        struct Options
+        {
+                std::chrono::milliseconds tick{100};
+                std::chrono::milliseconds request_timeout{15000};
+                std::chrono::seconds default_interval{1800};   // when the tracker sends none
+                std::chrono::seconds retry_interval{15};       // after every tracker of a torrent failed, doubles per round
+                std::chrono::seconds max_retry_interval{1800};
+                std::chrono::seconds startup_spread{0};        // first announces are spread over this window
+                double jitter = 0.1;                           // up to this fraction of the interval is taken off
+                size_t max_in_flight = 256;
+                unsigned udp_retransmissions = 3;
+        };
+
+        struct Statistics
+        {
+                uint64_t announces = 0;
+                uint64_t successes = 0;
+                uint64_t failures = 0;
+                size_t torrents = 0;
+                size_t in_flight = 0;
+                size_t queued = 0; // due, waiting for an in-flight slot
+        };
+
+        explicit AnnounceScheduler(Callback callback, Options options);
+        explicit AnnounceScheduler(Callback callback);
+        ~AnnounceScheduler();
+        AnnounceScheduler(const AnnounceScheduler &) = delete;
+        AnnounceScheduler &operator=(const AnnounceScheduler &) = delete;
+
+        // thread safe, the torrent's first announce carries the params' event (usually `started`); empty tiers are
+        // dropped, and a torrent without any tracker throws std::invalid_argument
+        TorrentId add(const AnnounceParams &params, std::vector<std::vector<std::string>> tiers);
+        void remove(TorrentId torrent); // sends `stopped` if the torrent was announced before
+        Statistics statistics() const;
+
+private:
+        struct Torrent
+        {
+                AnnounceParams params;
+                AnnounceQuery query;
+                std::vector<std::vector<std::string>> tiers;
+                size_t tier = 0;
+                size_t position = 0;
+                unsigned failures = 0; // in a row
+                bool announced = false;
+                bool in_flight = false;
+                bool queued = false; // in ready
+                bool removed = false;
+                TimerWheel::TimerId timer = TimerWheel::invalid_timer;
+        };
+
+        struct HttpExchange;
+        struct UdpEndpoint;
+
+        struct Command
+        {
+                TorrentId torrent;
+                bool remove;
+                AnnounceParams params;
+                std::vector<std::vector<std::string>> tiers;
+        };
+
+        void run(std::stop_token stop);
+        void apply_commands(TimerWheel::Clock::time_point now);
+        void queue(TorrentId torrent); // onto ready, once
+        void start_announce(TorrentId torrent);
+        void finish_announce(TorrentId torrent, TrackerResponse response);
+        void schedule(TorrentId torrent, std::chrono::milliseconds delay);
+        std::chrono::milliseconds jittered(std::chrono::milliseconds interval);
+
+        void start_http(TorrentId torrent, const std::string &url);
+        void connect_http(uint64_t id);
+        void on_http_event(uint64_t id, uint32_t flags);
+        bool send_http(HttpExchange &exchange);
+        bool receive_http(HttpExchange &exchange);
+        void finish_http(uint64_t id, const std::string &error);
+        void start_udp(TorrentId torrent, const std::string &url);
+        void check_resolutions();
+
+        const Callback callback;
+        const Options options;
+
+        mutable std::mutex mutex; // guards commands, next_torrent and the counters read by statistics()
+        std::vector<Command> commands;
+        TorrentId next_torrent = 0;
+        Statistics counters;
+
+        // loop thread only
+        Poller poller;
+        TimerWheel wheel;
+        std::mt19937 random;
+        std::vector<Torrent> torrents;
+        std::deque<TorrentId> ready;
+        size_t in_flight = 0;
+        uint64_t next_id = 1;
+        std::unordered_map<uint64_t, std::unique_ptr<HttpExchange>> exchanges;
+        std::unordered_map<std::string, std::unique_ptr<UdpEndpoint>> udp_endpoints;
+        std::unordered_map<uint64_t, UdpEndpoint *> udp_by_id;
+        http::ConnectionPool pool;
+        http::Resolver resolver;
+
+        std::jthread loop; // last, so everything above exists while it runs
+};
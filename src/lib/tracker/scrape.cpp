@@ -0,0 +1,111 @@
+#include "scrape.hpp"
+#include "udp.hpp"
+#include "../bencode/stream.hpp"
+#include "../http/utils.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+// BEP 48: the last path component has to start with `announce`, which becomes `scrape`; UDP trackers keep their URL
+std::string scrape_url(const std::string &announce)
+{
+        if (announce.starts_with("udp://"))
+        {
+                return announce;
+        }
+
+        const size_t slash = announce.rfind('/');
+        if (slash == std::string::npos || announce.compare(slash + 1, 8, "announce") != 0)
+        {
+                throw std::invalid_argument("Tracker does not support scrape: " + announce);
+        }
+        return announce.substr(0, slash + 1) + "scrape" + announce.substr(slash + 1 + 8);
+}
+
+// the `files` dictionary is keyed by raw info hash
+void parse_scrape_files(const json &response, std::map<std::string, ScrapeStats> &files)
+{
+        if (response.contains("failure reason"))
+        {
+                throw std::runtime_error(response.at("failure reason").get<std::string>());
+        }
+        if (!response.contains("files"))
+        {
+                throw std::runtime_error("Scrape response without files");
+        }
+
+        for (const auto &[info_hash, counters] : response.at("files").items())
+        {
+                ScrapeStats stats;
+                stats.complete = counters.contains("complete") ? counters.at("complete").get<int64_t>() : 0;
+                stats.incomplete = counters.contains("incomplete") ? counters.at("incomplete").get<int64_t>() : 0;
+                stats.downloaded = counters.contains("downloaded") ? counters.at("downloaded").get<int64_t>() : 0;
+                files[info_hash] = stats;
+        }
+}
+
+Scraper::Scraper(const std::chrono::milliseconds deadline, const size_t max_hashes_per_request)
+    : deadline(deadline), max_hashes_per_request(std::max<size_t>(1, max_hashes_per_request))
+{
+}
+
+// never throws for tracker failures, they end up in ScrapeSummary::errors
+ScrapeSummary Scraper::scrape(const std::string &announce, const std::vector<std::string> &info_hashes)
+{
+        ScrapeSummary summary;
+        try
+        {
+                const std::string url = scrape_url(announce);
+                if (!url.starts_with("udp://"))
+                {
+                        return scrape_http(url, info_hashes);
+                }
+
+                // the lookup counts against the deadline as well
+                const auto start = std::chrono::steady_clock::now();
+                UdpTracker tracker{url, resolver, deadline, deadline / 4};
+                const auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+                summary.files = tracker.scrape_all(info_hashes, summary.errors, std::max(deadline - spent, std::chrono::milliseconds{0}));
+        }
+        catch (const std::exception &e)
+        {
+                summary.errors.push_back(e.what());
+        }
+        return summary;
+}
+
+ScrapeSummary Scraper::scrape_http(const std::string &url, const std::vector<std::string> &info_hashes)
+{
+        ScrapeSummary summary;
+        const char *separator = url.find('?') == std::string::npos ? "?" : "&";
+
+        for (size_t begin = 0; begin < info_hashes.size(); begin += max_hashes_per_request)
+        {
+                const size_t end = std::min(info_hashes.size(), begin + max_hashes_per_request);
+                std::string request_url = url;
+                request_url.reserve(url.size() + (end - begin) * 72);
+                for (size_t i = begin; i < end; ++i)
+                {
+                        request_url += (i == begin ? separator : "&");
+                        request_url += "info_hash=";
+                        percent_encode(info_hashes[i], request_url);
+                }
+
+                try
+                {
+                        http::Request request{request_url, pool, resolver};
+                        BencodeStreamDecoder decoder;
+                        const auto result = request.send("GET", "", {}, [&decoder](const std::uint8_t *data, const std::size_t size)
+                                                         { decoder.feed({reinterpret_cast<const char *>(data), size}); }, deadline);
+                        if (result.status.code != http::Status::Ok)
+                        {
+                                throw std::runtime_error("HTTP status " + std::to_string(result.status.code));
+                        }
+                        parse_scrape_files(decoder.value(), summary.files);
+                }
+                catch (const std::exception &e)
+                {
+                        summary.errors.push_back(e.what());
+                }
+        }
+        return summary;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "announce.hpp"
+
+// info hashes are the raw 20 bytes, counters of torrents the tracker did not mention are absent
+struct ScrapeSummary
+{
+        std::map<std::string, ScrapeStats> files;
+        std::vector<std::string> errors;
+};
+
+std::string scrape_url(const std::string &announce);
+void parse_scrape_files(const json &response, std::map<std::string, ScrapeStats> &files);
+
+// scrapes many torrents of one tracker with as few requests as the tracker allows
+class Scraper
+{
+public:
+        // 64 hashes keep the request line of an HTTP scrape around 4 KiB, below common server limits
+        explicit Scraper(std::chrono::milliseconds deadline = std::chrono::seconds{5}, size_t max_hashes_per_request = 64);
+
+        ScrapeSummary scrape(const std::string &announce, const std::vector<std::string> &info_hashes);
+
+private:
+        ScrapeSummary scrape_http(const std::string &url, const std::vector<std::string> &info_hashes);
+
+        const std::chrono::milliseconds deadline;
+        const size_t max_hashes_per_request;
+        http::ConnectionPool pool;
+        http::Resolver resolver;
+};
@@ -0,0 +1,1009 @@
+#include "server.hpp"
+#include "announce.hpp"
+#include "../bencode/writer.hpp"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+        // never a descriptor, marks the listening socket
+        constexpr uint64_t listen_token = UINT64_MAX - 1;
+
+        constexpr size_t max_scrape_hashes = 256;
+        constexpr std::chrono::seconds sweep_period{15};
+        constexpr std::chrono::seconds idle_timeout{120};
+
+        uint64_t hash_prefix(const InfoHash &info_hash)
+        {
+                uint64_t prefix;
+                std::memcpy(&prefix, info_hash.data(), sizeof(prefix));
+                return prefix;
+        }
+
+        int hex_value(const char c)
+        {
+                if (c >= '0' && c <= '9')
+                {
+                        return c - '0';
+                }
+                if (c >= 'a' && c <= 'f')
+                {
+                        return c - 'a' + 10;
+                }
+                if (c >= 'A' && c <= 'F')
+                {
+                        return c - 'A' + 10;
+                }
+                return -1;
+        }
+
+        // decodes into out, the decoded length or -1 if it does not fit or is malformed
+        ptrdiff_t percent_decode(const std::string_view value, uint8_t *out, const size_t capacity)
+        {
+                size_t length = 0;
+                for (size_t i = 0; i < value.size(); ++i)
+                {
+                        if (length == capacity)
+                        {
+                                return -1;
+                        }
+                        if (value[i] != '%')
+                        {
+                                out[length++] = static_cast<uint8_t>(value[i] == '+' ? ' ' : value[i]);
+                                continue;
+                        }
+                        if (i + 2 >= value.size())
+                        {
+                                return -1;
+                        }
+                        const int high = hex_value(value[i + 1]);
+                        const int low = hex_value(value[i + 2]);
+                        if (high < 0 || low < 0)
+                        {
+                                return -1;
+                        }
+                        out[length++] = static_cast<uint8_t>(high << 4 | low);
+                        i += 2;
+                }
+                return static_cast<ptrdiff_t>(length);
+        }
+
+        bool parse_info_hash(const std::string_view value, InfoHash &info_hash)
+        {
+                return percent_decode(value, info_hash.data(), info_hash.size()) == static_cast<ptrdiff_t>(info_hash.size());
+        }
+
+        template <typename Integer>
+        bool parse_number(const std::string_view value, Integer &number)
+        {
+                const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+                return error == std::errc{} && end == value.data() + value.size();
+        }
+
+        // calls function(name, value) for every name=value pair of a query string
+        template <typename Function>
+        void for_each_parameter(std::string_view query, Function function)
+        {
+                while (!query.empty())
+                {
+                        const size_t ampersand = query.find('&');
+                        const std::string_view pair = query.substr(0, ampersand);
+                        const size_t equals = pair.find('=');
+                        if (equals == std::string_view::npos)
+                        {
+                                function(pair, std::string_view{});
+                        }
+                        else
+                        {
+                                function(pair.substr(0, equals), pair.substr(equals + 1));
+                        }
+                        query = ampersand == std::string_view::npos ? std::string_view{} : query.substr(ampersand + 1);
+                }
+        }
+
+        bool equals_ignore_case(const std::string_view a, const std::string_view b)
+        {
+                return std::ranges::equal(a, b, [](const char x, const char y)
+                                          { return (x | 0x20) == (y | 0x20); });
+        }
+
+        // RFC 7230, 6.3: HTTP/1.1 stays open unless `Connection: close`, HTTP/1.0 only with keep-alive
+        bool wants_close(const std::string_view version, std::string_view headers)
+        {
+                bool close = version != "HTTP/1.1";
+                while (!headers.empty())
+                {
+                        const size_t line_end = headers.find("\r\n");
+                        const std::string_view line = headers.substr(0, line_end);
+                        headers = line_end == std::string_view::npos ? std::string_view{} : headers.substr(line_end + 2);
+
+                        const size_t colon = line.find(':');
+                        if (colon == std::string_view::npos || !equals_ignore_case(line.substr(0, colon), "connection"))
+                        {
+                                continue;
+                        }
+                        std::string_view value = line.substr(colon + 1);
+                        while (!value.empty() && value.front() == ' ')
+                        {
+                                value.remove_prefix(1);
+                        }
+                        if (equals_ignore_case(value, "close"))
+                        {
+                                close = true;
+                        }
+                        else if (equals_ignore_case(value, "keep-alive"))
+                        {
+                                close = false;
+                        }
+                }
+                return close;
+        }
+
+        // the client address, IPv4-mapped addresses from the dual stack socket are turned back into IPv4
+        PeerEndpoint remote_endpoint(const sockaddr_storage &storage)
+        {
+                PeerEndpoint endpoint = PeerEndpoint::from_sockaddr(reinterpret_cast<const sockaddr *>(&storage));
+                static constexpr uint8_t mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+                if (endpoint.family == AF_INET6 && std::memcmp(endpoint.address.data(), mapped, sizeof(mapped)) == 0)
+                {
+                        std::memmove(endpoint.address.data(), endpoint.address.data() + 12, 4);
+                        std::fill(endpoint.address.begin() + 4, endpoint.address.end(), uint8_t{0});
+                        endpoint.family = AF_INET;
+                }
+                return endpoint;
+        }
+
+        size_t peer_slot(const Swarm &swarm, const PeerEndpoint &endpoint)
+        {
+                const size_t mask = swarm.index.size() - 1;
+                for (size_t slot = endpoint.hash() & mask;; slot = (slot + 1) & mask)
+                {
+                        const uint32_t position = swarm.index[slot];
+                        if (position == 0 || swarm.peers[position - 1].endpoint == endpoint)
+                        {
+                                return slot;
+                        }
+                }
+        }
+
+        void rebuild_peer_index(Swarm &swarm, const size_t size)
+        {
+                swarm.index.assign(size, 0);
+                for (uint32_t position = 0; position < swarm.peers.size(); ++position)
+                {
+                        swarm.index[peer_slot(swarm, swarm.peers[position].endpoint)] = position + 1;
+                }
+        }
+
+        // index of the peer in swarm.peers, or npos
+        size_t find_peer(const Swarm &swarm, const PeerEndpoint &endpoint)
+        {
+                if (swarm.index.empty())
+                {
+                        return std::string::npos;
+                }
+                const uint32_t position = swarm.index[peer_slot(swarm, endpoint)];
+                return position == 0 ? std::string::npos : position - 1;
+        }
+
+        size_t insert_peer(Swarm &swarm, const SwarmPeer &peer)
+        {
+                // at most half full keeps probe sequences short
+                if ((swarm.peers.size() + 1) * 2 > swarm.index.size())
+                {
+                        rebuild_peer_index(swarm, std::max<size_t>(16, swarm.index.size() * 2));
+                }
+                swarm.peers.push_back(peer);
+                swarm.index[peer_slot(swarm, peer.endpoint)] = static_cast<uint32_t>(swarm.peers.size());
+                swarm.seeds += peer.seed;
+                return swarm.peers.size() - 1;
+        }
+
+        // backward shift deletion keeps the table free of tombstones, then the last peer fills the gap
+        void remove_peer(Swarm &swarm, const size_t position)
+        {
+                const size_t mask = swarm.index.size() - 1;
+                size_t hole = peer_slot(swarm, swarm.peers[position].endpoint);
+                for (size_t slot = (hole + 1) & mask; swarm.index[slot] != 0; slot = (slot + 1) & mask)
+                {
+                        const size_t home = swarm.peers[swarm.index[slot] - 1].endpoint.hash() & mask;
+                        if (((slot - home) & mask) >= ((slot - hole) & mask))
+                        {
+                                swarm.index[hole] = swarm.index[slot];
+                                hole = slot;
+                        }
+                }
+                swarm.index[hole] = 0;
+
+                swarm.seeds -= swarm.peers[position].seed;
+                if (position + 1 != swarm.peers.size())
+                {
+                        swarm.index[peer_slot(swarm, swarm.peers.back().endpoint)] = static_cast<uint32_t>(position + 1);
+                        swarm.peers[position] = swarm.peers.back();
+                }
+                swarm.peers.pop_back();
+        }
+
+        void write_endpoint(uint8_t *out, const PeerEndpoint &endpoint)
+        {
+                const size_t address_length = endpoint.family == AF_INET6 ? 16 : 4;
+                std::memcpy(out, endpoint.address.data(), address_length);
+                out[address_length] = static_cast<uint8_t>(endpoint.port >> 8);
+                out[address_length + 1] = static_cast<uint8_t>(endpoint.port);
+        }
+
+        void append(std::vector<char> &output, const std::string_view text)
+        {
+                output.insert(output.end(), text.begin(), text.end());
+        }
+}
+
+SwarmTable::SwarmTable()
+    : slots(1024, Slot{0, 0})
+{
+}
+
+Swarm *SwarmTable::find(const InfoHash &info_hash)
+{
+        const uint64_t prefix = hash_prefix(info_hash);
+        const size_t mask = slots.size() - 1;
+        for (size_t slot = prefix & mask; slots[slot].swarm != 0; slot = (slot + 1) & mask)
+        {
+                // the prefix filters out almost every other swarm before the full key is compared
+                Swarm &swarm = swarm_list[slots[slot].swarm - 1];
+                if (slots[slot].prefix == prefix && swarm.info_hash == info_hash)
+                {
+                        return &swarm;
+                }
+        }
+        return nullptr;
+}
+
+Swarm &SwarmTable::find_or_insert(const InfoHash &info_hash)
+{
+        if (Swarm *swarm = find(info_hash))
+        {
+                return *swarm;
+        }
+        if ((swarm_list.size() + 1) * 2 > slots.size())
+        {
+                grow();
+        }
+
+        const uint64_t prefix = hash_prefix(info_hash);
+        const size_t mask = slots.size() - 1;
+        size_t slot = prefix & mask;
+        while (slots[slot].swarm != 0)
+        {
+                slot = (slot + 1) & mask;
+        }
+        swarm_list.push_back(Swarm{info_hash, {}, {}, 0, 0});
+        slots[slot] = Slot{prefix, static_cast<uint32_t>(swarm_list.size())};
+        return swarm_list.back();
+}
+
+// backward shift deletion as for the peers of a swarm
+void SwarmTable::erase(const size_t position)
+{
+        const size_t mask = slots.size() - 1;
+        size_t hole = slot_of(position);
+        for (size_t slot = (hole + 1) & mask; slots[slot].swarm != 0; slot = (slot + 1) & mask)
+        {
+                const size_t home = slots[slot].prefix & mask;
+                if (((slot - home) & mask) >= ((slot - hole) & mask))
+                {
+                        slots[hole] = slots[slot];
+                        hole = slot;
+                }
+        }
+        slots[hole] = Slot{0, 0};
+
+        if (position + 1 != swarm_list.size())
+        {
+                slots[slot_of(swarm_list.size() - 1)].swarm = static_cast<uint32_t>(position + 1);
+                swarm_list[position] = std::move(swarm_list.back());
+        }
+        swarm_list.pop_back();
+}
+
+std::vector<Swarm> &SwarmTable::swarms()
+{
+        return swarm_list;
+}
+
+size_t SwarmTable::slot_of(const size_t position) const
+{
+        const size_t mask = slots.size() - 1;
+        size_t slot = hash_prefix(swarm_list[position].info_hash) & mask;
+        while (slots[slot].swarm != position + 1)
+        {
+                slot = (slot + 1) & mask;
+        }
+        return slot;
+}
+
+void SwarmTable::grow()
+{
+        std::vector<Slot> old = std::move(slots);
+        slots.assign(old.size() * 2, Slot{0, 0});
+        const size_t mask = slots.size() - 1;
+        for (const Slot &entry : old)
+        {
+                if (entry.swarm == 0)
+                {
+                        continue;
+                }
+                size_t slot = entry.prefix & mask;
+                while (slots[slot].swarm != 0)
+                {
+                        slot = (slot + 1) & mask;
+                }
+                slots[slot] = entry;
+        }
+}
+
+struct TrackerServer::Connection
+{
+        int fd;
+        PeerEndpoint remote;
+        std::array<char, 4096> input;
+        size_t input_size = 0;
+        std::vector<char> output;
+        size_t output_sent = 0;
+        bool close_after = false;
+        bool want_writable = false;
+        std::chrono::steady_clock::time_point last_active;
+};
+
+TrackerServer::TrackerServer(const TrackerServerOptions options)
+    : options(options), body(64 * 1024), random(std::random_device{}())
+{
+        // a dual stack socket serves IPv4 and IPv6 clients alike
+        int family = AF_INET6;
+        listen_fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd == -1)
+        {
+                family = AF_INET;
+                listen_fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        }
+        if (listen_fd == -1)
+        {
+                throw std::runtime_error(std::string("Failed to create tracker socket: ") + std::strerror(errno));
+        }
+
+        const int on = 1;
+        const int off = 0;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_storage storage{};
+        socklen_t length;
+        if (family == AF_INET6)
+        {
+                setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+                auto &address = reinterpret_cast<sockaddr_in6 &>(storage);
+                address.sin6_family = AF_INET6;
+                address.sin6_addr = in6addr_any;
+                address.sin6_port = htons(options.port);
+                length = sizeof(sockaddr_in6);
+        }
+        else
+        {
+                auto &address = reinterpret_cast<sockaddr_in &>(storage);
+                address.sin_family = AF_INET;
+                address.sin_addr.s_addr = htonl(INADDR_ANY);
+                address.sin_port = htons(options.port);
+                length = sizeof(sockaddr_in);
+        }
+
+        if (bind(listen_fd, reinterpret_cast<sockaddr *>(&storage), length) == -1 || listen(listen_fd, SOMAXCONN) == -1)
+        {
+                const int error = errno;
+                close(listen_fd);
+                throw std::runtime_error("Failed to listen on tracker port " + std::to_string(options.port) + ": " + std::strerror(error));
+        }
+
+        length = sizeof(storage);
+        getsockname(listen_fd, reinterpret_cast<sockaddr *>(&storage), &length);
+        bound_port = PeerEndpoint::from_sockaddr(reinterpret_cast<sockaddr *>(&storage)).port;
+        poller.add(listen_fd, poll_readable, listen_token);
+}
+
+TrackerServer::~TrackerServer()
+{
+        for (const auto &connection : connections)
+        {
+                if (connection)
+                {
+                        close(connection->fd);
+                }
+        }
+        close(listen_fd);
+}
+
+uint16_t TrackerServer::port() const
+{
+        return bound_port;
+}
+
+TrackerServerStatistics TrackerServer::statistics() const
+{
+        return {announces.load(std::memory_order_relaxed), scrapes.load(std::memory_order_relaxed),
+                failures.load(std::memory_order_relaxed), accepted.load(std::memory_order_relaxed),
+                torrent_count.load(std::memory_order_relaxed), peer_count.load(std::memory_order_relaxed)};
+}
+
+// serves until stop is requested, everything (sockets, swarms) is touched only by this thread
+void TrackerServer::run(const std::stop_token stop)
+{
+        std::stop_callback wake_on_stop{stop, [this]
+                                        { poller.wake(); }};
+        std::vector<PollEvent> events;
+        auto next_sweep = std::chrono::steady_clock::now() + sweep_period;
+
+        while (!stop.stop_requested())
+        {
+                poller.wait(events, 1000);
+                for (const PollEvent &event : events)
+                {
+                        if (event.token == listen_token)
+                        {
+                                accept_connections();
+                                continue;
+                        }
+
+                        const int fd = static_cast<int>(event.token);
+                        if (static_cast<size_t>(fd) >= connections.size() || !connections[fd])
+                        {
+                                continue;
+                        }
+                        if (event.flags & poll_error)
+                        {
+                                close_connection(fd);
+                                continue;
+                        }
+                        if (event.flags & (poll_readable | poll_hangup))
+                        {
+                                on_readable(*connections[fd]);
+                        }
+                        if ((event.flags & poll_writable) && connections[fd])
+                        {
+                                flush(*connections[fd]);
+                        }
+                }
+
+                const auto now = std::chrono::steady_clock::now();
+                if (now >= next_sweep)
+                {
+                        expire(now);
+                        for (const auto &connection : connections)
+                        {
+                                if (connection && now - connection->last_active > idle_timeout)
+                                {
+                                        close_connection(connection->fd);
+                                }
+                        }
+                        next_sweep = now + sweep_period;
+                }
+        }
+}
+
+void TrackerServer::accept_connections()
+{
+        for (;;)
+        {
+                sockaddr_storage storage{};
+                socklen_t length = sizeof(storage);
+                const int fd = accept4(listen_fd, reinterpret_cast<sockaddr *>(&storage), &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd == -1)
+                {
+                        return; // EAGAIN, or out of descriptors until some connection closes
+                }
+
+                const int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+                auto connection = std::make_unique<Connection>();
+                connection->fd = fd;
+                connection->remote = remote_endpoint(storage);
+                connection->last_active = std::chrono::steady_clock::now();
+                if (static_cast<size_t>(fd) >= connections.size())
+                {
+                        connections.resize(std::bit_ceil(static_cast<size_t>(fd) + 1));
+                }
+                connections[fd] = std::move(connection);
+                poller.add(fd, poll_readable, static_cast<uint64_t>(fd));
+                accepted.fetch_add(1, std::memory_order_relaxed);
+        }
+}
+
+// reads what arrived and answers every complete request in it, pipelined requests included
+void TrackerServer::on_readable(Connection &connection)
+{
+        const int fd = connection.fd;
+        for (;;)
+        {
+                if (connection.input_size == connection.input.size())
+                {
+                        append(connection.output, "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                        connection.close_after = true;
+                        break;
+                }
+
+                const ssize_t received = recv(fd, connection.input.data() + connection.input_size, connection.input.size() - connection.input_size, 0);
+                if (received == 0 || (received == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                {
+                        close_connection(fd);
+                        return;
+                }
+                if (received == -1)
+                {
+                        break;
+                }
+                connection.input_size += static_cast<size_t>(received);
+                connection.last_active = std::chrono::steady_clock::now();
+
+                size_t consumed = 0;
+                const std::string_view input{connection.input.data(), connection.input_size};
+                while (!connection.close_after)
+                {
+                        const size_t head_end = input.find("\r\n\r\n", consumed);
+                        if (head_end == std::string_view::npos)
+                        {
+                                break;
+                        }
+                        if (!handle_request(connection, input.substr(consumed, head_end + 2 - consumed)))
+                        {
+                                connection.close_after = true;
+                        }
+                        consumed = head_end + 4;
+                }
+                std::memmove(connection.input.data(), connection.input.data() + consumed, connection.input_size - consumed);
+                connection.input_size -= consumed;
+
+                if (connection.close_after)
+                {
+                        break;
+                }
+        }
+        flush(connection);
+}
+
+void TrackerServer::flush(Connection &connection)
+{
+        while (connection.output_sent < connection.output.size())
+        {
+                const ssize_t sent = send(connection.fd, connection.output.data() + connection.output_sent,
+                                          connection.output.size() - connection.output_sent, MSG_NOSIGNAL);
+                if (sent == -1)
+                {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        {
+                                if (!connection.want_writable)
+                                {
+                                        connection.want_writable = true;
+                                        poller.modify(connection.fd, poll_readable | poll_writable, static_cast<uint64_t>(connection.fd));
+                                }
+                                return;
+                        }
+                        if (errno == EINTR)
+                        {
+                                continue;
+                        }
+                        close_connection(connection.fd);
+                        return;
+                }
+                connection.output_sent += static_cast<size_t>(sent);
+        }
+
+        connection.output.clear();
+        connection.output_sent = 0;
+        if (connection.close_after)
+        {
+                close_connection(connection.fd);
+                return;
+        }
+        if (connection.want_writable)
+        {
+                connection.want_writable = false;
+                poller.modify(connection.fd, poll_readable, static_cast<uint64_t>(connection.fd));
+        }
+}
+
+void TrackerServer::close_connection(const int fd)
+{
+        poller.remove(fd);
+        close(fd);
+        connections[fd].reset();
+}
+
+// head is the request line and headers, each ending with CRLF; false closes the connection
+bool TrackerServer::handle_request(Connection &connection, const std::string_view head)
+{
+        const size_t line_end = head.find("\r\n");
+        const std::string_view request_line = head.substr(0, line_end);
+        const size_t target_begin = request_line.find(' ');
+        const size_t target_end = request_line.rfind(' ');
+        if (target_begin == std::string_view::npos || target_end == target_begin)
+        {
+                append(connection.output, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                return false;
+        }
+
+        const std::string_view method = request_line.substr(0, target_begin);
+        const std::string_view target = request_line.substr(target_begin + 1, target_end - target_begin - 1);
+        const std::string_view version = request_line.substr(target_end + 1);
+        const bool close_after = wants_close(version, head.substr(line_end + 2));
+
+        const size_t question = target.find('?');
+        const std::string_view path = target.substr(0, question);
+        const std::string_view query = question == std::string_view::npos ? std::string_view{} : target.substr(question + 1);
+
+        std::string_view response;
+        if (method != "GET")
+        {
+                append(connection.output, "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                return false;
+        }
+        if (path == "/announce")
+        {
+                response = announce(connection, query);
+        }
+        else if (path == "/scrape")
+        {
+                response = scrape(query);
+        }
+        else
+        {
+                append(connection.output, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n");
+                append(connection.output, close_after ? "Connection: close\r\n\r\n" : "\r\n");
+                return !close_after;
+        }
+        if (response.empty())
+        {
+                // no bencoded response is empty, the builder ran out of body space
+                failures.fetch_add(1, std::memory_order_relaxed);
+                append(connection.output, "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n");
+                append(connection.output, close_after ? "Connection: close\r\n\r\n" : "\r\n");
+                return !close_after;
+        }
+
+        char length[24];
+        append(connection.output, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: ");
+        append(connection.output, {length, std::to_chars(length, length + sizeof(length), response.size()).ptr});
+        append(connection.output, close_after ? "\r\nConnection: close\r\n\r\n" : "\r\n\r\n");
+        append(connection.output, response);
+        return !close_after;
+}
+
+// updates the swarm and answers with compact peers (BEP 23, BEP 7) chosen from a random offset
+std::string_view TrackerServer::announce(const Connection &connection, const std::string_view query)
+{
+        InfoHash info_hash;
+        bool have_info_hash = false;
+        bool have_port = false;
+        uint16_t port = 0;
+        int64_t left = -1;
+        size_t numwant = options.default_numwant;
+        std::string_view event;
+
+        bool malformed = false;
+        for_each_parameter(query, [&](const std::string_view name, const std::string_view value)
+                           {
+                                   if (name == "info_hash")
+                                   {
+                                           have_info_hash = parse_info_hash(value, info_hash);
+                                           malformed |= !have_info_hash;
+                                   }
+                                   else if (name == "port")
+                                   {
+                                           have_port = parse_number(value, port);
+                                           malformed |= !have_port;
+                                   }
+                                   else if (name == "left")
+                                   {
+                                           malformed |= !parse_number(value, left);
+                                   }
+                                   else if (name == "numwant")
+                                   {
+                                           malformed |= !parse_number(value, numwant);
+                                   }
+                                   else if (name == "event")
+                                   {
+                                           event = value;
+                                   } });
+
+        if (malformed || !have_info_hash || !have_port || port == 0)
+        {
+                return failure(malformed ? "Malformed announce" : "Missing info_hash or port");
+        }
+        announces.fetch_add(1, std::memory_order_relaxed);
+
+        const auto now = std::chrono::steady_clock::now();
+        Swarm &swarm = table.find_or_insert(info_hash);
+        torrent_count.store(table.swarms().size(), std::memory_order_relaxed);
+
+        PeerEndpoint endpoint = connection.remote;
+        endpoint.port = port;
+        const bool seed = left == 0;
+        size_t self = find_peer(swarm, endpoint);
+
+        if (event == "stopped")
+        {
+                if (self != std::string::npos)
+                {
+                        remove_peer(swarm, self);
+                        peer_count.fetch_sub(1, std::memory_order_relaxed);
+                }
+                self = std::string::npos;
+                numwant = 0;
+        }
+        else if (self == std::string::npos)
+        {
+                self = insert_peer(swarm, {endpoint, now, seed});
+                peer_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+                SwarmPeer &peer = swarm.peers[self];
+                swarm.seeds += static_cast<uint32_t>(seed) - static_cast<uint32_t>(peer.seed);
+                peer.seed = seed;
+                peer.last_seen = now;
+        }
+        if (event == "completed")
+        {
+                ++swarm.downloaded;
+        }
+
+        // seeds have no use for other seeds
+        std::array<uint32_t, 256> chosen;
+        size_t chosen_count = 0;
+        size_t ipv4_count = 0;
+        numwant = std::min({numwant, options.max_numwant, chosen.size()});
+        const size_t peer_total = swarm.peers.size();
+        const size_t offset = peer_total == 0 ? 0 : random() % peer_total;
+        for (size_t i = 0; i < peer_total && chosen_count < numwant; ++i)
+        {
+                const size_t position = (offset + i) % peer_total;
+                if (position == self || (seed && swarm.peers[position].seed))
+                {
+                        continue;
+                }
+                chosen[chosen_count++] = static_cast<uint32_t>(position);
+                ipv4_count += swarm.peers[position].endpoint.family == AF_INET;
+        }
+        std::partition(chosen.begin(), chosen.begin() + static_cast<ptrdiff_t>(chosen_count), [&](const uint32_t position)
+                       { return swarm.peers[position].endpoint.family == AF_INET; });
+
+        BencodeWriter writer{body.data(), body.size()};
+        writer.begin_dictionary()
+            .string("complete")
+            .integer(swarm.seeds)
+            .string("incomplete")
+            .integer(static_cast<int64_t>(swarm.peers.size() - swarm.seeds))
+            .string("interval")
+            .integer(options.interval.count())
+            .string("min interval")
+            .integer(options.min_interval.count());
+
+        writer.string("peers");
+        if (auto out = reinterpret_cast<uint8_t *>(writer.string_space(ipv4_count * 6)))
+        {
+                for (size_t i = 0; i < ipv4_count; ++i)
+                {
+                        write_endpoint(out + i * 6, swarm.peers[chosen[i]].endpoint);
+                }
+        }
+        if (chosen_count > ipv4_count)
+        {
+                writer.string("peers6");
+                if (auto out = reinterpret_cast<uint8_t *>(writer.string_space((chosen_count - ipv4_count) * 18)))
+                {
+                        for (size_t i = ipv4_count; i < chosen_count; ++i)
+                        {
+                                write_endpoint(out + (i - ipv4_count) * 18, swarm.peers[chosen[i]].endpoint);
+                        }
+                }
+        }
+        writer.end();
+        return writer.ok() ? writer.view() : std::string_view{};
+}
+
+// BEP 48, unknown info hashes are left out of `files`
+std::string_view TrackerServer::scrape(const std::string_view query)
+{
+        std::array<InfoHash, max_scrape_hashes> hashes;
+        size_t count = 0;
+        bool malformed = false;
+        for_each_parameter(query, [&](const std::string_view name, const std::string_view value)
+                           {
+                                   if (name == "info_hash" && count < hashes.size())
+                                   {
+                                           malformed |= !parse_info_hash(value, hashes[count++]);
+                                   } });
+        if (malformed)
+        {
+                return failure("Malformed info_hash");
+        }
+        scrapes.fetch_add(1, std::memory_order_relaxed);
+
+        // dictionary keys go out in sorted order
+        const auto end = hashes.begin() + static_cast<ptrdiff_t>(count);
+        std::sort(hashes.begin(), end);
+        BencodeWriter writer{body.data(), body.size()};
+        writer.begin_dictionary().string("files").begin_dictionary();
+        for (auto it = hashes.begin(); it != std::unique(hashes.begin(), end); ++it)
+        {
+                const Swarm *swarm = table.find(*it);
+                if (!swarm)
+                {
+                        continue;
+                }
+                writer.string({reinterpret_cast<const char *>(it->data()), it->size()})
+                    .begin_dictionary()
+                    .string("complete")
+                    .integer(swarm->seeds)
+                    .string("downloaded")
+                    .integer(static_cast<int64_t>(swarm->downloaded))
+                    .string("incomplete")
+                    .integer(static_cast<int64_t>(swarm->peers.size() - swarm->seeds))
+                    .end();
+        }
+        writer.end().end();
+        return writer.ok() ? writer.view() : std::string_view{};
+}
+
+std::string_view TrackerServer::failure(const std::string_view reason)
+{
+        failures.fetch_add(1, std::memory_order_relaxed);
+        BencodeWriter writer{body.data(), body.size()};
+        writer.begin_dictionary().string("failure reason").string(reason).end();
+        return writer.ok() ? writer.view() : std::string_view{};
+}
+
+// peers that missed two announce intervals are gone, and so are the swarms they leave empty
+void TrackerServer::expire(const std::chrono::steady_clock::time_point now)
+{
+        const auto cutoff = now - 2 * options.interval;
+        size_t removed = 0;
+        std::vector<Swarm> &swarms = table.swarms();
+        // walking backwards, whatever is swapped into a removed position has been looked at already
+        for (size_t index = swarms.size(); index-- > 0;)
+        {
+                Swarm &swarm = swarms[index];
+                for (size_t position = swarm.peers.size(); position-- > 0;)
+                {
+                        if (swarm.peers[position].last_seen < cutoff)
+                        {
+                                remove_peer(swarm, position);
+                                ++removed;
+                        }
+                }
+                if (swarm.peers.empty())
+                {
+                        table.erase(index);
+                }
+        }
+        peer_count.fetch_sub(removed, std::memory_order_relaxed);
+        torrent_count.store(swarms.size(), std::memory_order_relaxed);
+}
+
+// load generator: every thread keeps one connection and pipelines announces for random torrents as distinct peers
+TrackerBenchmark benchmark_tracker(const uint16_t port, const unsigned connections, const uint64_t requests, const size_t torrents)
+{
+        constexpr size_t pipeline = 16;
+        constexpr size_t prepared_per_connection = 1024;
+        if (connections == 0)
+        {
+                throw std::invalid_argument("Tracker benchmark needs at least one connection");
+        }
+
+        std::atomic<uint64_t> completed{0};
+        std::atomic<uint64_t> failed{0};
+        const auto start = std::chrono::steady_clock::now();
+        {
+                std::vector<std::jthread> clients;
+                for (unsigned client = 0; client < connections; ++client)
+                {
+                        const uint64_t share = requests / connections + (client < requests % connections ? 1 : 0);
+                        clients.emplace_back([&, client, share]
+                                             {
+                                                     const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                                                     sockaddr_in address{};
+                                                     address.sin_family = AF_INET;
+                                                     address.sin_port = htons(port);
+                                                     address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                                                     if (fd == -1 || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1)
+                                                     {
+                                                             failed.fetch_add(share);
+                                                             if (fd != -1)
+                                                             {
+                                                                     close(fd);
+                                                             }
+                                                             return;
+                                                     }
+                                                     const int on = 1;
+                                                     setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+                                                     // requests are prepared up front so the clients cost the server as little CPU as possible
+                                                     std::minstd_rand random{client + 1};
+                                                     std::vector<std::string> prepared;
+                                                     AnnounceParams params;
+                                                     params.info_hash.assign(20, '\x5a');
+                                                     params.peer_id = "-BT0001-benchmark000";
+                                                     params.left = client % 4 == 0 ? 0 : 1 << 20;
+                                                     for (size_t i = 0; i < std::min<uint64_t>(share, prepared_per_connection); ++i)
+                                                     {
+                                                             const uint64_t torrent = random() % std::max<size_t>(1, torrents);
+                                                             std::memcpy(params.info_hash.data(), &torrent, sizeof(torrent));
+                                                             params.port = static_cast<uint16_t>(1024 + (client * prepared_per_connection + i) % 60000);
+                                                             AnnounceQuery query{params};
+                                                             prepared.push_back("GET " + query.url("/announce", params) + " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+                                                     }
+
+                                                     std::string batch;
+                                                     std::vector<char> input(64 * 1024);
+                                                     size_t input_size = 0;
+                                                     uint64_t sent = 0;
+                                                     while (sent < share)
+                                                     {
+                                                             const size_t depth = static_cast<size_t>(std::min<uint64_t>(pipeline, share - sent));
+                                                             batch.clear();
+                                                             for (size_t i = 0; i < depth; ++i)
+                                                             {
+                                                                     batch += prepared[(sent + i) % prepared.size()];
+                                                             }
+                                                             if (send(fd, batch.data(), batch.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(batch.size()))
+                                                             {
+                                                                     break;
+                                                             }
+                                                             sent += depth;
+
+                                                             // every response carries a Content-Length, which is all the framing needed here
+                                                             for (size_t answered = 0; answered < depth;)
+                                                             {
+                                                                     const std::string_view data{input.data(), input_size};
+                                                                     const size_t head_end = data.find("\r\n\r\n");
+                                                                     const size_t length_at = data.find("Content-Length: ");
+                                                                     size_t body_length = 0;
+                                                                     if (head_end != std::string_view::npos && length_at < head_end)
+                                                                     {
+                                                                             std::from_chars(data.data() + length_at + 16, data.data() + head_end, body_length);
+                                                                     }
+                                                                     if (head_end != std::string_view::npos && input_size >= head_end + 4 + body_length)
+                                                                     {
+                                                                             const bool ok = data.starts_with("HTTP/1.1 200") && data.substr(head_end + 4, 11) == "d8:complete";
+                                                                             (ok ? completed : failed).fetch_add(1, std::memory_order_relaxed);
+                                                                             const size_t consumed = head_end + 4 + body_length;
+                                                                             std::memmove(input.data(), input.data() + consumed, input_size - consumed);
+                                                                             input_size -= consumed;
+                                                                             ++answered;
+                                                                             continue;
+                                                                     }
+
+                                                                     const ssize_t received = recv(fd, input.data() + input_size, input.size() - input_size, 0);
+                                                                     if (received <= 0)
+                                                                     {
+                                                                             failed.fetch_add(depth - answered);
+                                                                             answered = depth;
+                                                                             sent = share;
+                                                                             break;
+                                                                     }
+                                                                     input_size += static_cast<size_t>(received);
+                                                             }
+                                                     }
+                                                     close(fd); });
+                }
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return {completed.load(), failed.load(), elapsed.count()};
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../net/endpoint.hpp"
+#include "../net/poller.hpp"
+
+using InfoHash = std::array<uint8_t, 20>;
+
+struct TrackerServerOptions
+{
+        uint16_t port = 6969; // 0 picks a free one
+        std::chrono::seconds interval{1800};
+        std::chrono::seconds min_interval{60};
+        size_t default_numwant = 50;
+        size_t max_numwant = 200;
+};
+
+struct TrackerServerStatistics
+{
+        uint64_t announces = 0;
+        uint64_t scrapes = 0;
+        uint64_t failures = 0;
+        uint64_t connections = 0;
+        size_t torrents = 0;
+        size_t peers = 0;
+};
+
+struct SwarmPeer
+{
+        PeerEndpoint endpoint;
+        std::chrono::steady_clock::time_point last_seen;
+        bool seed;
+};
+
+// the peers of one torrent, index is an open addressing table of positions in peers
+struct Swarm
+{
+        InfoHash info_hash;
+        std::vector<SwarmPeer> peers;
+        std::vector<uint32_t> index;
+        uint32_t seeds = 0;
+        uint64_t downloaded = 0;
+};
+
+// swarms by info hash with linear probing; info hashes are uniformly distributed already, so their first
+// 8 bytes serve as the hash. erase() moves the last swarm into the gap, so positions change.
+class SwarmTable
+{
+public:
+        SwarmTable();
+
+        Swarm *find(const InfoHash &info_hash);
+        Swarm &find_or_insert(const InfoHash &info_hash);
+        void erase(size_t position); // by position in swarms()
+        std::vector<Swarm> &swarms();
+
+private:
+        struct Slot
+        {
+                uint64_t prefix;
+                uint32_t swarm; // index + 1 into swarm_list, 0 when empty
+        };
+
+        void grow();
+        size_t slot_of(size_t position) const;
+
+        std::vector<Slot> slots;
+        std::vector<Swarm> swarm_list;
+};
+
+// HTTP tracker (announce and scrape) on a single epoll loop thread
+class TrackerServer
+{
+public:
+        explicit TrackerServer(TrackerServerOptions options = {});
+        ~TrackerServer();
+        TrackerServer(const TrackerServer &) = delete;
+        TrackerServer &operator=(const TrackerServer &) = delete;
+
+        uint16_t port() const;
+        void run(std::stop_token stop);
+        TrackerServerStatistics statistics() const;
+
+private:
+        struct Connection;
+
+        void accept_connections();
+        void on_readable(Connection &connection);
+        void flush(Connection &connection);
+        void close_connection(int fd);
+        bool handle_request(Connection &connection, std::string_view head);
+        std::string_view announce(const Connection &connection, std::string_view query);
+        std::string_view scrape(std::string_view query);
+        std::string_view failure(std::string_view reason);
+        void expire(std::chrono::steady_clock::time_point now);
+
+        const TrackerServerOptions options;
+        int listen_fd = -1;
+        uint16_t bound_port = 0;
+        Poller poller;
+        SwarmTable table;
+        std::vector<std::unique_ptr<Connection>> connections; // by descriptor
+        std::vector<char> body; // every response body is built here first
+        std::minstd_rand random;
+
+        std::atomic<uint64_t> announces{0};
+        std::atomic<uint64_t> scrapes{0};
+        std::atomic<uint64_t> failures{0};
+        std::atomic<uint64_t> accepted{0};
+        std::atomic<size_t> torrent_count{0};
+        std::atomic<size_t> peer_count{0};
+};
+
+struct TrackerBenchmark
+{
+        uint64_t requests;
+        uint64_t failures;
+        double seconds;
+};
+
+TrackerBenchmark benchmark_tracker(uint16_t port, unsigned connections, uint64_t requests, size_t torrents);
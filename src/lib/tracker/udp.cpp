@@ -0,0 +1,597 @@
+#include "udp.hpp"
+#include "peers.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <poll.h>
+#include <unistd.h>
+
+namespace
+{
+        constexpr uint64_t protocol_id = 0x41727101980;
+        constexpr auto connection_lifetime = std::chrono::minutes{1};
+        constexpr size_t max_datagram_size = 2048;
+        constexpr unsigned batch_size = 64; // datagrams per sendmmsg/recvmmsg call
+
+        void put_u32(std::vector<uint8_t> &out, const uint32_t value)
+        {
+                for (int shift = 24; shift >= 0; shift -= 8)
+                {
+                        out.push_back(static_cast<uint8_t>(value >> shift));
+                }
+        }
+
+        void put_u64(std::vector<uint8_t> &out, const uint64_t value)
+        {
+                put_u32(out, static_cast<uint32_t>(value >> 32));
+                put_u32(out, static_cast<uint32_t>(value));
+        }
+
+        uint32_t get_u32(const uint8_t *data)
+        {
+                return (uint32_t{data[0]} << 24) | (uint32_t{data[1]} << 16) | (uint32_t{data[2]} << 8) | uint32_t{data[3]};
+        }
+
+        uint64_t get_u64(const uint8_t *data)
+        {
+                return (uint64_t{get_u32(data)} << 32) | get_u32(data + 4);
+        }
+
+        void put_bytes(std::vector<uint8_t> &out, const std::string &bytes, const size_t size)
+        {
+                if (bytes.size() != size)
+                {
+                        throw std::invalid_argument("Info hash and peer ID must be 20 bytes");
+                }
+                out.insert(out.end(), bytes.begin(), bytes.end());
+        }
+}
+
+namespace
+{
+        // the lookup goes through the caller's resolver, so a cached name costs nothing and a slow one gives up in time
+        http::Address resolve_tracker(const std::string &url, http::Resolver &resolver, const std::chrono::milliseconds timeout)
+        {
+                const auto uri = http::parseUri(url.begin(), url.end());
+                if (uri.scheme != "udp" || uri.port.empty())
+                {
+                        throw std::invalid_argument("Invalid UDP tracker URL: " + url);
+                }
+                const auto lookup = resolver.resolveAsync(uri.host, uri.port, http::InternetProtocol::any);
+                if (timeout >= std::chrono::milliseconds{0} && lookup.wait_for(timeout) != std::future_status::ready)
+                {
+                        throw std::runtime_error("Timed out resolving " + uri.host);
+                }
+                return UdpTracker::pick_address(lookup.get());
+        }
+}
+
+UdpTracker::UdpTracker(const std::string &url, http::Resolver &resolver, const std::chrono::milliseconds resolve_timeout,
+                       const std::chrono::milliseconds base_timeout, const unsigned max_retransmissions)
+    : UdpTracker(url, resolve_tracker(url, resolver, resolve_timeout), base_timeout, max_retransmissions)
+{
+}
+
+UdpTracker::UdpTracker(const std::string &url, const http::Address &address, const std::chrono::milliseconds base_timeout, const unsigned max_retransmissions,
+                       const std::chrono::milliseconds request_timeout)
+    : tracker_url(url), base_timeout(base_timeout), max_retransmissions(max_retransmissions), request_timeout(request_timeout),
+      random(std::random_device{}())
+{
+        ipv6 = address.family() == AF_INET6;
+        socket_fd = socket(address.family(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+        if (socket_fd < 0)
+        {
+                throw std::system_error(errno, std::system_category(), "Failed to create UDP socket");
+        }
+
+        // a connected socket drops datagrams from anyone but the tracker and needs no address per send
+        if (connect(socket_fd, reinterpret_cast<const sockaddr *>(&address.storage), address.length) != 0)
+        {
+                const int error = errno;
+                close(socket_fd);
+                throw std::system_error(error, std::system_category(), "Failed to connect UDP socket");
+        }
+}
+
+// IPv4 first where there is a choice, it is what most trackers are reachable over
+const http::Address &UdpTracker::pick_address(const std::vector<http::Address> &addresses)
+{
+        if (addresses.empty())
+        {
+                throw std::runtime_error("No address for UDP tracker");
+        }
+        const auto ipv4 = std::find_if(addresses.begin(), addresses.end(), [](const http::Address &address)
+                                       { return address.family() == AF_INET; });
+        return ipv4 != addresses.end() ? *ipv4 : addresses.front();
+}
+
+UdpTracker::~UdpTracker()
+{
+        close(socket_fd);
+}
+
+void UdpTracker::announce(const AnnounceParams &params, Callback callback)
+{
+        std::vector<uint8_t> body;
+        body.reserve(82);
+        put_bytes(body, params.info_hash, 20);
+        put_bytes(body, params.peer_id, 20);
+        put_u64(body, static_cast<uint64_t>(params.downloaded));
+        put_u64(body, static_cast<uint64_t>(params.left));
+        put_u64(body, static_cast<uint64_t>(params.uploaded));
+        put_u32(body, static_cast<uint32_t>(params.event));
+        put_u32(body, 0); // IP address, the sender's
+        put_u32(body, static_cast<uint32_t>(random()));
+        put_u32(body, static_cast<uint32_t>(-1)); // num_want, tracker default
+        body.push_back(static_cast<uint8_t>(params.port >> 8));
+        body.push_back(static_cast<uint8_t>(params.port));
+
+        submit(Action::announce, body, [this, callback = std::move(callback), start = Clock::now()](const std::string_view reply, const std::string &error)
+               {
+                       TrackerResponse response;
+                       response.tracker = tracker_url;
+                       response.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+                       try
+                       {
+                               if (!error.empty())
+                               {
+                                       throw std::runtime_error(error);
+                               }
+                               if (reply.size() < 12)
+                               {
+                                       throw std::runtime_error("Truncated announce response");
+                               }
+                               const auto data = reinterpret_cast<const uint8_t *>(reply.data());
+                               response.interval = get_u32(data);
+                               response.incomplete = get_u32(data + 4);
+                               response.complete = get_u32(data + 8);
+                               // peers come in the address family the request was sent over
+                               if (ipv6)
+                               {
+                                       decode_compact_peers6(reply.substr(12), response.peers);
+                               }
+                               else
+                               {
+                                       decode_compact_peers(reply.substr(12), response.peers);
+                               }
+                               response.success = true;
+                       }
+                       catch (const std::exception &e)
+                       {
+                               response.error = e.what();
+                       }
+                       callback(std::move(response)); });
+}
+
+// one connect and one burst of datagrams for the whole batch, results come back in batch order
+std::vector<TrackerResponse> UdpTracker::announce_all(const std::vector<AnnounceParams> &batch, const std::chrono::milliseconds timeout)
+{
+        std::vector<TrackerResponse> responses(batch.size());
+        size_t remaining = batch.size();
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+                announce(batch[i], [&responses, &remaining, i](TrackerResponse response)
+                         { responses[i] = std::move(response);
+                           --remaining; });
+        }
+
+        run(remaining, timeout);
+        return responses;
+}
+
+// splits the hashes into packets of max_scrape_hashes, packets that failed are listed in errors
+std::map<std::string, ScrapeStats> UdpTracker::scrape_all(const std::vector<std::string> &info_hashes, std::vector<std::string> &errors,
+                                                          const std::chrono::milliseconds timeout)
+{
+        std::map<std::string, ScrapeStats> result;
+        size_t remaining = 0;
+        for (size_t begin = 0; begin < info_hashes.size(); begin += max_scrape_hashes)
+        {
+                const std::vector<std::string> packet(info_hashes.begin() + static_cast<std::ptrdiff_t>(begin),
+                                                      info_hashes.begin() + static_cast<std::ptrdiff_t>(std::min(info_hashes.size(), begin + max_scrape_hashes)));
+                ++remaining;
+                scrape(packet, [&result, &errors, &remaining, packet](const std::vector<ScrapeStats> &stats, const std::string &error)
+                       {
+                               --remaining;
+                               if (!error.empty())
+                               {
+                                       errors.push_back(error);
+                                       return;
+                               }
+                               for (size_t i = 0; i < stats.size(); ++i)
+                               {
+                                       result[packet[i]] = stats[i];
+                               } });
+        }
+
+        run(remaining, timeout);
+        return result;
+}
+
+// at most max_scrape_hashes, the reply lists seeders, completed and leechers in request order
+void UdpTracker::scrape(const std::vector<std::string> &info_hashes, ScrapeCallback callback)
+{
+        if (info_hashes.empty() || info_hashes.size() > max_scrape_hashes)
+        {
+                throw std::invalid_argument("A UDP scrape carries 1 to 74 info hashes");
+        }
+
+        std::vector<uint8_t> body;
+        body.reserve(info_hashes.size() * 20);
+        for (const auto &info_hash : info_hashes)
+        {
+                put_bytes(body, info_hash, 20);
+        }
+
+        submit(Action::scrape, body, [count = info_hashes.size(), callback = std::move(callback)](const std::string_view reply, const std::string &error)
+               {
+                       if (!error.empty())
+                       {
+                               callback({}, error);
+                               return;
+                       }
+                       if (reply.size() < count * 12)
+                       {
+                               callback({}, "Truncated scrape response");
+                               return;
+                       }
+
+                       const auto data = reinterpret_cast<const uint8_t *>(reply.data());
+                       std::vector<ScrapeStats> stats(count);
+                       for (size_t i = 0; i < count; ++i)
+                       {
+                               stats[i].complete = get_u32(data + i * 12);
+                               stats[i].downloaded = get_u32(data + i * 12 + 4);
+                               stats[i].incomplete = get_u32(data + i * 12 + 8);
+                       }
+                       callback(std::move(stats), {}); });
+}
+
+// drains every queued datagram, several per syscall
+void UdpTracker::on_readable()
+{
+        if (receive_buffers.empty())
+        {
+                receive_buffers.resize(batch_size * max_datagram_size);
+                receive_vectors.resize(batch_size);
+                receive_messages.resize(batch_size);
+        }
+        std::vector<uint8_t> &buffers = receive_buffers;
+        std::vector<mmsghdr> &messages = receive_messages;
+
+        for (;;)
+        {
+                for (unsigned i = 0; i < batch_size; ++i)
+                {
+                        receive_vectors[i] = {buffers.data() + i * max_datagram_size, max_datagram_size};
+                        messages[i] = {};
+                        messages[i].msg_hdr.msg_iov = &receive_vectors[i];
+                        messages[i].msg_hdr.msg_iovlen = 1;
+                }
+
+                const int count = recvmmsg(socket_fd, messages.data(), batch_size, MSG_DONTWAIT, nullptr);
+                if (count < 0)
+                {
+                        if (errno == EINTR)
+                        {
+                                continue;
+                        }
+                        // EAGAIN, or an ICMP error of an earlier send, which the retransmission timer covers
+                        break;
+                }
+
+                for (int i = 0; i < count; ++i)
+                {
+                        handle(buffers.data() + i * max_datagram_size, messages[i].msg_len);
+                }
+                flush();
+
+                if (static_cast<unsigned>(count) < batch_size)
+                {
+                        break;
+                }
+        }
+}
+
+// retransmits whatever timed out, gives up after max_retransmissions or once a request outlived request_timeout
+void UdpTracker::on_timer(const Clock::time_point now)
+{
+        if (connecting && now >= connect_deadline)
+        {
+                if (++connect_attempt > max_retransmissions)
+                {
+                        connecting = false;
+                        connect_deadline = Clock::time_point::max();
+                        fail_waiting("Tracker did not respond");
+                }
+                else
+                {
+                        send_connect(now);
+                }
+        }
+
+        std::vector<uint32_t> expired;
+        for (const auto &[transaction_id, transaction] : transactions)
+        {
+                if (now >= transaction.expiry || (!transaction.waiting && now >= transaction.deadline))
+                {
+                        expired.push_back(transaction_id);
+                }
+        }
+
+        for (const auto transaction_id : expired)
+        {
+                auto &transaction = transactions.at(transaction_id);
+                if (now >= transaction.expiry || ++transaction.attempt > max_retransmissions)
+                {
+                        complete(transaction_id, {}, "Tracker did not respond");
+                }
+                else
+                {
+                        wait_for(transaction, now);
+                }
+        }
+        flush();
+}
+
+void UdpTracker::cancel_all(const std::string &error)
+{
+        connecting = false;
+        connect_deadline = Clock::time_point::max();
+        while (!transactions.empty())
+        {
+                complete(transactions.begin()->first, {}, error);
+        }
+        outbox.clear();
+}
+
+UdpTracker::Clock::time_point UdpTracker::next_deadline() const
+{
+        auto deadline = connecting ? connect_deadline : Clock::time_point::max();
+        for (const auto &[_, transaction] : transactions)
+        {
+                deadline = std::min(deadline, transaction.waiting ? transaction.expiry : transaction.deadline);
+        }
+        return deadline;
+}
+
+bool UdpTracker::idle() const
+{
+        return transactions.empty() && !connecting;
+}
+
+int UdpTracker::fd() const
+{
+        return socket_fd;
+}
+
+const std::string &UdpTracker::url() const
+{
+        return tracker_url;
+}
+
+// drives the socket until remaining drops to zero, whatever is left at the timeout fails
+void UdpTracker::run(const size_t &remaining, const std::chrono::milliseconds timeout)
+{
+        const auto stop_time = timeout.count() < 0 ? Clock::time_point::max() : Clock::now() + timeout;
+        while (remaining > 0)
+        {
+                const auto now = Clock::now();
+                if (now >= stop_time)
+                {
+                        cancel_all("Request timed out");
+                        break;
+                }
+
+                const auto wake_time = std::min(next_deadline(), stop_time);
+                const auto wait = wake_time == Clock::time_point::max() ? -1 : std::chrono::ceil<std::chrono::milliseconds>(wake_time - now).count();
+                pollfd descriptor{socket_fd, POLLIN, 0};
+                if (poll(&descriptor, 1, static_cast<int>(std::min<int64_t>(wait, INT32_MAX))) > 0)
+                {
+                        on_readable();
+                }
+                on_timer(Clock::now());
+        }
+}
+
+void UdpTracker::submit(const Action action, const std::vector<uint8_t> &body, Handler handler)
+{
+        const uint32_t transaction_id = new_transaction_id();
+        Transaction transaction;
+        transaction.action = action;
+        transaction.request.reserve(8 + body.size());
+        put_u32(transaction.request, static_cast<uint32_t>(action));
+        put_u32(transaction.request, transaction_id);
+        transaction.request.insert(transaction.request.end(), body.begin(), body.end());
+        transaction.handler = std::move(handler);
+
+        const auto now = Clock::now();
+        if (request_timeout.count() >= 0)
+        {
+                transaction.expiry = now + request_timeout;
+        }
+        auto &stored = transactions.emplace(transaction_id, std::move(transaction)).first->second;
+        wait_for(stored, now);
+        flush();
+}
+
+// sends right away with a cached connection ID, otherwise parks the transaction until connect succeeds
+void UdpTracker::wait_for(Transaction &transaction, const Clock::time_point now)
+{
+        if (connected(now))
+        {
+                send_request(transaction, now);
+                return;
+        }
+
+        transaction.waiting = true;
+        transaction.deadline = Clock::time_point::max();
+        start_connect(now);
+}
+
+void UdpTracker::send_request(Transaction &transaction, const Clock::time_point now)
+{
+        std::vector<uint8_t> datagram;
+        datagram.reserve(8 + transaction.request.size());
+        put_u64(datagram, connection_id);
+        datagram.insert(datagram.end(), transaction.request.begin(), transaction.request.end());
+        outbox.push_back(std::move(datagram));
+
+        transaction.waiting = false;
+        transaction.deadline = std::min(now + timeout(transaction.attempt), transaction.expiry);
+}
+
+void UdpTracker::start_connect(const Clock::time_point now)
+{
+        if (connecting)
+        {
+                return;
+        }
+        connecting = true;
+        connect_attempt = 0;
+        connect_transaction_id = new_transaction_id();
+        send_connect(now);
+}
+
+// retransmissions keep the transaction ID, so a late reply to an earlier attempt still counts
+void UdpTracker::send_connect(const Clock::time_point now)
+{
+        std::vector<uint8_t> datagram;
+        datagram.reserve(16);
+        put_u64(datagram, protocol_id);
+        put_u32(datagram, static_cast<uint32_t>(Action::connect));
+        put_u32(datagram, connect_transaction_id);
+        outbox.push_back(std::move(datagram));
+        connect_deadline = now + timeout(connect_attempt);
+}
+
+void UdpTracker::fail_waiting(const std::string &error)
+{
+        std::vector<uint32_t> waiting;
+        for (const auto &[transaction_id, transaction] : transactions)
+        {
+                if (transaction.waiting)
+                {
+                        waiting.push_back(transaction_id);
+                }
+        }
+        for (const auto transaction_id : waiting)
+        {
+                complete(transaction_id, {}, error);
+        }
+}
+
+// removes the transaction before its handler runs, the handler may submit new ones
+void UdpTracker::complete(const uint32_t transaction_id, const std::string_view response, const std::string &error)
+{
+        const auto found = transactions.find(transaction_id);
+        if (found == transactions.end())
+        {
+                return;
+        }
+        const Handler handler = std::move(found->second.handler);
+        transactions.erase(found);
+        handler(response, error);
+}
+
+void UdpTracker::handle(const uint8_t *data, const size_t size)
+{
+        if (size < 8)
+        {
+                return;
+        }
+
+        const auto action = static_cast<Action>(get_u32(data));
+        const uint32_t transaction_id = get_u32(data + 4);
+        const std::string_view payload(reinterpret_cast<const char *>(data + 8), size - 8);
+
+        if (connecting && transaction_id == connect_transaction_id)
+        {
+                connecting = false;
+                connect_deadline = Clock::time_point::max();
+                if (action != Action::connect || size < 16)
+                {
+                        fail_waiting(action == Action::error ? std::string(payload) : "Invalid connect response");
+                        return;
+                }
+
+                const auto now = Clock::now();
+                connection_id = get_u64(data + 8);
+                connection_expiry = now + connection_lifetime;
+                for (auto &[_, transaction] : transactions)
+                {
+                        if (transaction.waiting)
+                        {
+                                send_request(transaction, now);
+                        }
+                }
+                return;
+        }
+
+        const auto found = transactions.find(transaction_id);
+        if (found == transactions.end())
+        {
+                return;
+        }
+
+        if (action == Action::error)
+        {
+                complete(transaction_id, {}, payload.empty() ? "Tracker error" : std::string(payload));
+        }
+        else if (action == found->second.action)
+        {
+                complete(transaction_id, payload, {});
+        }
+}
+
+// every queued datagram in as few syscalls as possible, a full socket buffer is left to retransmission
+void UdpTracker::flush()
+{
+        size_t sent = 0;
+        while (sent < outbox.size())
+        {
+                const size_t count = std::min<size_t>(outbox.size() - sent, batch_size);
+                std::vector<iovec> vectors(count);
+                std::vector<mmsghdr> messages(count);
+                for (size_t i = 0; i < count; ++i)
+                {
+                        vectors[i] = {outbox[sent + i].data(), outbox[sent + i].size()};
+                        messages[i].msg_hdr.msg_iov = &vectors[i];
+                        messages[i].msg_hdr.msg_iovlen = 1;
+                }
+
+                const int result = sendmmsg(socket_fd, messages.data(), static_cast<unsigned>(count), 0);
+                if (result < 0)
+                {
+                        if (errno == EINTR)
+                        {
+                                continue;
+                        }
+                        break;
+                }
+                sent += static_cast<size_t>(result);
+        }
+        outbox.clear();
+}
+
+bool UdpTracker::connected(const Clock::time_point now) const
+{
+        return !connecting && now < connection_expiry;
+}
+
+UdpTracker::Clock::duration UdpTracker::timeout(const unsigned attempt) const
+{
+        return base_timeout * (int64_t{1} << std::min(attempt, 30u));
+}
+
+uint32_t UdpTracker::new_transaction_id()
+{
+        uint32_t transaction_id;
+        do
+        {
+                transaction_id = static_cast<uint32_t>(random());
+        } while (transactions.contains(transaction_id) || (connecting && transaction_id == connect_transaction_id));
+        return transaction_id;
+}
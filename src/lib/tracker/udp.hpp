@@ -0,0 +1,111 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "announce.hpp"
+
+// BEP 15 client for one UDP tracker. It never blocks on its own: the owner calls on_readable() when fd() is
+// readable and on_timer() once next_deadline() has passed, announce_all() does both for blocking callers.
+class UdpTracker
+{
+public:
+        using Clock = std::chrono::steady_clock;
+        using Callback = std::function<void(TrackerResponse)>;
+        using ScrapeCallback = std::function<void(std::vector<ScrapeStats> stats, const std::string &error)>;
+
+        // a reply to 74 hashes is as large as a datagram can safely get
+        static constexpr size_t max_scrape_hashes = 74;
+
+        // base_timeout * 2^n is the wait before retransmission n + 1, BEP 15 uses 15 s and up to 8 retransmissions;
+        // a request_timeout of 0 or more cuts the schedule short, counted from the announce or scrape call. The URL's
+        // host is looked up through resolver, giving up after resolve_timeout unless that is negative.
+        UdpTracker(const std::string &url, http::Resolver &resolver, std::chrono::milliseconds resolve_timeout,
+                   std::chrono::milliseconds base_timeout = std::chrono::seconds{15}, unsigned max_retransmissions = 8);
+        UdpTracker(const std::string &url, const http::Address &address, std::chrono::milliseconds base_timeout = std::chrono::seconds{15}, unsigned max_retransmissions = 8,
+                   std::chrono::milliseconds request_timeout = std::chrono::milliseconds{-1});
+        ~UdpTracker();
+        UdpTracker(const UdpTracker &) = delete;
+        UdpTracker &operator=(const UdpTracker &) = delete;
+
+        static const http::Address &pick_address(const std::vector<http::Address> &addresses);
+
+        void announce(const AnnounceParams &params, Callback callback);
+        std::vector<TrackerResponse> announce_all(const std::vector<AnnounceParams> &batch, std::chrono::milliseconds timeout = std::chrono::milliseconds{-1});
+        void scrape(const std::vector<std::string> &info_hashes, ScrapeCallback callback);
+        std::map<std::string, ScrapeStats> scrape_all(const std::vector<std::string> &info_hashes, std::vector<std::string> &errors,
+                                                      std::chrono::milliseconds timeout = std::chrono::milliseconds{-1});
+
+        void on_readable();
+        void on_timer(Clock::time_point now);
+        void cancel_all(const std::string &error);
+        Clock::time_point next_deadline() const; // Clock::time_point::max() when nothing is outstanding
+        bool idle() const;
+        int fd() const;
+        const std::string &url() const;
+
+private:
+        enum class Action : uint32_t
+        {
+                connect = 0,
+                announce = 1,
+                scrape = 2,
+                error = 3,
+        };
+
+        // gets the response after action and transaction ID, or an error message
+        using Handler = std::function<void(std::string_view response, const std::string &error)>;
+
+        struct Transaction
+        {
+                Action action;
+                std::vector<uint8_t> request; // everything after the connection ID
+                Handler handler;
+                unsigned attempt = 0;
+                bool waiting = true; // for a connection ID
+                Clock::time_point deadline = Clock::time_point::max();
+                Clock::time_point expiry = Clock::time_point::max(); // fails here whatever the attempt
+        };
+
+        void run(const size_t &remaining, std::chrono::milliseconds timeout);
+        void submit(Action action, const std::vector<uint8_t> &body, Handler handler);
+        void wait_for(Transaction &transaction, Clock::time_point now);
+        void send_request(Transaction &transaction, Clock::time_point now);
+        void start_connect(Clock::time_point now);
+        void send_connect(Clock::time_point now);
+        void fail_waiting(const std::string &error);
+        void complete(uint32_t transaction_id, std::string_view response, const std::string &error);
+        void handle(const uint8_t *data, size_t size);
+        void flush();
+        bool connected(Clock::time_point now) const;
+        Clock::duration timeout(unsigned attempt) const;
+        uint32_t new_transaction_id();
+
+        std::string tracker_url;
+        int socket_fd = -1;
+        bool ipv6 = false;
+        const std::chrono::milliseconds base_timeout;
+        const unsigned max_retransmissions;
+        const std::chrono::milliseconds request_timeout;
+        std::mt19937 random;
+
+        uint64_t connection_id = 0;
+        Clock::time_point connection_expiry{};
+        bool connecting = false;
+        uint32_t connect_transaction_id = 0;
+        unsigned connect_attempt = 0;
+        Clock::time_point connect_deadline = Clock::time_point::max();
+
+        std::unordered_map<uint32_t, Transaction> transactions;
+        std::vector<std::vector<uint8_t>> outbox; // datagrams that go out together in flush()
+        std::vector<uint8_t> receive_buffers; // recvmmsg batch, allocated on the first on_readable()
+        std::vector<iovec> receive_vectors;
+        std::vector<mmsghdr> receive_messages;
+};